@@ -1,5 +1,21 @@
 ﻿#include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <climits>          // INT_MAX
+#include <cstdio>           // snprintf
+#include <cstring>          // memcpy
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>           // steady_clock for load timings
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>              // Counting operator new
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 
@@ -23,6 +39,22 @@
 //************************************************************
 #include "camera.h"
 
+#include "thread_pool.h"    // Worker threads for texture decoding
+#include "texture_baker.h"  // BC1/BC3 encoding and the KTX2 texture cache
+#include "atlas_packer.h"   // Skyline packing of small textures into a shared atlas
+#include "resource_registry.h" // Generational handles and memory accounting for GL objects
+#include "draw_queue.h"     // Radix sorted draw order
+#include "command_queue.h"  // Lock-free queue feeding the render thread
+#include "job_system.h"     // Work-stealing scheduler for short engine tasks
+#include "frame_arena.h"    // Per-thread bump allocators for data living one frame
+#include "entity_store.h"   // Stable entity ids over packed component rows
+#include "scene_format.h"   // JSON and compiled scene files
+#include "snapshot_image.h" // Memory mapped images of pointer-free sections
+
+#ifdef __linux__
+#include <sys/inotify.h>  // Shader hot reload
+#include <unistd.h>
+#endif
 
 
 
@@ -49,8 +81,13 @@ namespace
         GLuint vao;         // Handle for the vertex array object
         GLuint vbos[2];     // Handles for the vertex buffer objects
         GLuint nIndices;    // Number of indices of the mesh
+        ResourceHandle resource; // Owns the vertex array and buffers in the registry
+        float radius;       // Bounding sphere around the mesh origin, for culling
     };
 
+    // Every GL object is owned by the registry, globals below hold handles or borrowed names
+    ResourceRegistry* gResources = nullptr;
+
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
@@ -67,37 +104,583 @@ namespace
     GLMesh gMesh_handleOutside;
     // Light Cube mesh data
     GLMesh gMesh_cube;
-    glm::vec2 gUVScale(5.0f, 5.0f);
     //**********************
 
-    // Texture data
-    GLuint gTextureId_handle;
-    GLuint gTextureId_cupBody;
-    GLuint gTextureId_carpet;
-    GLuint gTextureId_coffee;
-    GLuint gTextureId_cupHandle;
-    GLuint gTextureId_candleTop;
-    GLuint gTextureId_candle;
-    GLuint gTextureId_wax;
-    GLuint gTextureId_cart;
-    GLuint gTextureId_label;
-    GLuint gTextureId_book;
-    GLuint gTextureId_pages;
-    GLuint gTextureId_spine;
-
-
-    // Shader programs
-    GLuint gProgramId;
-    GLuint gLampProgramId;
-    GLuint gPlaneProgramId;
-    GLuint gCandleProgramId;
+    // Texture data, one handle per texture of the scene file
+    std::vector<ResourceHandle> gSceneTextures;
+
+    // Procedural textures
+    // Simple materials can be generated by a compute shader instead of decoded from their file
+    enum ProceduralPattern
+    {
+        PROCEDURAL_NOISE,   // Soft mottling
+        PROCEDURAL_WEAVE,   // Over-under threads
+        PROCEDURAL_GRAIN    // Long streaks
+    };
+    struct ProceduralMaterial
+    {
+        ProceduralPattern pattern;
+        glm::vec3 baseColor;
+        glm::vec3 detailColor;
+        float scale;        // Pattern repeats across the texture, whole numbers keep it tileable
+    };
+    GLuint gProceduralProgramId;
+    enum ProceduralUniform    // Uniform locations of the procedural compute shader
+    {
+        PROCEDURAL_UNIFORM_PATTERN = 0,
+        PROCEDURAL_UNIFORM_BASE_COLOR = 1,
+        PROCEDURAL_UNIFORM_DETAIL_COLOR = 2,
+        PROCEDURAL_UNIFORM_SCALE = 3,
+        PROCEDURAL_UNIFORM_SIZE = 4
+    };
+    bool gUseProceduralTextures = false;  // --procedural also generates the patterned textures the scene loads from files
+    int gProceduralSize = 0;              // --procedural-size N overrides the size derived from the texture budget
+
+    // Texture file paired with the handle it is loaded into
+    struct TextureAsset
+    {
+        const char* filename;
+        ResourceHandle* texture;
+    };
+
+    // Texture atlas
+    // Small material textures share one atlas texture. Their own handles stay on the placeholder
+    // and draws bind the atlas in their place, with a UV scale and offset onto their region.
+    struct AtlasEntry
+    {
+        ResourceHandle texture;   // Handle of the packed texture
+        glm::vec4 uvScaleOffset;  // xy scale, zw offset of its region in atlas UVs
+    };
+    std::vector<AtlasEntry> gAtlasEntries;  // Empty until the atlas is resident
+    ResourceHandle gTexture_atlas;
+    const int ATLAS_PADDING = 8;            // Gutter and placement grid, in texels
+    const int ATLAS_MIP_LEVELS = 4;         // log2(ATLAS_PADDING) + 1, coarser levels would bleed across gutters
+    const int ATLAS_MAX_SIZE = 4096;
+    bool gUseTextureAtlas = true;           // --no-atlas loads every texture on its own
+    GLuint gBoundTexture = 0;               // Texture on unit 0 as far as UBindTexture knows, reset every frame
+
+    // Loaded texture waiting to be copied into its GL texture through the staging buffer
+    struct TextureUpload
+    {
+        std::string filename;
+        ResourceHandle handle;        // Receives the finished texture, replacing its previous objects
+        bool loaded = false;          // false when the file could not be read or decoded
+        bool streamIn = false;        // Adds finer levels to a resident texture instead of replacing the placeholder
+        std::string cachePath;        // KTX2 file further levels can be streamed from
+        BakedTexture texture;
+        int level = 0;                // Mip level being uploaded, smallest first
+        int rowsUploaded = 0;         // Rows of pixels, or rows of 4x4 blocks when compressed
+        GLuint uploadTextureId = 0;   // Texture being filled, 0 until the first rows are staged
+        GLsizei storageLevels = 0;    // Mip levels allocated for it
+        std::vector<AtlasEntry> atlasEntries; // Regions of the packed textures when this is the atlas
+    };
+
+    // Async texture loading
+    // Workers decode images, the render thread uploads them in small per-frame budgets
+    ThreadPool* gTextureDecodePool = nullptr;
+    std::mutex gDecodedTexturesMutex;
+    std::deque<TextureUpload> gDecodedTextures; // Filled by workers, guarded by the mutex above
+    std::deque<TextureUpload> gActiveUploads;   // Render thread only
+    int gTexturesPending = 0;
+    ResourceHandle gPlaceholderTexture;         // 1x1 texture bound until the real one is resident
+
+    // Persistently mapped pixel unpack buffer, split in segments that are each fenced
+    // One segment is filled per frame, so the segment size is the per-frame upload budget
+    const GLsizeiptr TEXTURE_UPLOAD_BUDGET = 2 * 1024 * 1024;
+    const int STAGING_SEGMENTS = 3;
+    GLuint gStagingBuffer = 0;
+    unsigned char* gStagingMemory = nullptr;
+    GLsync gStagingFences[STAGING_SEGMENTS] = {};
+    int gStagingSegment = 0;
+
+    // Mip streaming
+    // Compressed textures start with only their coarse levels resident. Draws report the finest
+    // level they can use on screen and finer levels are streamed in from the KTX2 cache while
+    // the total stays within the budget, evicting least recently used levels to make room.
+    struct StreamedTexture
+    {
+        ResourceHandle handle;    // Holds the chain levels [residentLevel, mipCount)
+        std::string cachePath;
+        TextureFormat format;
+        int width;                // Full resolution size
+        int height;
+        int mipCount;
+        int tailLevel;            // Coarsest levels loaded at startup, never evicted
+        int residentLevel;        // Finest level on the GPU, mipCount while nothing is resident
+        int requestedLevel;       // Finest level asked for by this frame's draws
+        bool loading;             // A stream-in or a full (re)load is in flight, levels stay as they are
+        unsigned int lastUsedFrame;
+    };
+    std::deque<StreamedTexture> gStreamedTextures; // deque keeps records in place as textures are added
+    const int STREAMING_TAIL_SIZE = 128;           // Longest side of the finest level loaded at startup
+    const int MAX_STREAMING_LOADS = 2;             // Level loads in flight at once
+    float gTextureBudgetMB = 64.0f;                // --texture-budget MB
+    int gStreamingLoads = 0;
+    unsigned int gFrameIndex = 0;
+
+    // Block compressed texture cache, used when the driver supports S3TC
+    const char* const TEXTURE_CACHE_DIR = "../resources/cache/";
+    bool gUseCompressedTextures = false;
+
+    // Program binary cache, linked programs from earlier launches on the same driver
+    const char* const PROGRAM_CACHE_DIR = "../resources/cache/programs/";
+    const uint32_t PROGRAM_CACHE_MAGIC = 0x42504C47;  // "GLPB"
+    const uint32_t PROGRAM_CACHE_VERSION = 1;         // Bump when the cache file layout changes
+    bool gUseProgramCache = true;                     // --no-program-cache always compiles from source
+    int gProgramsFromCache = 0;                       // Program build counts and times for the startup report
+    int gProgramsCompiled = 0;
+    double gProgramCacheMs = 0.0;
+    double gProgramCompileMs = 0.0;
+
+    // SPIR-V modules built from the GLSL sources by --build-shaders, loaded with GL_ARB_gl_spirv
+    const char* const SHADER_DIR = "../resources/shaders/";
+    bool gUseSpirv = true;                            // --no-spirv always builds from the GLSL sources
+    bool gBuildShaders = false;                       // --build-shaders
+
+    // Shader hot reload, files in SHADER_DIR override the embedded sources unless they are outdated seeds
+#ifdef __linux__
+    int gShaderWatch = -1;                            // inotify descriptor watching SHADER_DIR
+#else
+    std::map<std::string, std::filesystem::file_time_type> gShaderFileTimes; // Last seen write time per file
+#endif
+    bool gShaderFilesEdited = false;                  // SPIR-V modules are stale once a source was saved
+    int gPermutationModulesCurrent = -1;              // Modules of every permutation are current, -1 until checked
+
+    // Shared sampler objects, every texture is sampled through texture unit 0
+    enum SamplerType
+    {
+        SAMPLER_BILINEAR,     // No mip sampling, the old per-texture GL_LINEAR setup
+        SAMPLER_TRILINEAR,
+        SAMPLER_ANISOTROPIC,  // Trilinear plus anisotropic filtering, used for rendering
+        SAMPLER_COUNT
+    };
+    GLuint gSamplers[SAMPLER_COUNT];
+    float gAnisotropy = 16.0f; // Requested level, clamped to what the driver supports (--anisotropy N)
+
+    // Benchmarks selected on the command line
+    bool gBenchmarkFillRate = false; // --bench-fillrate
+    bool gBenchmarkLights = false;   // --bench-lights
+    bool gBenchmarkRenderPaths = false; // --bench-deferred
+    bool gBenchmarkRecording = false;   // --bench-recording
+    bool gBenchmarkJobs = false;        // --bench-jobs, runs without a window
+    int gBenchmarkSceneEntities = 0;    // --bench-scene N, runs without a window
+    bool gBenchmarkSnapshot = false;    // --bench-snapshot, runs without a window
+
+    // --compile-scene in out, writes the compiled form of a scene file without opening a window
+    const char* gCompileSceneInput = nullptr;
+    const char* gCompileSceneOutput = nullptr;
+
+    // Startup timings
+    std::chrono::steady_clock::time_point gStartupTime;
+    bool gFirstFrameReported = false;
+    const float HITCH_THRESHOLD = 0.05f;  // Frames taking longer than this many seconds count as a hitch
+    bool gFirstHitchReported = false;
+
+
+    // Shader permutations
+    // Every object draws with one uber shader. Material constants are uniforms, features that change
+    // the shader code are #defines, and each feature combination is compiled the first time it is drawn.
+    enum ShaderFeature
+    {
+        SHADER_ALPHA_TEST = 1 << 0,   // Discards texels that are nearly transparent
+        SHADER_UNLIT = 1 << 1,        // Flat white without lighting, for the lamp
+        SHADER_DEFERRED = 1 << 2,     // Writes the G-buffer instead of shading, set by the render path
+        SHADER_OIT = 1 << 3,          // Writes weighted blended transparency targets, set for blended objects
+        SHADER_FEATURE_COUNT = 4
+    };
+    const char* const SHADER_FEATURE_DEFINES[SHADER_FEATURE_COUNT] = { "ALPHA_TEST", "UNLIT", "DEFERRED", "OIT" };
+    const unsigned int PERMUTATION_DEPTH_ONLY = 1u << SHADER_FEATURE_COUNT; // uber.vert with depth.frag, the depth prepass program
+
+    // Shader program whose compile and link may still be running on driver threads
+    const int PROGRAM_MAX_STAGES = 2;
+    struct ProgramBuild
+    {
+        GLuint programId = 0;
+        GLuint shaderIds[PROGRAM_MAX_STAGES] = {};
+        GLenum stages[PROGRAM_MAX_STAGES] = {};
+        int shaderCount = 0;          // Shader objects still attached, 0 for cached binaries
+        uint64_t cacheKey = 0;
+        const char* label = "program";
+        bool fromCache = false;
+        uint64_t vertexKey = 0;       // Source and path of the vertex stage, equal keys write equal depth
+        std::chrono::steady_clock::time_point buildStart;
+    };
+    bool gParallelShaderCompile = false;  // GL_KHR_parallel_shader_compile, builds can be polled without blocking
+
+    enum PermutationState
+    {
+        PERMUTATION_BUILDING,
+        PERMUTATION_READY,
+        PERMUTATION_FAILED        // Kept so the build is not retried every frame
+    };
+
+    // Uniform locations fixed in the shader sources with layout(location), every permutation shares them
+    enum UniformLocation
+    {
+        UNIFORM_MODEL = 0,
+        UNIFORM_VIEW = 1,
+        UNIFORM_PROJECTION = 2,
+        UNIFORM_UV_SCALE_OFFSET = 3,
+        UNIFORM_OBJECT_COLOR = 4,
+        UNIFORM_LIGHT_COLOR = 5,          // Lamp colour, only scales the ambient term now
+        UNIFORM_VIEW_POSITION = 7,
+        UNIFORM_AMBIENT_STRENGTH = 8,
+        UNIFORM_SPECULAR_INTENSITY = 9,
+        UNIFORM_HIGHLIGHT_SIZE = 10,
+        UNIFORM_ALPHA = 11,
+        UNIFORM_CLUSTER_PARAMS = 12,
+        UNIFORM_INVERSE_VIEW_PROJECTION = 13, // Deferred lighting pass only
+        UNIFORM_INSTANCED = 14,           // Model matrices come from the instance buffer
+        UNIFORM_FIRST_INSTANCE = 15,
+        UNIFORM_NORMAL_MATRIX = 16        // Recorded with the draw, ignored by instanced draws
+    };
+
+    struct ShaderPermutation
+    {
+        unsigned int features;    // ShaderFeature bits it was compiled with
+        PermutationState state;
+        ProgramBuild build;
+        GLuint programId;         // 0 until the build is ready
+        ProgramBuild reloadBuild; // Rebuild after a shader file changed, swapped in once it linked
+        bool reloading;
+        bool rebuildPending;      // A file it depends on was saved while it was building
+        std::vector<std::string> dependencies; // Shader files the GLSL source was read from
+    };
+    std::deque<ShaderPermutation> gShaderPermutations; // deque keeps entries in place as permutations are added
+
+    // Program of a fixed pass (light binning, deferred lighting, shadows, ...), hot reloaded like the permutations
+    struct PassProgram
+    {
+        const char* label;
+        const char* names[PROGRAM_MAX_STAGES];
+        GLenum stages[PROGRAM_MAX_STAGES];
+        int count;
+        GLuint* programId;        // The global the pass draws with, replaced once a rebuild linked
+        ProgramBuild reloadBuild;
+        bool reloading;
+        bool rebuildPending;
+        std::vector<std::string> dependencies;
+    };
+    std::deque<PassProgram> gPassPrograms;
+    const ShaderPermutation* gFallbackShader = nullptr; // Draws objects whose own permutation is still building
+    const ShaderPermutation* gDeferredFallbackShader = nullptr; // Same for the G-buffer pass, nullptr when deferred is unavailable
+    const ShaderPermutation* gOitFallbackShader = nullptr; // Same for weighted blended transparency, nullptr when unavailable
+    bool gShadersReadyReported = false;
+
+    // Lighting constants and shader features of a surface
+    struct Material
+    {
+        unsigned int features;
+        float ambientStrength;
+        float specularIntensity;
+        float highlightSize;
+        float alpha;
+    };
+    // Materials of the generated test objects, the scene's own come from its file
+    const Material MATERIAL_MATTE = { 0, 0.5f, 0.5f, 16.0f, 1.0f };              // Recording stress test clutter
+    const Material MATERIAL_GLASS = { 0, 0.3f, 2.0f, 64.0f, 0.3f };              // Transparency test scene
+    const Material MATERIAL_WAX = { 0, 0.5f, 0.5f, 16.0f, 0.6f };
+    const Material* const SNAPSHOT_MATERIALS[] = { &MATERIAL_MATTE, &MATERIAL_GLASS, &MATERIAL_WAX }; // Numbered after the scene's in snapshots
+    const size_t SNAPSHOT_MATERIAL_COUNT = sizeof(SNAPSHOT_MATERIALS) / sizeof(SNAPSHOT_MATERIALS[0]);
+
+    // Stencil state an object is drawn with, used to cut the hole out of the cup handle
+    enum StencilPass
+    {
+        STENCIL_OFF,
+        STENCIL_MARK,       // Writes 1 under the object, no color or depth
+        STENCIL_CUT,        // Writes 0 under the object, no color or depth
+        STENCIL_MASKED      // Draws only where the stencil is still 1
+    };
+
+    // Everything needed to create one entity of the scene, UCreateEntity splits it into components
+    struct EntityDescription
+    {
+        const char* name;
+        const GLMesh* mesh;
+        GLuint indexCount;
+        ResourceHandle* texture;  // nullptr draws without a texture
+        const Material* material;
+        StencilPass stencil;
+        glm::mat4 model;
+        bool dynamic = false;     // Moves at runtime, drawn into the shadow map every frame instead of cached
+    };
+
+    // Scene file
+    // Read from --scene, JSON or compiled with --compile-scene, or else from the embedded desk scene.
+    // Entities point at the materials and texture handles, so both are sized once per scene.
+    const char* gScenePath = nullptr;
+    SceneDescription gSceneDescription;
+    std::vector<Material> gSceneMaterials;        // Parallel to gSceneDescription.materials
+
+    // Procedural meshes by the names scene files use for them
+    struct SceneMesh
+    {
+        const char* name;
+        const GLMesh* mesh;
+    };
+    const SceneMesh SCENE_MESHES[] = {
+        { "plane", &gMesh_plane },
+        { "body", &gMesh_body },                    // Cylinder without top
+        { "bodyTop", &gMesh_bodyTop },              // Circle
+        { "fullCyl", &gMesh_fullCyl },
+        { "handle", &gMesh_handle },                // Cup handle frame
+        { "handleInside", &gMesh_handleInside },
+        { "handleOutside", &gMesh_handleOutside },
+        { "cube", &gMesh_cube },
+    };
+    const size_t SCENE_MESH_COUNT = sizeof(SCENE_MESHES) / sizeof(SCENE_MESHES[0]);
+
+    // Scene snapshot
+    // --snapshot path maps the built scene from an image instead of reading and building it, and
+    // writes the image whenever it is missing or stale. Entity names point into the mapping.
+    const char* gSnapshotPath = nullptr;
+    MappedFile gSceneSnapshot;
+    const uint32_t SCENE_SNAPSHOT_MAGIC = 0x4E534353;     // "SCSN"
+    const uint32_t SCENE_SNAPSHOT_VERSION = 3;            // Bump when a column or its meaning changes
+    enum SnapshotSectionId
+    {
+        SNAPSHOT_KEY,               // SceneSnapshotKey
+        SNAPSHOT_SCENE,             // Compiled scene file without its entities
+        SNAPSHOT_NAMES,             // Entity names, zero terminated
+        SNAPSHOT_NAME_OFFSETS,      // Per row, into SNAPSHOT_NAMES
+        SNAPSHOT_MODEL,
+        SNAPSHOT_NORMAL_MATRIX,
+        SNAPSHOT_BOUNDS_X,
+        SNAPSHOT_BOUNDS_Y,
+        SNAPSHOT_BOUNDS_Z,
+        SNAPSHOT_BOUNDS_RADIUS,
+        SNAPSHOT_MESH,              // Index into SCENE_MESHES
+        SNAPSHOT_INDEX_COUNT,
+        SNAPSHOT_MATERIAL,          // Index into gSceneMaterials, then SNAPSHOT_MATERIALS
+        SNAPSHOT_TEXTURE,           // Index into gSceneTextures, SCENE_NONE for none
+        SNAPSHOT_STENCIL,
+        SNAPSHOT_FLAGS,
+        SNAPSHOT_MESH_INFO          // SnapshotMeshInfo per SCENE_MESHES entry
+    };
+    struct SceneSnapshotKey
+    {
+        uint64_t sourceSize;
+        int64_t sourceTime;         // Modification time of the scene file, a hash of the embedded scene
+        int32_t oitTestCylinders;
+        int32_t extraObjects;
+    };
+    // The procedural mesh a snapshot's index counts and bounds were taken from. Meshes are only
+    // created after the snapshot is loaded, so these are compared by USnapshotMatchesMeshes.
+    struct SnapshotMeshInfo
+    {
+        uint32_t nIndices;
+        float radius;
+    };
+
+    enum EntityFlags
+    {
+        ENTITY_DYNAMIC = 1 << 0,            // See EntityDescription::dynamic
+        ENTITY_TRANSFORM_DIRTY = 1 << 1     // Model changed since UUpdateTransforms last ran
+    };
+
+    // The scene's entities in structure of arrays layout, every array indexed by row. Rows are in
+    // draw order when not sorted and a stencil run, from its mark on, takes consecutive rows.
+    struct SceneStore
+    {
+        EntityIndex entities;
+        std::vector<const char*> name;
+
+        // Transform
+        std::vector<glm::mat4> model;
+        std::vector<glm::mat3> normalMatrix;    // Inverse transpose of model, kept up to date by UUpdateTransforms
+
+        // World space bounding spheres, a stencil run shares the one of its mark so it is culled whole
+        std::vector<float> boundsX;
+        std::vector<float> boundsY;
+        std::vector<float> boundsZ;
+        std::vector<float> boundsRadius;
+
+        // Mesh
+        std::vector<const GLMesh*> mesh;
+        std::vector<GLuint> indexCount;
+
+        // Material
+        std::vector<const Material*> material;
+        std::vector<ResourceHandle*> texture;   // nullptr draws without a texture
+        std::vector<StencilPass> stencil;
+
+        std::vector<uint8_t> flags;             // EntityFlags
+    };
+    SceneStore gScene;
+
+    // Scene objects in this frame's draw order, rebuilt by UBuildDrawQueues
+    FrameVector<DrawKey> gOpaqueQueue;      // Front to back
+    FrameVector<DrawKey> gBlendedQueue;     // Back to front, materials with alpha below 1
+    FrameVector<DrawKey> gDrawSortScratch;
+
+    // Everything the render thread needs to submit one object, recorded by a worker
+    struct DrawPacket
+    {
+        uint32_t object;            // Row in gScene
+        StreamedTexture* stream;    // nullptr unless the object's texture streams its mip levels
+        int textureLevel;           // Finest level of stream the draw resolves
+    };
+
+    // Linear buffers one worker records into, taken from the frame arena of the thread recording
+    struct CommandRecorder
+    {
+        FrameVector<uint32_t> visible;      // Rows of the recorder's range that passed culling
+        FrameVector<DrawPacket> packets;
+        FrameVector<DrawKey> opaqueKeys;    // DrawKey indices hold the recorder above the packet index
+        FrameVector<DrawKey> blendedKeys;
+    };
+    const int DRAW_PACKET_RECORDER_SHIFT = 24;
+    const size_t RECORD_OBJECTS_PER_WORKER = 256;   // Fewer objects than this are not worth handing to a worker
+    JobSystem* gJobs = nullptr;                     // Short non-blocking engine tasks, texture decoding stays on its pool
+    std::vector<CommandRecorder> gRecorders;        // One per job system thread, the render thread included
+    int gExtraObjects = 0;                          // --extra-objects N scatters N small objects over the carpet
 
     //Light color
     glm::vec3 gLightColor(1.0, 1.0f, 0.90f);
 
-    // Light position and scale
+    // Light position, both are replaced by the first light of the scene file
     glm::vec3 gLightPosition(-3.5f, 1.5f, 0.0f);
-    glm::vec3 gLightScale(0.5f);
+
+    // Clustered point lights, the first one is the lamp above. Layout matches PointLight in the shaders.
+    struct PointLight
+    {
+        glm::vec4 positionRadius;   // World space position and the distance the light reaches
+        glm::vec4 color;
+    };
+    const int LIGHT_CLUSTER_GRID_X = 16;   // Screen tiles across, must match CLUSTER_GRID in the shaders
+    const int LIGHT_CLUSTER_GRID_Y = 9;
+    const int LIGHT_CLUSTER_GRID_Z = 24;   // Exponential depth slices between the near and far plane
+    const int LIGHT_CLUSTER_COUNT = LIGHT_CLUSTER_GRID_X * LIGHT_CLUSTER_GRID_Y * LIGHT_CLUSTER_GRID_Z;
+    const int MAX_LIGHTS_PER_CLUSTER = 256;
+    const float LIGHT_CAMERA_NEAR = 0.1f;  // Clip planes of both camera projections
+    const float LIGHT_CAMERA_FAR = 100.0f;
+    enum LightBinding                       // Shader storage buffer bindings
+    {
+        LIGHT_BINDING_LIGHTS = 0,
+        LIGHT_BINDING_CLUSTER_COUNTS = 1,
+        LIGHT_BINDING_CLUSTER_INDICES = 2
+    };
+    enum ClusterUniform                     // Uniform locations of the light clustering compute shader
+    {
+        CLUSTER_UNIFORM_VIEW = 0,
+        CLUSTER_UNIFORM_INVERSE_PROJECTION = 1,
+        CLUSTER_UNIFORM_LIGHT_COUNT = 2,
+        CLUSTER_UNIFORM_DEPTH_RANGE = 3
+    };
+    int gLightCount = 1;                    // --lights N
+    GLuint gLightBuffer = 0;
+    GLuint gClusterLightCountBuffer = 0;
+    GLuint gClusterLightIndexBuffer = 0;
+    GLuint gClusterProgramId = 0;
+
+    // Render paths, G switches between them at runtime
+    enum RenderPath
+    {
+        RENDER_FORWARD,       // Every fragment is lit as it is drawn
+        RENDER_DEFERRED,      // G-buffer pass, then one lighting pass over the screen
+        RENDER_PATH_COUNT
+    };
+    RenderPath gRenderPath = RENDER_FORWARD; // --deferred starts with the deferred path
+    enum GBufferTarget
+    {
+        GBUFFER_ALBEDO,       // RGBA8: albedo and ambient strength
+        GBUFFER_SURFACE,      // RGBA16F: octahedral normal, specular intensity, highlight size (0 when unlit)
+        GBUFFER_DEPTH,        // Depth and the stencil the cup handle is cut out with
+        GBUFFER_TARGET_COUNT
+    };
+    GLuint gGBuffer = 0;
+    ResourceHandle gGBufferTextures;        // All three targets, reallocated when the window size changes
+    int gGBufferWidth = 0;
+    int gGBufferHeight = 0;
+    GLuint gDeferredProgramId = 0;
+    GLuint gFullscreenVao = 0;
+
+    // Cube shadow map of the lamp. Static casters are cached in their own cube, the sampled one
+    // gets a copy of it with the dynamic casters drawn on top.
+    const int SHADOW_MAP_SIZE = 1024;
+    const float SHADOW_NEAR = 0.1f;
+    const float SHADOW_FAR = 30.0f;         // Must match SHADOW_FAR in lighting.glsl
+    const int SHADOW_TEXTURE_UNIT = 4;      // After the material texture and the G-buffer
+    enum ShadowCube
+    {
+        SHADOW_CUBE_STATIC,
+        SHADOW_CUBE_SAMPLED,
+        SHADOW_CUBE_COUNT
+    };
+    enum ShadowUniform                      // Uniform locations of the shadow map shaders
+    {
+        SHADOW_UNIFORM_MODEL = 0,
+        SHADOW_UNIFORM_FACE_VIEW_PROJECTION = 1,
+        SHADOW_UNIFORM_LIGHT_POSITION = 2,
+        SHADOW_UNIFORM_FAR_PLANE = 3
+    };
+    GLuint gShadowProgramId = 0;
+    GLuint gShadowFramebuffer = 0;
+    ResourceHandle gShadowCubes;
+    uint64_t gStaticShadowState = 0;        // Hash of the lamp and static caster transforms the cache was rendered with
+    bool gStaticShadowsRendered = false;
+    bool gShadowHadDynamic = false;         // The sampled cube holds dynamic casters from the last frame
+
+    // Depth prepass, switched by measured overdraw unless forced with --prepass on|off
+    enum DepthPrepassMode
+    {
+        PREPASS_AUTO,
+        PREPASS_ON,
+        PREPASS_OFF
+    };
+    DepthPrepassMode gDepthPrepassMode = PREPASS_AUTO;
+    const float DEPTH_PREPASS_ENABLE_OVERDRAW = 1.5f;   // Fragments per pixel, the gap between the two avoids flipping
+    const float DEPTH_PREPASS_DISABLE_OVERDRAW = 1.25f;
+    const int OVERDRAW_QUERY_FRAMES = 3;                // Frames a query result may take to arrive without stalling
+    struct OverdrawQuery
+    {
+        GLuint depthQuery = 0;      // GL_SAMPLES_PASSED of the prepass
+        GLuint shadedQuery = 0;     // GL_SAMPLES_PASSED of the shading pass
+        bool prepass = false;
+        bool pending = false;
+        int pixels = 0;
+    };
+    OverdrawQuery gOverdrawQueries[OVERDRAW_QUERY_FRAMES];
+    int gOverdrawQueryIndex = 0;
+    const ShaderPermutation* gDepthShader = nullptr;    // PERMUTATION_DEPTH_ONLY, swapped together with the shading permutations
+    bool gDepthPrepassActive = false;
+    float gShadedPerPixel = 0.0f;                       // Last measured, fragments shaded per pixel
+    float gOverdrawWithoutPrepass = 0.0f;               // Same without the prepass, counted by the prepass itself while it is on
+    bool gOverdrawMeasuredWithPrepass = false;
+
+    // Transparency, T switches between sorting blended objects and weighted blended OIT
+    enum TransparencyMode
+    {
+        TRANSPARENCY_SORTED,  // Back to front with alpha blending
+        TRANSPARENCY_OIT      // Weighted blended order independent transparency
+    };
+    TransparencyMode gTransparencyMode = TRANSPARENCY_SORTED; // --oit starts with OIT
+    int gOitTestCylinders = 0;                                // --oit-scene N adds N crossing translucent cylinders
+    enum OitTarget
+    {
+        OIT_ACCUMULATION,     // RGBA16F: weighted premultiplied colour and weighted alpha
+        OIT_REVEALAGE,        // R8: product of 1 - alpha, how much of the opaque scene shows through
+        OIT_DEPTH,            // Copy of the opaque depth, tested but not written
+        OIT_TARGET_COUNT
+    };
+    GLuint gOitFramebuffer = 0;
+    ResourceHandle gOitTextures;
+    int gOitWidth = 0;
+    int gOitHeight = 0;
+    GLuint gOitCompositeProgramId = 0;
+
+    // Model matrices of instanced draws, read by the uber vertex shader
+    const GLuint INSTANCE_BUFFER_BINDING = 3;   // After the light buffers
+    struct InstanceBatch
+    {
+        uint32_t object;            // Row of the first entity, its mesh, texture and material are shared by the batch
+        int first;                  // First model matrix in the instance buffer
+        int count;
+    };
+    FrameVector<InstanceBatch> gInstanceBatches;
+    FrameVector<glm::mat4> gInstanceModels;
+    GLuint gInstanceBuffer = 0;
+    size_t gInstanceCapacity = 0;               // Matrices the buffer holds
 
     // Mesh and light color
     glm::vec3 gObjectColor(1.f, 0.2f, 0.0f);
@@ -114,6 +697,59 @@ namespace
 
     // Perspective var
     bool isOrtho = false;
+
+    // Render thread, --no-render-thread draws on the main thread instead
+    // The main thread fills one FrameState per frame; two of them let it prepare a frame while the last one is drawn.
+    struct FrameState
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec3 viewPosition;
+        glm::vec3 cameraPosition;   // Texture streaming measures screen size from the camera
+        float zoom;
+        float deltaTime;            // Main thread time between this frame and the previous one
+        double mainThreadMs;        // Main thread time spent on events, input and the camera for this frame
+    };
+    const int FRAME_STATE_COUNT = 2;
+
+    // Transient per-frame data, one arena per thread and frame state
+    const size_t FRAME_ARENA_BYTES = 256 * 1024;    // Starting size, arenas grow to the largest frame seen
+    FrameArenas gFrameArenas(FRAME_STATE_COUNT, FRAME_ARENA_BYTES);
+    std::atomic<uint64_t> gHeapAllocations{ 0 };     // Every operator new in the process, see HEAP ALLOCATION COUNTER
+    enum RenderCommandType
+    {
+        RENDER_COMMAND_FRAME,       // Draw the frame state in value, then hand it back
+        RENDER_COMMAND_KEY,         // Key press in value that needs the context, see UHandleRenderKey
+        RENDER_COMMAND_RESIZE,
+        RENDER_COMMAND_QUIT
+    };
+    struct RenderCommand
+    {
+        RenderCommandType type;
+        int value;
+        int width;
+        int height;
+    };
+    bool gUseRenderThread = true;
+    std::thread gRenderThread;
+    FrameState gFrameStates[FRAME_STATE_COUNT];
+    CommandQueue<RenderCommand, 64> gRenderCommands;            // Main thread to render thread
+    CommandQueue<int, FRAME_STATE_COUNT> gFreeFrameStates;      // Frame states the render thread is done with, back to the main thread
+    const FrameState* gRenderState = nullptr;                   // Frame being drawn, render thread only
+    std::atomic<bool> gCloseRequested{ false };                 // A benchmark finished, the main thread closes the window
+
+    // Frame time and thread overlap since the last report, render thread only
+    struct FrameTiming
+    {
+        int frames = 0;
+        double mainMs = 0.0;
+        double renderMs = 0.0;
+        double frameMs = 0.0;
+        uint64_t allocations = 0;                       // Heap allocations on any thread between the frames
+        uint64_t lastFrameAllocations = 0;              // gHeapAllocations when the last frame ended
+        std::chrono::steady_clock::time_point lastFrameEnd;
+    };
+    FrameTiming gFrameTiming;
 }
 
 /* User-defined Function prototypes to:
@@ -122,252 +758,695 @@ namespace
  * and render graphics on the screen
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
+void UParseArguments(int argc, char* argv[]);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void UMousePosCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UPerspectiveSwitch(GLFWwindow* window, int key, int scancode, int action, int mods);
 void UDestroyMesh(GLMesh& mesh);
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+bool UBeginProgramBuild(const char* const* sources, const GLenum* stages, int count, const char* label, ProgramBuild& build);
+bool UIsProgramBuildDone(const ProgramBuild& build);
+bool UFinishProgramBuild(ProgramBuild& build);
+bool UBeginShaderProgramBuild(const char* const* shaderNames, const GLenum* stages, int count, const char* label, ProgramBuild& build,
+                              std::vector<std::string>& dependencies);
+bool UCreateShaderProgram(const char* const* shaderNames, const GLenum* stages, int count, const char* label, GLuint& programId);
+bool UCreateComputeProgram(const char* shaderName, GLuint& programId);
+bool UBuildShaders();
+bool UBeginSpirvProgramBuild(const char* const* modules, const std::string* sources, const GLenum* stages, int count, GLenum specializedStage,
+                             const GLuint* constantIds, const GLuint* constantValues, int constantCount,
+                             const char* label, ProgramBuild& build);
+bool USpirvModuleCurrent(const char* module, const std::string& source);
+bool UPermutationsUseSpirv();
+const char* UEmbeddedShaderSource(const std::string& name);
+bool UShaderSeedOutdated(const std::string& name, const std::string& text);
+bool ULoadShaderSource(const std::string& name, std::string& source, std::vector<std::string>& dependencies, int depth = 0);
+std::string UAddShaderDefines(const std::string& source, unsigned int features);
+void UWatchShaderFiles();
+void UStopWatchingShaderFiles();
+std::vector<std::string> UReadChangedShaderFiles();
+void UPollShaderChanges();
+void URebuildShaderPermutation(ShaderPermutation& permutation);
+void URebuildPassProgram(PassProgram& pass);
+void UFinishPassReload(PassProgram& pass);
+void UAbandonProgramBuild(ProgramBuild& build);
+void URegisterProgram(GLuint programId, const char* label, bool fromCache, std::chrono::steady_clock::time_point buildStart);
+uint64_t UProgramCacheKey(const char* const* sources, int count);
+std::string UProgramCachePath(uint64_t key);
+bool ULoadProgramBinary(uint64_t key, GLuint& programId);
+void USaveProgramBinary(uint64_t key, GLuint programId);
+void UReportProgramBuilds();
 void UDestroyShaderProgram(GLuint programId);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+void UTextureFormatToGL(TextureFormat format, GLenum& internalFormat, GLenum& pixelFormat);
+bool ULoadTextureData(const char* filename, BakedTexture& texture, int maxDimension = INT_MAX, std::string* cachePath = nullptr);
+bool UCreateTexture(const char* filename, ResourceHandle& handle);
+void UDestroyTexture(ResourceHandle& texture);
+GLuint UTextureName(ResourceHandle texture);
+size_t UTextureBytes(TextureFormat format, int width, int height, int levels);
+GLsizei UMipLevelCount(int width, int height);
+void UCreateSamplers();
+void UDestroySamplers();
+void UCreatePlaceholderTexture(ResourceHandle& texture);
+bool UCreateStagingBuffer();
+void UDestroyStagingBuffer();
+void UCreateTextureAsync(const char* filename, ResourceHandle& texture);
+void ULoadTextures();
+void UUploadPendingTextures();
+void UFinishTextureLoad();
+bool ULoadAtlasData(const std::vector<TextureAsset>& assets, BakedTexture& texture, std::vector<AtlasEntry>& entries);
+void UCreateAtlasAsync(const TextureAsset* assets, int count);
+void UCreateProceduralTexture(const ProceduralMaterial& material, ResourceHandle& texture);
+int UProceduralSize();
+void UBindTexture(ResourceHandle texture);
+StreamedTexture* UFindStreamedTexture(ResourceHandle texture);
+size_t UStreamedBytes(const StreamedTexture& stream, int firstLevel, int endLevel);
+void UTrimTextureLevels(StreamedTexture& stream, int newResidentLevel);
+size_t UEvictTextureLevels(size_t bytesNeeded, const StreamedTexture* keep);
+void UUpdateTextureStreaming();
+void UBenchmarkFillRate();
+bool UCreateLightClusters();
+void UDestroyLightClusters();
+void UCreateLights(int count);
+void UUpdateLightClusters(const glm::mat4& view, const glm::mat4& projection);
+void UBenchmarkLights();
+bool UCreateDeferredRenderer();
+void UDestroyDeferredRenderer();
+bool UResizeGBuffer(int width, int height);
+bool UAllocateRenderTargets(GLuint framebuffer, ResourceHandle textures, const GLenum* formats, const size_t* texelBytes, int count,
+                            int width, int height, const char* label);
+void UDrawFrame(RenderPath path, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition);
+void UDrawDeferredLighting(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition);
+void UBenchmarkRenderPaths();
+bool UCreateShadowMaps();
+void UDestroyShadowMaps();
+bool UCastsShadow(uint32_t row);
+void URenderShadowCube(GLuint cube, bool dynamic);
+void UUpdateShadowMaps();
+bool UCreateDepthPrepass();
+void UDestroyDepthPrepass();
+bool UInDepthPrepass(uint32_t row);
+void UDrawDepthPrepass(const glm::mat4& view, const glm::mat4& projection);
+void UCollectOverdraw();
+void UReportOverdraw();
+void UReleaseGpuObjects(ResourceType type, const uint32_t* names, int count);
+void UReportGpuMemory();
+const ShaderPermutation* UGetShaderPermutation(unsigned int features);
+const ShaderPermutation* UWaitForShaderPermutation(unsigned int features);
+bool UBeginPermutationBuild(ShaderPermutation& permutation, ProgramBuild& build);
+std::string UPermutationName(unsigned int features);
+void UFinishShaderPermutation(ShaderPermutation& permutation);
+void UFinishShaderReload(ShaderPermutation& permutation);
+void UPollShaderPermutations();
+void UWarmUpShaderPermutation(const ShaderPermutation& permutation);
+void UApplyFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition);
+void UApplyMaterial(const Material& material);
+void UApplyStencilPass(StencilPass& current, StencilPass next);
+void UCreateScene();
+bool ULoadScene();
+bool UReadScene(const char* path, SceneDescription& scene, std::string& error);
+const GLMesh* USceneMesh(const char* name);
+ResourceHandle* USceneTexture(const char* name);
+void UCreateSceneMaterials();
+void UUseSceneLamp();
+bool UCompileScene();
+bool UBenchmarkScene();
+SceneSnapshotKey USceneSnapshotKey();
+bool UBuildSceneSnapshot(std::vector<unsigned char>& image);
+bool UWriteSceneSnapshot(const char* path);
+bool ULoadSceneSnapshot(const char* path);
+bool USnapshotMatchesMeshes();
+bool UBenchmarkSnapshot();
 void UCreateMesh(GLMesh& mesh, int meshChoice);
-void URender(GLMesh& mesh_plane, GLMesh& mesh_body, GLMesh& mesh_bodyTop, GLMesh& mesh_handle, GLMesh& mesh_handleInside, GLMesh& mesh_handleOutside, GLMesh& mesh_cube, GLMesh& mesh_fullCyl, float incRotation);
+void UGetCameraMatrices(glm::mat4& view, glm::mat4& projection, glm::vec3& viewPosition);
+void UDrawScene(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, unsigned int pathFeatures, bool depthPrepass,
+                const FrameVector<DrawKey>& queue);
+bool UIsBlended(uint32_t row);
+int UTextureLevelForDraw(const StreamedTexture& stream, const glm::mat4& model, const FrameState& frame);
+void UFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+void UCreateEntity(const EntityDescription& description);
+void UUpdateTransforms();
+uint32_t UCullEntities(const glm::vec4 planes[6], uint32_t first, uint32_t end, uint32_t* visible);
+void URecordDraws(CommandRecorder& recorder, uint32_t recorderIndex, uint32_t first, uint32_t end,
+                  const glm::mat4& view, const glm::vec4 planes[6], const FrameState& frame);
+const DrawPacket& UDrawPacket(uint32_t index);
+int UBuildDrawQueues(const glm::mat4& view, const glm::mat4& projection, int recorderCount);
+void UBenchmarkRecording();
+bool UBenchmarkJobs();
+void UDrawBlended(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, bool deferred);
+bool UCreateWeightedBlendedOit();
+void UDestroyWeightedBlendedOit();
+bool UResizeOitTargets(int width, int height);
+bool USameInstanceBatch(uint32_t a, uint32_t b);
+void UBuildInstanceBatches();
+void UDrawWeightedBlended(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, GLuint depthFramebuffer);
+void URender(const FrameState& frame);
+void UStartRenderThread();
+void UStopRenderThread();
+void URenderThreadMain();
+void UCaptureFrameState(FrameState& frame);
+void URenderFrame(const FrameState& frame);
+void UHandleRenderKey(int key);
+void UReportFrameTiming();
 
 
 /* Vertex Shader Source Code*/
+// Uniforms and varyings have explicit locations since SPIR-V modules carry no names (see UniformLocation)
 const GLchar* vertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
     layout(location = 2) in vec3 normal; // VAP position 2 for normals
     layout(location = 1) in vec2 textureCoordinate;  // Texture Data from Vertex Attrib Pointer 1
 
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-    out vec2 vertexTextureCoordinate; // variable to transfer texture coords to the fragment shader
+    layout(location = 0) out vec3 vertexNormal; // For outgoing normals to fragment shader
+    layout(location = 1) out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+    layout(location = 2) out vec2 vertexTextureCoordinate; // variable to transfer texture coords to the fragment shader
 
     //Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    layout(location = 0) uniform mat4 model;
+    layout(location = 1) uniform mat4 view;
+    layout(location = 2) uniform mat4 projection;
 
+    layout(location = 3) uniform vec4 uvScaleOffset; // Maps the mesh UVs onto a texture atlas region (xy scale, zw offset), set by UBindTexture
 
+    // Instanced draws read one model matrix per instance, starting at firstInstance
+    layout(std430, binding = 3) readonly buffer InstanceBuffer { mat4 instanceModels[]; };
+    layout(location = 14) uniform bool instanced;
+    layout(location = 15) uniform int firstInstance;
+    layout(location = 16) uniform mat3 normalMatrix; // Inverse transpose of model, computed once per draw on the CPU
+
+    invariant gl_Position; // The depth prepass and the shading pass must agree exactly for GL_EQUAL
 
     void main()
     {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+        mat4 objectModel = instanced ? instanceModels[firstInstance + gl_InstanceID] : model;
+
+        gl_Position = projection * view * objectModel * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 
-        vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+        vertexFragmentPos = vec3(objectModel * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
-        vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-        vertexTextureCoordinate = textureCoordinate;
+        mat3 objectNormalMatrix = instanced ? mat3(transpose(inverse(objectModel))) : normalMatrix;
+        vertexNormal = objectNormalMatrix * normal; // get normal vectors in world space only and exclude normal translation properties
+        vertexTextureCoordinate = textureCoordinate * uvScaleOffset.xy + uvScaleOffset.zw;
     }
 );
 
 
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec3 vertexNormal; // Variable to hold incoming normal coords
-    in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate; // Variable to hold incoming texture coords from vertex shader
+/* Uber Fragment Shader Source Code
+ * Compiled to SPIR-V, ShaderFeature bits are specialization constants with the bit index as
+ * their id. Compiled from GLSL, UAddShaderDefines puts one #define per enabled feature
+ * after the #version line, which is why this is a raw string rather than the GLSL macro. */
+const GLchar* uberFragmentShaderSource = R"(#version 440 core
+#ifdef GL_SPIRV
+    layout(constant_id = 0) const bool ALPHA_TEST_ENABLED = false;
+    layout(constant_id = 1) const bool UNLIT_ENABLED = false;
+    layout(constant_id = 2) const bool DEFERRED_ENABLED = false;
+    layout(constant_id = 3) const bool OIT_ENABLED = false;
+#else
+#ifdef ALPHA_TEST
+    const bool ALPHA_TEST_ENABLED = true;
+#else
+    const bool ALPHA_TEST_ENABLED = false;
+#endif
+#ifdef UNLIT
+    const bool UNLIT_ENABLED = true;
+#else
+    const bool UNLIT_ENABLED = false;
+#endif
+#ifdef DEFERRED
+    const bool DEFERRED_ENABLED = true;
+#else
+    const bool DEFERRED_ENABLED = false;
+#endif
+#ifdef OIT
+    const bool OIT_ENABLED = true;
+#else
+    const bool OIT_ENABLED = false;
+#endif
+#endif
+
+    layout(location = 0) in vec3 vertexNormal; // Variable to hold incoming normal coords
+    layout(location = 1) in vec3 vertexFragmentPos; // For incoming fragment position
+    layout(location = 2) in vec2 vertexTextureCoordinate; // Variable to hold incoming texture coords from vertex shader
+
+    // Forward: the shaded colour. Deferred: albedo, with the ambient strength in alpha. OIT: weighted premultiplied colour.
+    layout(location = 0) out vec4 fragmentColor;
+    layout(location = 1) out vec4 fragmentSurface; // Deferred: packed normal, specular intensity, highlight size. OIT: alpha for the revealage.
+
+    layout(location = 4) uniform vec3 objectColor;
+    layout(location = 5) uniform vec3 lightColor; // Lamp colour for the ambient term
+    layout(location = 7) uniform vec3 viewPosition;
 
-    out vec4 fragmentColor;
+    // Material
+    layout(location = 8) uniform float ambientStrength;
+    layout(location = 9) uniform float specularIntensity;
+    layout(location = 10) uniform float highlightSize;
+    layout(location = 11) uniform float alpha;
 
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightColor2;
-    uniform vec3 lightPos;
-    uniform vec3 lightPos2;
-    uniform vec3 viewPosition;
+    layout(binding = 0) uniform sampler2D uTexture; // Every texture is bound to unit 0
 
-    uniform sampler2D uTexture; // Useful when working with multiple textures
+#include "lighting.glsl"
 
     void main()
     {
-        //Phong lighting model calculations to generate ambient, diffuse, and specular components
+        if (UNLIT_ENABLED)
+        {
+            fragmentColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+            if (DEFERRED_ENABLED)
+                fragmentSurface = vec4(0.0f); // A highlight size of 0 marks unlit pixels
+            return;
+        }
 
-        //Calculate Ambient lighting
-        float ambientStrength1 = 1.0f; // Set ambient or global lighting strength
-        vec3 ambient = (ambientStrength1 * lightColor);
+        // Texture holds the color to be used for all three components
+        vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
+        if (ALPHA_TEST_ENABLED && textureColor.a < 0.1)
+            discard;
 
-        //Calculate Diffuse lighting
         vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-        float impact1 = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        vec3 diffuse = (impact1 * lightColor); // Generate diffuse light color
 
-        //Calculate Specular lighting
-        float specularIntensity = 3.0f; // Set specular light strength        
-        float highlightSize = 16.0f; // Set specular highlight size        
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector        
+        // The lighting pass shades the pixel later from what is written here
+        if (DEFERRED_ENABLED)
+        {
+            fragmentColor = vec4(textureColor.rgb, ambientStrength);
+            fragmentSurface = vec4(packNormal(norm), specularIntensity, highlightSize);
+            return;
+        }
 
-        //Calculate specular component
-        float specularComponent = pow(max(dot(viewDir, (reflectDir)), 0.0), highlightSize);        
-        vec3 specular = (specularIntensity * specularComponent * lightColor);
+        //Phong lighting model calculations to generate ambient, diffuse, and specular components
 
-        // Texture holds the color to be used for all three components
-        vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
+        //Calculate Ambient lighting
+        vec3 ambient = (ambientStrength * lightColor);
+
+        // Diffuse and specular of every light listed for this fragment's cluster
+        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+        vec3 lighting = shadeClusterLights(vertexFragmentPos, norm, viewDir, specularIntensity, highlightSize);
 
         // Calculate phong result
-        vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+        vec3 phong = (ambient + lighting) * textureColor.xyz;
+
+        if (OIT_ENABLED)
+        {
+            // Near and more opaque fragments weigh more, clamped to what RGBA16F accumulates safely
+            float weight = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+            fragmentColor = vec4(phong * alpha, alpha) * weight;
+            fragmentSurface = vec4(alpha);
+            return;
+        }
 
-        fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+        fragmentColor = vec4(phong, alpha); // Send lighting results to GPU
+    }
+)";
+
+/* Clustered Lighting Shader Include
+ * Included by the uber and deferred lighting fragment shaders through #include "lighting.glsl",
+ * both shade the lights the clustering compute pass listed for the pixel's cluster. */
+const GLchar* lightingShaderSource = R"(
+    struct PointLight
+    {
+        vec4 positionRadius;
+        vec4 color;
+    };
+    layout(std430, binding = 0) readonly buffer LightBuffer { PointLight lights[]; };
+    layout(std430, binding = 1) readonly buffer ClusterLightCountBuffer { uint clusterLightCounts[]; };
+    layout(std430, binding = 2) readonly buffer ClusterLightIndexBuffer { uint clusterLightIndices[]; };
+
+    layout(location = 1) uniform mat4 view;
+    layout(location = 12) uniform vec4 clusterParams; // Viewport size, near and far plane
+    const uvec3 CLUSTER_GRID = uvec3(16, 9, 24);
+    const uint MAX_LIGHTS_PER_CLUSTER = 256;
+
+    // Distance to the lamp, light 0, over SHADOW_FAR in every direction
+    layout(binding = 4) uniform samplerCubeShadow lampShadowMap;
+    const float SHADOW_FAR = 30.0;
+
+    // Fraction of the lamp's light reaching worldPosition. Every tap is a hardware filtered
+    // 2x2 comparison, eight of them spread around the direction soften the edge further.
+    float lampShadow(vec3 worldPosition, vec3 norm)
+    {
+        const vec3 offsets[8] = vec3[](vec3(1, 1, 1), vec3(1, -1, 1), vec3(-1, -1, 1), vec3(-1, 1, 1),
+                                       vec3(1, 1, -1), vec3(1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1));
+
+        vec3 fromLight = worldPosition - lights[0].positionRadius.xyz;
+        float distance = length(fromLight);
+
+        // Surfaces facing away from the lamp at a grazing angle need more bias not to shadow themselves
+        float slope = 1.0 - abs(dot(norm, fromLight / max(distance, 0.0001)));
+        float reference = (distance - 0.03 - 0.1 * slope) / SHADOW_FAR;
+        float filterRadius = 0.01 * distance;
+
+        float lit = 0.0;
+        for (int i = 0; i < 8; ++i)
+            lit += texture(lampShadowMap, vec4(fromLight + offsets[i] * filterRadius, reference));
+        return lit / 8.0;
     }
-);
 
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource_plane = GLSL(440,
-    in vec3 vertexNormal; // Variable to hold incoming normal coords
-    in vec3 vertexFragmentPos; // For incoming fragment position
-    in vec2 vertexTextureCoordinate; // Variable to hold incoming texture coords from vertex shader
+    // Index of the cluster a pixel falls in, the inverse of the slicing in the compute pass
+    uint clusterIndex(vec3 worldPosition)
+    {
+        float depth = -(view * vec4(worldPosition, 1.0)).z;
+        float slice = log(depth / clusterParams.z) / log(clusterParams.w / clusterParams.z) * float(CLUSTER_GRID.z);
+        uvec2 tile = uvec2(clamp(gl_FragCoord.xy / clusterParams.xy, 0.0, 0.9999) * vec2(CLUSTER_GRID.xy));
+        uint z = uint(clamp(slice, 0.0, float(CLUSTER_GRID.z - 1)));
+        return tile.x + CLUSTER_GRID.x * (tile.y + CLUSTER_GRID.y * z);
+    }
 
-    out vec4 fragmentColor;
+    // Summed diffuse and specular light of the cluster's lights, to be scaled by the albedo
+    vec3 shadeClusterLights(vec3 worldPosition, vec3 norm, vec3 viewDir, float specularIntensity, float highlightSize)
+    {
+        vec3 lighting = vec3(0.0);
+        uint cluster = clusterIndex(worldPosition);
+        uint count = clusterLightCounts[cluster];
+        for (uint i = 0; i < count; ++i)
+        {
+            uint lightIndex = clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+            PointLight light = lights[lightIndex];
+            vec3 toLight = light.positionRadius.xyz - worldPosition;
+            float distance = length(toLight);
+
+            // Fades to zero at the light's radius, barely changes anything well inside it
+            float falloff = clamp(1.0 - (distance * distance) / (light.positionRadius.w * light.positionRadius.w), 0.0, 1.0);
+            falloff *= falloff;
+
+            // Only the lamp casts shadows
+            if (lightIndex == 0)
+                falloff *= lampShadow(worldPosition, norm);
+
+            //Calculate Diffuse lighting
+            vec3 lightDirection = toLight / max(distance, 0.0001);
+            float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
+            vec3 diffuse = impact * light.color.rgb;
+
+            //Calculate Specular lighting
+            vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
+            float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+            vec3 specular = specularIntensity * specularComponent * light.color.rgb;
+
+            lighting += (diffuse + specular) * falloff;
+        }
+        return lighting;
+    }
 
-    uniform vec3 objectColor;
-    uniform vec3 lightColor;
-    uniform vec3 lightColor2;
-    uniform vec3 lightPos;
-    uniform vec3 lightPos2;
-    uniform vec3 viewPosition;
+    // Octahedral normal encoding, two components in [-1, 1] for the G-buffer
+    vec2 packNormal(vec3 n)
+    {
+        n /= abs(n.x) + abs(n.y) + abs(n.z);
+        vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        return n.z >= 0.0 ? n.xy : folded;
+    }
 
-    uniform sampler2D uTexture; // Useful when working with multiple textures
+    vec3 unpackNormal(vec2 e)
+    {
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.0);
+        n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+        return normalize(n);
+    }
+)";
 
+/* Full Screen Triangle Vertex Shader Source Code
+ * Covers the viewport with one triangle made from gl_VertexID, drawn without vertex buffers. */
+const GLchar* fullscreenVertexShaderSource = GLSL(440,
     void main()
     {
-        //Phong lighting model calculations to generate ambient, diffuse, and specular components
+        vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    }
+);
 
-        //Calculate Ambient lighting
-        float ambientStrength1 = 0.5f; // Set ambient or global lighting strength
-        vec3 ambient = (ambientStrength1 * lightColor);
+/* Deferred Lighting Fragment Shader Source Code
+ * Shades every pixel of the G-buffer once with the same clustered lights as the forward path.
+ * The world position is rebuilt from the depth buffer. */
+const GLchar* deferredFragmentShaderSource = R"(#version 440 core
+    layout(location = 0) out vec4 fragmentColor;
 
-        //Calculate Diffuse lighting
-        vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-        vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-        float impact1 = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-        vec3 diffuse = (impact1 * lightColor); // Generate diffuse light color
+    layout(location = 5) uniform vec3 lightColor;
+    layout(location = 7) uniform vec3 viewPosition;
+    layout(location = 13) uniform mat4 inverseViewProjection;
 
-        //Calculate Specular lighting
-        float specularIntensity = 0.5f; // Set specular light strength        
-        float highlightSize = 16.0f; // Set specular highlight size        
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector        
+    layout(binding = 1) uniform sampler2D albedoBuffer;  // Albedo and ambient strength
+    layout(binding = 2) uniform sampler2D surfaceBuffer; // Packed normal, specular intensity and highlight size
+    layout(binding = 3) uniform sampler2D depthBuffer;
 
-        //Calculate specular component
-        float specularComponent = pow(max(dot(viewDir, (reflectDir)), 0.0), highlightSize);
-        vec3 specular = (specularIntensity * specularComponent * lightColor);
+#include "lighting.glsl"
 
-        // Texture holds the color to be used for all three components
-        vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
-        if (textureColor.a < 0.1)
-            discard;
+    void main()
+    {
+        ivec2 pixel = ivec2(gl_FragCoord.xy);
+        float depth = texelFetch(depthBuffer, pixel, 0).r;
+        if (depth == 1.0)
+            discard; // Nothing was drawn here
+
+        vec4 albedo = texelFetch(albedoBuffer, pixel, 0);
+        vec4 surface = texelFetch(surfaceBuffer, pixel, 0);
+        if (surface.w == 0.0)
+        {
+            fragmentColor = vec4(albedo.rgb, 1.0);
+            return;
+        }
 
-        // Calculate phong result
-        vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+        vec4 position = inverseViewProjection * vec4(gl_FragCoord.xy / clusterParams.xy * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+        position /= position.w;
 
-        
+        vec3 norm = unpackNormal(surface.xy);
+        vec3 viewDir = normalize(viewPosition - position.xyz);
+        vec3 ambient = albedo.a * lightColor;
+        vec3 lighting = shadeClusterLights(position.xyz, norm, viewDir, surface.z, surface.w);
 
-        fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+        fragmentColor = vec4((ambient + lighting) * albedo.rgb, 1.0);
     }
-);
+)";
 
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource_candle = GLSL(440,
-    in vec3 vertexNormal; // Variable to hold incoming normal coords
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate; // Variable to hold incoming texture coords from vertex shader
+/* Shadow Map Shader Source Code
+ * Renders one face of the lamp's cube shadow map. The depth written is the distance to the
+ * lamp over SHADOW_FAR, so lighting can compare it without knowing which face it came from. */
+const GLchar* shadowVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position;
 
-out vec4 fragmentColor;
+    layout(location = 0) out vec3 worldPosition;
 
-uniform vec3 objectColor;
-uniform vec3 lightColor;
-uniform vec3 lightColor2;
-uniform vec3 lightPos;
-uniform vec3 lightPos2;
-uniform vec3 viewPosition;
+    layout(location = 0) uniform mat4 model;
+    layout(location = 1) uniform mat4 faceViewProjection;
 
-uniform sampler2D uTexture; // Useful when working with multiple textures
+    void main()
+    {
+        vec4 world = model * vec4(position, 1.0);
+        worldPosition = world.xyz;
+        gl_Position = faceViewProjection * world;
+    }
+);
 
-void main()
-{
-    //Phong lighting model calculations to generate ambient, diffuse, and specular components
+const GLchar* shadowFragmentShaderSource = GLSL(440,
+    layout(location = 0) in vec3 worldPosition;
 
-    //Calculate Ambient lighting
-    float ambientStrength1 = 0.5f; // Set ambient or global lighting strength
-    vec3 ambient = (ambientStrength1 * lightColor);
+    layout(location = 2) uniform vec3 lightPosition;
+    layout(location = 3) uniform float farPlane;
 
-    //Calculate Diffuse lighting
-    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
-    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact1 = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse = (impact1 * lightColor); // Generate diffuse light color
+    void main()
+    {
+        gl_FragDepth = length(worldPosition - lightPosition) / farPlane;
+    }
+);
 
-    //Calculate Specular lighting
-    float specularIntensity = 0.5f; // Set specular light strength        
-    float highlightSize = 16.0f; // Set specular highlight size        
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector        
+/* Weighted Blended Transparency Composite Fragment Shader Source Code
+ * Turns the accumulated weighted colour into an average and blends it over the opaque scene
+ * with GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, the revealage going out as alpha. */
+const GLchar* oitCompositeFragmentShaderSource = GLSL(440,
+    layout(location = 0) out vec4 fragmentColor;
 
-    //Calculate specular component
-    float specularComponent = pow(max(dot(viewDir, (reflectDir)), 0.0), highlightSize);
-    vec3 specular = (specularIntensity * specularComponent * lightColor);
+    layout(binding = 1) uniform sampler2D accumulationBuffer;
+    layout(binding = 2) uniform sampler2D revealageBuffer;
 
-    // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
+    void main()
+    {
+        ivec2 pixel = ivec2(gl_FragCoord.xy);
+        float revealage = texelFetch(revealageBuffer, pixel, 0).r;
+        if (revealage == 1.0)
+            discard; // No transparent surface here
 
-    
+        vec4 accumulation = texelFetch(accumulationBuffer, pixel, 0);
 
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+        // An overflowing sum would turn the average into infinity
+        if (isinf(max(max(abs(accumulation.r), abs(accumulation.g)), abs(accumulation.b))))
+            accumulation.rgb = vec3(accumulation.a);
 
-    fragmentColor = vec4(phong, 0.1f); // Send lighting results to GPU
-}
+        fragmentColor = vec4(accumulation.rgb / max(accumulation.a, 0.00001), revealage);
+    }
+);
+
+/* Depth Prepass Fragment Shader Source Code
+ * Paired with the uber vertex shader, only the depth the rasterizer writes is wanted. */
+const GLchar* depthFragmentShaderSource = GLSL(440,
+    void main()
+    {
+    }
 );
 
-/* Lamp Shader Source Code*/
-const GLchar* lampVertexShaderSource = GLSL(440,
+/* Light Clustering Compute Shader Source Code
+ * One invocation per cluster of the view space grid. Lights are moved into view space one batch
+ * per workgroup at a time through shared memory, then every invocation keeps the ones whose
+ * sphere touches its cluster's bounding box. */
+const GLchar* clusterComputeShaderSource = GLSL(440,
+    layout(local_size_x = 128) in;
 
-    layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
-    layout(location = 2) in vec3 normal; // VAP position 1 for normals
-    layout(location = 1) in vec2 textureCoordinate;  // Texture Data from Vertex Attrib Pointer 2
+    struct PointLight
+    {
+        vec4 positionRadius;   // World space position and the distance the light reaches
+        vec4 color;
+    };
 
-    out vec3 vertexNormal; // For outgoing normals to fragment shader
-    out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-    out vec2 vertexTextureCoordinate; // variable to transfer texture coords to the fragment shader
+    layout(std430, binding = 0) readonly buffer LightBuffer { PointLight lights[]; };
+    layout(std430, binding = 1) writeonly buffer ClusterLightCountBuffer { uint clusterLightCounts[]; };
+    layout(std430, binding = 2) writeonly buffer ClusterLightIndexBuffer { uint clusterLightIndices[]; };
 
-    //Global variables for the  transform matrices
-    uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    layout(location = 0) uniform mat4 view;
+    layout(location = 1) uniform mat4 inverseProjection;
+    layout(location = 2) uniform int lightCount;
+    layout(location = 3) uniform vec2 depthRange;      // Near and far plane distance
+
+    const uvec3 CLUSTER_GRID = uvec3(16, 9, 24);       // Same as LIGHT_CLUSTER_GRID_* in the C++
+    const uint MAX_LIGHTS_PER_CLUSTER = 256;
+    const int BATCH_SIZE = 128;                        // Matches local_size_x
 
+    shared vec4 batch[BATCH_SIZE];                     // View space position and radius
 
+    // View space point at distance depth along the ray through ndc. Interpolating between the
+    // near and far plane points works for perspective and orthographic projections alike.
+    vec3 viewSpacePoint(vec2 ndc, float depth)
+    {
+        vec4 nearPoint = inverseProjection * vec4(ndc, -1.0, 1.0);
+        vec4 farPoint = inverseProjection * vec4(ndc, 1.0, 1.0);
+        nearPoint /= nearPoint.w;
+        farPoint /= farPoint.w;
+        float t = (depth + nearPoint.z) / (nearPoint.z - farPoint.z);
+        return mix(nearPoint.xyz, farPoint.xyz, t);
+    }
 
     void main()
     {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+        uint clusterIndex = gl_GlobalInvocationID.x;
+        bool active = clusterIndex < CLUSTER_GRID.x * CLUSTER_GRID.y * CLUSTER_GRID.z;
+        uvec3 cluster = uvec3(clusterIndex % CLUSTER_GRID.x, (clusterIndex / CLUSTER_GRID.x) % CLUSTER_GRID.y, clusterIndex / (CLUSTER_GRID.x * CLUSTER_GRID.y));
+
+        // Depth slices grow exponentially so clusters stay roughly cube shaped
+        float depthRatio = depthRange.y / depthRange.x;
+        float sliceNear = depthRange.x * pow(depthRatio, float(cluster.z) / float(CLUSTER_GRID.z));
+        float sliceFar = depthRange.x * pow(depthRatio, float(cluster.z + 1) / float(CLUSTER_GRID.z));
+        vec2 ndcMin = vec2(cluster.xy) / vec2(CLUSTER_GRID.xy) * 2.0 - 1.0;
+        vec2 ndcMax = vec2(cluster.xy + 1) / vec2(CLUSTER_GRID.xy) * 2.0 - 1.0;
+
+        vec3 boxMin = vec3(1e30);
+        vec3 boxMax = vec3(-1e30);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            vec2 ndc = vec2((corner & 1) != 0 ? ndcMax.x : ndcMin.x, (corner & 2) != 0 ? ndcMax.y : ndcMin.y);
+            vec3 point = viewSpacePoint(ndc, (corner & 4) != 0 ? sliceFar : sliceNear);
+            boxMin = min(boxMin, point);
+            boxMax = max(boxMax, point);
+        }
 
-        vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+        uint count = 0;
+        for (int first = 0; first < lightCount; first += BATCH_SIZE)
+        {
+            int lightIndex = first + int(gl_LocalInvocationIndex);
+            if (lightIndex < lightCount)
+            {
+                vec4 light = lights[lightIndex].positionRadius;
+                batch[gl_LocalInvocationIndex] = vec4((view * vec4(light.xyz, 1.0)).xyz, light.w);
+            }
+            barrier();
+
+            int batchCount = min(BATCH_SIZE, lightCount - first);
+            for (int i = 0; i < batchCount && active; ++i)
+            {
+                vec3 offset = clamp(batch[i].xyz, boxMin, boxMax) - batch[i].xyz;
+                if (dot(offset, offset) <= batch[i].w * batch[i].w && count < MAX_LIGHTS_PER_CLUSTER)
+                {
+                    clusterLightIndices[clusterIndex * MAX_LIGHTS_PER_CLUSTER + count] = uint(first + i);
+                    ++count;
+                }
+            }
+            barrier();
+        }
 
-        vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-        vertexTextureCoordinate = textureCoordinate;
+        if (active)
+            clusterLightCounts[clusterIndex] = count;
     }
 );
 
-/* Fragment Shader Source Code*/
-const GLchar* lampFragmentShaderSource = GLSL(440,
+/* Procedural Texture Compute Shader Source Code*/
+const GLchar* proceduralComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
+    layout(rgba8, binding = 0) writeonly uniform image2D outputImage;
 
-    in vec2 vertexTextureCoordinate; // Variable to hold incoming texture coords from vertex shader
+    layout(location = 0) uniform int pattern;      // ProceduralPattern
+    layout(location = 1) uniform vec3 baseColor;
+    layout(location = 2) uniform vec3 detailColor;
+    layout(location = 3) uniform float scale;
+    layout(location = 4) uniform int size;
+
+    float hash(vec2 p)
+    {
+        return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
+    }
 
-    out vec4 fragmentColor;
+    // Value noise whose lattice wraps at period, so the texture tiles under GL_REPEAT
+    float valueNoise(vec2 p, vec2 period)
+    {
+        vec2 i = floor(p);
+        vec2 f = fract(p);
+        vec2 u = f * f * (3.0 - 2.0 * f);
+
+        float a = hash(mod(i, period));
+        float b = hash(mod(i + vec2(1.0, 0.0), period));
+        float c = hash(mod(i + vec2(0.0, 1.0), period));
+        float d = hash(mod(i + vec2(1.0, 1.0), period));
+        return mix(mix(a, b, u.x), mix(c, d, u.x), u.y);
+    }
 
-    uniform sampler2D uTexture;
+    float fbm(vec2 p, vec2 period)
+    {
+        float value = 0.0;
+        float amplitude = 0.5;
+        for (int octave = 0; octave < 5; ++octave)
+        {
+            value += amplitude * valueNoise(p, period);
+            p *= 2.0;
+            period *= 2.0;
+            amplitude *= 0.5;
+        }
+        return value;
+    }
 
     void main()
     {
-        //vec4 texColor = texture(uTexture, vertexTextureCoordinate);
-        //if (texColor.a < 0.1)
-            //discard;
-        fragmentColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);// Sends texture to GPU
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (texel.x >= size || texel.y >= size)
+            return;
+
+        vec2 p = (vec2(texel) + 0.5) / float(size) * scale;
+        vec3 color;
+
+        if (pattern == 1)
+        {
+            // Weave: neighbouring cells alternate which thread runs on top
+            vec2 cell = floor(p);
+            vec2 f = fract(p);
+            bool warpOnTop = mod(cell.x + cell.y, 2.0) < 1.0;
+            float across = warpOnTop ? f.x : f.y;
+            float along = warpOnTop ? f.y : f.x;
+            float shade = sin(across * 3.14159) * (0.75 + 0.25 * sin(along * 3.14159));
+            float fibre = fbm(p * 4.0, vec2(scale * 4.0));
+            color = mix(baseColor, detailColor, fibre * 0.35) * (0.55 + 0.45 * shade);
+        }
+        else if (pattern == 2)
+        {
+            // Grain: noise stretched along the texture's height
+            float streak = fbm(vec2(p.x * 8.0, p.y), vec2(scale * 8.0, scale));
+            float bands = smoothstep(0.3, 0.7, fract(streak * 6.0));
+            color = mix(baseColor, detailColor, bands * 0.6 + streak * 0.2);
+        }
+        else
+            color = mix(baseColor, detailColor, fbm(p, vec2(scale)));
+
+        imageStore(outputImage, texel, vec4(color, 1.0));
     }
 );
 
@@ -390,13 +1469,111 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
     }
 }
 
+//**********************************************************
+//HEAP ALLOCATION COUNTER
+//
+//Replaces the global operator new to count every allocation
+//in the process, which is how the frame loop is checked for
+//staying off the heap. The plain and the align_val_t forms are
+//replaced, array and nothrow forms end up in them. Like the
+//library's, they call the new handler until the allocation
+//succeeds and throw std::bad_alloc when there is none.
+//**********************************************************
+void* operator new(size_t size)
+{
+    gHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    for (;;)
+    {
+        if (void* pointer = malloc(size > 0 ? size : 1))
+            return pointer;
+        const std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    gHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = std::max((size_t)alignment, sizeof(void*));
+    for (;;)
+    {
+#ifdef _WIN32
+        if (void* pointer = _aligned_malloc(size > 0 ? size : 1, align))
+            return pointer;
+#else
+        void* pointer = nullptr;
+        if (posix_memalign(&pointer, align, size > 0 ? size : 1) == 0)
+            return pointer;
+#endif
+        const std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    free(pointer);
+#endif
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
 //*************************************************************************************************************************
 
 int main(int argc, char* argv[])
 {
-    if (!UInitialize(argc, argv, &gWindow))
+    gStartupTime = std::chrono::steady_clock::now();
+
+    UParseArguments(argc, argv);
+
+    // Manual shader build, needs no window
+    if (gBuildShaders)
+        return UBuildShaders() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Job system benchmark and self checks, needs no window either
+    if (gBenchmarkJobs)
+        return UBenchmarkJobs() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Scene compilation and its benchmark, no window either
+    if (gCompileSceneInput != nullptr)
+        return UCompileScene() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (gBenchmarkSceneEntities > 0)
+        return UBenchmarkScene() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (gBenchmarkSnapshot)
+        return UBenchmarkSnapshot() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // A snapshot of the built scene replaces reading and building it. Without one, a broken
+    // scene file fails before the window opens.
+    bool sceneFromSnapshot = gSnapshotPath != nullptr && ULoadSceneSnapshot(gSnapshotPath);
+    if (!sceneFromSnapshot && !ULoadScene())
         return EXIT_FAILURE;
 
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
+
+    // GL objects created from here on are owned by the registry
+    gResources = new ResourceRegistry(UReleaseGpuObjects);
+
     //***************************************************************
     //Create Individual Meshes
     //***************************************************************
@@ -414,7 +1591,6 @@ int main(int argc, char* argv[])
     //***************************************************************
 
     // Create the meshes based on identifier
-
     UCreateMesh(gMesh_plane, 0);
     UCreateMesh(gMesh_body, 1);
     UCreateMesh(gMesh_handle, 2);
@@ -426,194 +1602,141 @@ int main(int argc, char* argv[])
 
     //***************************************************************
 
+    // A snapshot taken with other meshes is replaced like a stale one
+    if (sceneFromSnapshot && !USnapshotMatchesMeshes())
+    {
+        gScene = SceneStore();
+        gSceneSnapshot.Close();
+        sceneFromSnapshot = false;
+        if (!ULoadScene())
+            return EXIT_FAILURE;
+    }
 
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
+    // Describe the scene, its shader permutations are built below. Bounds need the meshes,
+    // so a snapshot is written from here rather than when the scene file was read.
+    if (!sceneFromSnapshot)
+    {
+        UCreateScene();
+        if (gSnapshotPath != nullptr)
+        {
+            UUpdateTransforms();
+            UWriteSceneSnapshot(gSnapshotPath);
+        }
+    }
 
-    // Create the light cube shader program
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
-        return EXIT_FAILURE;
+    // Program binaries can only be cached when the driver offers at least one binary format
+    GLint programBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &programBinaryFormats);
+    gUseProgramCache = gUseProgramCache && programBinaryFormats > 0;
 
-    // Create the light cube shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource_plane, gPlaneProgramId))
-        return EXIT_FAILURE;
+    // SPIR-V modules are only used when the driver can load them
+    gUseSpirv = gUseSpirv && GLEW_ARB_gl_spirv;
+    if (gUseSpirv)
+        cout << "INFO: Loading SPIR-V shader modules from " << SHADER_DIR << " where present" << endl;
 
-    // Create the light cube shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource_candle, gCandleProgramId))
+    // Create the procedural texture compute program
+    if (!UCreateComputeProgram("procedural.comp", gProceduralProgramId))
         return EXIT_FAILURE;
 
-    // Load Textures
-    // Transparent Texture
-    const char* texFilename = "../resources/textures/transparency.png";
-    if (!UCreateTexture(texFilename, gTextureId_handle))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Point lights and the cluster grid they are binned into
+    if (!UCreateLightClusters())
         return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
 
-    //Cup Texture
-    texFilename = "../resources/textures/brown5.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_cupBody))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    // G-buffer and lighting pass of the deferred path
+    const bool deferredAvailable = UCreateDeferredRenderer();
 
-    //handle
-    texFilename = "../resources/textures/brown4.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_cupHandle))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    // Accumulation targets and composite pass of order independent transparency
+    const bool oitAvailable = UCreateWeightedBlendedOit();
 
-    //Carpet
-    texFilename = "../resources/textures/carpet.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_carpet))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Lamp shadows, the static part is rendered on the first frame and then cached
+    if (!UCreateShadowMaps())
         return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
 
-    //Coffee
-    texFilename = "../resources/textures/coffee2.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_coffee))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    // Depth only program and the overdraw counters deciding whether to use it
+    if (!UCreateDepthPrepass())
         return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
 
-    //Candle Top
-    texFilename = "../resources/textures/candleTop.png";
-    if (!UCreateTexture(texFilename, gTextureId_candleTop))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    // Saved shader files rebuild the permutations using them while the scene keeps drawing
+    UWatchShaderFiles();
 
-    //Candle 
-    texFilename = "../resources/textures/candle4.png";
-    if (!UCreateTexture(texFilename, gTextureId_candle))
+    // Submit every permutation the scene uses at once so the driver can compile them side by side.
+    // Only the default one is waited for, objects draw with it until their own is ready.
+    gParallelShaderCompile = GLEW_KHR_parallel_shader_compile != 0;
+    if (gParallelShaderCompile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    // Deferred permutations are built up front as well, so switching paths never waits.
+    for (uint32_t row = 0; row < gScene.entities.Size(); ++row)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        const unsigned int features = gScene.material[row]->features;
+        UGetShaderPermutation(features);
+        if (deferredAvailable)
+            UGetShaderPermutation(features | SHADER_DEFERRED);
+        if (oitAvailable && UIsBlended(row))
+            UGetShaderPermutation(features | SHADER_OIT);
     }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gCandleProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gCandleProgramId, "uTexture"), 0);
-
-    //Wax
-    texFilename = "../resources/textures/wax.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_wax))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
+    gFallbackShader = UWaitForShaderPermutation(0);
+    if (gFallbackShader == nullptr)
         return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-    //cart
-    texFilename = "../resources/textures/grey.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_cart))
+    if (deferredAvailable)
+        gDeferredFallbackShader = UWaitForShaderPermutation(SHADER_DEFERRED);
+    if (gDeferredFallbackShader == nullptr)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        cout << "INFO: Deferred shading is unavailable, rendering forward only" << endl;
+        gRenderPath = RENDER_FORWARD;
     }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
-
-    //cart Label
-    texFilename = "../resources/textures/mario label.png";
-    if (!UCreateTexture(texFilename, gTextureId_label))
+    if (oitAvailable)
+        gOitFallbackShader = UWaitForShaderPermutation(SHADER_OIT);
+    if (gOitFallbackShader == nullptr)
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        cout << "INFO: Order independent transparency is unavailable, sorting blended objects" << endl;
+        gTransparencyMode = TRANSPARENCY_SORTED;
     }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
 
-    //book cover
-    texFilename = "../resources/textures/book.png";
-    if (!UCreateTexture(texFilename, gTextureId_book))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
 
-    //pages
-    texFilename = "../resources/textures/pages.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_pages))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
+    // Block compressed textures need S3TC, without it images are uploaded uncompressed
+    gUseCompressedTextures = GLEW_EXT_texture_compression_s3tc != 0;
+    if (gUseCompressedTextures)
+        cout << "INFO: Textures are cached as BC1/BC3 in " << TEXTURE_CACHE_DIR << endl;
 
-    //spine
-    texFilename = "../resources/textures/spine.jpg";
-    if (!UCreateTexture(texFilename, gTextureId_spine)){
-        cout << "Failed to load texture " << texFilename << endl;
+    UCreateSamplers();
+    UCreatePlaceholderTexture(gPlaceholderTexture);
+    if (!UCreateStagingBuffer())
         return EXIT_FAILURE;
-    }
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
+
+    // Load Textures
+    // Images are decoded on worker threads and streamed into their textures over the first frames.
+    // Until then every handle points at a 1x1 placeholder so the scene renders immediately.
+    gTextureDecodePool = new ThreadPool();
+    ULoadTextures();
+
+    // Workers recording draw packets, the thread drawing the frame records a share as well
+    gJobs = new JobSystem();
+    gRecorders.resize(gJobs->Size());
 
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    //incremental rotation variable for camera movement
-    //this example doesn't currently increment, stays at 0.0
-    float incRotation = 0.0;
-
     //*************************************************************************************************************
     //RENDER LOOP
     //*************************************************************************************************************
 
-    while (!glfwWindowShouldClose(gWindow))
+    // From here on only the render thread calls GL, until it is stopped after the loop
+    if (gUseRenderThread)
+        UStartRenderThread();
+
+    FrameState mainThreadFrame;
+    while (!glfwWindowShouldClose(gWindow) && !gCloseRequested)
     {
+        // The state the render thread drew two frames ago, waits while it is still behind on the last one
+        int slot = 0;
+        if (gUseRenderThread)
+            gFreeFrameStates.Pop(slot);
+        FrameState& frame = gUseRenderThread ? gFrameStates[slot] : mainThreadFrame;
+        const std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+        glfwPollEvents();
 
         // per-frame timing
         // --------------------
@@ -624,18 +1747,25 @@ int main(int argc, char* argv[])
         // input
         // -----
         UProcessInput(gWindow);
-   
-        // Render this frame
-        // Call overloaded URender, passing in multiple meshes and rotation variable 
-        // No rotation in this example
 
-        URender(gMesh_plane, gMesh_body, gMesh_bodyTop, gMesh_handle, gMesh_handleInside, gMesh_handleOutside, gMesh_cube, gMesh_fullCyl, incRotation);
+        UCaptureFrameState(frame);
+        frame.mainThreadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
 
-
-        glfwPollEvents();
+        if (gUseRenderThread)
+            gRenderCommands.Push({ RENDER_COMMAND_FRAME, slot, 0, 0 });
+        else
+            URenderFrame(frame);
     }
 
+    if (gUseRenderThread)
+        UStopRenderThread();
+    UReportFrameTiming();
 
+    // Stop decoding before the textures it would upload into are released
+    delete gTextureDecodePool;
+    gTextureDecodePool = nullptr;
+    delete gJobs;
+    gJobs = nullptr;
 
 
     // Release mesh data
@@ -650,24 +1780,47 @@ int main(int argc, char* argv[])
 
 
     // Release shader program
-    UDestroyShaderProgram(gProgramId);
-    UDestroyShaderProgram(gLampProgramId);
-    UDestroyShaderProgram(gCandleProgramId);
-    UDestroyShaderProgram(gPlaneProgramId);
+    for (ShaderPermutation& permutation : gShaderPermutations)
+    {
+        // Builds that never finished were not handed to the registry yet
+        if (permutation.state == PERMUTATION_READY)
+            UDestroyShaderProgram(permutation.programId);
+        else if (permutation.state == PERMUTATION_BUILDING)
+            UAbandonProgramBuild(permutation.build);
+        if (permutation.reloading)
+            UAbandonProgramBuild(permutation.reloadBuild);
+    }
+    gShaderPermutations.clear();
+    for (PassProgram& pass : gPassPrograms)
+    {
+        if (pass.reloading)
+            UAbandonProgramBuild(pass.reloadBuild);
+    }
+    gPassPrograms.clear();
+    UStopWatchingShaderFiles();
+    UDestroyShaderProgram(gProceduralProgramId);
+    UDestroyLightClusters();
+    UDestroyDeferredRenderer();
+    UDestroyWeightedBlendedOit();
+    UDestroyShadowMaps();
+    UDestroyDepthPrepass();
 
     // Release texture data
-    UDestroyTexture(gTextureId_handle);
-    UDestroyTexture(gTextureId_cupBody);
-    UDestroyTexture(gTextureId_carpet);
-    UDestroyTexture(gTextureId_coffee);
-    UDestroyTexture(gTextureId_candleTop);
-    UDestroyTexture(gTextureId_candle);
-    UDestroyTexture(gTextureId_wax);
-    UDestroyTexture(gTextureId_cart);
-    UDestroyTexture(gTextureId_label);
-    UDestroyTexture(gTextureId_book);
-    UDestroyTexture(gTextureId_spine);
-    UDestroyTexture(gTextureId_pages);
+    for (ResourceHandle& texture : gSceneTextures)
+        UDestroyTexture(texture);
+    UDestroyTexture(gTexture_atlas);
+    UDestroyTexture(gPlaceholderTexture);
+    UDestroySamplers();
+    UDestroyStagingBuffer();
+
+    // Anything still registered at this point was leaked by its owner
+    UReportGpuMemory();
+    gResources->ReleaseAll([](ResourceType type, const std::string& label)
+    {
+        cout << "WARNING: Released leaked " << RESOURCE_TYPE_NAMES[type] << " resource " << label << endl;
+    });
+    delete gResources;
+    gResources = nullptr;
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -727,10 +1880,81 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     return true;
 }
 
+// Command line options
+void UParseArguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+
+        if (argument == "--anisotropy" && i + 1 < argc)
+            gAnisotropy = (float)atof(argv[++i]);
+        else if (argument == "--texture-budget" && i + 1 < argc)
+            gTextureBudgetMB = (float)atof(argv[++i]);
+        else if (argument == "--procedural")
+            gUseProceduralTextures = true;
+        else if (argument == "--procedural-size" && i + 1 < argc)
+            gProceduralSize = std::max(atoi(argv[++i]), 1);
+        else if (argument == "--build-shaders")
+            gBuildShaders = true;
+        else if (argument == "--no-spirv")
+            gUseSpirv = false;
+        else if (argument == "--no-program-cache")
+            gUseProgramCache = false;
+        else if (argument == "--no-atlas")
+            gUseTextureAtlas = false;
+        else if (argument == "--lights" && i + 1 < argc)
+            gLightCount = std::max(atoi(argv[++i]), 1);
+        else if (argument == "--bench-fillrate")
+            gBenchmarkFillRate = true;
+        else if (argument == "--bench-lights")
+            gBenchmarkLights = true;
+        else if (argument == "--deferred")
+            gRenderPath = RENDER_DEFERRED;
+        else if (argument == "--bench-deferred")
+            gBenchmarkRenderPaths = true;
+        else if (argument == "--oit")
+            gTransparencyMode = TRANSPARENCY_OIT;
+        else if (argument == "--oit-scene" && i + 1 < argc)
+            gOitTestCylinders = std::max(atoi(argv[++i]), 0);
+        else if (argument == "--extra-objects" && i + 1 < argc)
+            gExtraObjects = std::max(atoi(argv[++i]), 0);
+        else if (argument == "--bench-recording")
+            gBenchmarkRecording = true;
+        else if (argument == "--bench-jobs")
+            gBenchmarkJobs = true;
+        else if (argument == "--scene" && i + 1 < argc)
+            gScenePath = argv[++i];
+        else if (argument == "--compile-scene" && i + 2 < argc)
+        {
+            gCompileSceneInput = argv[++i];
+            gCompileSceneOutput = argv[++i];
+        }
+        else if (argument == "--bench-scene" && i + 1 < argc)
+            gBenchmarkSceneEntities = std::max(atoi(argv[++i]), 1);
+        else if (argument == "--snapshot" && i + 1 < argc)
+            gSnapshotPath = argv[++i];
+        else if (argument == "--bench-snapshot")
+            gBenchmarkSnapshot = true;
+        else if (argument == "--no-render-thread")
+            gUseRenderThread = false;
+        else if (argument == "--prepass" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            gDepthPrepassMode = mode == "on" ? PREPASS_ON : mode == "off" ? PREPASS_OFF : PREPASS_AUTO;
+        }
+        else
+            cout << "Unknown argument " << argument << endl;
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    if (gRenderThread.joinable())
+        gRenderCommands.Push({ RENDER_COMMAND_RESIZE, 0, width, height });
+    else
+        glViewport(0, 0, width, height);
 }
 
 
@@ -787,6 +2011,15 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 
 void UPerspectiveSwitch(GLFWwindow* window, int key, int scancode, int action, int mod)
 {
+    // Keys acting on render state are handled by whichever thread owns the context
+    if (action == GLFW_PRESS)
+    {
+        if (gRenderThread.joinable())
+            gRenderCommands.Push({ RENDER_COMMAND_KEY, key, 0, 0 });
+        else
+            UHandleRenderKey(key);
+    }
+
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
         if (isOrtho == true) {
             isOrtho = false;
@@ -800,2719 +2033,5821 @@ void UPerspectiveSwitch(GLFWwindow* window, int key, int scancode, int action, i
 
 
 
+// M reports GPU memory, O overdraw, R frame time, F5 reloads every texture from disk, G switches forward and deferred
+// shading, T sorted and order independent transparency
+void UHandleRenderKey(int key)
+{
+    if (key == GLFW_KEY_M)
+        UReportGpuMemory();
+    if (key == GLFW_KEY_O)
+        UReportOverdraw();
+    if (key == GLFW_KEY_R)
+        UReportFrameTiming();
+    if (key == GLFW_KEY_G && gDeferredFallbackShader != nullptr)
+    {
+        gRenderPath = gRenderPath == RENDER_FORWARD ? RENDER_DEFERRED : RENDER_FORWARD;
+        cout << "INFO: " << (gRenderPath == RENDER_FORWARD ? "Forward" : "Deferred") << " shading" << endl;
+    }
+    if (key == GLFW_KEY_T && gOitFallbackShader != nullptr)
+    {
+        gTransparencyMode = gTransparencyMode == TRANSPARENCY_SORTED ? TRANSPARENCY_OIT : TRANSPARENCY_SORTED;
+        cout << "INFO: " << (gTransparencyMode == TRANSPARENCY_SORTED ? "Sorted" : "Weighted blended") << " transparency" << endl;
+    }
+    if (key == GLFW_KEY_F5 && gTexturesPending == 0 && gStreamingLoads == 0)
+        ULoadTextures();
+}
+
+
+
 //***********************************************************************************************************************
-//RENDER FUNCTION
+//SCENE DESCRIPTION
 //
-//Overloaded URender function passing multiple meshes
-//Used to render a single frame
+//Every object of the scene with its mesh, texture, material and transform, in draw order, plus
+//the textures, materials and lights they use. Read from a scene file so the scene changes without
+//a rebuild; the desk scene below is the one used without --scene. Meshes are the procedural ones
+//created at startup, referenced by name (see USceneMesh). Rotations are in radians.
 //***********************************************************************************************************************
+const char* const defaultSceneSource = R"({
+    "textures": [
+        { "name": "transparency", "path": "../resources/textures/transparency.png" },
+        { "name": "cupBody", "path": "../resources/textures/brown5.jpg" },
+        { "name": "cupHandle", "path": "../resources/textures/brown4.jpg" },
+        { "name": "carpet", "path": "../resources/textures/carpet.jpg",
+          "procedural": { "pattern": "weave", "base": [0.42, 0.10, 0.09], "detail": [0.78, 0.58, 0.36], "scale": 48.0, "generate": true } },
+        { "name": "candle", "path": "../resources/textures/candle4.png",
+          "procedural": { "pattern": "grain", "base": [0.90, 0.86, 0.74], "detail": [0.80, 0.72, 0.58], "scale": 4.0, "generate": true } },
+        { "name": "cart", "path": "../resources/textures/grey.jpg" },
+        { "name": "book", "path": "../resources/textures/book.png" },
+        { "name": "coffee", "path": "../resources/textures/coffee2.jpg", "atlas": true },
+        { "name": "candleTop", "path": "../resources/textures/candleTop.png", "atlas": true },
+        { "name": "wax", "path": "../resources/textures/wax.jpg", "atlas": true,
+          "procedural": { "pattern": "noise", "base": [0.95, 0.92, 0.82], "detail": [0.82, 0.76, 0.62], "scale": 8.0, "generate": true } },
+        { "name": "label", "path": "../resources/textures/mario label.png", "atlas": true },
+        { "name": "pages", "path": "../resources/textures/pages.jpg", "atlas": true },
+        { "name": "spine", "path": "../resources/textures/spine.jpg", "atlas": true }
+    ],
+    "materials": [
+        { "name": "glossy", "ambient": 1.0, "specular": 3.0, "highlight": 16.0, "alpha": 1.0 },
+        { "name": "matte", "ambient": 0.5, "specular": 0.5, "highlight": 16.0, "alpha": 1.0 },
+        { "name": "cutout", "ambient": 0.5, "specular": 0.5, "highlight": 16.0, "alpha": 1.0, "alphaTest": true },
+        { "name": "candle", "ambient": 0.5, "specular": 0.5, "highlight": 16.0, "alpha": 0.1 },
+        { "name": "lamp", "ambient": 0.0, "specular": 0.0, "highlight": 1.0, "alpha": 1.0, "unlit": true }
+    ],
+    "lights": [
+        { "position": [-3.5, 1.5, 0.0], "color": [1.0, 1.0, 0.9] }
+    ],
+    "entities": [
+        { "name": "Plane", "mesh": "plane", "texture": "carpet", "material": "matte",
+          "position": [-3.0, -2.25, 0.0], "scale": [15.0, 15.0, 15.0] },
+        { "name": "Lamp", "mesh": "cube", "material": "lamp",
+          "position": [-3.5, 1.5, 0.0], "scale": [0.5, 0.5, 0.5] },
+        { "name": "Book Pages", "mesh": "cube", "texture": "pages", "material": "matte",
+          "position": [-3.0, -2.0, 5.0], "rotate": [[0.25, 0, 1, 0]], "scale": [2.0, 0.5, 3.0] },
+        { "name": "Book Cover", "mesh": "plane", "texture": "book", "material": "cutout",
+          "position": [-3.3, -1.746, 3.55], "rotate": [[1.8208, 0, 1, 0]], "scale": [3.15, 0.5, 2.15] },
+        { "name": "Book Cover 2", "mesh": "plane", "texture": "book", "material": "cutout",
+          "position": [-3.3, -2.24, 3.55], "rotate": [[1.8208, 0, 1, 0]], "scale": [3.15, 0.5, 2.15] },
+        { "name": "Book Spine", "mesh": "plane", "texture": "spine", "material": "matte",
+          "position": [-4.35, -2.0, 3.8], "rotate": [[0.25, 0, 1, 0], [1.5708, 0, 0, 1]], "scale": [0.5, 0.5, 3.05] },
+        { "name": "Cartridge Body", "mesh": "cube", "texture": "cart", "material": "matte",
+          "position": [-1.7, -2.13, 2.5], "rotate": [[-0.6, 0, 0, 1], [-1.575, 1, 0, 0], [1.5708, 0, 1, 0]], "scale": [0.25, 1.0, 1.2] },
+        { "name": "Cartridge Inside Wall", "mesh": "plane", "texture": "cart", "material": "matte",
+          "position": [-2.15, -1.825, 2.85], "rotate": [[-0.6, 0, 0, 1], [-1.575, 1, 0, 0], [1.5708, 0, 1, 0]], "scale": [0.25, 1.0, 1.2] },
+        { "name": "Cartridge Chip", "mesh": "plane", "texture": "cupBody", "material": "matte",
+          "position": [-2.15, -1.825, 2.85], "rotate": [[-0.6, 0, 0, 1], [1.5708, 0, 1, 0]], "scale": [0.25, 1.0, 1.2] },
+        { "name": "Cartridge Label", "mesh": "plane", "texture": "label", "material": "cutout",
+          "position": [-2.13, -1.66, 2.5], "rotate": [[-0.6, 0, 0, 1], [1.5708, 0, 1, 0]], "scale": [0.80, 0.85, 0.90] },
+        { "name": "Cartridge Side 1", "mesh": "fullCyl", "texture": "cart", "material": "matte",
+          "position": [-1.7, -2.13, 2.0005], "scale": [0.25, 0.25, 0.999] },
+        { "name": "Cartridge Side 2", "mesh": "fullCyl", "texture": "cart", "material": "matte",
+          "position": [-2.68, -1.462, 2.0005], "rotate": [[-0.005, 1, 0, 0]], "scale": [0.25, 0.25, 0.999] },
+        { "name": "Coffee Cup Body", "mesh": "body", "texture": "cupBody", "material": "glossy",
+          "position": [0.0, -0.24, 0.0], "rotate": [[1.5708, 1, 0, 0]], "scale": [2.0, 2.0, 2.0] },
+        { "name": "Candle Body", "mesh": "body", "texture": "candle", "material": "candle",
+          "position": [-5.5, -0.24, 0.0], "rotate": [[1.5708, 1, 0, 0]], "scale": [2.0, 2.0, 2.0] },
+        { "name": "Candle Inside", "mesh": "body", "texture": "wax", "material": "glossy",
+          "position": [-5.5, -0.5, 0.0], "rotate": [[1.5708, 1, 0, 0]], "scale": [1.8, 1.5, 1.8] },
+        { "name": "Coffee Cup Top", "mesh": "bodyTop", "texture": "coffee", "material": "glossy",
+          "position": [0.0, -0.5, 0.0], "rotate": [[1.5708, 1, 0, 0]], "scale": [2.0, 2.0, 2.0] },
+        { "name": "Candle Top", "mesh": "bodyTop", "texture": "candleTop", "material": "glossy",
+          "position": [-5.5, -0.5, 0.0], "rotate": [[1.5708, 1, 0, 0]], "scale": [2.0, 2.0, 2.0] },
+
+        { "name": "Coffee Cup Handle Mark", "mesh": "handle", "texture": "cupHandle", "material": "glossy", "stencil": "mark",
+          "position": [0.9, -1.25, 0.0], "rotate": [[0.122173, 0, -1, 0]], "scale": [1.5, 1.5, 0.25] },
+        { "name": "Coffee Cup Handle Inside", "mesh": "handle", "indexMesh": "handleInside", "texture": "cupHandle", "material": "glossy", "stencil": "cut",
+          "position": [0.9, -1.25, 0.0], "rotate": [[0.122173, 0, -1, 0]], "scale": [1.0, 1.0, 0.25] },
+        { "name": "Coffee Cup Handle", "mesh": "handle", "texture": "cupHandle", "material": "glossy", "stencil": "masked",
+          "position": [0.9, -1.25, 0.0], "rotate": [[0.122173, 0, -1, 0]], "scale": [1.5, 1.5, 0.25] },
+        { "name": "Coffee Cup Handle Outside", "mesh": "handleOutside", "texture": "cupHandle", "material": "glossy",
+          "position": [0.9, -1.25, 0.0], "rotate": [[0.122173, 0, -1, 0]], "scale": [1.5, 1.5, 0.25] }
+    ]
+}
+)";
 
-
-void URender(GLMesh& mesh_plane, GLMesh& mesh_body, GLMesh& mesh_bodyTop, GLMesh& mesh_handle, GLMesh& mesh_handleInside, GLMesh& mesh_handleOutside, GLMesh& mesh_cube, GLMesh& mesh_fullCyl, float incRotation)
+// Reads a scene file, compiled scenes are told apart from JSON by their magic number
+bool UReadScene(const char* path, SceneDescription& scene, std::string& error)
 {
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-    
-
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error = "cannot open file";
+        return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(bytes.data());
+    if (IsSceneBinary(data, bytes.size()))
+        return ReadSceneBinary(data, bytes.size(), scene, error);
+    return ParseSceneJson(bytes.data(), bytes.size(), scene, error);
+}
 
+// Reads the scene into gSceneDescription and takes the lamp from its first light
+bool ULoadScene()
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const char* source = gScenePath != nullptr ? gScenePath : "embedded desk scene";
 
-    //**********************************************************************
-    //Plane
-    //**********************************************************************
+    std::string error;
+    const bool read = gScenePath != nullptr ? UReadScene(gScenePath, gSceneDescription, error)
+                                            : ParseSceneJson(defaultSceneSource, strlen(defaultSceneSource), gSceneDescription, error);
+    if (!read)
+    {
+        cout << "ERROR: Scene " << source << ": " << error << endl;
+        return false;
+    }
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    //glDisable(GL_CULL_FACE);
+    for (uint32_t mesh : gSceneDescription.meshes)
+    {
+        if (USceneMesh(gSceneDescription.String(mesh)) == nullptr)
+        {
+            cout << "ERROR: Scene " << source << " uses the unknown mesh " << gSceneDescription.String(mesh) << endl;
+            return false;
+        }
+    }
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+    UUseSceneLamp();
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cout << "INFO: Scene " << source << ": " << gSceneDescription.entities.size() << " entities, " << gSceneDescription.textures.size()
+         << " textures, " << gSceneDescription.lights.size() << " lights read in " << ms << " ms" << endl;
+    return true;
+}
 
-    //Set up scaling and rotation for plane
-    glm::mat4 scale = glm::scale(glm::vec3(15.0f, 15.0f, 15.0f));
-    glm::mat4 XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    glm::mat4 YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    glm::mat4 translation = glm::translate(glm::vec3(-3.0f, -2.25f, 0.0f));
-    glm::mat4 model = translation * XRotation * scale;       
+// The first light of the scene is the lamp, it keeps its defaults when the scene has no lights
+void UUseSceneLamp()
+{
+    if (!gSceneDescription.lights.empty())
+    {
+        gLightPosition = glm::make_vec3(gSceneDescription.lights[0].position);
+        gLightColor = glm::make_vec3(gSceneDescription.lights[0].color);
+    }
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+// Procedural mesh a scene file refers to by name, nullptr for unknown names
+const GLMesh* USceneMesh(const char* name)
+{
+    for (const SceneMesh& mesh : SCENE_MESHES)
+    {
+        if (strcmp(mesh.name, name) == 0)
+            return mesh.mesh;
+    }
+    return nullptr;
+}
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Handle of the scene texture with the name, nullptr draws without a texture when the scene has none
+ResourceHandle* USceneTexture(const char* name)
+{
+    for (size_t i = 0; i < gSceneDescription.textures.size(); ++i)
+    {
+        if (strcmp(gSceneDescription.String(gSceneDescription.textures[i].name), name) == 0)
+            return &gSceneTextures[i];
+    }
+    return nullptr;
+}
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+// Writes the compiled form of a scene file, it loads without parsing
+bool UCompileScene()
+{
+    SceneDescription scene;
+    std::string error;
+    if (!UReadScene(gCompileSceneInput, scene, error))
+    {
+        cout << "ERROR: Scene " << gCompileSceneInput << ": " << error << endl;
+        return false;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    std::vector<unsigned char> bytes;
+    WriteSceneBinary(scene, bytes);
+    std::ofstream file(gCompileSceneOutput, std::ios::binary | std::ios::trunc);
+    if (!file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size()))
+    {
+        cout << "ERROR: Could not write " << gCompileSceneOutput << endl;
+        return false;
+    }
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");    
-    GLint lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");    
-    GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+    cout << "INFO: Compiled " << gCompileSceneInput << " into " << gCompileSceneOutput << ", " << scene.entities.size()
+         << " entities in " << bytes.size() / 1024 << " KB" << endl;
+    return true;
+}
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);    
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);    
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+// Creates the materials and texture handles of the loaded scene. Textures only get their
+// handles here, ULoadTextures fills them.
+void UCreateSceneMaterials()
+{
+    gSceneTextures.assign(gSceneDescription.textures.size(), ResourceHandle());
+    gSceneMaterials.clear();
+    for (const SceneMaterial& material : gSceneDescription.materials)
+    {
+        const unsigned int features = ((material.flags & SCENE_MATERIAL_ALPHA_TEST) ? SHADER_ALPHA_TEST : 0) |
+                                      ((material.flags & SCENE_MATERIAL_UNLIT) ? SHADER_UNLIT : 0);
+        gSceneMaterials.push_back({ features, material.ambientStrength, material.specularIntensity, material.highlightSize, material.alpha });
+    }
+}
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+// Creates the entities of the loaded scene followed by the generated test objects
+void UCreateScene()
+{
+    const SceneDescription& scene = gSceneDescription;
+    UCreateSceneMaterials();
 
-    
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_carpet);
+    for (const SceneEntity& entity : scene.entities)
+    {
+        EntityDescription object = { scene.String(entity.name), USceneMesh(scene.String(scene.meshes[entity.mesh])),
+                                     (GLuint)USceneMesh(scene.String(scene.meshes[entity.indexMesh]))->nIndices,
+                                     entity.texture != SCENE_NONE ? &gSceneTextures[entity.texture] : nullptr,
+                                     &gSceneMaterials[entity.material], (StencilPass)entity.stencil, glm::make_mat4(entity.model) };
+        object.dynamic = entity.dynamic != 0;
+        UCreateEntity(object);
+    }
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+    // Transparency test: translucent cylinders crossing each other above the carpet, which no
+    // order of whole objects draws correctly. Glass first, then wax, so each half is one batch.
+    std::mt19937 random(4321);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < gOitTestCylinders; ++i)
+    {
+        const bool glass = i < gOitTestCylinders / 2;
+        const glm::vec3 position(-4.0f + 5.0f * unit(random), -1.2f + 1.5f * unit(random), -5.0f + 3.0f * unit(random));
+        const glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) - 0.5f + 0.001f);
+        const glm::mat4 model = glm::translate(position) * glm::rotate(6.2832f * unit(random), axis) * glm::scale(glm::vec3(0.3f, 0.3f, 2.5f));
+        UCreateEntity({ "Translucent Cylinder", &gMesh_fullCyl, gMesh_fullCyl.nIndices, USceneTexture(glass ? "wax" : "candle"),
+                        glass ? &MATERIAL_GLASS : &MATERIAL_WAX, STENCIL_OFF, model });
+    }
 
+    // Recording stress test: small boxes and cylinders lying around on the carpet
+    const glm::vec3 yAxis(0.0f, 1.0f, 0.0f);
+    std::mt19937 clutterRandom(2468);
+    for (int i = 0; i < gExtraObjects; ++i)
+    {
+        const bool box = i % 2 == 0;
+        const float size = 0.05f + 0.15f * unit(clutterRandom);
+        const glm::vec3 position(-10.5f + 15.0f * unit(clutterRandom), -2.25f + size * 0.5f, -7.5f + 15.0f * unit(clutterRandom));
+        const glm::mat4 model = glm::translate(position) * glm::rotate(6.2832f * unit(clutterRandom), yAxis) * glm::scale(glm::vec3(size));
+        UCreateEntity({ "Clutter", box ? &gMesh_cube : &gMesh_fullCyl, box ? gMesh_cube.nIndices : gMesh_fullCyl.nIndices,
+                        USceneTexture(box ? "pages" : "cart"), &MATERIAL_MATTE, STENCIL_OFF, model });
+    }
+}
 
-    //**********************************************************************
-    //Lamp 
-    //**********************************************************************
-    glUseProgram(gLampProgramId);
+// Moves the stencil state from the current pass to the next one
+void UApplyStencilPass(StencilPass& current, StencilPass next)
+{
+    if (next == current)
+        return;
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_cube.vao);
+    if (current == STENCIL_OFF)
+    {
+        // whole stencil=0
+        glEnable(GL_STENCIL_TEST);
+        glStencilMask(0xFF);
+        glClearStencil(0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+    }
 
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
+    // Marking and cutting only touch the stencil, turn off color,depth
+    const GLboolean writeColor = next == STENCIL_OFF || next == STENCIL_MASKED ? GL_TRUE : GL_FALSE;
+    glColorMask(writeColor, writeColor, writeColor, writeColor);
+    glDepthMask(writeColor);
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+    switch (next)
+    {
+    case STENCIL_OFF:
+        glDisable(GL_STENCIL_TEST);
+        break;
+    case STENCIL_MARK:
+        glStencilFunc(GL_ALWAYS, 1, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        break;
+    case STENCIL_CUT:
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        break;
+    case STENCIL_MASKED:
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        break;
+    }
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    current = next;
+}
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
+//***********************************************************************************************************************
+//RENDER FUNCTION
+//
+//Draws every scene object with the shader permutation its material needs
+//Used to render a single frame
+//***********************************************************************************************************************
 
-    // Draws the cube
-    glDrawElements(GL_TRIANGLES, mesh_cube.nIndices, GL_UNSIGNED_SHORT, NULL);
 
-    //**********************************************************************
-    //Book Pages
-    //**********************************************************************
+void URender(const FrameState& frame)
+{
+    // Texture binds made outside of URender are unknown to UBindTexture
+    gBoundTexture = 0;
 
-    // Wireframe Mode (helps with translation & scaling)
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+    // Clear the frame and z buffers
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(2.0f, .5f, 3.0f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.25f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-3.0f, -2.0f, 5.0f));
-    model = translation * XRotation * YRotation * scale;
+    UDrawFrame(gRenderPath, frame.view, frame.projection, frame.viewPosition);
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+}
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+//***********************************************************************************************************************
+//RENDER THREAD
+//
+//The main thread handles window events, input and the camera, and fills a FrameState for every frame. The render thread
+//owns the GL context and draws the states it is sent through a lock-free command queue, so slow GL calls no longer delay
+//input. With two states the main thread prepares frame N + 1 while frame N is being submitted; it waits for a free state
+//when it gets further ahead than that. --no-render-thread draws every frame on the main thread as before.
+//***********************************************************************************************************************
+void UStartRenderThread()
+{
+    for (int i = 0; i < FRAME_STATE_COUNT; ++i)
+        gFreeFrameStates.Push(i);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+    // A context can only be current on one thread at a time
+    glfwMakeContextCurrent(nullptr);
+    gRenderThread = std::thread(URenderThreadMain);
+    cout << "INFO: Rendering on a separate thread" << endl;
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Lets the render thread finish the frames already queued, then takes the context back
+void UStopRenderThread()
+{
+    gRenderCommands.Push({ RENDER_COMMAND_QUIT, 0, 0, 0 });
+    gRenderThread.join();
+    glfwMakeContextCurrent(gWindow);
+}
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+void URenderThreadMain()
+{
+    glfwMakeContextCurrent(gWindow);
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+    for (;;)
+    {
+        RenderCommand command;
+        gRenderCommands.Pop(command);
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        switch (command.type)
+        {
+        case RENDER_COMMAND_FRAME:
+            URenderFrame(gFrameStates[command.value]);
+            gFreeFrameStates.Push(command.value);
+            break;
+        case RENDER_COMMAND_KEY:
+            UHandleRenderKey(command.value);
+            break;
+        case RENDER_COMMAND_RESIZE:
+            glViewport(0, 0, command.width, command.height);
+            break;
+        case RENDER_COMMAND_QUIT:
+            glfwMakeContextCurrent(nullptr);
+            return;
+        }
+    }
+}
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+// Camera and timing of the coming frame, main thread
+void UCaptureFrameState(FrameState& frame)
+{
+    UGetCameraMatrices(frame.view, frame.projection, frame.viewPosition);
+    frame.cameraPosition = gCamera.Position;
+    frame.zoom = gCamera.Zoom;
+    frame.deltaTime = gDeltaTime;
+}
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_cube.vao);
+// All GL work of one frame, on whichever thread owns the context
+void URenderFrame(const FrameState& frame)
+{
+    const std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    gRenderState = &frame;
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_pages);
+    // Workers are idle between frames, so the arenas of the frame state being reused can be rewound
+    gFrameArenas.BeginFrame(gFrameIndex);
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_cube.nIndices, GL_UNSIGNED_SHORT, NULL);
+    // Stream decoded textures into GPU memory within this frame's budget
+    UUploadPendingTextures();
 
-    //**********************************************************************
-    //Book Cover
-    //**********************************************************************
+    // Rebuild permutations whose shader files were saved and pick up the ones that finished building
+    UPollShaderChanges();
+    UPollShaderPermutations();
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // Render this frame
+    URender(frame);
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+    // Stream in or evict mip levels based on what this frame's draws needed
+    UUpdateTextureStreaming();
+    ++gFrameIndex;
+
+    if (!gFirstFrameReported)
+    {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - gStartupTime;
+        cout << "INFO: Time to first frame: " << elapsed.count() << " ms" << endl;
+        gFirstFrameReported = true;
+    }
+    else if (!gFirstHitchReported && gFrameIndex > 2 && frame.deltaTime > HITCH_THRESHOLD)
+    {
+        // deltaTime measured the previous frame, the first one is covered above
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - gStartupTime;
+        cout << "INFO: First hitch: frame " << gFrameIndex - 2 << " took " << frame.deltaTime * 1000.0f << " ms, "
+             << elapsed.count() << " ms after startup" << endl;
+        gFirstHitchReported = true;
+    }
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(3.15f, .5f, 2.15f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.8208f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-3.3f, -1.746f, 3.55f));
-    model = translation * XRotation * YRotation * scale;
+    // Each benchmark runs once, the main thread closes the window when it sees the request
+    if (gBenchmarkFillRate && gTexturesPending == 0)
+    {
+        UBenchmarkFillRate();
+        gBenchmarkFillRate = false;
+        gCloseRequested = true;
+    }
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+    if (gBenchmarkLights && gTexturesPending == 0 && gShadersReadyReported)
+    {
+        UBenchmarkLights();
+        gBenchmarkLights = false;
+        gCloseRequested = true;
+    }
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    if (gBenchmarkRenderPaths && gTexturesPending == 0 && gShadersReadyReported && gDeferredFallbackShader != nullptr)
+    {
+        UBenchmarkRenderPaths();
+        gBenchmarkRenderPaths = false;
+        gCloseRequested = true;
+    }
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+    if (gBenchmarkRecording)
+    {
+        UBenchmarkRecording();
+        gBenchmarkRecording = false;
+        gCloseRequested = true;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    gRenderState = nullptr;
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+    // The interval between two finished frames is the frame time; whatever main and render thread work
+    // does not fit into it ran side by side
+    const std::chrono::steady_clock::time_point renderEnd = std::chrono::steady_clock::now();
+    const uint64_t allocations = gHeapAllocations.load(std::memory_order_relaxed);
+    if (gFrameIndex > 1)
+    {
+        gFrameTiming.frames++;
+        gFrameTiming.mainMs += frame.mainThreadMs;
+        gFrameTiming.renderMs += std::chrono::duration<double, std::milli>(renderEnd - renderStart).count();
+        gFrameTiming.frameMs += std::chrono::duration<double, std::milli>(renderEnd - gFrameTiming.lastFrameEnd).count();
+        gFrameTiming.allocations += allocations - gFrameTiming.lastFrameAllocations;
+    }
+    gFrameTiming.lastFrameEnd = renderEnd;
+    gFrameTiming.lastFrameAllocations = allocations;
+}
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+// Average frame time since the last report and how much of the main thread's work overlapped rendering
+void UReportFrameTiming()
+{
+    FrameTiming& timing = gFrameTiming;
+    if (timing.frames == 0)
+        return;
+
+    const double frameMs = timing.frameMs / timing.frames;
+    const double mainMs = timing.mainMs / timing.frames;
+    const double renderMs = timing.renderMs / timing.frames;
+    const double overlapMs = std::min(std::max(mainMs + renderMs - frameMs, 0.0), mainMs);
+
+    cout << "INFO: Frame time " << frameMs << " ms over " << timing.frames << " frames: main thread " << mainMs
+         << " ms, rendering " << renderMs << " ms (including the wait in swap), overlapped " << overlapMs << " ms";
+    if (mainMs > 0.0)
+        cout << " (" << (int)(overlapMs / mainMs * 100.0 + 0.5) << "% of the main thread's work)";
+    cout << endl;
+
+    // Zero once textures and shaders settled, anything else means a per-frame container escaped the arenas
+    cout << "INFO: " << (double)timing.allocations / timing.frames << " heap allocations per frame, "
+         << gFrameArenas.Capacity() / 1024 << " KB in frame arenas" << endl;
+
+    timing.frames = 0;
+    timing.mainMs = 0.0;
+    timing.renderMs = 0.0;
+    timing.frameMs = 0.0;
+    timing.allocations = 0;
+}
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+//***************************************************************************
+//Set up camera perspective
+//****************************************************************************
+void UGetCameraMatrices(glm::mat4& view, glm::mat4& projection, glm::vec3& viewPosition)
+{
+    //Perspective view settings
+    if (isOrtho == false) {
+        // camera/view transformation
+        view = gCamera.GetViewMatrix();
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+        // Creates a perspective projection
+        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
+        viewPosition = gCamera.Position;
+    }
+    //Orthographic view settings
+    else {
+        viewPosition = glm::vec3(0, -0.49, 5);
+        view = glm::lookAt(
+            viewPosition, //Camera at this location in space
+            glm::vec3(0, -.5, 0), //Camera looking at this location
+            glm::vec3(0, 1, 0) // Head up or down 
+            );
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+        view = view * glm::translate(glm::vec3(3.0f, 0.0f, 0.0f));
+        viewPosition -= glm::vec3(3.0f, 0.0f, 0.0f);
+        projection = glm::ortho(-10.0f, 10.0f, -7.5f, 7.5f, LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
+    }
+}
 
+// Draws the scene objects in queue, lights have to be binned for the same camera first.
+// pathFeatures are added to every material's features, SHADER_DEFERRED fills the G-buffer.
+// After UDrawDepthPrepass, objects it drew only shade the fragments that ended up visible.
+void UDrawScene(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, unsigned int pathFeatures, bool depthPrepass,
+                const FrameVector<DrawKey>& queue)
+{
     // bind textures on corresponding texture units
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_book);
-
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
 
-    //**********************************************************************
-    //Book Cover
-    //**********************************************************************
+    const ShaderPermutation* shader = nullptr;
+    const Material* material = nullptr;
+    StencilPass stencil = STENCIL_OFF;
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    for (const DrawKey& draw : queue)
+    {
+        const uint32_t row = UDrawPacket(draw.index).object;
+        const ShaderPermutation* objectShader = UGetShaderPermutation(gScene.material[row]->features | pathFeatures);
+        if (objectShader == nullptr)
+            objectShader = (pathFeatures & SHADER_DEFERRED) ? gDeferredFallbackShader : gFallbackShader;
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+        // Objects sharing a permutation share its program, frame uniforms only change on a switch
+        if (objectShader != shader)
+        {
+            shader = objectShader;
+            glUseProgram(shader->programId);
+            UApplyFrameUniforms(view, projection, viewPosition);
+            material = nullptr;
+        }
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(3.15f, .5f, 2.15f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.8208f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-3.3f, -2.24f, 3.55f));
-    model = translation * XRotation * YRotation * scale;
+        if (gScene.material[row] != material)
+        {
+            material = gScene.material[row];
+            UApplyMaterial(*material);
+        }
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+        UApplyStencilPass(stencil, gScene.stencil[row]);
+        if (depthPrepass)
+        {
+            // Stencil passes set their own depth writes, the others write depth unless the prepass did.
+            // Until a rebuilt program and the prepass agree on the vertex stage again, depths can
+            // differ in the last bit and only GL_LEQUAL keeps the object on screen.
+            const bool prepassed = UInDepthPrepass(row);
+            const bool sameVertexStage = shader->build.vertexKey == gDepthShader->build.vertexKey;
+            glDepthFunc(!prepassed ? GL_LESS : sameVertexStage ? GL_EQUAL : GL_LEQUAL);
+            if (gScene.stencil[row] == STENCIL_OFF)
+                glDepthMask(prepassed ? GL_FALSE : GL_TRUE);
+        }
+        glUniformMatrix4fv(UNIFORM_MODEL, 1, GL_FALSE, glm::value_ptr(gScene.model[row]));
+        glUniformMatrix3fv(UNIFORM_NORMAL_MATRIX, 1, GL_FALSE, glm::value_ptr(gScene.normalMatrix[row]));
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+        if (gScene.texture[row] != nullptr)
+            UBindTexture(*gScene.texture[row]);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+        // Activate the VBOs contained within the mesh's VAO
+        glBindVertexArray(gScene.mesh[row]->vao);
+        glDrawElements(GL_TRIANGLES, gScene.indexCount[row], GL_UNSIGNED_SHORT, NULL);
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    UApplyStencilPass(stencil, STENCIL_OFF);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+    // Deactivate the Vertex Array Object
+    glBindVertexArray(0);
+}
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+//***************************************************************************************
+//CREATE MESH FUNCTION
+//
+//Overloaded the UCreateMesh function passing in mesh choice to create different meshes
+//***************************************************************************************
+void UCreateMesh(GLMesh& mesh, int meshChoice)
+{
+    if (meshChoice == 0) {
+        //**********************************************************************
+        //Plane Data
+        //**********************************************************************
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+        // Position and Color data
+        GLfloat verts[] = {
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_book);
+            // Square Plane
+            // Vertex Positions                  //Normals
+             0.5f,  0.0f, 0.5f,    1.0f, 1.0f,   0.0f, 1.0f, 0.0f,             // Top Right Corner 0
+            -0.5f,  0.0f, 0.5f,    1.0f, 0.0f,   0.0f, 1.0f, 0.0f,             // Top Left Corner 1
+             0.5f,  0.0f, -0.5f,   0.0f, 1.0f,   0.0f, 1.0f, 0.0f,              // Bottom Right Corner 2
+            -0.5f,  0.0f, -0.5f,   0.0f, 0.0f,   0.0f, 1.0f, 0.0f,                 // Bottom Left Corner 3            
+        };
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+        // Index data to share position data
+        GLushort indices[] = {            
+            0, 1, 2,
+            2, 3, 1           
+        };
 
-    //**********************************************************************
-    //Book Spine
-    //**********************************************************************
+        const GLuint floatsPerTexture = 2;
+        const GLuint floatsPerVertex = 3;
+        const GLuint floatsPerNormal = 3;
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+        glBindVertexArray(mesh.vao);
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(.5f, .5f, 3.05f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.25f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(1.5708f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-4.35f, -2.0f, 3.8f));
-    model = translation * XRotation *  YRotation * ZRotation * scale;
+        // Create 2 buffers: first one for the vertex data; second one for the indices
+        glGenBuffers(2, mesh.vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+        // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
+        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+        // Create Vertex Attribute Pointers
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+        glEnableVertexAttribArray(1);
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+        glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerTexture)));
+        glEnableVertexAttribArray(2);
+    }
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+    else if (meshChoice == 1)  {
+        //**********************************************************************
+        //Coffee Cup Body
+        //**********************************************************************
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        // Position and Color data
+        GLfloat verts[] = {
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+            //Top Circle
+            // Vertex Positions    
+            // Top Right Quarter
+             0.0f,  0.5f, 0.0f,      0.0f,  1.0f,     0.0f, 1.0f, -0.5f,                    // Top Mid Circle Vertex 0
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+             0.1f,  0.49f, 0.0f,     0.03f, 1.0f,     0.2f, 0.98f, -0.5f,                   // 1
+             0.2f,  0.45f, 0.0f,     0.06f, 1.0f,      0.4f, 0.92f, -0.5f,                 // 2
+             0.3f,  0.4f, 0.0f,      0.12f, 1.0f,      0.6f, 0.8f, -0.5f,                   // 3
+             0.4f,  0.3f, 0.0f,      0.15f, 1.0f,      0.8f, 0.6f, -0.5f,                  // 4
+             0.46f,  0.2f, 0.0f,     0.18f, 1.0f,       0.90f, 0.43f, -0.5f,                // 5
+             0.49f,  0.1f, 0.0f,     0.21f, 1.0f,      0.98f, 0.2f, -0.5f,                   // 6
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_spine);
+             0.5f,  0.0f, 0.0f,      0.25f, 1.0f,      1.0f, 0.0f, -0.5f,                  // 7 Right Mid Circle Vertex
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+             // Bottom Right Quarter
+             0.49f,  -0.1f, 0.0f,    0.28f, 1.0f,      0.98f, -0.2f, -0.5f,                 // 8
+             0.45f,  -0.2f, 0.0f,    0.31f, 1.0f,      0.92f, -0.4f, -0.5f,                 // 9
+             0.4f,  -0.3f, 0.0f,     0.34f, 1.0f,      0.8f, -0.6f, -0.5f,                  // 10
+             0.3f,  -0.4f, 0.0f,     0.37f, 1.0f,      0.6f, -0.8f, -0.5f,                  // 11
+             0.2f,  -0.46f, 0.0f,    0.40f, 1.0f,      0.4f, -0.92f, -0.5f,                 // 12
+             0.1f,  -0.49f, 0.0f,    0.43f, 1.0f,      0.2f, -0.98f, -0.5f,                 // 13
 
-    //**********************************************************************
-   //Cartridge Body
-   //**********************************************************************
+             0.0f,  -0.5f, 0.0f,     0.5f, 1.0f,       0.0f, -1.0f, -0.5f,                 // 14 Bottom Mid Circle Vertex
 
-   // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+             // Bottom Left Quarter
+             -0.1f,  -0.49f, 0.0f,   0.53f, 1.0f,      -0.2f, -0.98f, -0.5f,                  // 15
+             -0.2f,  -0.45f, 0.0f,   0.56f, 1.0f,       -0.4f, -0.92f, -0.5f,                 // 16
+             -0.3f,  -0.4f, 0.0f,    0.59f, 1.0f,       -0.6f, -0.8f, -0.5f,                  // 17
+             -0.4f,  -0.3f, 0.0f,    0.63f, 1.0f,       -0.8f, -0.6f, -0.5f,                  // 18
+             -0.46f, -0.2f, 0.0f,    0.66f, 1.0f,        -0.90f, -0.43f, -0.5f,               // 19
+             -0.49f, -0.1f, 0.0f,    0.70f, 1.0f,       -0.98f, -0.2f, -0.5f,                 // 20
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+             -0.5f,  -0.0f, 0.0f,    0.75f, 1.0f,       -1.0f, 0.0f, -0.5f,                  // 21 Left Mid Circle Vertex
+             // Top Right Quarter
+             -0.49f, 0.1f, 0.0f,     0.78f, 1.0f,      -0.98f, 0.2f, -0.5f,                 // 22
+             -0.45f, 0.2f, 0.0f,     0.81f, 1.0f,      -0.92f, 0.4f, -0.5f,                 // 23
+             -0.4f,  0.3f, 0.0f,     0.84f, 1.0f,      -0.8f, 0.6f, -0.5f,                  // 24
+             -0.3f,  0.4f, 0.0f,     0.87f, 1.0f,      -0.6f, 0.8f, -0.5f,                  // 25
+             -0.2f,  0.46f, 0.0f,    0.91f, 1.0f,      -0.4f, 0.92f, -0.5f,                 // 26
+             -0.1f,  0.49f, 0.0f,    0.93f, 1.0f,      -0.2f, 0.98f, -0.5f,                 // 27
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(.25f, 1.0f, 1.2f)); 
-    XRotation = glm::rotate(-1.575f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.5708f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(-0.6f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-1.7f, -2.13f, 2.5f));
-    model = translation * ZRotation * XRotation *  YRotation * scale;
+              0.0f,  0.0f, 0.0f,     1.0f, 1.0f,       -0.5f, 1.0f, -0.5f,          // Circle Center 28
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+            //Bottom Circle
+            // Vertex Positions    
+            // Top Right Quarter
+             0.0f,  0.5f, 1.0f,     0.0f, 0.0f,  0.0f, 1.0f, -0.5f,            // Top Mid Circle Vertex 29
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+             0.1f,  0.49f, 1.0f,    0.03f, 0.0f, 0.2f, 0.98f, -0.5f,           // 30
+             0.2f,  0.45f, 1.0f,    0.06f, 0.0f,  0.4f, 0.92f, -0.5f,          // 31
+             0.3f,  0.4f, 1.0f,     0.12f, 0.0f,  0.6f, 0.8f, -0.5f,           // 32
+             0.4f,  0.3f, 1.0f,     0.15f, 0.0f,  0.8f, 0.6f, -0.5f,           // 33
+             0.46f,  0.2f, 1.0f,    0.18f, 0.0f,   0.90f, 0.43f, -0.5f,        // 34
+             0.49f,  0.1f, 1.0f,    0.21f, 0.0f,  0.98f, 0.2f, -0.5f,          // 35
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+             0.5f,  0.0f, 1.0f,     0.25f, 0.0f,  1.0f, 0.0f, -0.5f,          //36 Right Mid Circle Vertex
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+             // Bottom Right Quarter
+             0.49f,  -0.1f, 1.0f,   0.28f, 0.0f,  0.98f, -0.2f, -0.5f,          // 37
+             0.45f,  -0.2f, 1.0f,   0.31f, 0.0f,  0.92f, -0.4f, -0.5f,          // 38
+             0.4f,  -0.3f, 1.0f,    0.34f, 0.0f,  0.8f, -0.6f, -0.5f,           // 39
+             0.3f,  -0.4f, 1.0f,    0.37f, 0.0f,  0.6f, -0.8f, -0.5f,           // 40
+             0.2f,  -0.46f, 1.0f,   0.40f, 0.0f,  0.4f, -0.92f, -0.5f,          // 41
+             0.1f,  -0.49f, 1.0f,   0.43f, 0.0f,  0.2f, -0.98f, -0.5f,          // 42
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+             0.0f,  -0.5f, 1.0f,    0.5f, 0.0f,   0.0f, -1.0f, -0.5f,            //43 Bottom Mid Circle Vertex
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+             // Bottom Left Quarter
+             -0.1f,  -0.49f, 1.0f,  0.53f, 0.0f,   -0.2f, -0.98f, -0.5f,             //44
+             -0.2f,  -0.45f, 1.0f,  0.56f, 0.0f,    -0.4f, -0.92f, -0.5f,            //45
+             -0.3f,  -0.4f, 1.0f,   0.59f, 0.0f,    -0.6f, -0.8f, -0.5f,             //46
+             -0.4f,  -0.3f, 1.0f,   0.63f, 0.0f,    -0.8f, -0.6f, -0.5f,              //47
+             -0.46f, -0.2f, 1.0f,   0.66f, 0.0f,     -0.90f, -0.43f, -0.5f,          //48
+             -0.49f, -0.1f, 1.0f,   0.70f, 0.0f,    -0.98f, -0.2f, -0.5f,           // 49
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+             -0.5f,  -0.0f, 1.0f,   0.75f, 0.0f,    -1.0f, 0.0f, -0.5f,              //50 Left Mid Circle Vertex
+                                          
+             // Top Right Quarter
+             -0.49f, 0.1f, 1.0f,    0.78f, 0.0f,  -0.98f, 0.2f, -0.5f,             // 51
+             -0.45f, 0.2f, 1.0f,    0.81f, 0.0f,  -0.92f, 0.4f, -0.5f,             //52
+             -0.4f,  0.3f, 1.0f,    0.84f, 0.0f,  -0.8f, 0.6f, -0.5f,             // 53
+             -0.3f,  0.4f, 1.0f,    0.87f, 0.0f,  -0.6f, 0.8f, -0.5f,              //54
+             -0.2f,  0.46f, 1.0f,   0.91f, 0.0f,  -0.4f, 0.92f, -0.5f,             //55
+             -0.1f,  0.49f, 1.0f,   0.93f, 0.0f,  -0.2f, 0.98f, -0.5f,             //56
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+             0.0f,  0.0f, 1.0f,      1.0f, 1.0f,  0.0f, 0.0f, 0.0f,              // Circle Center 57
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_cube.vao);
+             0.0f,  0.5f, 0.0f,      1.0f,  1.0f,  0.0f, 0.0f, 0.0f,          // Top Mid Circle Vertex 58
+             0.0f,  0.5f, 1.0f,      1.0f,  0.0f,   0.0f, 0.0f, 0.0f,          // bottom Mid Circle Vertex 59
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cart);
+        };
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_cube.nIndices, GL_UNSIGNED_SHORT, NULL);
+        // Index data to share position data
+        GLushort indices[] = {
+            //**********************************************************************
+            //Coffee Cup Body
+            //**********************************************************************
+            
+            //Bottom Circle 
+            //Top Right Quarter
+            29, 30, 57,
+            30, 31, 57,
+            31, 32, 57,
+            32, 33, 57,
+            33, 34, 57,
+            34, 35, 57,
+            35, 36, 57,
 
-    //**********************************************************************
-   //Cartridge inside wall
-   //**********************************************************************
+            //Bottom Right Quarter
+            36, 37, 57,
+            37, 38, 57,
+            38, 39, 57,
+            39, 40, 57,
+            40, 41, 57,
+            41, 42, 57,
+            42, 43, 57,
 
-   // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            //Bottom Left Quarter
+            43, 44, 57,
+            44, 45, 57,
+            45, 46, 57,
+            46, 47, 57,
+            47, 48, 57,
+            48, 49, 57,
+            49, 50, 57,
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+            //Top Right Quarter
+            50, 51, 57,
+            51, 52, 57,
+            52, 53, 57,
+            53, 54, 57,
+            54, 55, 57,
+            55, 56, 57,
+            56, 29, 57,
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(.25f, 1.0f, 1.2f));
-    XRotation = glm::rotate(-1.575f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.5708f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(-0.6f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-2.15f, -1.825f, 2.85f));
-    model = translation * ZRotation * XRotation * YRotation * scale;
+            //Cylinder Sides
+            0, 29, 30,
+            30, 1, 0,
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+            1, 30, 31,
+            31, 2, 1,
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+            2, 31, 32,
+            32, 3, 2,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+            3, 32, 33,
+            33, 4, 3,
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+            4, 33, 34,
+            34, 5, 4,
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+            5, 34, 35,
+            35, 6, 5,
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+            6, 35, 36,
+            36, 7, 6,
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            7, 36, 37,
+            37, 8, 7,
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+            8, 37, 38,
+            38, 9, 8,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+            9, 38, 39,
+            39, 10, 9,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cart);
+            10, 39, 40,
+            40, 11, 10,
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+            11, 40, 41,
+            41, 12, 11,
 
-    //**********************************************************************
-  //Cartridge chip
-  //**********************************************************************
+            12, 41, 42,
+            42, 13, 12,
 
-  // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            13, 42, 43,
+            43, 14, 13,
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+            14, 43, 44,
+            44, 15, 14,
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(.25f, 1.0f, 1.2f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.5708f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(-0.6f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-2.15f, -1.825f, 2.85f));
-    model = translation * ZRotation * XRotation * YRotation * scale;
+            15, 44, 45,
+            45, 16, 15,
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+            16, 45, 46,
+            46, 17, 16,
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+            17, 46, 47,
+            47, 18, 17,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+            18, 47, 48,
+            48, 19, 18,
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+            19, 48, 49,
+            49, 20, 19,
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+            20, 49, 50,
+            50, 21, 20,
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+            21, 50, 51,
+            51, 22, 21,
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            22, 51, 52,
+            52, 23, 22,
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+            23, 52, 53,
+            53, 24, 23,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+            24, 53, 54,
+            54, 25, 24,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupBody);
+            25, 54, 55,
+            55, 26, 25,
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+            26, 55, 56,
+            56, 27, 26,
 
-    //**********************************************************************
-    //Cartridge Label
-    //**********************************************************************
+            27, 58, 59,
+            27, 56, 59
+        };
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        const GLuint floatsPerTexture = 2;
+        const GLuint floatsPerVertex = 3;
+        const GLuint floatsPerNormal = 3;
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(0.80f, 0.85f, 0.90f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(1.5708f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(-0.6f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-2.13f, -1.66f, 2.5f));
-    model = translation * ZRotation * XRotation * YRotation * scale;
+        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+        glBindVertexArray(mesh.vao);
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+        // Create 2 buffers: first one for the vertex data; second one for the indices
+        glGenBuffers(2, mesh.vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+        // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
+        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        // Create Vertex Attribute Pointers
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+        glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
+        glEnableVertexAttribArray(1);
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+        glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
+        glEnableVertexAttribArray(2);
+             
+    }
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    else if (meshChoice == 2) {
+           //**********************************************************************
+           //Coffee Cup Handle
+           //**********************************************************************
+           //Currently using half cylinder mesh scaled and rotated for handle
+           //Will eventually try to use a torus once I understand how to render one
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_plane.vao);
+            // Position and Color data
+            GLfloat verts[] = {
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_label);
+                //Top Circle
+                // Vertex Positions    // Colors (r,g,b,a)
+                // Top Right Quarter
+                 0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+                 0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
+                 0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
+                 0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
+                 0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
+                 0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
+                 0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
 
-    //**********************************************************************
-    //Cartridge Side 1
-    //**********************************************************************
+                 0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                 // Bottom Right Quarter
+                 0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
+                 0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
+                 0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
+                 0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
+                 0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
+                 0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+                 0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(0.25f, 0.25f, 0.999f));
-    XRotation = glm::rotate(0.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-1.7f, -2.13f, 2.0005f));
-    model = translation * ZRotation * XRotation * YRotation * scale;
+                 0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+                //Bottom Circle
+                // Vertex Positions    // Colors (r,g,b,a)
+                // Top Right Quarter
+                 0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+                 0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
+                 0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
+                 0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
+                 0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
+                 0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
+                 0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+                 0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+                 // Bottom Right Quarter
+                 0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
+                 0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
+                 0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
+                 0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
+                 0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
+                 0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+                 0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+                 0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
+            };
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            // Index data to share position data
+            GLushort indices[] = {
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+                //Top Circle 
+                //Top Right Quarter
+                0, 1, 15,
+                1, 2, 15,
+                2, 3, 15,
+                3, 4, 15,
+                4, 5, 15,
+                5, 6, 15,
+                6, 7, 15,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_fullCyl.vao);
+                //Bottom Right Quarter
+                7, 8, 15,
+                8, 9, 15,
+                9, 10, 15,
+                10, 11, 15,
+                11, 12, 15,
+                12, 13, 15,
+                13, 14, 15,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cart);
+                //Bottom Circle 
+                //Top Right Quarter
+                16, 17, 31,
+                17, 18, 31,
+                18, 19, 31,
+                19, 20, 31,
+                20, 21, 31,
+                21, 22, 31,
+                22, 23, 31,
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_fullCyl.nIndices, GL_UNSIGNED_SHORT, NULL);
+                //Bottom Right Quarter
+                23, 24, 31,
+                24, 25, 31,
+                25, 26, 31,
+                26, 27, 31,
+                27, 28, 31,
+                28, 29, 31,
+                29, 30, 31,
 
-   //**********************************************************************
-   //Cartridge Side 2
-   //**********************************************************************
+                
+                //Cylinder Sides
+                0, 16, 1,
+                16, 17, 1,
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                1, 17, 2,
+                17, 18, 2,
+                2,	18,	3,
 
-    // Set the shader to be used
-    glUseProgram(gPlaneProgramId);
+                18,	19,	3,
+                3,	19,	4,
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(0.25f, 0.25f, 0.999f));
-    XRotation = glm::rotate(-0.005f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-2.68f, -1.462f, 2.0005f));
-    model = translation * ZRotation * XRotation * YRotation * scale;
+                19,	20,	4,
+                4,	20,	5,
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+                20,	21,	5,
+                5,	21, 6,
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+                21,	22,	6,
+                6,	22,	7,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+                22,	23,	7,
+                7,	23,	8,
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+                23,	24,	8,
+                8,	24,	9,
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+                24,	25, 9,
+                9,	25,	10,
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+                25,	26,	10,
+                10, 26, 11,
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+                26,	27,	11,
+                11,	27,	12,
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+                27,	28,	12,
+                12,	28,	13,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_fullCyl.vao);
+                28,	29,	13,
+                13,	29,	14,
+                
+                30,	0,	14,
+                0, 16, 30,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cart);
+                30, 29, 14
+                
+            };
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_fullCyl.nIndices, GL_UNSIGNED_SHORT, NULL);
+            const GLuint floatsPerTexture = 2;
+            const GLuint floatsPerVertex = 3;
 
 
-    //**********************************************************************
-    //Coffee Cup Body
-    //**********************************************************************
+            glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+            glBindVertexArray(mesh.vao);
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            // Create 2 buffers: first one for the vertex data; second one for the indices
+            glGenBuffers(2, mesh.vbos);
+            glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+            glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+            mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    XRotation = glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(0.0f, -0.24f, 0.0f));
-    model =  translation * XRotation * scale;
+            // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
+            GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+            // Create Vertex Attribute Pointers
+            glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+            glEnableVertexAttribArray(0);
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+            glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float)* floatsPerVertex));
+            glEnableVertexAttribArray(2);
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    else if (meshChoice == 3) {
+       //**********************************************************************
+       //Coffee Cup Handle Inside
+       //**********************************************************************
+       //Currently using half cylinder mesh scaled and rotated for handle
+       //Will eventually try to use a torus once I understand how to render one
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+        // Position and Color data
+        GLfloat verts[] = {
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+            //Top Circle
+            // Vertex Positions    // Colors (r,g,b,a)
+            // Top Right Quarter
+             0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+             0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
+             0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
+             0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
+             0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
+             0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
+             0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-    
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_body.vao);
+             0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupBody);
+             // Bottom Right Quarter
+             0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
+             0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
+             0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
+             0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
+             0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
+             0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_body.nIndices, GL_UNSIGNED_SHORT, NULL);
+             0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
 
-   //**********************************************************************
-   //Candle Body
-   //**********************************************************************
+             0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
 
-   // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            //Bottom Circle
+            // Vertex Positions    // Colors (r,g,b,a)
+            // Top Right Quarter
+             0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
 
-    // Set the shader to be used
-    glUseProgram(gCandleProgramId);
+             0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
+             0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
+             0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
+             0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
+             0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
+             0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
 
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    XRotation = glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-5.5f, -0.24f, 0.0f));
-    model = translation * XRotation * scale;
+             0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+             // Bottom Right Quarter
+             0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
+             0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
+             0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
+             0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
+             0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
+             0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+             0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+             0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
+        };
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        // Index data to share position data
+        GLushort indices[] = {
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+            //Top Circle 
+            //Top Right Quarter
+            0, 1, 15,
+            1, 2, 15,
+            2, 3, 15,
+            3, 4, 15,
+            4, 5, 15,
+            5, 6, 15,
+            6, 7, 15,
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+            //Bottom Right Quarter
+            7, 8, 15,
+            8, 9, 15,
+            9, 10, 15,
+            10, 11, 15,
+            11, 12, 15,
+            12, 13, 15,
+            13, 14, 15,
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            //Bottom Circle 
+            //Top Right Quarter
+            16, 17, 31,
+            17, 18, 31,
+            18, 19, 31,
+            19, 20, 31,
+            20, 21, 31,
+            21, 22, 31,
+            22, 23, 31,
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+            //Bottom Right Quarter
+            23, 24, 31,
+            24, 25, 31,
+            25, 26, 31,
+            26, 27, 31,
+            27, 28, 31,
+            28, 29, 31,
+            29, 30, 31,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_body.vao);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_candle);
+            //Cylinder Sides
+            0, 16, 1,
+            16, 17, 1,
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_body.nIndices, GL_UNSIGNED_SHORT, NULL);
+            1, 17, 2,
+            17, 18, 2,
+            2,	18,	3,
 
-    //**********************************************************************
-   //Candle Inside
-   //**********************************************************************
+            18,	19,	3,
+            3,	19,	4,
 
-   // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            19,	20,	4,
+            4,	20,	5,
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
-
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(1.8f, 1.5f, 1.8f));
-    XRotation = glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-5.5f, -0.5f, 0.0f));
-    model = translation * XRotation * scale;
+            20,	21,	5,
+            5,	21, 6,
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
+            21,	22,	6,
+            6,	22,	7,
 
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+            22,	23,	7,
+            7,	23,	8,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
+            23,	24,	8,
+            8,	24,	9,
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+            24,	25, 9,
+            9,	25,	10,
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+            25,	26,	10,
+            10, 26, 11,
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+            26,	27,	11,
+            11,	27,	12,
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            27,	28,	12,
+            12,	28,	13,
 
-    //UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    //glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+            28,	29,	13,
+            13,	29,	14,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_body.vao);
+            30,	0,	14,
+            0, 16, 30,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_wax);
+            30, 29, 14
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_body.nIndices, GL_UNSIGNED_SHORT, NULL);
+        };
 
+        const GLuint floatsPerTexture = 2;
+        const GLuint floatsPerVertex = 3;
 
-    //**********************************************************************
-    //Coffee Cup Top Texture
-    //**********************************************************************
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+        glBindVertexArray(mesh.vao);
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
-
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    XRotation = glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(0.0f, -0.5f, 0.0f));
-    model = translation * XRotation * scale;
-
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
-
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        // Create 2 buffers: first one for the vertex data; second one for the indices
+        glGenBuffers(2, mesh.vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_bodyTop.vao);
+        // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
+        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_coffee);
+        // Create Vertex Attribute Pointers
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_bodyTop.nIndices, GL_UNSIGNED_SHORT, NULL);
 
+        glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
+        glEnableVertexAttribArray(2);
+}
 
+    else if (meshChoice == 4) {
     //**********************************************************************
-    //Candle Top Texture
+    //Coffee Cup Handle Outside
     //**********************************************************************
+    //Currently using half cylinder mesh scaled and rotated for handle
+    //Will eventually try to use a torus once I understand how to render one
 
-    // Wireframe Mode (helps with translation & scaling)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-    // Set the shader to be used
-    glUseProgram(gProgramId);
-
-    //Set up scaling and rotation for cup body
-    scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    XRotation = glm::rotate(1.5708f, glm::vec3(1.0f, 0.0f, 0.0f));
-    YRotation = glm::rotate(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ZRotation = glm::rotate(0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    translation = glm::translate(glm::vec3(-5.5f, -0.5f, 0.0f));
-    model = translation * XRotation * scale;
-
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection
-    projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+     // Position and Color data
+     GLfloat verts[] = {
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+         //Top Circle
+         // Vertex Positions    // Colors (r,g,b,a)
+         // Top Right Quarter
+          0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
+          0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
+          0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
+          0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
+          0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
+          0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
+          0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
 
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+          0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
 
-    UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+          // Bottom Right Quarter
+          0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
+          0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
+          0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
+          0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
+          0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
+          0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_bodyTop.vao);
+          0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_candleTop);
+          0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
 
-    // Draws the coffee cup body
-    glDrawElements(GL_TRIANGLES, mesh_bodyTop.nIndices, GL_UNSIGNED_SHORT, NULL);
+         //Bottom Circle
+         // Vertex Positions    // Colors (r,g,b,a)
+         // Top Right Quarter
+          0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
 
+          0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
+          0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
+          0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
+          0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
+          0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
+          0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
 
-    
-    //**********************************************************************
-    //Coffee Cup Handle
-    //**********************************************************************
+          0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    
-    // [stencil]
-    glEnable(GL_STENCIL_TEST);
-    // whole stencil=0
-    glClearStencil(0);
-    glClear(GL_STENCIL_BUFFER_BIT);
-    // turn off color,depth
-    glStencilMask(0xFF);
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    glDepthMask(GL_FALSE);
+          // Bottom Right Quarter
+          0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
+          0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
+          0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
+          0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
+          0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
+          0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
 
-    glStencilFunc(GL_ALWAYS, 1, 0xFF);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+          0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
 
-    //Set up scaling and rotations for coffee cup handle
-    scale = glm::scale(glm::vec3(1.5f, 1.5f, 0.25f));    
-    YRotation = glm::rotate(0.122173f, glm::vec3(0.0f, -1.0f, 0.0f));
-    translation = glm::translate(glm::vec3(0.9f, -1.25f, 0.0f));
-    
+          0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
+     };
 
-    model =  translation * YRotation * scale;
+     // Index data to share position data
+     GLushort indices[] = {
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+         /*//Top Circle 
+         //Top Right Quarter
+         0, 1, 15,
+         1, 2, 15,
+         2, 3, 15,
+         3, 4, 15,
+         4, 5, 15,
+         5, 6, 15,
+         6, 7, 15,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    
+         //Bottom Right Quarter
+         7, 8, 15,
+         8, 9, 15,
+         9, 10, 15,
+         10, 11, 15,
+         11, 12, 15,
+         12, 13, 15,
+         13, 14, 15,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_handle.vao);
+         //Bottom Circle 
+         //Top Right Quarter
+         16, 17, 31,
+         17, 18, 31,
+         18, 19, 31,
+         19, 20, 31,
+         20, 21, 31,
+         21, 22, 31,
+         22, 23, 31,
 
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupHandle);
+         //Bottom Right Quarter
+         23, 24, 31,
+         24, 25, 31,
+         25, 26, 31,
+         26, 27, 31,
+         27, 28, 31,
+         28, 29, 31,
+         29, 30, 31,*/
 
-    // Draws the coffee cup handle
-    glDrawElements(GL_TRIANGLES, mesh_handle.nIndices, GL_UNSIGNED_SHORT, NULL);
 
-    
-    //**********************************************************************
-    //Coffee Cup Handle Inside
-    //**********************************************************************
+         //Cylinder Sides
+         0, 16, 1,
+         16, 17, 1,
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+         1, 17, 2,
+         17, 18, 2,
+         2,	18,	3,
 
-    glStencilFunc(GL_ALWAYS, 0, 0xFF);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+         18,	19,	3,
+         3,	19,	4,
 
-    //Set up scaling and rotations for coffee cup handle
-    scale = glm::scale(glm::vec3(1.0f, 1.0f, 0.25f));
-    YRotation = glm::rotate(0.122173f, glm::vec3(0.0f, -1.0f, 0.0f));
-    translation = glm::translate(glm::vec3(0.9f, -1.25f, 0.0f));
+         19,	20,	4,
+         4,	20,	5,
 
+         20,	21,	5,
+         5,	21, 6,
 
-    model = translation * YRotation * scale;
+         21,	22,	6,
+         6,	22,	7,
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+         22,	23,	7,
+         7,	23,	8,
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+         23,	24,	8,
+         8,	24,	9,
 
+         24,	25, 9,
+         9,	25,	10,
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_handle.vao);
+         25,	26,	10,
+         10, 26, 11,
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupHandle);
+         26,	27,	11,
+         11,	27,	12,
 
+         27,	28,	12,
+         12,	28,	13,
 
-    // Draws the coffee cup handle
-    glDrawElements(GL_TRIANGLES, mesh_handleInside.nIndices, GL_UNSIGNED_SHORT, NULL);
+         28,	29,	13,
+         13,	29,	14,
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-    glDepthMask(GL_TRUE);
-    
-    glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+         30,	0,	14,
+         0, 16, 30,
 
+         30, 29, 14
 
-    //Set up scaling and rotations for coffee cup handle
-    scale = glm::scale(glm::vec3(1.5f, 1.5f, 0.25f));
-    YRotation = glm::rotate(0.122173f, glm::vec3(0.0f, -1.0f, 0.0f));
-    translation = glm::translate(glm::vec3(0.9f, -1.25f, 0.0f));
+     };
 
+     const GLuint floatsPerTexture = 2;
+     const GLuint floatsPerVertex = 3;
 
-    model = translation * YRotation * scale;
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+     glBindVertexArray(mesh.vao);
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+     // Create 2 buffers: first one for the vertex data; second one for the indices
+     glGenBuffers(2, mesh.vbos);
+     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
+     mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_handle.vao);
+     // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
+     GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
 
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupHandle);
+     // Create Vertex Attribute Pointers
+     glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+     glEnableVertexAttribArray(0);
 
-    // Draws the coffee cup handle
-    glDrawElements(GL_TRIANGLES, mesh_handle.nIndices, GL_UNSIGNED_SHORT, NULL);
 
-    glDisable(GL_STENCIL_TEST);
+     glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
+     glEnableVertexAttribArray(2);
+    }
 
+    else if (meshChoice == 5) {
     //**********************************************************************
-    //Coffee Cup Handle Outside
+    //Coffee Cup Texture Top
     //**********************************************************************
 
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-    //Set up scaling and rotations for coffee cup handle
-    scale = glm::scale(glm::vec3(1.5f, 1.5f, 0.25f));
-    YRotation = glm::rotate(0.122173f, glm::vec3(0.0f, -1.0f, 0.0f));
-    translation = glm::translate(glm::vec3(0.9f, -1.25f, 0.0f));
+    // Position and Color data
+    GLfloat verts[] = {
 
+        //Top Circle
+        // Vertex Positions    // Colors (r,g,b,a) 
+        // Top Right Quarter                        //Normals            
+         0.0f,  0.5f, 0.0f,     0.5f, 1.0f,         0.0f, 1.0f,  0.0f,                    // Top Mid Circle Vertex 0
+                                                    
+         0.1f,  0.49f, 0.0f,    0.6f, 0.99f,         0.0f, 1.0f,  0.0f,                    // 1
+         0.2f,  0.45f, 0.0f,    0.7f, 0.95f,         0.0f, 1.0f,  0.0f,                    // 2
+         0.3f,  0.4f, 0.0f,     0.8f, 0.9f,          0.0f, 1.0f,  0.0f,                   // 3
+         0.4f,  0.3f, 0.0f,     0.9f, 0.8f,          0.0f, 1.0f,  0.0f,                   // 4
+         0.46f,  0.2f, 0.0f,    0.96f, 0.7f,         0.0f, 1.0f,  0.0f,                    // 5
+         0.49f,  0.1f, 0.0f,    0.99f, 0.6f,         0.0f, 1.0f,  0.0f,                    // 6
 
-    model = translation * YRotation * scale;
+         0.5f,  0.0f, 0.0f,     1.0f, 0.5f,       0.0f, 1.0f,  0.0f,                      // 7 Right Mid Circle Vertex
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+         // Bottom Right Quarter
+         0.49f,  -0.1f, 0.0f,   0.99f, 0.4f,      0.0f, 1.0f,  0.0f,                       // 8
+         0.45f,  -0.2f, 0.0f,   0.95f, 0.3f,      0.0f, 1.0f,  0.0f,                       // 9
+         0.4f,  -0.3f, 0.0f,    0.9f, 0.2f,       0.0f, 1.0f,  0.0f,                      // 10
+         0.3f,  -0.4f, 0.0f,    0.8f, 0.1f,       0.0f, 1.0f,  0.0f,                      // 11
+         0.2f,  -0.46f, 0.0f,   0.7f, 0.04f,      0.0f, 1.0f,  0.0f,                       // 12
+         0.1f,  -0.49f, 0.0f,   0.6f, 0.01f,      0.0f, 1.0f,  0.0f,                       // 13
 
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+         0.0f,  -0.5f, 0.0f,    0.5f, 0.0f,      0.0f, 1.0f,  0.0f,                       // 14 Bottom Mid Circle Vertex
 
+         // Bottom Left Quarter
+         -0.1f,  -0.49f, 0.0f,  0.4f, 0.01f,    0.0f, 1.0f,  0.0f,                         // 15
+         -0.2f,  -0.45f, 0.0f,  0.3f, 0.05f,    0.0f, 1.0f,  0.0f,                         // 16
+         -0.3f,  -0.4f, 0.0f,   0.2f, 0.1f,     0.0f, 1.0f,  0.0f,                        // 17
+         -0.4f,  -0.3f, 0.0f,   0.1f, 0.2f,     0.0f, 1.0f,  0.0f,                        // 18
+         -0.46f, -0.2f, 0.0f,   0.04f, 0.3f,    0.0f, 1.0f,  0.0f,                         // 19
+         -0.49f, -0.1f, 0.0f,   0.01f, 0.4f,    0.0f, 1.0f,  0.0f,                         // 20
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(mesh_handleOutside.vao);
+         -0.5f,  -0.0f, 0.0f,   0.0f, 0.5f,     0.0f, 1.0f,  0.0f,                        // 21 Left Mid Circle Vertex
 
-    glBindTexture(GL_TEXTURE_2D, gTextureId_cupHandle);
+         // Top Right Quarter
+         -0.49f, 0.1f, 0.0f,    0.01f, 0.6f,    0.0f, 1.0f,  0.0f,                         // 22
+         -0.45f, 0.2f, 0.0f,    0.05f, 0.7f,    0.0f, 1.0f,  0.0f,                         // 23
+         -0.4f,  0.3f, 0.0f,    0.1f, 0.8f,     0.0f, 1.0f,  0.0f,                        // 24
+         -0.3f,  0.4f, 0.0f,    0.2f, 0.9f,     0.0f, 1.0f,  0.0f,                        // 25
+         -0.2f,  0.46f, 0.0f,   0.3f, 0.96f,    0.0f, 1.0f,  0.0f,                         // 26
+         -0.1f,  0.49f, 0.0f,   0.4f, 0.99f,    0.0f, 1.0f,  0.0f,                         // 27
 
-    // Draws the coffee cup handle
-    glDrawElements(GL_TRIANGLES, mesh_handleOutside.nIndices, GL_UNSIGNED_SHORT, NULL);
-
-    //***************************************************************************
-    //Set up camera perspective
-    //****************************************************************************
-    //Perspective view settings
-    if (isOrtho == false) {
-        viewLoc = glGetUniformLocation(gProgramId, "view");
-        projLoc = glGetUniformLocation(gProgramId, "projection");
+          0.0f,  0.0f, 0.0f,     0.5f, 0.5f,    0.0f, 1.0f,  0.0f,                       // Circle Center 28
+    };
 
+    // Index data to share position data
+    GLushort indices[] = {
+        //**********************************************************************
+        //Coffee Cup Body
+        //**********************************************************************
+        //Top Circle 
+        //Top Right Quarter
+        0, 1, 28,
+        1, 2, 28,
+        2, 3, 28,
+        3, 4, 28,
+        4, 5, 28,
+        5, 6, 28,
+        6, 7, 28,
 
-        // camera/view transformation
-        view = gCamera.GetViewMatrix();
+        //Bottom Right Quarter
+        7, 8, 28,
+        8, 9, 28,
+        9, 10, 28,
+        10, 11, 28,
+        11, 12, 28,
+        12, 13, 28,
+        13, 14, 28,
 
-        // Creates a perspective projection
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-        
+        //Bottom Left Quarter
+        14, 15, 28,
+        15, 16, 28,
+        16, 17, 28,
+        17, 18, 28,
+        18, 19, 28,
+        19, 20, 28,
+        20, 21, 28,
 
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        //Top Right Quarter
+        21, 22, 28,
+        22, 23, 28,
+        23, 24, 28,
+        24, 25, 28,
+        25, 26, 28,
+        26, 27, 28,
+        27, 0, 28,
+    };
 
+    const GLuint floatsPerTexture = 2;
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
 
-        // Deactivate the Vertex Array Object
-        glBindVertexArray(0);
 
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.    
-    }
-    //Orthographic view settings
-    else if (isOrtho == true) {
+    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+    glBindVertexArray(mesh.vao);
 
-        viewLoc = glGetUniformLocation(gProgramId, "view");
-        projLoc = glGetUniformLocation(gProgramId, "projection");       
+    // Create 2 buffers: first one for the vertex data; second one for the indices
+    glGenBuffers(2, mesh.vbos);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-        view = glm::lookAt(
-            glm::vec3(0, -0.49, 5), //Camera at this location in space
-            glm::vec3(0, -.5, 0), //Camera looking at this location
-            glm::vec3(0, 1, 0) // Head up or down 
-            );
+    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-        translation = glm::translate(glm::vec3(3.0f, 0.0f, 0.0f));
+    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
+    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
 
-        glm::mat4 orthoView = view * translation;
-        glm::mat4 orthoProjection = glm::ortho(-10.0f, 10.0f, -7.5f, 7.5f, 0.1f, 100.0f);
+    // Create Vertex Attribute Pointers
+    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
 
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(orthoProjection));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(orthoView));
+    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
+    glEnableVertexAttribArray(1);
 
+    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
+    glEnableVertexAttribArray(2);
     
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.  
     }
-}
-
 
+    else if (meshChoice == 6) {
+    //**********************************************************************
+    //Cube Data
+    //**********************************************************************
 
-//***************************************************************************************
-//CREATE MESH FUNCTION
-//
-//Overloaded the UCreateMesh function passing in mesh choice to create different meshes
-//***************************************************************************************
-void UCreateMesh(GLMesh& mesh, int meshChoice)
-{
-    if (meshChoice == 0) {
-        //**********************************************************************
-        //Plane Data
-        //**********************************************************************
-
-        // Position and Color data
-        GLfloat verts[] = {
+    // Position and Color data
+    GLfloat verts[] = {
+        //Right Pyramid
+        // Vertex Positions   // Texture Coords     //Normals
+         0.5f,  0.5f, 0.0f,   1.0f, 1.0f,           0.0f, -0.0f,  1.0f,                     // Top Right Square Vertex 0
+         0.5f, -0.5f, 0.0f,   1.0f, 0.0f,           0.0f, -0.0f,  1.0f,                     // Bottom Right Square Vertex 1
+         -0.5f, -0.5f, 0.0f,  0.0f, 0.0f,           0.0f, -0.0f,  1.0f,                     // Bottom Left Square Vertex 2
+         -0.5f,  0.5f, 0.0f,  0.0f, 1.0f,           0.0f, -0.0f,  1.0f,                     // Top Left Square Vertex 3
 
-            // Square Plane
-            // Vertex Positions                  //Normals
-             0.5f,  0.0f, 0.5f,    1.0f, 1.0f,   0.0f, 1.0f, 0.0f,             // Top Right Corner 0
-            -0.5f,  0.0f, 0.5f,    1.0f, 0.0f,   0.0f, 1.0f, 0.0f,             // Top Left Corner 1
-             0.5f,  0.0f, -0.5f,   0.0f, 1.0f,   0.0f, 1.0f, 0.0f,              // Bottom Right Corner 2
-            -0.5f,  0.0f, -0.5f,   0.0f, 0.0f,   0.0f, 1.0f, 0.0f,                 // Bottom Left Corner 3            
-        };
+         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           0.0f, -0.0f,  -2.0f, // 4
+         0.5f, -0.5f, -1.0f,  1.0f, 0.0f,           0.0f, -0.0f,  -2.0f, // 5
+         - 0.5f, -0.5f, -1.0f, 0.0f, 0.0f,          0.0f, -0.0f,  -2.0f, // 6
+         - 0.5f,  0.5f, -1.0f, 0.0f, 1.0f,          0.0f, -0.0f,  -2.0f,  // 7
 
-        // Index data to share position data
-        GLushort indices[] = {            
-            0, 1, 2,
-            2, 3, 1           
-        };
+         0.5f,  0.5f, 0.0f,   1.0f, 0.0f,           0.0f, 1.0f,  -0.5f,                     // Top Right Square Vertex 8
+         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           0.0f, 1.0f,  -0.5f, // 9
+         -0.5f,  0.5f, -1.0f, 0.0f, 1.0f,           0.0f, 1.0f,  -0.5f,  // 10
+         -0.5f,  0.5f, 0.0f,  0.0f, 0.0f,           0.0f, 1.0f,  -0.5f,                     // Top Left Square Vertex 11
 
-        const GLuint floatsPerTexture = 2;
-        const GLuint floatsPerVertex = 3;
-        const GLuint floatsPerNormal = 3;
+         -0.5f,  0.5f, 0.0f,  1.0f, 1.0f,           -1.0f, 0.0f,  -0.5f,                     // Top Left Square Vertex 12
+         -0.5f,  0.5f, -1.0f, 0.0f, 1.0f,           -1.0f, -0.0f,  -0.5f,  // 13
+         -0.5f, -0.5f, -1.0f, 0.0f, 0.0f,           -1.0f, -0.0f,  -0.5f, // 14
+         -0.5f, -0.5f, 0.0f,  1.0f, 0.0f,           -1.0f, -0.0f,  -0.5f,                     // Bottom Left Square Vertex 15
 
+         0.5f,  0.5f, 0.0f,   0.0f, 1.0f,           1.0f, -0.0f,  -0.5f,                     // Top Right Square Vertex 16
+         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           1.0f, -0.0f,  -0.5f, // 17
+         0.5f, -0.5f, 0.0f,   0.0f, 0.0f,           1.0f, -0.0f,  -0.5f,                     // Bottom Right Square Vertex 18
+         0.5f, -0.5f, -1.0f,  1.0f, 0.0f,           1.0f, -0.0f,  -0.5f, // 19
+    };
 
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+    // Index data to share position data
+    GLushort indices[] = {
 
-        // Create 2 buffers: first one for the vertex data; second one for the indices
-        glGenBuffers(2, mesh.vbos);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+        //Square Base
+        0, 1, 3,  // Triangle 1
+        1, 2, 3,   // Triangle 2
 
-        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        4, 5, 7,
+        5, 6, 7,
 
-        // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+        16, 17, 18,
+        17, 19, 18,
 
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
+        12, 13, 14,
+        14, 15, 12,
 
-        glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-        glEnableVertexAttribArray(1);
+        8, 9, 10,
+        10, 11, 8,
 
-        glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerTexture)));
-        glEnableVertexAttribArray(2);
-    }
+        
 
-    else if (meshChoice == 1)  {
-        //**********************************************************************
-        //Coffee Cup Body
-        //**********************************************************************
+    };
 
-        // Position and Color data
-        GLfloat verts[] = {
+    const GLuint floatsPerTexture = 2;
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
 
-            //Top Circle
-            // Vertex Positions    
-            // Top Right Quarter
-             0.0f,  0.5f, 0.0f,      0.0f,  1.0f,     0.0f, 1.0f, -0.5f,                    // Top Mid Circle Vertex 0
 
-             0.1f,  0.49f, 0.0f,     0.03f, 1.0f,     0.2f, 0.98f, -0.5f,                   // 1
-             0.2f,  0.45f, 0.0f,     0.06f, 1.0f,      0.4f, 0.92f, -0.5f,                 // 2
-             0.3f,  0.4f, 0.0f,      0.12f, 1.0f,      0.6f, 0.8f, -0.5f,                   // 3
-             0.4f,  0.3f, 0.0f,      0.15f, 1.0f,      0.8f, 0.6f, -0.5f,                  // 4
-             0.46f,  0.2f, 0.0f,     0.18f, 1.0f,       0.90f, 0.43f, -0.5f,                // 5
-             0.49f,  0.1f, 0.0f,     0.21f, 1.0f,      0.98f, 0.2f, -0.5f,                   // 6
+    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+    glBindVertexArray(mesh.vao);
 
-             0.5f,  0.0f, 0.0f,      0.25f, 1.0f,      1.0f, 0.0f, -0.5f,                  // 7 Right Mid Circle Vertex
+    // Create 2 buffers: first one for the vertex data; second one for the indices
+    glGenBuffers(2, mesh.vbos);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-             // Bottom Right Quarter
-             0.49f,  -0.1f, 0.0f,    0.28f, 1.0f,      0.98f, -0.2f, -0.5f,                 // 8
-             0.45f,  -0.2f, 0.0f,    0.31f, 1.0f,      0.92f, -0.4f, -0.5f,                 // 9
-             0.4f,  -0.3f, 0.0f,     0.34f, 1.0f,      0.8f, -0.6f, -0.5f,                  // 10
-             0.3f,  -0.4f, 0.0f,     0.37f, 1.0f,      0.6f, -0.8f, -0.5f,                  // 11
-             0.2f,  -0.46f, 0.0f,    0.40f, 1.0f,      0.4f, -0.92f, -0.5f,                 // 12
-             0.1f,  -0.49f, 0.0f,    0.43f, 1.0f,      0.2f, -0.98f, -0.5f,                 // 13
+    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-             0.0f,  -0.5f, 0.0f,     0.5f, 1.0f,       0.0f, -1.0f, -0.5f,                 // 14 Bottom Mid Circle Vertex
+    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
+    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
 
-             // Bottom Left Quarter
-             -0.1f,  -0.49f, 0.0f,   0.53f, 1.0f,      -0.2f, -0.98f, -0.5f,                  // 15
-             -0.2f,  -0.45f, 0.0f,   0.56f, 1.0f,       -0.4f, -0.92f, -0.5f,                 // 16
-             -0.3f,  -0.4f, 0.0f,    0.59f, 1.0f,       -0.6f, -0.8f, -0.5f,                  // 17
-             -0.4f,  -0.3f, 0.0f,    0.63f, 1.0f,       -0.8f, -0.6f, -0.5f,                  // 18
-             -0.46f, -0.2f, 0.0f,    0.66f, 1.0f,        -0.90f, -0.43f, -0.5f,               // 19
-             -0.49f, -0.1f, 0.0f,    0.70f, 1.0f,       -0.98f, -0.2f, -0.5f,                 // 20
+    // Create Vertex Attribute Pointers
+    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
 
-             -0.5f,  -0.0f, 0.0f,    0.75f, 1.0f,       -1.0f, 0.0f, -0.5f,                  // 21 Left Mid Circle Vertex
-             // Top Right Quarter
-             -0.49f, 0.1f, 0.0f,     0.78f, 1.0f,      -0.98f, 0.2f, -0.5f,                 // 22
-             -0.45f, 0.2f, 0.0f,     0.81f, 1.0f,      -0.92f, 0.4f, -0.5f,                 // 23
-             -0.4f,  0.3f, 0.0f,     0.84f, 1.0f,      -0.8f, 0.6f, -0.5f,                  // 24
-             -0.3f,  0.4f, 0.0f,     0.87f, 1.0f,      -0.6f, 0.8f, -0.5f,                  // 25
-             -0.2f,  0.46f, 0.0f,    0.91f, 1.0f,      -0.4f, 0.92f, -0.5f,                 // 26
-             -0.1f,  0.49f, 0.0f,    0.93f, 1.0f,      -0.2f, 0.98f, -0.5f,                 // 27
+    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
+    glEnableVertexAttribArray(1);
 
-              0.0f,  0.0f, 0.0f,     1.0f, 1.0f,       -0.5f, 1.0f, -0.5f,          // Circle Center 28
+    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
+    glEnableVertexAttribArray(2);
+    }
 
-            //Bottom Circle
-            // Vertex Positions    
-            // Top Right Quarter
-             0.0f,  0.5f, 1.0f,     0.0f, 0.0f,  0.0f, 1.0f, -0.5f,            // Top Mid Circle Vertex 29
+    else if (meshChoice == 7) {
+    //**********************************************************************
+    //Full Cylinder
+    //**********************************************************************
 
-             0.1f,  0.49f, 1.0f,    0.03f, 0.0f, 0.2f, 0.98f, -0.5f,           // 30
-             0.2f,  0.45f, 1.0f,    0.06f, 0.0f,  0.4f, 0.92f, -0.5f,          // 31
-             0.3f,  0.4f, 1.0f,     0.12f, 0.0f,  0.6f, 0.8f, -0.5f,           // 32
-             0.4f,  0.3f, 1.0f,     0.15f, 0.0f,  0.8f, 0.6f, -0.5f,           // 33
-             0.46f,  0.2f, 1.0f,    0.18f, 0.0f,   0.90f, 0.43f, -0.5f,        // 34
-             0.49f,  0.1f, 1.0f,    0.21f, 0.0f,  0.98f, 0.2f, -0.5f,          // 35
+    // Position and Color data
+    GLfloat verts[] = {
 
-             0.5f,  0.0f, 1.0f,     0.25f, 0.0f,  1.0f, 0.0f, -0.5f,          //36 Right Mid Circle Vertex
+        //Top Circle
+        // Vertex Positions    
+        // Top Right Quarter
+         0.0f,  0.5f, 0.0f,      0.0f,  1.0f,     0.0f, 1.0f, -0.5f,                    // Top Mid Circle Vertex 0
 
-             // Bottom Right Quarter
-             0.49f,  -0.1f, 1.0f,   0.28f, 0.0f,  0.98f, -0.2f, -0.5f,          // 37
-             0.45f,  -0.2f, 1.0f,   0.31f, 0.0f,  0.92f, -0.4f, -0.5f,          // 38
-             0.4f,  -0.3f, 1.0f,    0.34f, 0.0f,  0.8f, -0.6f, -0.5f,           // 39
-             0.3f,  -0.4f, 1.0f,    0.37f, 0.0f,  0.6f, -0.8f, -0.5f,           // 40
-             0.2f,  -0.46f, 1.0f,   0.40f, 0.0f,  0.4f, -0.92f, -0.5f,          // 41
-             0.1f,  -0.49f, 1.0f,   0.43f, 0.0f,  0.2f, -0.98f, -0.5f,          // 42
+         0.1f,  0.49f, 0.0f,     0.03f, 1.0f,     0.2f, 0.98f, -0.5f,                   // 1
+         0.2f,  0.45f, 0.0f,     0.06f, 1.0f,      0.4f, 0.92f, -0.5f,                 // 2
+         0.3f,  0.4f, 0.0f,      0.12f, 1.0f,      0.6f, 0.8f, -0.5f,                   // 3
+         0.4f,  0.3f, 0.0f,      0.15f, 1.0f,      0.8f, 0.6f, -0.5f,                  // 4
+         0.46f,  0.2f, 0.0f,     0.18f, 1.0f,       0.90f, 0.43f, -0.5f,                // 5
+         0.49f,  0.1f, 0.0f,     0.21f, 1.0f,      0.98f, 0.2f, -0.5f,                   // 6
+
+         0.5f,  0.0f, 0.0f,      0.25f, 1.0f,      1.0f, 0.0f, -0.5f,                  // 7 Right Mid Circle Vertex
+
+         // Bottom Right Quarter
+         0.49f,  -0.1f, 0.0f,    0.28f, 1.0f,      0.98f, -0.2f, -0.5f,                 // 8
+         0.45f,  -0.2f, 0.0f,    0.31f, 1.0f,      0.92f, -0.4f, -0.5f,                 // 9
+         0.4f,  -0.3f, 0.0f,     0.34f, 1.0f,      0.8f, -0.6f, -0.5f,                  // 10
+         0.3f,  -0.4f, 0.0f,     0.37f, 1.0f,      0.6f, -0.8f, -0.5f,                  // 11
+         0.2f,  -0.46f, 0.0f,    0.40f, 1.0f,      0.4f, -0.92f, -0.5f,                 // 12
+         0.1f,  -0.49f, 0.0f,    0.43f, 1.0f,      0.2f, -0.98f, -0.5f,                 // 13
+
+         0.0f,  -0.5f, 0.0f,     0.5f, 1.0f,       0.0f, -1.0f, -0.5f,                 // 14 Bottom Mid Circle Vertex
+
+         // Bottom Left Quarter
+         -0.1f,  -0.49f, 0.0f,   0.53f, 1.0f,      -0.2f, -0.98f, -0.5f,                  // 15
+         -0.2f,  -0.45f, 0.0f,   0.56f, 1.0f,       -0.4f, -0.92f, -0.5f,                 // 16
+         -0.3f,  -0.4f, 0.0f,    0.59f, 1.0f,       -0.6f, -0.8f, -0.5f,                  // 17
+         -0.4f,  -0.3f, 0.0f,    0.63f, 1.0f,       -0.8f, -0.6f, -0.5f,                  // 18
+         -0.46f, -0.2f, 0.0f,    0.66f, 1.0f,        -0.90f, -0.43f, -0.5f,               // 19
+         -0.49f, -0.1f, 0.0f,    0.70f, 1.0f,       -0.98f, -0.2f, -0.5f,                 // 20
+
+         -0.5f,  -0.0f, 0.0f,    0.75f, 1.0f,       -1.0f, 0.0f, -0.5f,                  // 21 Left Mid Circle Vertex
+         // Top Right Quarter
+         -0.49f, 0.1f, 0.0f,     0.78f, 1.0f,      -0.98f, 0.2f, -0.5f,                 // 22
+         -0.45f, 0.2f, 0.0f,     0.81f, 1.0f,      -0.92f, 0.4f, -0.5f,                 // 23
+         -0.4f,  0.3f, 0.0f,     0.84f, 1.0f,      -0.8f, 0.6f, -0.5f,                  // 24
+         -0.3f,  0.4f, 0.0f,     0.87f, 1.0f,      -0.6f, 0.8f, -0.5f,                  // 25
+         -0.2f,  0.46f, 0.0f,    0.91f, 1.0f,      -0.4f, 0.92f, -0.5f,                 // 26
+         -0.1f,  0.49f, 0.0f,    0.93f, 1.0f,      -0.2f, 0.98f, -0.5f,                 // 27
+
+          0.0f,  0.0f, 0.0f,     1.0f, 1.0f,       -0.5f, 1.0f, -0.5f,          // Circle Center 28
+
+        //Bottom Circle
+        // Vertex Positions    
+        // Top Right Quarter
+         0.0f,  0.5f, 1.0f,     0.0f, 0.0f,  0.0f, 1.0f, -0.5f,            // Top Mid Circle Vertex 29
+
+         0.1f,  0.49f, 1.0f,    0.03f, 0.0f, 0.2f, 0.98f, -0.5f,           // 30
+         0.2f,  0.45f, 1.0f,    0.06f, 0.0f,  0.4f, 0.92f, -0.5f,          // 31
+         0.3f,  0.4f, 1.0f,     0.12f, 0.0f,  0.6f, 0.8f, -0.5f,           // 32
+         0.4f,  0.3f, 1.0f,     0.15f, 0.0f,  0.8f, 0.6f, -0.5f,           // 33
+         0.46f,  0.2f, 1.0f,    0.18f, 0.0f,   0.90f, 0.43f, -0.5f,        // 34
+         0.49f,  0.1f, 1.0f,    0.21f, 0.0f,  0.98f, 0.2f, -0.5f,          // 35
+
+         0.5f,  0.0f, 1.0f,     0.25f, 0.0f,  1.0f, 0.0f, -0.5f,          //36 Right Mid Circle Vertex
+
+         // Bottom Right Quarter
+         0.49f,  -0.1f, 1.0f,   0.28f, 0.0f,  0.98f, -0.2f, -0.5f,          // 37
+         0.45f,  -0.2f, 1.0f,   0.31f, 0.0f,  0.92f, -0.4f, -0.5f,          // 38
+         0.4f,  -0.3f, 1.0f,    0.34f, 0.0f,  0.8f, -0.6f, -0.5f,           // 39
+         0.3f,  -0.4f, 1.0f,    0.37f, 0.0f,  0.6f, -0.8f, -0.5f,           // 40
+         0.2f,  -0.46f, 1.0f,   0.40f, 0.0f,  0.4f, -0.92f, -0.5f,          // 41
+         0.1f,  -0.49f, 1.0f,   0.43f, 0.0f,  0.2f, -0.98f, -0.5f,          // 42
+
+         0.0f,  -0.5f, 1.0f,    0.5f, 0.0f,   0.0f, -1.0f, -0.5f,            //43 Bottom Mid Circle Vertex
+
+         // Bottom Left Quarter
+         -0.1f,  -0.49f, 1.0f,  0.53f, 0.0f,   -0.2f, -0.98f, -0.5f,             //44
+         -0.2f,  -0.45f, 1.0f,  0.56f, 0.0f,    -0.4f, -0.92f, -0.5f,            //45
+         -0.3f,  -0.4f, 1.0f,   0.59f, 0.0f,    -0.6f, -0.8f, -0.5f,             //46
+         -0.4f,  -0.3f, 1.0f,   0.63f, 0.0f,    -0.8f, -0.6f, -0.5f,              //47
+         -0.46f, -0.2f, 1.0f,   0.66f, 0.0f,     -0.90f, -0.43f, -0.5f,          //48
+         -0.49f, -0.1f, 1.0f,   0.70f, 0.0f,    -0.98f, -0.2f, -0.5f,           // 49
+
+         -0.5f,  -0.0f, 1.0f,   0.75f, 0.0f,    -1.0f, 0.0f, -0.5f,              //50 Left Mid Circle Vertex
+
+         // Top Right Quarter
+         -0.49f, 0.1f, 1.0f,    0.78f, 0.0f,  -0.98f, 0.2f, -0.5f,             // 51
+         -0.45f, 0.2f, 1.0f,    0.81f, 0.0f,  -0.92f, 0.4f, -0.5f,             //52
+         -0.4f,  0.3f, 1.0f,    0.84f, 0.0f,  -0.8f, 0.6f, -0.5f,             // 53
+         -0.3f,  0.4f, 1.0f,    0.87f, 0.0f,  -0.6f, 0.8f, -0.5f,              //54
+         -0.2f,  0.46f, 1.0f,   0.91f, 0.0f,  -0.4f, 0.92f, -0.5f,             //55
+         -0.1f,  0.49f, 1.0f,   0.93f, 0.0f,  -0.2f, 0.98f, -0.5f,             //56
+
+         0.0f,  0.0f, 1.0f,      1.0f, 1.0f,  0.0f, 0.0f, 0.0f,              // Circle Center 57
+
+         0.0f,  0.5f, 0.0f,      1.0f,  1.0f,  0.0f, 0.0f, 0.0f,          // Top Mid Circle Vertex 58
+         0.0f,  0.5f, 1.0f,      1.0f,  0.0f,   0.0f, 0.0f, 0.0f,          // bottom Mid Circle Vertex 59
+
+    };
+
+    // Index data to share position data
+    GLushort indices[] = {
+        //**********************************************************************
+        //Coffee Cup Body
+        //**********************************************************************
+
+        //Top Circle 
+        //Top Right Quarter
+        0, 1, 28,
+        1, 2, 28,
+        2, 3, 28,
+        3, 4, 28,
+        4, 5, 28,
+        5, 6, 28,
+        6, 7, 28,
+
+        //Bottom Right Quarter
+        7, 8, 28,
+        8, 9, 28,
+        9, 10, 28,
+        10, 11, 28,
+        11, 12, 28,
+        12, 13, 28,
+        13, 14, 28,
+
+        //Bottom Left Quarter
+        14, 15, 28,
+        15, 16, 28,
+        16, 17, 28,
+        17, 18, 28,
+        18, 19, 28,
+        19, 20, 28,
+        20, 21, 28,
+
+        //Top Right Quarter
+        21, 22, 28,
+        22, 23, 28,
+        23, 24, 28,
+        24, 25, 28,
+        25, 26, 28,
+        26, 27, 28,
+        27, 0, 28,
+
+        //Bottom Circle 
+        //Top Right Quarter
+        29, 30, 57,
+        30, 31, 57,
+        31, 32, 57,
+        32, 33, 57,
+        33, 34, 57,
+        34, 35, 57,
+        35, 36, 57,
+
+        //Bottom Right Quarter
+        36, 37, 57,
+        37, 38, 57,
+        38, 39, 57,
+        39, 40, 57,
+        40, 41, 57,
+        41, 42, 57,
+        42, 43, 57,
+
+        //Bottom Left Quarter
+        43, 44, 57,
+        44, 45, 57,
+        45, 46, 57,
+        46, 47, 57,
+        47, 48, 57,
+        48, 49, 57,
+        49, 50, 57,
+
+        //Top Right Quarter
+        50, 51, 57,
+        51, 52, 57,
+        52, 53, 57,
+        53, 54, 57,
+        54, 55, 57,
+        55, 56, 57,
+        56, 29, 57,
+
+        //Cylinder Sides
+        0, 29, 30,
+        30, 1, 0,
+
+        1, 30, 31,
+        31, 2, 1,
+
+        2, 31, 32,
+        32, 3, 2,
+
+        3, 32, 33,
+        33, 4, 3,
+
+        4, 33, 34,
+        34, 5, 4,
+
+        5, 34, 35,
+        35, 6, 5,
+
+        6, 35, 36,
+        36, 7, 6,
+
+        7, 36, 37,
+        37, 8, 7,
+
+        8, 37, 38,
+        38, 9, 8,
+
+        9, 38, 39,
+        39, 10, 9,
+
+        10, 39, 40,
+        40, 11, 10,
+
+        11, 40, 41,
+        41, 12, 11,
+
+        12, 41, 42,
+        42, 13, 12,
+
+        13, 42, 43,
+        43, 14, 13,
+
+        14, 43, 44,
+        44, 15, 14,
+
+        15, 44, 45,
+        45, 16, 15,
+
+        16, 45, 46,
+        46, 17, 16,
+
+        17, 46, 47,
+        47, 18, 17,
+
+        18, 47, 48,
+        48, 19, 18,
+
+        19, 48, 49,
+        49, 20, 19,
+
+        20, 49, 50,
+        50, 21, 20,
+
+        21, 50, 51,
+        51, 22, 21,
+
+        22, 51, 52,
+        52, 23, 22,
+
+        23, 52, 53,
+        53, 24, 23,
+
+        24, 53, 54,
+        54, 25, 24,
+
+        25, 54, 55,
+        55, 26, 25,
+
+        26, 55, 56,
+        56, 27, 26,
+
+        27, 58, 59,
+        27, 56, 59
+    };
+
+    const GLuint floatsPerTexture = 2;
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
+
+
+    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+    glBindVertexArray(mesh.vao);
+
+    // Create 2 buffers: first one for the vertex data; second one for the indices
+    glGenBuffers(2, mesh.vbos);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+
+    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
+    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+
+    // Create Vertex Attribute Pointers
+    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerTexture)));
+    glEnableVertexAttribArray(2);
+
+    }
+
+    // Hand the vertex array and its buffers to the registry
+    GLint vertexBytes = 0, indexBytes = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &vertexBytes);
+
+    // Bounding sphere from the positions in attribute 0, whatever the layout of the branch above
+    GLint vertexStride = 0;
+    glBindVertexArray(mesh.vao);
+    glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &vertexStride);
+    glBindVertexArray(0);
+    std::vector<GLfloat> vertexData(vertexBytes / sizeof(GLfloat));
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, vertexData.data());
+    const size_t floatStride = vertexStride > 0 ? vertexStride / sizeof(GLfloat) : 3;
+    mesh.radius = 0.0f;
+    for (size_t i = 0; i + 2 < vertexData.size(); i += floatStride)
+        mesh.radius = std::max(mesh.radius, glm::length(glm::vec3(vertexData[i], vertexData[i + 1], vertexData[i + 2])));
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[1]);
+    glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &indexBytes);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    const uint32_t names[3] = { mesh.vao, mesh.vbos[0], mesh.vbos[1] };
+    mesh.resource = gResources->Create(RESOURCE_MESH, "mesh " + std::to_string(meshChoice), names, 3, (size_t)vertexBytes + indexBytes);
+}
+
+
+
+//**********************************************************
+//DESTROY MESH
+//**********************************************************
+void UDestroyMesh(GLMesh& mesh)
+{
+    gResources->Release(mesh.resource);
+    mesh.resource = ResourceHandle();
+}
+
+//**********************************************************
+//CREATE TEXTURE
+//**********************************************************
+
+// GL enums for a baked texture format
+void UTextureFormatToGL(TextureFormat format, GLenum& internalFormat, GLenum& pixelFormat)
+{
+    switch (format)
+    {
+    case TEXTURE_RGB8:  internalFormat = GL_RGB8;  pixelFormat = GL_RGB;  break;
+    case TEXTURE_RGBA8: internalFormat = GL_RGBA8; pixelFormat = GL_RGBA; break;
+    case TEXTURE_BC1:   internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  pixelFormat = GL_RGB;  break;
+    case TEXTURE_BC3:   internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; pixelFormat = GL_RGBA; break;
+    }
+}
+
+// Reads the image behind filename into CPU memory, ready to be uploaded.
+// With compression enabled the baked mip chain comes from the KTX2 cache when the source is unchanged,
+// otherwise the image is decoded, encoded and written to the cache for the next launch.
+// Makes no GL calls so it can run on a worker thread.
+// Only levels at most maxDimension texels on their longest side are kept, the finer ones
+// are left in the cache file for streaming. The cache file path is returned in cachePath.
+bool ULoadTextureData(const char* filename, BakedTexture& texture, int maxDimension, std::string* cachePath)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::string cacheFile;
+    if (gUseCompressedTextures)
+    {
+        char cacheName[64];
+        snprintf(cacheName, sizeof(cacheName), "%016llx_v%u.ktx2", (unsigned long long)HashContent(bytes.data(), bytes.size()), TEXTURE_BAKER_VERSION);
+        cacheFile = std::string(TEXTURE_CACHE_DIR) + cacheName;
+        if (cachePath)
+            *cachePath = cacheFile;
+
+        if (ReadKtx2(cacheFile, texture, maxDimension))
+            return true;
+    }
+
+    int width, height, channels;
+    unsigned char* image = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 0);
+    if (!image)
+        return false;
+
+    flipImageVertically(image, width, height, channels);
+
+    bool loaded = channels == 3 || channels == 4;
+    if (!loaded)
+        cout << "Not implemented to handle image with " << channels << " channels" << endl;
+    else if (gUseCompressedTextures)
+    {
+        BakeTexture(image, width, height, channels, gTextureDecodePool, texture);
+
+        std::error_code error;
+        std::filesystem::create_directories(TEXTURE_CACHE_DIR, error);
+        if (!WriteKtx2(cacheFile, texture))
+            cout << "Failed to write texture cache " << cacheFile << endl;
+
+        // Keep only the coarse end of the chain that was asked for
+        while (texture.levels.size() > 1 && std::max(texture.levels[0].width, texture.levels[0].height) > maxDimension)
+        {
+            texture.levels.erase(texture.levels.begin());
+            ++texture.firstLevel;
+        }
+    }
+    else
+    {
+        // Uncompressed single level, the mip chain is generated on the GPU
+        texture.format = channels == 3 ? TEXTURE_RGB8 : TEXTURE_RGBA8;
+        texture.baseWidth = width;
+        texture.baseHeight = height;
+        texture.mipCount = 1;
+        texture.firstLevel = 0;
+        texture.levels.clear();
+        texture.levels.push_back({ width, height, std::vector<unsigned char>(image, image + (size_t)width * height * channels) });
+    }
+
+    stbi_image_free(image);
+    return loaded;
+}
+
+bool UCreateTexture(const char* filename, ResourceHandle& handle)
+{
+    BakedTexture texture;
+    if (!ULoadTextureData(filename, texture))
+        return false; // Error loading the image
+
+    GLenum internalFormat, pixelFormat;
+    UTextureFormatToGL(texture.format, internalFormat, pixelFormat);
+
+    const TextureLevel& base = texture.levels[0];
+    const bool compressed = IsBlockCompressed(texture.format);
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+
+    // Immutable storage for the exact mip chain, filtering comes from the shared sampler objects
+    const GLsizei mipLevels = compressed ? (GLsizei)texture.levels.size() : UMipLevelCount(base.width, base.height);
+    glTexStorage2D(GL_TEXTURE_2D, mipLevels, internalFormat, base.width, base.height);
+
+    if (compressed)
+    {
+        // Baked blocks go straight to the GPU, mip chain included
+        for (size_t level = 0; level < texture.levels.size(); ++level)
+        {
+            const TextureLevel& data = texture.levels[level];
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, data.width, data.height, internalFormat, (GLsizei)data.data.size(), data.data.data());
+        }
+    }
+    else
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, base.width, base.height, pixelFormat, GL_UNSIGNED_BYTE, base.data.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+    handle = gResources->Create(RESOURCE_TEXTURE, filename, &textureId, 1, UTextureBytes(texture.format, base.width, base.height, mipLevels));
+    return true;
+}
+
+// Number of levels in a full mip chain down to 1x1
+GLsizei UMipLevelCount(int width, int height)
+{
+    GLsizei levels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2)
+        ++levels;
+    return levels;
+}
+
+//**********************************************************
+//SAMPLERS
+//
+//Filtering and wrapping live in sampler objects shared by all
+//textures instead of per-texture parameters
+//**********************************************************
+void UCreateSamplers()
+{
+    glGenSamplers(SAMPLER_COUNT, gSamplers);
+
+    for (GLuint sampler : gSamplers)
+    {
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+    glSamplerParameteri(gSamplers[SAMPLER_BILINEAR], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    float maxAnisotropy = 1.0f;
+    if (GLEW_ARB_texture_filter_anisotropic || GLEW_EXT_texture_filter_anisotropic)
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropy);
+    gAnisotropy = std::min(std::max(gAnisotropy, 1.0f), maxAnisotropy);
+    if (maxAnisotropy > 1.0f)
+        glSamplerParameterf(gSamplers[SAMPLER_ANISOTROPIC], GL_TEXTURE_MAX_ANISOTROPY, gAnisotropy);
+
+    cout << "INFO: Texture filtering: trilinear, " << gAnisotropy << "x anisotropic" << endl;
+
+    // Every material samples through unit 0
+    glBindSampler(0, gSamplers[SAMPLER_ANISOTROPIC]);
+}
+
+void UDestroySamplers()
+{
+    glBindSampler(0, 0);
+    glDeleteSamplers(SAMPLER_COUNT, gSamplers);
+}
+
+//**********************************************************
+//DESTROY TEXTURE
+//**********************************************************
+void UDestroyTexture(ResourceHandle& texture)
+{
+    gResources->Release(texture);
+    texture = ResourceHandle();
+}
 
-             0.0f,  -0.5f, 1.0f,    0.5f, 0.0f,   0.0f, -1.0f, -0.5f,            //43 Bottom Mid Circle Vertex
+// Texture to bind for the handle, the placeholder while nothing is resident yet
+GLuint UTextureName(ResourceHandle texture)
+{
+    const GLuint name = gResources->Name(texture);
+    return name != 0 ? name : gResources->Name(gPlaceholderTexture);
+}
 
-             // Bottom Left Quarter
-             -0.1f,  -0.49f, 1.0f,  0.53f, 0.0f,   -0.2f, -0.98f, -0.5f,             //44
-             -0.2f,  -0.45f, 1.0f,  0.56f, 0.0f,    -0.4f, -0.92f, -0.5f,            //45
-             -0.3f,  -0.4f, 1.0f,   0.59f, 0.0f,    -0.6f, -0.8f, -0.5f,             //46
-             -0.4f,  -0.3f, 1.0f,   0.63f, 0.0f,    -0.8f, -0.6f, -0.5f,              //47
-             -0.46f, -0.2f, 1.0f,   0.66f, 0.0f,     -0.90f, -0.43f, -0.5f,          //48
-             -0.49f, -0.1f, 1.0f,   0.70f, 0.0f,    -0.98f, -0.2f, -0.5f,           // 49
+// GPU bytes of a mip chain of the given number of levels
+size_t UTextureBytes(TextureFormat format, int width, int height, int levels)
+{
+    size_t bytes = 0;
+    for (int level = 0; level < levels; ++level)
+        bytes += TextureLevelBytes(format, std::max(1, width >> level), std::max(1, height >> level));
+    return bytes;
+}
 
-             -0.5f,  -0.0f, 1.0f,   0.75f, 0.0f,    -1.0f, 0.0f, -0.5f,              //50 Left Mid Circle Vertex
-                                          
-             // Top Right Quarter
-             -0.49f, 0.1f, 1.0f,    0.78f, 0.0f,  -0.98f, 0.2f, -0.5f,             // 51
-             -0.45f, 0.2f, 1.0f,    0.81f, 0.0f,  -0.92f, 0.4f, -0.5f,             //52
-             -0.4f,  0.3f, 1.0f,    0.84f, 0.0f,  -0.8f, 0.6f, -0.5f,             // 53
-             -0.3f,  0.4f, 1.0f,    0.87f, 0.0f,  -0.6f, 0.8f, -0.5f,              //54
-             -0.2f,  0.46f, 1.0f,   0.91f, 0.0f,  -0.4f, 0.92f, -0.5f,             //55
-             -0.1f,  0.49f, 1.0f,   0.93f, 0.0f,  -0.2f, 0.98f, -0.5f,             //56
+//**********************************************************
+//ASYNC TEXTURE LOADING
+//
+//Worker threads decode images while the render thread copies
+//the pixels into a persistently mapped pixel unpack buffer a
+//few rows at a time, so loading never stalls a frame
+//**********************************************************
 
-             0.0f,  0.0f, 1.0f,      1.0f, 1.0f,  0.0f, 0.0f, 0.0f,              // Circle Center 57
+// 1x1 texture drawn while the real texture is still loading
+void UCreatePlaceholderTexture(ResourceHandle& texture)
+{
+    const unsigned char pixel[4] = { 128, 128, 128, 255 };
 
-             0.0f,  0.5f, 0.0f,      1.0f,  1.0f,  0.0f, 0.0f, 0.0f,          // Top Mid Circle Vertex 58
-             0.0f,  0.5f, 1.0f,      1.0f,  0.0f,   0.0f, 0.0f, 0.0f,          // bottom Mid Circle Vertex 59
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-        };
+    texture = gResources->Create(RESOURCE_TEXTURE, "placeholder", &textureId, 1, sizeof(pixel));
+}
 
-        // Index data to share position data
-        GLushort indices[] = {
-            //**********************************************************************
-            //Coffee Cup Body
-            //**********************************************************************
-            
-            //Bottom Circle 
-            //Top Right Quarter
-            29, 30, 57,
-            30, 31, 57,
-            31, 32, 57,
-            32, 33, 57,
-            33, 34, 57,
-            34, 35, 57,
-            35, 36, 57,
+bool UCreateStagingBuffer()
+{
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr size = TEXTURE_UPLOAD_BUDGET * STAGING_SEGMENTS;
 
-            //Bottom Right Quarter
-            36, 37, 57,
-            37, 38, 57,
-            38, 39, 57,
-            39, 40, 57,
-            40, 41, 57,
-            41, 42, 57,
-            42, 43, 57,
+    glGenBuffers(1, &gStagingBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gStagingBuffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    gStagingMemory = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-            //Bottom Left Quarter
-            43, 44, 57,
-            44, 45, 57,
-            45, 46, 57,
-            46, 47, 57,
-            47, 48, 57,
-            48, 49, 57,
-            49, 50, 57,
+    const uint32_t name = gStagingBuffer;
+    gResources->Create(RESOURCE_BUFFER, "texture staging buffer", &name, 1, (size_t)size);
 
-            //Top Right Quarter
-            50, 51, 57,
-            51, 52, 57,
-            52, 53, 57,
-            53, 54, 57,
-            54, 55, 57,
-            55, 56, 57,
-            56, 29, 57,
+    if (gStagingMemory == nullptr)
+    {
+        cout << "Failed to map the texture staging buffer" << endl;
+        return false;
+    }
+    return true;
+}
 
-            //Cylinder Sides
-            0, 29, 30,
-            30, 1, 0,
+// Uploads still in flight are abandoned together with the buffer
+void UDestroyStagingBuffer()
+{
+    for (GLsync& fence : gStagingFences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+        fence = 0;
+    }
 
-            1, 30, 31,
-            31, 2, 1,
+    for (TextureUpload& upload : gActiveUploads)
+        if (upload.uploadTextureId != 0)
+            glDeleteTextures(1, &upload.uploadTextureId);
+    gActiveUploads.clear();
 
-            2, 31, 32,
-            32, 3, 2,
+    {
+        std::lock_guard<std::mutex> lock(gDecodedTexturesMutex);
+        gDecodedTextures.clear();
+    }
 
-            3, 32, 33,
-            33, 4, 3,
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gStagingBuffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gStagingBuffer));
+    gStagingBuffer = 0;
+    gStagingMemory = nullptr;
+}
 
-            4, 33, 34,
-            34, 5, 4,
+// Queues the image for decoding. A new handle draws the placeholder until the texture is resident,
+// an existing one keeps drawing its current texture until the reloaded one replaces it.
+void UCreateTextureAsync(const char* filename, ResourceHandle& texture)
+{
+    if (!gResources->IsAlive(texture))
+        texture = gResources->Create(RESOURCE_TEXTURE, filename, nullptr, 0, 0);
+    ++gTexturesPending;
+
+    // Compressed textures are streamed, only their coarse levels are loaded now. A reload resets
+    // the resident levels once it uploads, so neither stream-ins nor eviction touch it meanwhile.
+    const bool streamed = gUseCompressedTextures;
+    if (streamed)
+    {
+        StreamedTexture* stream = UFindStreamedTexture(texture);
+        if (stream == nullptr)
+        {
+            gStreamedTextures.push_back({ texture, "", TEXTURE_BC1, 0, 0, 0, 0, 0, 0, false, 0 });
+            stream = &gStreamedTextures.back();
+        }
+        stream->loading = true;
+    }
 
-            5, 34, 35,
-            35, 6, 5,
+    std::string path = filename;
+    ResourceHandle target = texture;
+    gTextureDecodePool->Submit([path, target, streamed]()
+    {
+        TextureUpload upload;
+        upload.filename = path;
+        upload.handle = target;
+        upload.loaded = ULoadTextureData(path.c_str(), upload.texture, streamed ? STREAMING_TAIL_SIZE : INT_MAX, &upload.cachePath);
+
+        std::lock_guard<std::mutex> lock(gDecodedTexturesMutex);
+        gDecodedTextures.push_back(std::move(upload));
+    });
+}
 
-            6, 35, 36,
-            36, 7, 6,
+// Starts loading every scene texture, also used to reload them all from disk
+void ULoadTextures()
+{
+    // Generated materials never touch the disk and leave the atlas to the file based ones
+    std::vector<TextureAsset> packedAssets;
+    for (size_t i = 0; i < gSceneDescription.textures.size(); ++i)
+    {
+        const SceneTexture& asset = gSceneDescription.textures[i];
+        const char* filename = gSceneDescription.String(asset.path);
+        if (asset.pattern != SCENE_NONE && (asset.generate || gUseProceduralTextures))
+        {
+            const ProceduralMaterial procedural = { (ProceduralPattern)asset.pattern, glm::make_vec3(asset.baseColor),
+                                                    glm::make_vec3(asset.detailColor), asset.patternScale };
+            UCreateProceduralTexture(procedural, gSceneTextures[i]);
+        }
+        else if (asset.atlas && gUseTextureAtlas)
+            packedAssets.push_back({ filename, &gSceneTextures[i] });
+        else
+            UCreateTextureAsync(filename, gSceneTextures[i]);
+    }
+    if (!packedAssets.empty())
+        UCreateAtlasAsync(packedAssets.data(), (int)packedAssets.size());
+}
 
-            7, 36, 37,
-            37, 8, 7,
+// Generated textures follow the texture budget the streamed ones live in: the largest power of two
+// up to 2048 whose full chain takes at most an eighth of it, never below the streaming tail size
+int UProceduralSize()
+{
+    if (gProceduralSize > 0)
+        return gProceduralSize;
+
+    const size_t share = (size_t)(gTextureBudgetMB * 1024.0f * 1024.0f) / 8;
+    int size = 2048;
+    while (size > STREAMING_TAIL_SIZE && UTextureBytes(TEXTURE_RGBA8, size, size, UMipLevelCount(size, size)) > share)
+        size /= 2;
+    return size;
+}
 
-            8, 37, 38,
-            38, 9, 8,
+// Fills a full mip chain with the material's pattern on the GPU. The texture is ready for the
+// next draw, so it replaces whatever the handle held straight away.
+void UCreateProceduralTexture(const ProceduralMaterial& material, ResourceHandle& texture)
+{
+    if (!gResources->IsAlive(texture))
+        texture = gResources->Create(RESOURCE_TEXTURE, "procedural", nullptr, 0, 0);
 
-            9, 38, 39,
-            39, 10, 9,
+    const int size = UProceduralSize();
+    const GLsizei levels = UMipLevelCount(size, size);
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, size, size);
+
+    glUseProgram(gProceduralProgramId);
+    glUniform1i(PROCEDURAL_UNIFORM_PATTERN, (GLint)material.pattern);
+    glUniform3fv(PROCEDURAL_UNIFORM_BASE_COLOR, 1, glm::value_ptr(material.baseColor));
+    glUniform3fv(PROCEDURAL_UNIFORM_DETAIL_COLOR, 1, glm::value_ptr(material.detailColor));
+    glUniform1f(PROCEDURAL_UNIFORM_SCALE, material.scale);
+    glUniform1i(PROCEDURAL_UNIFORM_SIZE, size);
+
+    glBindImageTexture(0, textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute((size + 7) / 8, (size + 7) / 8, 1);
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    // Mip generation and later draws read what the image stores wrote
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const uint32_t name = textureId;
+    gResources->Replace(texture, &name, 1, UTextureBytes(TEXTURE_RGBA8, size, size, levels));
+}
+
+// Copies at most one staging segment worth of rows into the textures being loaded
+void UUploadPendingTextures()
+{
+    // Pick up everything the workers finished since last frame
+    {
+        std::lock_guard<std::mutex> lock(gDecodedTexturesMutex);
+        while (!gDecodedTextures.empty())
+        {
+            gActiveUploads.push_back(std::move(gDecodedTextures.front()));
+            gDecodedTextures.pop_front();
+        }
+    }
+
+    if (gActiveUploads.empty())
+        return;
+
+    // The GPU may still be reading this segment from a previous frame, try again next frame
+    GLsync& fence = gStagingFences[gStagingSegment];
+    if (fence)
+    {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    const GLsizeiptr segmentOffset = gStagingSegment * TEXTURE_UPLOAD_BUDGET;
+    GLsizeiptr used = 0;
+    bool uploadedDirect = false;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Staged rows are tightly packed
+
+    while (!gActiveUploads.empty())
+    {
+        TextureUpload& upload = gActiveUploads.front();
+
+        StreamedTexture* stream = UFindStreamedTexture(upload.handle);
+
+        if (!upload.loaded)
+        {
+            cout << "Failed to load texture " << upload.filename << endl;
+            if (upload.streamIn)
+            {
+                // Keep what is resident and stop asking for more
+                stream->cachePath.clear();
+                stream->loading = false;
+                --gStreamingLoads;
+            }
+            else
+            {
+                // A failed reload leaves the previous texture and its levels in place
+                if (stream)
+                    stream->loading = false;
+                UFinishTextureLoad();
+            }
+            gActiveUploads.pop_front();
+            continue;
+        }
+
+        const TextureFormat format = upload.texture.format;
+        const bool compressed = IsBlockCompressed(format);
+        GLenum internalFormat, pixelFormat;
+        UTextureFormatToGL(format, internalFormat, pixelFormat);
+
+        if (upload.uploadTextureId == 0)
+        {
+            const TextureLevel& base = upload.texture.levels[0];
+            const int firstLevel = upload.texture.firstLevel;
+
+            glGenTextures(1, &upload.uploadTextureId);
+            glBindTexture(GL_TEXTURE_2D, upload.uploadTextureId);
+
+            // Immutable storage for the chain from the first loaded level down to 1x1,
+            // contents arrive through the staging buffer
+            GLsizei mipLevels = compressed ? (GLsizei)(upload.texture.mipCount - firstLevel) : UMipLevelCount(base.width, base.height);
+            if (!upload.atlasEntries.empty())
+                mipLevels = std::min(mipLevels, (GLsizei)ATLAS_MIP_LEVELS);
+            glTexStorage2D(GL_TEXTURE_2D, mipLevels, internalFormat, base.width, base.height);
+            upload.storageLevels = mipLevels;
+
+            if (stream && !upload.streamIn)
+            {
+                // First load of a streamed texture, record what can be streamed in later
+                stream->cachePath = upload.cachePath;
+                stream->format = format;
+                stream->width = upload.texture.baseWidth;
+                stream->height = upload.texture.baseHeight;
+                stream->mipCount = upload.texture.mipCount;
+                stream->tailLevel = firstLevel;
+                stream->residentLevel = stream->mipCount;
+                stream->requestedLevel = firstLevel;
+            }
+            else if (stream)
+            {
+                // Coarser levels are already resident, copy them over on the GPU
+                for (int level = stream->residentLevel; level < stream->mipCount; ++level)
+                {
+                    const int width = std::max(1, stream->width >> level);
+                    const int height = std::max(1, stream->height >> level);
+                    glCopyImageSubData(gResources->Name(stream->handle), GL_TEXTURE_2D, level - stream->residentLevel, 0, 0, 0,
+                                       upload.uploadTextureId, GL_TEXTURE_2D, level - firstLevel, 0, 0, 0, width, height, 1);
+                }
+            }
+
+            // Smallest level first, matching the KTX2 file layout
+            upload.level = (int)upload.texture.levels.size() - 1;
+            upload.rowsUploaded = 0;
+        }
+        else
+            glBindTexture(GL_TEXTURE_2D, upload.uploadTextureId);
+
+        const TextureLevel& level = upload.texture.levels[upload.level];
+        const GLsizeiptr rowBytes = (GLsizeiptr)TextureRowBytes(format, level.width);
+        const int levelRows = TextureRowCount(format, level.height);
+
+        // A row wider than a whole segment never fits one. The driver gets it straight from the
+        // decoded data instead, one row per frame that takes the frame's whole budget.
+        const bool oversized = rowBytes > TEXTURE_UPLOAD_BUDGET;
+        if (uploadedDirect || (oversized && used > 0))
+            break; // Budget for this frame is spent
+        const int rows = oversized ? 1 : (int)std::min<GLsizeiptr>((TEXTURE_UPLOAD_BUDGET - used) / rowBytes, levelRows - upload.rowsUploaded);
+        if (rows <= 0)
+            break; // Budget for this frame is spent
+
+        const unsigned char* source = level.data.data() + upload.rowsUploaded * rowBytes;
+        const GLvoid* pixels = source;
+        if (!oversized)
+        {
+            memcpy(gStagingMemory + segmentOffset + used, source, rows * rowBytes);
+            pixels = (const GLvoid*)(segmentOffset + used);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gStagingBuffer);
+        }
+        if (compressed)
+        {
+            // Rows are rows of 4x4 blocks, the last one may hang over the level's edge
+            const int y = upload.rowsUploaded * 4;
+            const int height = std::min(rows * 4, level.height - y);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, y, level.width, height, internalFormat, (GLsizei)(rows * rowBytes), pixels);
+        }
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, upload.rowsUploaded, level.width, rows, pixelFormat, GL_UNSIGNED_BYTE, pixels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (oversized)
+            uploadedDirect = true;
+        else
+            used += rows * rowBytes;
+        upload.rowsUploaded += rows;
+
+        if (upload.rowsUploaded < levelRows)
+            break; // Budget for this frame is spent
+
+        if (upload.level > 0)
+        {
+            --upload.level;
+            upload.rowsUploaded = 0;
+            continue;
+        }
+
+        // Texture is complete, it replaces the placeholder, the previous load or the coarser texture it extends
+        if (!compressed)
+            glGenerateMipmap(GL_TEXTURE_2D);
+
+        const uint32_t name = upload.uploadTextureId;
+        if (gResources->IsAlive(upload.handle))
+        {
+            const TextureLevel& base = upload.texture.levels[0];
+            gResources->Replace(upload.handle, &name, 1, UTextureBytes(format, base.width, base.height, upload.storageLevels));
+        }
+        else
+            glDeleteTextures(1, &upload.uploadTextureId); // Released while it was loading
+
+        if (stream)
+        {
+            stream->residentLevel = upload.texture.firstLevel;
+            stream->loading = false;
+        }
+        if (!upload.atlasEntries.empty())
+            gAtlasEntries = std::move(upload.atlasEntries);
+
+        if (upload.streamIn)
+            --gStreamingLoads;
+        else
+            UFinishTextureLoad();
+        gActiveUploads.pop_front();
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (used > 0)
+    {
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gStagingSegment = (gStagingSegment + 1) % STAGING_SEGMENTS;
+    }
+}
+
+// Counts one texture load as done, uploaded or failed, and reports once none are left
+void UFinishTextureLoad()
+{
+    if (--gTexturesPending > 0)
+        return;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - gStartupTime;
+    cout << "INFO: All textures loaded in " << elapsed.count() << " ms" << endl;
+    UReportGpuMemory();
+}
+
+//**********************************************************
+//TEXTURE ATLAS
+//
+//Small textures are packed into one atlas at load time so
+//draws using them share a single bind. The packed atlas is
+//cached like any other texture, keyed on all of its sources.
+//**********************************************************
+
+// Packs the images behind assets into one texture and returns where each one ended up.
+// Only the image headers are needed for the layout, so a cache hit never decodes anything.
+// Makes no GL calls so it can run on a worker thread.
+bool ULoadAtlasData(const std::vector<TextureAsset>& assets, BakedTexture& texture, std::vector<AtlasEntry>& entries)
+{
+    std::vector<std::vector<unsigned char>> files;
+    std::vector<std::pair<int, int>> sizes;
+    std::vector<uint64_t> hashes;
+    int channels = 3;
+
+    for (const TextureAsset& asset : assets)
+    {
+        std::ifstream file(asset.filename, std::ios::binary);
+        if (!file)
+        {
+            cout << "Failed to open atlas texture " << asset.filename << endl;
+            return false;
+        }
+        files.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        int width, height, imageChannels;
+        if (!stbi_info_from_memory(files.back().data(), (int)files.back().size(), &width, &height, &imageChannels))
+        {
+            cout << "Failed to read atlas texture " << asset.filename << endl;
+            return false;
+        }
+        if (imageChannels == 4)
+            channels = 4; // One transparent image makes the whole atlas RGBA
+
+        sizes.push_back({ width, height });
+        hashes.push_back(HashContent(files.back().data(), files.back().size()));
+    }
+
+    int atlasWidth, atlasHeight;
+    std::vector<AtlasRect> rects;
+    if (!PackAtlas(sizes, ATLAS_PADDING, ATLAS_MAX_SIZE, atlasWidth, atlasHeight, rects))
+    {
+        cout << "Atlas textures do not fit in " << ATLAS_MAX_SIZE << "x" << ATLAS_MAX_SIZE << endl;
+        return false;
+    }
+
+    entries.clear();
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        const AtlasRect& rect = rects[i];
+        entries.push_back({ *assets[i].texture, glm::vec4((float)rect.width / atlasWidth, (float)rect.height / atlasHeight,
+                                                           (float)rect.x / atlasWidth, (float)rect.y / atlasHeight) });
+    }
+
+    std::string cacheFile;
+    if (gUseCompressedTextures)
+    {
+        hashes.push_back((uint64_t)ATLAS_PADDING);
+        char cacheName[64];
+        snprintf(cacheName, sizeof(cacheName), "atlas_%016llx_v%u.ktx2",
+                 (unsigned long long)HashContent((const unsigned char*)hashes.data(), hashes.size() * sizeof(uint64_t)), TEXTURE_BAKER_VERSION);
+        cacheFile = std::string(TEXTURE_CACHE_DIR) + cacheName;
+
+        if (ReadKtx2(cacheFile, texture))
+            return true;
+    }
+
+    std::vector<unsigned char> atlas((size_t)atlasWidth * atlasHeight * channels, 0);
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        int width, height, imageChannels;
+        unsigned char* image = stbi_load_from_memory(files[i].data(), (int)files[i].size(), &width, &height, &imageChannels, channels);
+        if (!image)
+            return false;
+
+        flipImageVertically(image, width, height, channels);
+        BlitWithGutter(atlas.data(), atlasWidth, atlasHeight, channels, image, rects[i], ATLAS_PADDING);
+        stbi_image_free(image);
+    }
+
+    cout << "INFO: Packed " << assets.size() << " textures into a " << atlasWidth << "x" << atlasHeight << " atlas" << endl;
+
+    if (gUseCompressedTextures)
+    {
+        BakeTexture(atlas.data(), atlasWidth, atlasHeight, channels, gTextureDecodePool, texture);
+
+        // The gutters only cover the first few levels
+        texture.levels.resize(std::min<size_t>(texture.levels.size(), ATLAS_MIP_LEVELS));
+        texture.mipCount = (int)texture.levels.size();
+
+        std::error_code error;
+        std::filesystem::create_directories(TEXTURE_CACHE_DIR, error);
+        if (!WriteKtx2(cacheFile, texture))
+            cout << "Failed to write texture cache " << cacheFile << endl;
+    }
+    else
+    {
+        texture.format = channels == 3 ? TEXTURE_RGB8 : TEXTURE_RGBA8;
+        texture.baseWidth = atlasWidth;
+        texture.baseHeight = atlasHeight;
+        texture.mipCount = 1;
+        texture.firstLevel = 0;
+        texture.levels.clear();
+        texture.levels.push_back({ atlasWidth, atlasHeight, std::move(atlas) });
+    }
+
+    return true;
+}
+
+// Queues the atlas build. The packed textures' handles keep pointing at the placeholder,
+// UBindTexture swaps in the atlas for them once it is resident.
+void UCreateAtlasAsync(const TextureAsset* assets, int count)
+{
+    if (!gResources->IsAlive(gTexture_atlas))
+        gTexture_atlas = gResources->Create(RESOURCE_TEXTURE, "texture atlas", nullptr, 0, 0);
+    for (int i = 0; i < count; ++i)
+    {
+        if (!gResources->IsAlive(*assets[i].texture))
+            *assets[i].texture = gResources->Create(RESOURCE_TEXTURE, assets[i].filename, nullptr, 0, 0);
+    }
+    ++gTexturesPending;
+
+    std::vector<TextureAsset> atlasAssets(assets, assets + count);
+    gTextureDecodePool->Submit([atlasAssets]()
+    {
+        TextureUpload upload;
+        upload.filename = "texture atlas";
+        upload.handle = gTexture_atlas;
+        upload.loaded = ULoadAtlasData(atlasAssets, upload.texture, upload.atlasEntries);
+
+        std::lock_guard<std::mutex> lock(gDecodedTexturesMutex);
+        gDecodedTextures.push_back(std::move(upload));
+    });
+}
+
+// Binds the texture on unit 0 for the next draw with programId. Packed textures bind the atlas
+// and point the draw's UVs at their region. Binding what is already bound is skipped, so
+// consecutive draws from the atlas cost no texture switch.
+void UBindTexture(ResourceHandle texture)
+{
+    GLuint bindId = UTextureName(texture);
+    glm::vec4 uvScaleOffset(1.0f, 1.0f, 0.0f, 0.0f);
+    for (const AtlasEntry& entry : gAtlasEntries)
+    {
+        if (entry.texture == texture)
+        {
+            bindId = UTextureName(gTexture_atlas);
+            uvScaleOffset = entry.uvScaleOffset;
+            break;
+        }
+    }
+
+    glUniform4fv(UNIFORM_UV_SCALE_OFFSET, 1, glm::value_ptr(uvScaleOffset));
+
+    if (bindId != gBoundTexture)
+    {
+        glBindTexture(GL_TEXTURE_2D, bindId);
+        gBoundTexture = bindId;
+    }
+}
+
+//**********************************************************
+//MIP STREAMING
+//
+//Draws ask for the finest level they can resolve on screen,
+//finer levels are streamed in from the KTX2 cache within the
+//residency budget and least recently used levels make room.
+//A residency change swaps in a texture sized for the new level
+//range, the levels both share are copied on the GPU.
+//**********************************************************
+StreamedTexture* UFindStreamedTexture(ResourceHandle texture)
+{
+    for (StreamedTexture& stream : gStreamedTextures)
+        if (stream.handle == texture)
+            return &stream;
+    return nullptr;
+}
+
+// GPU bytes of the chain levels [firstLevel, endLevel)
+size_t UStreamedBytes(const StreamedTexture& stream, int firstLevel, int endLevel)
+{
+    size_t bytes = 0;
+    for (int level = firstLevel; level < endLevel; ++level)
+        bytes += TextureLevelBytes(stream.format, std::max(1, stream.width >> level), std::max(1, stream.height >> level));
+    return bytes;
+}
+
+// Drops the finest resident levels by moving the rest into a smaller texture
+void UTrimTextureLevels(StreamedTexture& stream, int newResidentLevel)
+{
+    newResidentLevel = std::min(newResidentLevel, stream.tailLevel);
+    if (newResidentLevel <= stream.residentLevel)
+        return;
+
+    GLenum internalFormat, pixelFormat;
+    UTextureFormatToGL(stream.format, internalFormat, pixelFormat);
+
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glTexStorage2D(GL_TEXTURE_2D, stream.mipCount - newResidentLevel, internalFormat,
+                   std::max(1, stream.width >> newResidentLevel), std::max(1, stream.height >> newResidentLevel));
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    for (int level = newResidentLevel; level < stream.mipCount; ++level)
+        glCopyImageSubData(gResources->Name(stream.handle), GL_TEXTURE_2D, level - stream.residentLevel, 0, 0, 0,
+                           textureId, GL_TEXTURE_2D, level - newResidentLevel, 0, 0, 0,
+                           std::max(1, stream.width >> level), std::max(1, stream.height >> level), 1);
+
+    const uint32_t name = textureId;
+    gResources->Replace(stream.handle, &name, 1, UStreamedBytes(stream, newResidentLevel, stream.mipCount));
+    stream.residentLevel = newResidentLevel;
+}
 
-            10, 39, 40,
-            40, 11, 10,
+// Frees at least bytesNeeded by trimming the least recently used textures first.
+// Textures drawn this frame only give up levels finer than they asked for.
+// Returns the number of bytes freed.
+size_t UEvictTextureLevels(size_t bytesNeeded, const StreamedTexture* keep)
+{
+    FrameVector<StreamedTexture*> candidates(gFrameArenas.Local());
+    candidates.reserve(gStreamedTextures.size());
+    for (StreamedTexture& stream : gStreamedTextures)
+        if (&stream != keep && !stream.loading && stream.residentLevel < stream.tailLevel)
+            candidates.push_back(&stream);
 
-            11, 40, 41,
-            41, 12, 11,
+    std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* a, const StreamedTexture* b)
+    {
+        return a->lastUsedFrame < b->lastUsedFrame;
+    });
 
-            12, 41, 42,
-            42, 13, 12,
+    size_t freed = 0;
+    for (StreamedTexture* stream : candidates)
+    {
+        if (freed >= bytesNeeded)
+            break;
 
-            13, 42, 43,
-            43, 14, 13,
+        const int coarsest = stream->lastUsedFrame == gFrameIndex ? std::min(stream->requestedLevel, stream->tailLevel) : stream->tailLevel;
+        int level = stream->residentLevel;
+        while (level < coarsest && freed + UStreamedBytes(*stream, stream->residentLevel, level) < bytesNeeded)
+            ++level;
 
-            14, 43, 44,
-            44, 15, 14,
+        if (level > stream->residentLevel)
+        {
+            freed += UStreamedBytes(*stream, stream->residentLevel, level);
+            UTrimTextureLevels(*stream, level);
+        }
+    }
 
-            15, 44, 45,
-            45, 16, 15,
+    return freed;
+}
 
-            16, 45, 46,
-            46, 17, 16,
+// Runs once per frame after the draws have reported what they need
+void UUpdateTextureStreaming()
+{
+    const size_t budget = (size_t)(gTextureBudgetMB * 1024.0f * 1024.0f);
 
-            17, 46, 47,
-            47, 18, 17,
+    size_t resident = 0;
+    for (const StreamedTexture& stream : gStreamedTextures)
+        resident += UStreamedBytes(stream, stream.residentLevel, stream.mipCount);
 
-            18, 47, 48,
-            48, 19, 18,
+    for (StreamedTexture& stream : gStreamedTextures)
+    {
+        // Nothing to do until the initial load finished, or while a load is running
+        if (gStreamingLoads >= MAX_STREAMING_LOADS)
+            break;
+        if (stream.loading || stream.cachePath.empty() || stream.residentLevel == stream.mipCount || stream.requestedLevel >= stream.residentLevel)
+            continue;
+
+        const size_t needed = UStreamedBytes(stream, stream.requestedLevel, stream.residentLevel);
+        if (resident + needed > budget)
+            resident -= UEvictTextureLevels(resident + needed - budget, &stream);
+
+        // Still no room: settle for a coarser level that fits
+        int level = stream.requestedLevel;
+        while (level < stream.residentLevel && resident + UStreamedBytes(stream, level, stream.residentLevel) > budget)
+            ++level;
+        if (level == stream.residentLevel)
+            continue;
+
+        resident += UStreamedBytes(stream, level, stream.residentLevel);
+        stream.loading = true;
+        ++gStreamingLoads;
+
+        const std::string cachePath = stream.cachePath;
+        const int maxDimension = std::max(std::max(1, stream.width >> level), std::max(1, stream.height >> level));
+        const int endLevel = stream.residentLevel;
+        ResourceHandle target = stream.handle;
+        gTextureDecodePool->Submit([cachePath, maxDimension, endLevel, target]()
+        {
+            TextureUpload upload;
+            upload.filename = cachePath;
+            upload.handle = target;
+            upload.streamIn = true;
+            upload.loaded = ReadKtx2(cachePath, upload.texture, maxDimension, endLevel);
+
+            std::lock_guard<std::mutex> lock(gDecodedTexturesMutex);
+            gDecodedTextures.push_back(std::move(upload));
+        });
+    }
 
-            19, 48, 49,
-            49, 20, 19,
+    // The next frame's draws report their needs from scratch
+    for (StreamedTexture& stream : gStreamedTextures)
+        stream.requestedLevel = stream.tailLevel;
+}
 
-            20, 49, 50,
-            50, 21, 20,
+//********************************************************************
+//CLUSTERED LIGHTING
+//
+// Point lights live in a shader storage buffer. Every frame a compute
+// pass bins them into a grid of view space clusters, 16 x 9 screen
+// tiles by 24 exponential depth slices, and each fragment only shades
+// the lights listed for the cluster it falls in.
+//********************************************************************
+bool UCreateLightClusters()
+{
+    if (!UCreateComputeProgram("cluster.comp", gClusterProgramId))
+        return false;
 
-            21, 50, 51,
-            51, 22, 21,
+    // Counts start at zero so draws before the first binning pass see no lights
+    const std::vector<GLuint> zeroCounts(LIGHT_CLUSTER_COUNT, 0);
+    glGenBuffers(1, &gClusterLightCountBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gClusterLightCountBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, zeroCounts.size() * sizeof(GLuint), zeroCounts.data(), 0);
 
-            22, 51, 52,
-            52, 23, 22,
+    const size_t indexBytes = (size_t)LIGHT_CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(GLuint);
+    glGenBuffers(1, &gClusterLightIndexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gClusterLightIndexBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, indexBytes, NULL, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-            23, 52, 53,
-            53, 24, 23,
+    uint32_t name = gClusterLightCountBuffer;
+    gResources->Create(RESOURCE_BUFFER, "cluster light counts", &name, 1, zeroCounts.size() * sizeof(GLuint));
+    name = gClusterLightIndexBuffer;
+    gResources->Create(RESOURCE_BUFFER, "cluster light indices", &name, 1, indexBytes);
 
-            24, 53, 54,
-            54, 25, 24,
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING_CLUSTER_COUNTS, gClusterLightCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING_CLUSTER_INDICES, gClusterLightIndexBuffer);
 
-            25, 54, 55,
-            55, 26, 25,
+    UCreateLights(gLightCount);
+    return true;
+}
 
-            26, 55, 56,
-            56, 27, 26,
+void UDestroyLightClusters()
+{
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gLightBuffer));
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gClusterLightCountBuffer));
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gClusterLightIndexBuffer));
+    gLightBuffer = 0;
+    gClusterLightCountBuffer = 0;
+    gClusterLightIndexBuffer = 0;
+    UDestroyShaderProgram(gClusterProgramId);
+}
 
-            27, 58, 59,
-            27, 56, 59
-        };
+// Replaces the lights with the lights of the scene, lamp first, topped up to count with small
+// coloured lights scattered over the carpet. The same count always gives the same lights.
+void UCreateLights(int count)
+{
+    std::vector<PointLight> lights;
+    lights.reserve(std::max((size_t)count, gSceneDescription.lights.size()));
 
-        const GLuint floatsPerTexture = 2;
-        const GLuint floatsPerVertex = 3;
-        const GLuint floatsPerNormal = 3;
+    // The lamp reaches the whole scene, so it lights everything as before
+    lights.push_back({ glm::vec4(gLightPosition, LIGHT_CAMERA_FAR), glm::vec4(gLightColor, 1.0f) });
+    for (size_t i = 1; i < gSceneDescription.lights.size(); ++i)
+    {
+        const SceneLight& light = gSceneDescription.lights[i];
+        const float radius = light.radius > 0.0f ? light.radius : LIGHT_CAMERA_FAR;
+        lights.push_back({ glm::vec4(glm::make_vec3(light.position), radius), glm::vec4(glm::make_vec3(light.color), 1.0f) });
+    }
 
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = (int)lights.size(); i < count; ++i)
+    {
+        const glm::vec3 position(-10.0f + 14.0f * unit(random), -2.2f + 2.5f * unit(random), -7.0f + 14.0f * unit(random));
+        const glm::vec3 color = glm::vec3(unit(random), unit(random), unit(random)) * 0.6f;
+        lights.push_back({ glm::vec4(position, 1.0f + 1.5f * unit(random)), glm::vec4(color, 1.0f) });
+    }
 
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gLightBuffer));
 
-        // Create 2 buffers: first one for the vertex data; second one for the indices
-        glGenBuffers(2, mesh.vbos);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    const size_t bytes = lights.size() * sizeof(PointLight);
+    glGenBuffers(1, &gLightBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gLightBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, lights.data(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING_LIGHTS, gLightBuffer);
 
-        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    const uint32_t name = gLightBuffer;
+    gResources->Create(RESOURCE_BUFFER, "point lights", &name, 1, bytes);
+    gLightCount = (int)lights.size();
+}
 
-        // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+// Bins the lights into the clusters of this frame's camera, ahead of the draws reading them
+void UUpdateLightClusters(const glm::mat4& view, const glm::mat4& projection)
+{
+    glUseProgram(gClusterProgramId);
+    glUniformMatrix4fv(CLUSTER_UNIFORM_VIEW, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(CLUSTER_UNIFORM_INVERSE_PROJECTION, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+    glUniform1i(CLUSTER_UNIFORM_LIGHT_COUNT, gLightCount);
+    glUniform2f(CLUSTER_UNIFORM_DEPTH_RANGE, LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
 
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
+    glDispatchCompute((LIGHT_CLUSTER_COUNT + 127) / 128, 1, 1);
 
-        glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-        glEnableVertexAttribArray(1);
+    // Fragment shaders read the lists the compute pass wrote
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-        glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
-        glEnableVertexAttribArray(2);
-             
-    }
+//**********************************************************
+//LIGHT BENCHMARK
+//
+//Renders the scene with 1, 16, 256 and 4096 point lights and
+//reports the GPU time of the binning pass and of shading
+//**********************************************************
+void UBenchmarkLights()
+{
+    const int FRAMES = 50;
+    const int lightCounts[] = { 1, 16, 256, 4096 };
+    const int previousLightCount = gLightCount;
 
-    else if (meshChoice == 2) {
-           //**********************************************************************
-           //Coffee Cup Handle
-           //**********************************************************************
-           //Currently using half cylinder mesh scaled and rotated for handle
-           //Will eventually try to use a torus once I understand how to render one
+    GLuint queries[2];
+    glGenQueries(2, queries);
 
-            // Position and Color data
-            GLfloat verts[] = {
+    // Camera of the frame the benchmark runs in
+    const glm::mat4 view = gRenderState->view;
+    const glm::mat4 projection = gRenderState->projection;
+    const glm::vec3 viewPosition = gRenderState->viewPosition;
 
-                //Top Circle
-                // Vertex Positions    // Colors (r,g,b,a)
-                // Top Right Quarter
-                 0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
+    cout << "INFO: Light benchmark, " << LIGHT_CLUSTER_GRID_X << "x" << LIGHT_CLUSTER_GRID_Y << "x" << LIGHT_CLUSTER_GRID_Z
+         << " clusters, " << FRAMES << " frames per sample" << endl;
 
-                 0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
-                 0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
-                 0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
-                 0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
-                 0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
-                 0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
+    for (int lightCount : lightCounts)
+    {
+        UCreateLights(lightCount);
 
-                 0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
+        double clusterSeconds = 0.0;
+        double shadingSeconds = 0.0;
+        for (int frame = 0; frame < FRAMES; ++frame)
+        {
+            gBoundTexture = 0;
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+            glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+            UUpdateLightClusters(view, projection);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+            UBuildDrawQueues(view, projection, 0);
+            UDrawScene(view, projection, viewPosition, 0, false, gOpaqueQueue);
+            UDrawBlended(view, projection, viewPosition, false);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 clusterNanoseconds = 0, shadingNanoseconds = 0;
+            glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &clusterNanoseconds);
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &shadingNanoseconds);
+            clusterSeconds += clusterNanoseconds / 1e9;
+            shadingSeconds += shadingNanoseconds / 1e9;
+        }
 
-                 // Bottom Right Quarter
-                 0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
-                 0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
-                 0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
-                 0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
-                 0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
-                 0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
+        // How full the clusters got, lists longer than MAX_LIGHTS_PER_CLUSTER were cut short
+        std::vector<GLuint> counts(LIGHT_CLUSTER_COUNT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gClusterLightCountBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counts.size() * sizeof(GLuint), counts.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-                 0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
+        GLuint totalCount = 0;
+        int fullClusters = 0;
+        for (GLuint count : counts)
+        {
+            totalCount += count;
+            fullClusters += count == MAX_LIGHTS_PER_CLUSTER ? 1 : 0;
+        }
 
-                 0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
+        cout << "INFO:   " << lightCount << " lights: binning " << clusterSeconds * 1000.0 / FRAMES << " ms, shading "
+             << shadingSeconds * 1000.0 / FRAMES << " ms per frame, " << (double)totalCount / LIGHT_CLUSTER_COUNT
+             << " lights per cluster on average, " << fullClusters << " clusters full" << endl;
+    }
 
-                //Bottom Circle
-                // Vertex Positions    // Colors (r,g,b,a)
-                // Top Right Quarter
-                 0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
+    UCreateLights(previousLightCount);
+    glDeleteQueries(2, queries);
+}
 
-                 0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
-                 0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
-                 0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
-                 0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
-                 0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
-                 0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
+//********************************************************************
+//DEFERRED SHADING
+//
+// The deferred path draws the scene once into a G-buffer (albedo,
+// octahedral packed normal with the material's specular terms, and
+// depth) with the SHADER_DEFERRED permutations, then shades every
+// pixel exactly once in a full screen pass over the same clustered
+// light lists the forward path uses. G switches between the paths.
+//********************************************************************
+bool UCreateDeferredRenderer()
+{
+    const char* const names[] = { "fullscreen.vert", "deferred.frag" };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    if (!UCreateShaderProgram(names, stages, 2, "deferred lighting program", gDeferredProgramId))
+        return false;
 
-                 0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
+    // The full screen triangle has no vertex data, but core profiles need a vertex array bound to draw
+    glGenVertexArrays(1, &gFullscreenVao);
+    glGenFramebuffers(1, &gGBuffer);
+    gGBufferTextures = gResources->Create(RESOURCE_TEXTURE, "g-buffer", nullptr, 0, 0);
 
-                 // Bottom Right Quarter
-                 0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
-                 0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
-                 0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
-                 0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
-                 0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
-                 0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    return UResizeGBuffer(viewport[2], viewport[3]);
+}
 
-                 0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
+void UDestroyDeferredRenderer()
+{
+    gResources->Release(gGBufferTextures);
+    gGBufferTextures = ResourceHandle();
+    glDeleteFramebuffers(1, &gGBuffer);
+    glDeleteVertexArrays(1, &gFullscreenVao);
+    gGBuffer = 0;
+    gFullscreenVao = 0;
+    if (gDeferredProgramId != 0)
+        UDestroyShaderProgram(gDeferredProgramId);
+    gDeferredProgramId = 0;
+}
 
-                 0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
-            };
+// Reallocates the G-buffer textures when the viewport changed size
+bool UResizeGBuffer(int width, int height)
+{
+    if (width == gGBufferWidth && height == gGBufferHeight)
+        return true;
+    if (width <= 0 || height <= 0)
+        return false;
 
-            // Index data to share position data
-            GLushort indices[] = {
+    const GLenum formats[GBUFFER_TARGET_COUNT] = { GL_RGBA8, GL_RGBA16F, GL_DEPTH24_STENCIL8 };
+    const size_t texelBytes[GBUFFER_TARGET_COUNT] = { 4, 8, 4 };
+    if (!UAllocateRenderTargets(gGBuffer, gGBufferTextures, formats, texelBytes, GBUFFER_TARGET_COUNT, width, height, "G-buffer"))
+    {
+        gGBufferWidth = 0;
+        gGBufferHeight = 0;
+        return false;
+    }
 
-                //Top Circle 
-                //Top Right Quarter
-                0, 1, 15,
-                1, 2, 15,
-                2, 3, 15,
-                3, 4, 15,
-                4, 5, 15,
-                5, 6, 15,
-                6, 7, 15,
+    gGBufferWidth = width;
+    gGBufferHeight = height;
+    return true;
+}
 
-                //Bottom Right Quarter
-                7, 8, 15,
-                8, 9, 15,
-                9, 10, 15,
-                10, 11, 15,
-                11, 12, 15,
-                12, 13, 15,
-                13, 14, 15,
+// Allocates count single level textures for framebuffer and swaps them in behind the textures handle.
+// The last one is attached as depth and stencil, the others as colour attachments in order.
+bool UAllocateRenderTargets(GLuint framebuffer, ResourceHandle textures, const GLenum* formats, const size_t* texelBytes, int count,
+                            int width, int height, const char* label)
+{
+    uint32_t names[RESOURCE_MAX_NAMES];
+    GLenum drawBuffers[RESOURCE_MAX_NAMES];
+    size_t bytes = 0;
 
-                //Bottom Circle 
-                //Top Right Quarter
-                16, 17, 31,
-                17, 18, 31,
-                18, 19, 31,
-                19, 20, 31,
-                20, 21, 31,
-                21, 22, 31,
-                22, 23, 31,
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    for (int i = 0; i < count; ++i)
+    {
+        GLuint textureId;
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], width, height);
+        names[i] = textureId;
+        bytes += texelBytes[i] * width * height;
 
-                //Bottom Right Quarter
-                23, 24, 31,
-                24, 25, 31,
-                25, 26, 31,
-                26, 27, 31,
-                27, 28, 31,
-                28, 29, 31,
-                29, 30, 31,
+        const GLenum attachment = i == count - 1 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textureId, 0);
+        drawBuffers[i] = attachment;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-                
-                //Cylinder Sides
-                0, 16, 1,
-                16, 17, 1,
+    glDrawBuffers(count - 1, drawBuffers);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-                1, 17, 2,
-                17, 18, 2,
-                2,	18,	3,
+    // The old textures are freed by the swap, the handle stays the same
+    gResources->Replace(textures, names, count, bytes);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cout << "ERROR: " << label << " framebuffer is incomplete (" << status << ")" << endl;
+        return false;
+    }
+    return true;
+}
 
-                18,	19,	3,
-                3,	19,	4,
+// Everything between clearing the window and swapping, with the given render path
+void UDrawFrame(RenderPath path, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition)
+{
+    // Shadows and the light lists have to be ready before any fragment looks them up
+    UUpdateShadowMaps();
+    UUpdateLightClusters(view, projection);
+    UCollectOverdraw();
+    UBuildDrawQueues(view, projection, 0);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const bool deferred = path == RENDER_DEFERRED && UResizeGBuffer(viewport[2], viewport[3]);
+    if (deferred)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, gGBuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    }
 
-                19,	20,	4,
-                4,	20,	5,
+    // A query still in flight from an earlier frame skips counting this one rather than waiting
+    OverdrawQuery& query = gOverdrawQueries[gOverdrawQueryIndex];
+    const bool count = !query.pending;
+    const bool depthPrepass = gDepthPrepassActive;
+    if (depthPrepass)
+    {
+        if (count)
+            glBeginQuery(GL_SAMPLES_PASSED, query.depthQuery);
+        UDrawDepthPrepass(view, projection);
+        if (count)
+            glEndQuery(GL_SAMPLES_PASSED);
+    }
 
-                20,	21,	5,
-                5,	21, 6,
+    if (count)
+        glBeginQuery(GL_SAMPLES_PASSED, query.shadedQuery);
+    UDrawScene(view, projection, viewPosition, deferred ? SHADER_DEFERRED : 0, depthPrepass, gOpaqueQueue);
+    if (count)
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        query.pending = true;
+        query.prepass = depthPrepass;
+        query.pixels = viewport[2] * viewport[3];
+        gOverdrawQueryIndex = (gOverdrawQueryIndex + 1) % OVERDRAW_QUERY_FRAMES;
+    }
 
-                21,	22,	6,
-                6,	22,	7,
+    if (deferred)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        UDrawDeferredLighting(view, projection, viewPosition);
+    }
 
-                22,	23,	7,
-                7,	23,	8,
+    UDrawBlended(view, projection, viewPosition, deferred);
+}
 
-                23,	24,	8,
-                8,	24,	9,
+// Shades the G-buffer into the bound framebuffer with one full screen triangle
+void UDrawDeferredLighting(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition)
+{
+    glUseProgram(gDeferredProgramId);
+    glUniformMatrix4fv(UNIFORM_VIEW, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(UNIFORM_INVERSE_VIEW_PROJECTION, 1, GL_FALSE, glm::value_ptr(glm::inverse(projection * view)));
+    glUniform3f(UNIFORM_LIGHT_COLOR, gLightColor.r, gLightColor.g, gLightColor.b);
+    glUniform3f(UNIFORM_VIEW_POSITION, viewPosition.x, viewPosition.y, viewPosition.z);
+    glUniform4f(UNIFORM_CLUSTER_PARAMS, (GLfloat)gGBufferWidth, (GLfloat)gGBufferHeight, LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
+
+    // G-buffer textures go on the units after the material texture, read with texelFetch
+    for (int i = 0; i < GBUFFER_TARGET_COUNT; ++i)
+    {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, gResources->Name(gGBufferTextures, i));
+    }
 
-                24,	25, 9,
-                9,	25,	10,
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(gFullscreenVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
 
-                25,	26,	10,
-                10, 26, 11,
+    for (int i = 0; i < GBUFFER_TARGET_COUNT; ++i)
+    {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
 
-                26,	27,	11,
-                11,	27,	12,
+//**********************************************************
+//RENDER PATH BENCHMARK
+//
+//Renders the scene forward and deferred with 16, 256 and
+//4096 point lights and reports the GPU time of each frame
+//**********************************************************
+void UBenchmarkRenderPaths()
+{
+    const int FRAMES = 50;
+    const int lightCounts[] = { 16, 256, 4096 };
+    const char* const pathNames[RENDER_PATH_COUNT] = { "forward", "deferred" };
+    const int previousLightCount = gLightCount;
 
-                27,	28,	12,
-                12,	28,	13,
+    GLuint query;
+    glGenQueries(1, &query);
 
-                28,	29,	13,
-                13,	29,	14,
-                
-                30,	0,	14,
-                0, 16, 30,
+    // Camera of the frame the benchmark runs in
+    const glm::mat4 view = gRenderState->view;
+    const glm::mat4 projection = gRenderState->projection;
+    const glm::vec3 viewPosition = gRenderState->viewPosition;
 
-                30, 29, 14
-                
-            };
+    cout << "INFO: Render path benchmark, " << FRAMES << " frames per sample" << endl;
 
-            const GLuint floatsPerTexture = 2;
-            const GLuint floatsPerVertex = 3;
+    for (int lightCount : lightCounts)
+    {
+        UCreateLights(lightCount);
 
+        double pathMs[RENDER_PATH_COUNT] = {};
+        for (int path = 0; path < RENDER_PATH_COUNT; ++path)
+        {
+            double seconds = 0.0;
+            for (int frame = 0; frame < FRAMES; ++frame)
+            {
+                gBoundTexture = 0;
+                glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+                glBeginQuery(GL_TIME_ELAPSED, query);
+                UDrawFrame((RenderPath)path, view, projection, viewPosition);
+                glEndQuery(GL_TIME_ELAPSED);
+
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+                seconds += nanoseconds / 1e9;
+            }
+            pathMs[path] = seconds * 1000.0 / FRAMES;
+        }
 
-            glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-            glBindVertexArray(mesh.vao);
+        cout << "INFO:   " << lightCount << " lights: " << pathNames[RENDER_FORWARD] << " " << pathMs[RENDER_FORWARD] << " ms, "
+             << pathNames[RENDER_DEFERRED] << " " << pathMs[RENDER_DEFERRED] << " ms per frame" << endl;
+    }
 
-            // Create 2 buffers: first one for the vertex data; second one for the indices
-            glGenBuffers(2, mesh.vbos);
-            glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-            glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    UCreateLights(previousLightCount);
+    glDeleteQueries(1, &query);
+}
 
-            mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+//********************************************************************
+//SHADOW MAPS
+//
+// The lamp casts shadows through a depth cube map holding the
+// distance to the lamp. Static objects are rendered into their own
+// cube only when the lamp or one of them moved. Each frame with
+// dynamic objects copies that cube into the sampled one and draws
+// just the dynamic objects on top.
+//********************************************************************
+bool UCreateShadowMaps()
+{
+    const char* const names[] = { "shadow.vert", "shadow.frag" };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    if (!UCreateShaderProgram(names, stages, 2, "shadow program", gShadowProgramId))
+        return false;
 
-            // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
-            GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
+    uint32_t cubes[SHADOW_CUBE_COUNT];
+    for (int i = 0; i < SHADOW_CUBE_COUNT; ++i)
+    {
+        GLuint textureId;
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        // Hardware compares and filters 2x2 texels per lookup, the shader adds more taps on top
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        cubes[i] = textureId;
+    }
+    gShadowCubes = gResources->Create(RESOURCE_TEXTURE, "shadow maps", cubes, SHADOW_CUBE_COUNT,
+                                      (size_t)SHADOW_CUBE_COUNT * 6 * SHADOW_MAP_SIZE * SHADOW_MAP_SIZE * 4);
 
-            // Create Vertex Attribute Pointers
-            glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-            glEnableVertexAttribArray(0);
+    // Filter taps near a cube edge read across into the next face
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
+    // Lighting samples the lamp's shadows from a unit nothing else uses
+    glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubes[SHADOW_CUBE_SAMPLED]);
+    glActiveTexture(GL_TEXTURE0);
 
-            glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float)* floatsPerVertex));
-            glEnableVertexAttribArray(2);
+    glGenFramebuffers(1, &gShadowFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, gShadowFramebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
 }
 
-    else if (meshChoice == 3) {
-       //**********************************************************************
-       //Coffee Cup Handle Inside
-       //**********************************************************************
-       //Currently using half cylinder mesh scaled and rotated for handle
-       //Will eventually try to use a torus once I understand how to render one
-
-        // Position and Color data
-        GLfloat verts[] = {
+void UDestroyShadowMaps()
+{
+    gResources->Release(gShadowCubes);
+    gShadowCubes = ResourceHandle();
+    glDeleteFramebuffers(1, &gShadowFramebuffer);
+    gShadowFramebuffer = 0;
+    if (gShadowProgramId != 0)
+        UDestroyShaderProgram(gShadowProgramId);
+    gShadowProgramId = 0;
+}
 
-            //Top Circle
-            // Vertex Positions    // Colors (r,g,b,a)
-            // Top Right Quarter
-             0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
+// Objects drawn into the shadow maps: the ones that leave depth behind in the scene. The lamp
+// is left out since the light sits inside it, and the cup handle casts its uncut shadow.
+bool UCastsShadow(uint32_t row)
+{
+    return (gScene.material[row]->features & SHADER_UNLIT) == 0 && (gScene.stencil[row] == STENCIL_OFF || gScene.stencil[row] == STENCIL_MASKED);
+}
 
-             0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
-             0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
-             0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
-             0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
-             0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
-             0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
+// Renders the static or the dynamic shadow casters into all six faces of cube.
+// The static pass starts from a cleared cube, the dynamic pass adds to what is there.
+void URenderShadowCube(GLuint cube, bool dynamic)
+{
+    // Faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order with the up vectors cube map lookups expect
+    const glm::vec3 directions[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    const glm::vec3 ups[6] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+    const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR, SHADOW_FAR);
 
-             0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
+    glUseProgram(gShadowProgramId);
+    glUniform3fv(SHADOW_UNIFORM_LIGHT_POSITION, 1, glm::value_ptr(gLightPosition));
+    glUniform1f(SHADOW_UNIFORM_FAR_PLANE, SHADOW_FAR);
 
-             // Bottom Right Quarter
-             0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
-             0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
-             0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
-             0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
-             0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
-             0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
+    for (int face = 0; face < 6; ++face)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cube, 0);
+        if (!dynamic)
+            glClear(GL_DEPTH_BUFFER_BIT);
 
-             0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
+        const glm::mat4 faceViewProjection = projection * glm::lookAt(gLightPosition, gLightPosition + directions[face], ups[face]);
+        glUniformMatrix4fv(SHADOW_UNIFORM_FACE_VIEW_PROJECTION, 1, GL_FALSE, glm::value_ptr(faceViewProjection));
 
-             0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
+        for (uint32_t row = 0; row < gScene.entities.Size(); ++row)
+        {
+            if (((gScene.flags[row] & ENTITY_DYNAMIC) != 0) != dynamic || !UCastsShadow(row))
+                continue;
 
-            //Bottom Circle
-            // Vertex Positions    // Colors (r,g,b,a)
-            // Top Right Quarter
-             0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
+            glUniformMatrix4fv(SHADOW_UNIFORM_MODEL, 1, GL_FALSE, glm::value_ptr(gScene.model[row]));
+            glBindVertexArray(gScene.mesh[row]->vao);
+            glDrawElements(GL_TRIANGLES, gScene.indexCount[row], GL_UNSIGNED_SHORT, NULL);
+        }
+    }
+    glBindVertexArray(0);
+}
 
-             0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
-             0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
-             0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
-             0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
-             0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
-             0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
+// Brings the sampled shadow cube up to date for this frame. Static casters are only rendered
+// again when they or the lamp moved, and without dynamic casters nothing happens at all.
+void UUpdateShadowMaps()
+{
+    // The cached cube stays valid as long as the lamp and every static caster stay where they are
+    FrameVector<glm::mat4> staticTransforms(gFrameArenas.Local());
+    staticTransforms.reserve(gScene.entities.Size() + 1);
+    bool hasDynamic = false;
+    for (uint32_t row = 0; row < gScene.entities.Size(); ++row)
+    {
+        if (!UCastsShadow(row))
+            continue;
+        if ((gScene.flags[row] & ENTITY_DYNAMIC) != 0)
+            hasDynamic = true;
+        else
+            staticTransforms.push_back(gScene.model[row]);
+    }
+    staticTransforms.push_back(glm::translate(gLightPosition));
+    const uint64_t staticState = HashContent((const unsigned char*)staticTransforms.data(), staticTransforms.size() * sizeof(glm::mat4));
 
-             0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
+    const bool staticChanged = !gStaticShadowsRendered || staticState != gStaticShadowState;
+    if (!staticChanged && !hasDynamic && !gShadowHadDynamic)
+        return;
 
-             // Bottom Right Quarter
-             0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
-             0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
-             0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
-             0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
-             0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
-             0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glBindFramebuffer(GL_FRAMEBUFFER, gShadowFramebuffer);
 
-             0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
+    const GLuint staticCube = gResources->Name(gShadowCubes, SHADOW_CUBE_STATIC);
+    const GLuint sampledCube = gResources->Name(gShadowCubes, SHADOW_CUBE_SAMPLED);
+    if (staticChanged)
+    {
+        URenderShadowCube(staticCube, false);
+        gStaticShadowState = staticState;
+        gStaticShadowsRendered = true;
+        cout << "INFO: Rendered the static shadow map" << endl;
+    }
 
-             0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
-        };
+    // Dynamic casters are drawn over a fresh copy of the static shadows every frame
+    glCopyImageSubData(staticCube, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+                       sampledCube, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 6);
+    if (hasDynamic)
+        URenderShadowCube(sampledCube, true);
+    gShadowHadDynamic = hasDynamic;
 
-        // Index data to share position data
-        GLushort indices[] = {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
 
-            //Top Circle 
-            //Top Right Quarter
-            0, 1, 15,
-            1, 2, 15,
-            2, 3, 15,
-            3, 4, 15,
-            4, 5, 15,
-            5, 6, 15,
-            6, 7, 15,
+//********************************************************************
+//DEPTH PREPASS
+//
+// Objects are drawn in scene order, so the carpet is shaded in full
+// before the book, cartridge and cup cover most of it. The prepass
+// lays down depth with a program that does no shading, and the
+// shading pass then only runs for the fragments with GL_EQUAL depth.
+// Sample queries count the fragments of both passes. In auto mode
+// the prepass turns on when more than DEPTH_PREPASS_ENABLE_OVERDRAW
+// fragments per pixel pass the depth test, and off again below
+// DEPTH_PREPASS_DISABLE_OVERDRAW. GL_EQUAL needs the same compile of
+// uber.vert on both sides, so the prepass program is a permutation
+// rebuilt along with the shading ones; draws whose program does not
+// match it yet test with GL_LEQUAL.
+//********************************************************************
+bool UCreateDepthPrepass()
+{
+    // A permutation, so it is rebuilt from the same uber.vert as the shading pass
+    gDepthShader = UWaitForShaderPermutation(PERMUTATION_DEPTH_ONLY);
+    if (gDepthShader == nullptr)
+        return false;
 
-            //Bottom Right Quarter
-            7, 8, 15,
-            8, 9, 15,
-            9, 10, 15,
-            10, 11, 15,
-            11, 12, 15,
-            12, 13, 15,
-            13, 14, 15,
+    for (OverdrawQuery& query : gOverdrawQueries)
+    {
+        glGenQueries(1, &query.depthQuery);
+        glGenQueries(1, &query.shadedQuery);
+    }
+    gDepthPrepassActive = gDepthPrepassMode == PREPASS_ON;
+    return true;
+}
 
-            //Bottom Circle 
-            //Top Right Quarter
-            16, 17, 31,
-            17, 18, 31,
-            18, 19, 31,
-            19, 20, 31,
-            20, 21, 31,
-            21, 22, 31,
-            22, 23, 31,
+void UDestroyDepthPrepass()
+{
+    for (OverdrawQuery& query : gOverdrawQueries)
+    {
+        glDeleteQueries(1, &query.depthQuery);
+        glDeleteQueries(1, &query.shadedQuery);
+        query = OverdrawQuery();
+    }
+    gDepthShader = nullptr;   // Released with the other permutations
+    gDepthPrepassActive = false;
+}
 
-            //Bottom Right Quarter
-            23, 24, 31,
-            24, 25, 31,
-            25, 26, 31,
-            26, 27, 31,
-            27, 28, 31,
-            28, 29, 31,
-            29, 30, 31,
+// Opaque objects drawn outside the stencil passes. Alpha tested objects would need their texture
+// in the prepass, and the cup handle its stencil, so those keep regular depth testing and writes.
+bool UInDepthPrepass(uint32_t row)
+{
+    return gScene.stencil[row] == STENCIL_OFF && (gScene.material[row]->features & SHADER_ALPHA_TEST) == 0 && !UIsBlended(row);
+}
 
+// Fills the depth buffer with the prepass objects front to back, no color is written
+void UDrawDepthPrepass(const glm::mat4& view, const glm::mat4& projection)
+{
+    glUseProgram(gDepthShader->programId);
+    glUniformMatrix4fv(UNIFORM_VIEW, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(UNIFORM_PROJECTION, 1, GL_FALSE, glm::value_ptr(projection));
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-            //Cylinder Sides
-            0, 16, 1,
-            16, 17, 1,
+    for (const DrawKey& draw : gOpaqueQueue)
+    {
+        const uint32_t row = UDrawPacket(draw.index).object;
+        if (!UInDepthPrepass(row))
+            continue;
 
-            1, 17, 2,
-            17, 18, 2,
-            2,	18,	3,
+        glUniformMatrix4fv(UNIFORM_MODEL, 1, GL_FALSE, glm::value_ptr(gScene.model[row]));
+        glBindVertexArray(gScene.mesh[row]->vao);
+        glDrawElements(GL_TRIANGLES, gScene.indexCount[row], GL_UNSIGNED_SHORT, NULL);
+    }
 
-            18,	19,	3,
-            3,	19,	4,
+    glBindVertexArray(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
 
-            19,	20,	4,
-            4,	20,	5,
+// Reads the overdraw queries that finished without waiting, and switches the prepass in auto mode
+void UCollectOverdraw()
+{
+    for (OverdrawQuery& query : gOverdrawQueries)
+    {
+        if (!query.pending)
+            continue;
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(query.shadedQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        GLuint64 shaded = 0, depth = 0;
+        glGetQueryObjectui64v(query.shadedQuery, GL_QUERY_RESULT, &shaded);
+        if (query.prepass)
+            glGetQueryObjectui64v(query.depthQuery, GL_QUERY_RESULT, &depth);
+        query.pending = false;
+
+        // With the prepass on, its own fragment count is what shading would cost without it
+        const double pixels = std::max(query.pixels, 1);
+        gShadedPerPixel = (float)(shaded / pixels);
+        gOverdrawWithoutPrepass = query.prepass ? (float)(depth / pixels) : gShadedPerPixel;
+        gOverdrawMeasuredWithPrepass = query.prepass;
+    }
 
-            20,	21,	5,
-            5,	21, 6,
+    if (gDepthPrepassMode != PREPASS_AUTO || gOverdrawWithoutPrepass == 0.0f)
+        return;
 
-            21,	22,	6,
-            6,	22,	7,
+    if (!gDepthPrepassActive && gOverdrawWithoutPrepass > DEPTH_PREPASS_ENABLE_OVERDRAW)
+    {
+        gDepthPrepassActive = true;
+        cout << "INFO: Overdraw at " << gOverdrawWithoutPrepass << " fragments per pixel, depth prepass on" << endl;
+    }
+    else if (gDepthPrepassActive && gOverdrawMeasuredWithPrepass && gOverdrawWithoutPrepass < DEPTH_PREPASS_DISABLE_OVERDRAW)
+    {
+        gDepthPrepassActive = false;
+        cout << "INFO: Overdraw down to " << gOverdrawWithoutPrepass << " fragments per pixel, depth prepass off" << endl;
+    }
+}
 
-            22,	23,	7,
-            7,	23,	8,
+void UReportOverdraw()
+{
+    if (gDepthPrepassActive && gOverdrawMeasuredWithPrepass)
+        cout << "INFO: Overdraw: " << gShadedPerPixel << " fragments shaded per pixel with the depth prepass, "
+             << gOverdrawWithoutPrepass << " without it" << endl;
+    else
+        cout << "INFO: Overdraw: " << gShadedPerPixel << " fragments shaded per pixel, depth prepass off" << endl;
+}
 
-            23,	24,	8,
-            8,	24,	9,
+//********************************************************************
+//DRAW ORDER
+//
+// Every frame the scene is split into an opaque queue sorted front
+// to back, so early depth testing rejects hidden fragments before
+// they are shaded, and a blended queue sorted back to front, drawn
+// last with blending on and depth writes off. Both are ordered by
+// the quantized view depth of the object's origin.
+//
+// The per object work is recorded in parallel: the scene's rows
+// are cut into contiguous ranges, one per worker, and every worker
+// culls its rows against the view frustum and writes draw packets
+// and sort keys into its own recorder. Nothing is shared between
+// workers while they record. The render thread then only
+// concatenates the keys, in range order so equal keys keep scene
+// order, and sorts them.
+//
+// Each step is a system over the scene's component arrays: the
+// transform update walks model matrices, culling walks the bounds
+// arrays alone and recording only looks at the rows that survived.
+//********************************************************************
+bool UIsBlended(uint32_t row)
+{
+    return gScene.material[row]->alpha < 1.0f;
+}
 
-            24,	25, 9,
-            9,	25,	10,
+// Screen space estimate of the finest level of stream a draw can resolve.
+// The unit meshes map their UVs once across the mesh, so the model's largest axis scale is
+// the world size the texture is stretched over. The distance is taken to the nearest point
+// of the bounding sphere to stay conservative for large objects like the carpet.
+int UTextureLevelForDraw(const StreamedTexture& stream, const glm::mat4& model, const FrameState& frame)
+{
+    const float worldSize = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    const float distance = std::max(glm::length(glm::vec3(model[3]) - frame.cameraPosition) - worldSize * 0.87f, 0.1f);
+    const float screenPixels = worldSize / (2.0f * distance * tanf(glm::radians(frame.zoom) * 0.5f)) * WINDOW_HEIGHT;
+    const float texels = (float)std::max(stream.width, stream.height);
 
-            25,	26,	10,
-            10, 26, 11,
+    const int level = (int)floorf(log2f(std::max(texels / std::max(screenPixels, 1.0f), 1.0f)));
+    return std::min(level, stream.mipCount - 1);
+}
 
-            26,	27,	11,
-            11,	27,	12,
+// The six planes of the view frustum with normals pointing inwards, scaled so that
+// dot(plane, vec4(p, 1)) is the distance of p in world units
+void UFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    const glm::mat4 m = glm::transpose(viewProjection);
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[3] + m[2];
+    planes[5] = m[3] - m[2];
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
 
-            27,	28,	12,
-            12,	28,	13,
+// Appends an entity to every component array of gScene. Entities live until the scene is
+// replaced, so rows stay in the order they were created, which is the draw order.
+void UCreateEntity(const EntityDescription& description)
+{
+    SceneStore& scene = gScene;
+    scene.entities.Create();
+    scene.name.push_back(description.name);
+    scene.model.push_back(description.model);
+    scene.normalMatrix.emplace_back();
+    scene.boundsX.push_back(0.0f);
+    scene.boundsY.push_back(0.0f);
+    scene.boundsZ.push_back(0.0f);
+    scene.boundsRadius.push_back(0.0f);
+    scene.mesh.push_back(description.mesh);
+    scene.indexCount.push_back(description.indexCount);
+    scene.material.push_back(description.material);
+    scene.texture.push_back(description.texture);
+    scene.stencil.push_back(description.stencil);
+    scene.flags.push_back((uint8_t)(ENTITY_TRANSFORM_DIRTY | (description.dynamic ? ENTITY_DYNAMIC : 0)));
+}
 
-            28,	29,	13,
-            13,	29,	14,
+// Transform system: refreshes the normal matrix and bounding sphere of every entity whose model
+// changed. Rows of a stencil run after its mark copy the sphere of the row before them, which
+// was brought up to date first, so a moved mark carries its run along.
+void UUpdateTransforms()
+{
+    SceneStore& scene = gScene;
+    bool previousUpdated = false;
+    for (uint32_t row = 0; row < scene.entities.Size(); ++row)
+    {
+        const bool inRun = row > 0 && scene.stencil[row] != STENCIL_OFF && scene.stencil[row] != STENCIL_MARK;
+        if ((scene.flags[row] & ENTITY_TRANSFORM_DIRTY) == 0 && !(inRun && previousUpdated))
+        {
+            previousUpdated = false;
+            continue;
+        }
 
-            30,	0,	14,
-            0, 16, 30,
+        const glm::mat4& model = scene.model[row];
+        scene.normalMatrix[row] = glm::mat3(glm::transpose(glm::inverse(model)));
+        if (inRun)
+        {
+            scene.boundsX[row] = scene.boundsX[row - 1];
+            scene.boundsY[row] = scene.boundsY[row - 1];
+            scene.boundsZ[row] = scene.boundsZ[row - 1];
+            scene.boundsRadius[row] = scene.boundsRadius[row - 1];
+        }
+        else
+        {
+            const float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            scene.boundsX[row] = model[3].x;
+            scene.boundsY[row] = model[3].y;
+            scene.boundsZ[row] = model[3].z;
+            scene.boundsRadius[row] = scene.mesh[row]->radius * scale;
+        }
+        scene.flags[row] &= ~ENTITY_TRANSFORM_DIRTY;
+        previousUpdated = true;
+    }
+}
 
-            30, 29, 14
+// Culling system: writes the rows [first, end) whose bounds touch the frustum to visible, which
+// has room for end - first rows, and returns how many there are. Every row is tested against
+// all planes and written whether it passes or not, so the loop has no branches to vectorize around.
+uint32_t UCullEntities(const glm::vec4 planes[6], uint32_t first, uint32_t end, uint32_t* visible)
+{
+    const float* x = gScene.boundsX.data();
+    const float* y = gScene.boundsY.data();
+    const float* z = gScene.boundsZ.data();
+    const float* radius = gScene.boundsRadius.data();
 
-        };
+    uint32_t count = 0;
+    for (uint32_t row = first; row < end; ++row)
+    {
+        bool inside = true;
+        for (int i = 0; i < 6; ++i)
+            inside &= planes[i].x * x[row] + planes[i].y * y[row] + planes[i].z * z[row] + planes[i].w >= -radius[row];
+        visible[count] = row;
+        count += inside ? 1 : 0;
+    }
+    return count;
+}
 
-        const GLuint floatsPerTexture = 2;
-        const GLuint floatsPerVertex = 3;
+// Culls the rows [first, end) and records a packet and a sort key for each visible one.
+// Only reads shared state, so any number of these can run at once on different recorders.
+void URecordDraws(CommandRecorder& recorder, uint32_t recorderIndex, uint32_t first, uint32_t end,
+                  const glm::mat4& view, const glm::vec4 planes[6], const FrameState& frame)
+{
+    recorder.packets.clear();
+    recorder.opaqueKeys.clear();
+    recorder.blendedKeys.clear();
 
+    recorder.visible.resize(end - first);
+    const uint32_t visibleCount = UCullEntities(planes, first, end, recorder.visible.data());
 
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+    const SceneStore& scene = gScene;
+    for (uint32_t i = 0; i < visibleCount; ++i)
+    {
+        const uint32_t row = recorder.visible[i];
+
+        DrawPacket packet;
+        packet.object = row;
+        packet.stream = scene.texture[row] != nullptr ? UFindStreamedTexture(*scene.texture[row]) : nullptr;
+        if (packet.stream != nullptr && packet.stream->mipCount == 0)
+            packet.stream = nullptr;
+        packet.textureLevel = packet.stream != nullptr ? UTextureLevelForDraw(*packet.stream, scene.model[row], frame) : 0;
+
+        const uint32_t index = recorderIndex << DRAW_PACKET_RECORDER_SHIFT | (uint32_t)recorder.packets.size();
+        recorder.packets.push_back(packet);
+
+        // A stencil run shares its mark's sphere, so it gets one key and the stable sort keeps it together and in order
+        const glm::vec4 center(scene.boundsX[row], scene.boundsY[row], scene.boundsZ[row], 1.0f);
+        const uint32_t depthKey = QuantizeDepth(-(view * center).z, LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
+        if (UIsBlended(row))
+            recorder.blendedKeys.push_back({ (1u << DRAW_DEPTH_BITS) - 1 - depthKey, index }); // Farthest first
+        else
+            recorder.opaqueKeys.push_back({ depthKey, index });
+    }
+}
 
-        // Create 2 buffers: first one for the vertex data; second one for the indices
-        glGenBuffers(2, mesh.vbos);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+// Packet a DrawKey of this frame's queues refers to
+const DrawPacket& UDrawPacket(uint32_t index)
+{
+    return gRecorders[index >> DRAW_PACKET_RECORDER_SHIFT].packets[index & ((1u << DRAW_PACKET_RECORDER_SHIFT) - 1)];
+}
 
-        mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// Records this frame's draws, on up to recorderCount workers (0 uses all of them), and merges
+// them into the sorted queues. Must run on the thread that draws the frame. Returns the number
+// of workers used, small scenes are recorded by fewer than asked for.
+int UBuildDrawQueues(const glm::mat4& view, const glm::mat4& projection, int recorderCount)
+{
+    UUpdateTransforms();
 
-        // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
+    const uint32_t entityCount = gScene.entities.Size();
+    const int maxRecorders = (int)gRecorders.size();
+    const int wanted = (int)((entityCount + RECORD_OBJECTS_PER_WORKER - 1) / RECORD_OBJECTS_PER_WORKER);
+    const int recorders = std::max(std::min(recorderCount > 0 ? recorderCount : maxRecorders, std::min(wanted, maxRecorders)), 1);
 
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
+    glm::vec4 planes[6];
+    UFrustumPlanes(projection * view, planes);
+    const FrameState& frame = *gRenderState;
 
+    // Every recorder fills buffers in the arena of the thread it runs on, sized for all of its objects
+    auto record = [&](int r)
+    {
+        const uint32_t first = (uint32_t)((uint64_t)entityCount * r / recorders);
+        const uint32_t end = (uint32_t)((uint64_t)entityCount * (r + 1) / recorders);
+
+        CommandRecorder& recorder = gRecorders[r];
+        FrameArena* arena = gFrameArenas.Local();
+        recorder.visible = FrameVector<uint32_t>(arena);
+        recorder.packets = FrameVector<DrawPacket>(arena);
+        recorder.opaqueKeys = FrameVector<DrawKey>(arena);
+        recorder.blendedKeys = FrameVector<DrawKey>(arena);
+        recorder.visible.reserve(end - first);
+        recorder.packets.reserve(end - first);
+        recorder.opaqueKeys.reserve(end - first);
+        recorder.blendedKeys.reserve(end - first);
+        URecordDraws(recorder, (uint32_t)r, first, end, view, planes, frame);
+    };
+    if (recorders > 1)
+        gJobs->ParallelFor(recorders, record);
+    else
+        record(0);
+
+    size_t opaqueCount = 0;
+    size_t blendedCount = 0;
+    for (int r = 0; r < recorders; ++r)
+    {
+        opaqueCount += gRecorders[r].opaqueKeys.size();
+        blendedCount += gRecorders[r].blendedKeys.size();
+    }
 
-        glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-        glEnableVertexAttribArray(2);
-}
+    FrameArena* arena = gFrameArenas.Local();
+    gOpaqueQueue = FrameVector<DrawKey>(arena);
+    gBlendedQueue = FrameVector<DrawKey>(arena);
+    gDrawSortScratch = FrameVector<DrawKey>(arena);
+    gOpaqueQueue.reserve(opaqueCount);
+    gBlendedQueue.reserve(blendedCount);
+    gDrawSortScratch.reserve(std::max(opaqueCount, blendedCount));
+    for (int r = 0; r < recorders; ++r)
+    {
+        const CommandRecorder& recorder = gRecorders[r];
+        gOpaqueQueue.insert(gOpaqueQueue.end(), recorder.opaqueKeys.begin(), recorder.opaqueKeys.end());
+        gBlendedQueue.insert(gBlendedQueue.end(), recorder.blendedKeys.begin(), recorder.blendedKeys.end());
 
-    else if (meshChoice == 4) {
-    //**********************************************************************
-    //Coffee Cup Handle Outside
-    //**********************************************************************
-    //Currently using half cylinder mesh scaled and rotated for handle
-    //Will eventually try to use a torus once I understand how to render one
+        // Texture streaming is told about every texture drawn this frame and the detail it needs
+        for (const DrawPacket& packet : recorder.packets)
+        {
+            if (packet.stream == nullptr)
+                continue;
+            packet.stream->lastUsedFrame = gFrameIndex;
+            packet.stream->requestedLevel = std::min(packet.stream->requestedLevel, packet.textureLevel);
+        }
+    }
+    for (int r = recorders; r < maxRecorders; ++r)
+        gRecorders[r] = CommandRecorder();
 
-     // Position and Color data
-     GLfloat verts[] = {
+    RadixSortDrawKeys(gOpaqueQueue, gDrawSortScratch);
 
-         //Top Circle
-         // Vertex Positions    // Colors (r,g,b,a)
-         // Top Right Quarter
-          0.0f,  0.5f, 0.0f,   1.0f, 1.0f, // Top Mid Circle Vertex 0
+    // Weighted blended transparency does not depend on order, scene order keeps batches together
+    if (gTransparencyMode == TRANSPARENCY_SORTED)
+        RadixSortDrawKeys(gBlendedQueue, gDrawSortScratch);
+    return recorders;
+}
 
-          0.1f,  0.49f, 0.0f,    1.0f, 1.0f, // 1
-          0.2f,  0.45f, 0.0f,    1.0f, 1.0f, // 2
-          0.3f,  0.4f, 0.0f,    1.0f, 1.0f,// 3
-          0.4f,  0.3f, 0.0f,    1.0f, 1.0f,// 4
-          0.46f,  0.2f, 0.0f,    1.0f, 1.0f,// 5
-          0.49f,  0.1f, 0.0f,    1.0f, 1.0f,// 6
+//**********************************************************
+//RECORDING BENCHMARK
+//
+//Times recording the scene's draws with 1, 2, 4, ... workers
+//and reports the speedup over a single one. Use
+//--extra-objects to get a scene worth splitting.
+//**********************************************************
+void UBenchmarkRecording()
+{
+    const int RUNS = 50;
+    const FrameState& frame = *gRenderState;
 
-          0.5f,  0.0f, 0.0f,    1.0f, 1.0f,// 7 Right Mid Circle Vertex
+    cout << "INFO: Recording benchmark, " << gScene.entities.Size() << " objects, " << RUNS << " runs per sample" << endl;
 
-          // Bottom Right Quarter
-          0.49f,  -0.1f, 0.0f,    1.0f, 1.0f,// 8
-          0.45f,  -0.2f, 0.0f,    1.0f, 1.0f,// 9
-          0.4f,  -0.3f, 0.0f,    1.0f, 1.0f,// 10
-          0.3f,  -0.4f, 0.0f,    1.0f, 1.0f,// 11
-          0.2f,  -0.46f, 0.0f,   1.0f, 1.0f,// 12
-          0.1f,  -0.49f, 0.0f,   1.0f, 1.0f,// 13
+    double singleMs = 0.0;
+    for (int recorders = 1; ; recorders = std::min(recorders * 2, (int)gRecorders.size()))
+    {
+        int used = 0;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int run = 0; run < RUNS; ++run)
+        {
+            // Every run replaces the queues of the one before, so its arena space can be reused
+            gFrameArenas.RewindCurrent();
+            used = UBuildDrawQueues(frame.view, frame.projection, recorders);
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / RUNS;
+        if (recorders == 1)
+            singleMs = ms;
 
-          0.0f,  -0.5f, 0.0f,    1.0f, 1.0f,// 14 Bottom Mid Circle Vertex                  
+        cout << "INFO:   " << used << " workers: " << ms << " ms, " << singleMs / ms << "x, "
+             << gOpaqueQueue.size() + gBlendedQueue.size() << " draws after culling" << endl;
 
-          0.0f,  0.0f, 0.0f,     1.0f, 1.0f,// Circle Center 15
+        if (recorders == (int)gRecorders.size())
+            break;
+    }
+}
 
-         //Bottom Circle
-         // Vertex Positions    // Colors (r,g,b,a)
-         // Top Right Quarter
-          0.0f,  0.5f, 1.0f,   1.0f, 1.0f,// Top Mid Circle Vertex 16
+//**********************************************************
+//JOB SYSTEM BENCHMARK
+//
+//Measures what scheduling a job costs and how a parallel for
+//scales from 1 to 64 threads, after checking that every index
+//runs exactly once and that dependent jobs wait for theirs.
+//Thread counts above the core count show the cost of
+//oversubscription rather than a speedup.
+//**********************************************************
+bool UBenchmarkJobs()
+{
+    const int JOBS = 100000;
+    const int ITEMS = 1 << 20;
+    const int GRAIN = 1024;
+    const int RUNS = 10;
 
-          0.1f,  0.49f, 1.0f,   1.0f, 1.0f,// 17
-          0.2f,  0.45f, 1.0f,   1.0f, 1.0f,// 18
-          0.3f,  0.4f, 1.0f,    1.0f, 1.0f,// 19
-          0.4f,  0.3f, 1.0f,   1.0f, 1.0f,// 20
-          0.46f,  0.2f, 1.0f,   1.0f, 1.0f,// 21
-          0.49f,  0.1f, 1.0f,   1.0f, 1.0f,// 22
+    cout << "INFO: Job system benchmark, " << std::thread::hardware_concurrency() << " cores" << endl;
 
-          0.5f,  0.0f, 1.0f,    1.0f, 1.0f,// 23 Right Mid Circle Vertex
+    std::vector<float> data(ITEMS);
+    std::vector<std::atomic<int>> visits(ITEMS);
+    double singleMs = 0.0;
+    for (unsigned int threads = 1; threads <= 64; threads *= 2)
+    {
+        JobSystem jobs(threads);
 
-          // Bottom Right Quarter
-          0.49f,  -0.1f, 1.0f,    1.0f, 1.0f,// 24
-          0.45f,  -0.2f, 1.0f,   1.0f, 1.0f,// 25
-          0.4f,  -0.3f, 1.0f,   1.0f, 1.0f,// 26
-          0.3f,  -0.4f, 1.0f,    1.0f, 1.0f,// 27
-          0.2f,  -0.46f, 1.0f,    1.0f, 1.0f,// 28
-          0.1f,  -0.49f, 1.0f,    1.0f, 1.0f,// 29
+        // Every index exactly once, with a grain that does not divide the count
+        for (std::atomic<int>& visit : visits)
+            visit.store(0, std::memory_order_relaxed);
+        jobs.ParallelFor(ITEMS, [&](int i) { visits[i].fetch_add(1, std::memory_order_relaxed); }, 1000);
+        for (int i = 0; i < ITEMS; ++i)
+        {
+            if (visits[i].load(std::memory_order_relaxed) != 1)
+            {
+                cout << "ERROR: Job system ran index " << i << " " << visits[i] << " times with " << threads << " threads" << endl;
+                return false;
+            }
+        }
 
-          0.0f,  -0.5f, 1.0f,    1.0f, 1.0f,// 30 Bottom Mid Circle Vertex                
+        // A diamond of dependencies, the last job has to see all work before it
+        JobCounter first, middle, last;
+        std::atomic<int> stage{ 0 };
+        std::atomic<bool> ordered{ true };
+        jobs.Run([&] { stage = 1; }, &first);
+        for (int i = 0; i < 8; ++i)
+            jobs.RunAfter(first, [&] { if (stage.load() < 1) ordered = false; stage.fetch_add(1); }, &middle);
+        jobs.RunAfter(middle, [&] { if (stage.load() != 9) ordered = false; }, &last);
+        jobs.Wait(last);
+        if (!ordered)
+        {
+            cout << "ERROR: Job system ran a job before its dependency with " << threads << " threads" << endl;
+            return false;
+        }
 
-          0.0f,  0.0f, 1.0f,    1.0f, 1.0f,// Circle Center 31
-     };
+        // Overhead of scheduling, empty jobs do nothing but get queued, found and finished
+        JobCounter empty;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < JOBS; ++i)
+            jobs.Run([] {}, &empty);
+        jobs.Wait(empty);
+        const double jobNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / JOBS;
+
+        start = std::chrono::steady_clock::now();
+        jobs.ParallelFor(JOBS, [](int) {});
+        const double splitNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / JOBS;
+
+        // Scaling on work worth splitting
+        start = std::chrono::steady_clock::now();
+        for (int run = 0; run < RUNS; ++run)
+        {
+            jobs.ParallelFor(ITEMS, [&](int i)
+            {
+                const float x = (float)i * 0.001f;
+                data[i] = sqrtf(x) * sinf(x) + cosf(x * 0.5f);
+            }, GRAIN);
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / RUNS;
+        if (threads == 1)
+            singleMs = ms;
 
-     // Index data to share position data
-     GLushort indices[] = {
+        cout << "INFO:   " << threads << " threads: " << jobNs << " ns per submitted job, " << splitNs
+             << " ns per split index, parallel for " << ms << " ms, " << singleMs / ms << "x" << endl;
+    }
 
-         /*//Top Circle 
-         //Top Right Quarter
-         0, 1, 15,
-         1, 2, 15,
-         2, 3, 15,
-         3, 4, 15,
-         4, 5, 15,
-         5, 6, 15,
-         6, 7, 15,
+    cout << "INFO: Job system checks passed" << endl;
+    return true;
+}
 
-         //Bottom Right Quarter
-         7, 8, 15,
-         8, 9, 15,
-         9, 10, 15,
-         10, 11, 15,
-         11, 12, 15,
-         12, 13, 15,
-         13, 14, 15,
+//**********************************************************
+//SCENE FILE BENCHMARK
+//
+//Generates a scene of N entities and times reading it as
+//JSON and in its compiled form. A second parse into the same
+//description shows the reader itself does not allocate.
+//**********************************************************
+bool UBenchmarkScene()
+{
+    const int entities = gBenchmarkSceneEntities;
+    const int RUNS = 5;
+
+    // Entities on a grid, two meshes, materials and textures to look up by name
+    std::string json = "{\n    \"textures\": [\n"
+                       "        { \"name\": \"cart\", \"path\": \"../resources/textures/grey.jpg\" },\n"
+                       "        { \"name\": \"pages\", \"path\": \"../resources/textures/pages.jpg\", \"atlas\": true }\n    ],\n"
+                       "    \"materials\": [\n"
+                       "        { \"name\": \"matte\", \"ambient\": 0.5, \"specular\": 0.5, \"highlight\": 16.0, \"alpha\": 1.0 },\n"
+                       "        { \"name\": \"glossy\", \"ambient\": 1.0, \"specular\": 3.0, \"highlight\": 16.0, \"alpha\": 1.0 }\n    ],\n"
+                       "    \"lights\": [ { \"position\": [-3.5, 1.5, 0.0], \"color\": [1.0, 1.0, 0.9] } ],\n"
+                       "    \"entities\": [\n";
+    json.reserve(json.size() + (size_t)entities * 220);
+    char line[256];
+    for (int i = 0; i < entities; ++i)
+    {
+        const bool box = i % 2 == 0;
+        snprintf(line, sizeof(line),
+                 "        { \"name\": \"Entity %d\", \"mesh\": \"%s\", \"texture\": \"%s\", \"material\": \"%s\", \"position\": [%.3f, -2.0, %.3f], "
+                 "\"rotate\": [[%.4f, 0, 1, 0]], \"scale\": [0.2, 0.2, 0.2] }%s\n",
+                 i, box ? "cube" : "fullCyl", box ? "pages" : "cart", box ? "matte" : "glossy", (float)(i % 1000) * 0.1f,
+                 (float)(i / 1000) * 0.1f, (float)(i % 628) * 0.01f, i + 1 < entities ? "," : "");
+        json += line;
+    }
+    json += "    ]\n}\n";
 
-         //Bottom Circle 
-         //Top Right Quarter
-         16, 17, 31,
-         17, 18, 31,
-         18, 19, 31,
-         19, 20, 31,
-         20, 21, 31,
-         21, 22, 31,
-         22, 23, 31,
+    cout << "INFO: Scene file benchmark, " << entities << " entities, " << json.size() / 1024 << " KB of JSON" << endl;
 
-         //Bottom Right Quarter
-         23, 24, 31,
-         24, 25, 31,
-         25, 26, 31,
-         26, 27, 31,
-         27, 28, 31,
-         28, 29, 31,
-         29, 30, 31,*/
+    SceneDescription scene;
+    std::string error;
+    double jsonMs = 1e30;
+    uint64_t parseAllocations = 0;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        const uint64_t allocations = gHeapAllocations.load(std::memory_order_relaxed);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!ParseSceneJson(json.data(), json.size(), scene, error))
+        {
+            cout << "ERROR: Generated scene did not parse: " << error << endl;
+            return false;
+        }
+        jsonMs = std::min(jsonMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        parseAllocations = gHeapAllocations.load(std::memory_order_relaxed) - allocations;
+    }
+    if (scene.entities.size() != (size_t)entities || scene.meshes.size() != 2)
+    {
+        cout << "ERROR: Generated scene read back " << scene.entities.size() << " entities and " << scene.meshes.size() << " meshes" << endl;
+        return false;
+    }
 
+    std::vector<unsigned char> bytes;
+    WriteSceneBinary(scene, bytes);
 
-         //Cylinder Sides
-         0, 16, 1,
-         16, 17, 1,
+    SceneDescription compiled;
+    double binaryMs = 1e30;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!ReadSceneBinary(bytes.data(), bytes.size(), compiled, error))
+        {
+            cout << "ERROR: Compiled scene did not load: " << error << endl;
+            return false;
+        }
+        binaryMs = std::min(binaryMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
 
-         1, 17, 2,
-         17, 18, 2,
-         2,	18,	3,
+    // Both forms have to describe the same scene
+    if (compiled.entities.size() != scene.entities.size() || compiled.strings != scene.strings ||
+        memcmp(compiled.entities.data(), scene.entities.data(), scene.entities.size() * sizeof(SceneEntity)) != 0)
+    {
+        cout << "ERROR: Compiled scene differs from the JSON it was compiled from" << endl;
+        return false;
+    }
 
-         18,	19,	3,
-         3,	19,	4,
+    cout << "INFO:   JSON " << jsonMs << " ms, " << json.size() / (jsonMs * 1000.0) << " MB/s, " << parseAllocations
+         << " heap allocations parsing into a used description" << endl;
+    cout << "INFO:   Compiled " << binaryMs << " ms, " << bytes.size() / 1024 << " KB, " << jsonMs / binaryMs << "x faster" << endl;
+    cout << "INFO: Scene file checks passed" << endl;
+    return true;
+}
 
-         19,	20,	4,
-         4,	20,	5,
+//**********************************************************
+//SCENE SNAPSHOT
+//
+//The built scene saved as one image of pointer-free columns,
+//mapped on the next launch instead of reading and building
+//the scene again. Meshes, materials and textures are stored as
+//indices and resolved when the image is loaded; entity names
+//are read in place from the mapping. The image is tied to the
+//scene file it was built from, to the options adding
+//generated entities and to the procedural meshes, and is
+//rebuilt when any of them changed.
+//**********************************************************
 
-         20,	21,	5,
-         5,	21, 6,
+// Identifies the scene a snapshot was built from: the file's size and time, or a hash of the embedded scene
+SceneSnapshotKey USceneSnapshotKey()
+{
+    SceneSnapshotKey key = {};
+    if (gScenePath != nullptr)
+    {
+        std::error_code error;
+        key.sourceSize = (uint64_t)std::filesystem::file_size(gScenePath, error);
+        key.sourceTime = (int64_t)std::filesystem::last_write_time(gScenePath, error).time_since_epoch().count();
+    }
+    else
+    {
+        key.sourceSize = strlen(defaultSceneSource);
+        uint64_t hash = 14695981039346656037ull;        // FNV-1a
+        for (const char* c = defaultSceneSource; *c != '\0'; ++c)
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+        key.sourceTime = (int64_t)hash;
+    }
+    key.oitTestCylinders = gOitTestCylinders;
+    key.extraObjects = gExtraObjects;
+    return key;
+}
 
-         21,	22,	6,
-         6,	22,	7,
+// Lays out gScene and the scene description it was built from as a snapshot image
+bool UBuildSceneSnapshot(std::vector<unsigned char>& image)
+{
+    const SceneStore& scene = gScene;
+    const uint32_t rows = scene.entities.Size();
+
+    // The description without its entities, they are in the columns
+    SceneDescription description = gSceneDescription;
+    description.entities.clear();
+    std::vector<unsigned char> compiledScene;
+    WriteSceneBinary(description, compiledScene);
+
+    // Pointers become indices, names are stored once each
+    std::vector<char> names;
+    std::vector<uint32_t> nameOffsets(rows);
+    std::unordered_map<const char*, uint32_t> nameIndex;
+    std::vector<uint32_t> meshes(rows), materials(rows), textures(rows);
+    std::vector<uint8_t> stencil(rows);
+    for (uint32_t row = 0; row < rows; ++row)
+    {
+        const auto inserted = nameIndex.insert({ scene.name[row], (uint32_t)names.size() });
+        if (inserted.second)
+            names.insert(names.end(), scene.name[row], scene.name[row] + strlen(scene.name[row]) + 1);
+        nameOffsets[row] = inserted.first->second;
+
+        meshes[row] = SCENE_NONE;
+        for (size_t i = 0; i < SCENE_MESH_COUNT; ++i)
+            meshes[row] = SCENE_MESHES[i].mesh == scene.mesh[row] ? (uint32_t)i : meshes[row];
+
+        materials[row] = SCENE_NONE;
+        for (size_t i = 0; i < gSceneMaterials.size(); ++i)
+            materials[row] = &gSceneMaterials[i] == scene.material[row] ? (uint32_t)i : materials[row];
+        for (size_t i = 0; i < SNAPSHOT_MATERIAL_COUNT; ++i)
+            materials[row] = SNAPSHOT_MATERIALS[i] == scene.material[row] ? (uint32_t)(gSceneMaterials.size() + i) : materials[row];
+
+        textures[row] = scene.texture[row] != nullptr ? (uint32_t)(scene.texture[row] - gSceneTextures.data()) : SCENE_NONE;
+        stencil[row] = (uint8_t)scene.stencil[row];
+
+        if (meshes[row] == SCENE_NONE || materials[row] == SCENE_NONE || (textures[row] != SCENE_NONE && textures[row] >= gSceneTextures.size()) ||
+            (scene.flags[row] & ENTITY_TRANSFORM_DIRTY) != 0)
+        {
+            cout << "ERROR: Entity " << scene.name[row] << " cannot be stored in a snapshot" << endl;
+            return false;
+        }
+    }
 
-         22,	23,	7,
-         7,	23,	8,
+    std::vector<SnapshotMeshInfo> meshInfo(SCENE_MESH_COUNT);
+    for (size_t i = 0; i < SCENE_MESH_COUNT; ++i)
+        meshInfo[i] = { SCENE_MESHES[i].mesh->nIndices, SCENE_MESHES[i].mesh->radius };
+
+    const SceneSnapshotKey key = USceneSnapshotKey();
+    SnapshotWriter writer;
+    writer.Add(SNAPSHOT_KEY, &key, 1);
+    writer.Add(SNAPSHOT_SCENE, compiledScene);
+    writer.Add(SNAPSHOT_NAMES, names);
+    writer.Add(SNAPSHOT_NAME_OFFSETS, nameOffsets);
+    writer.Add(SNAPSHOT_MODEL, scene.model);
+    writer.Add(SNAPSHOT_NORMAL_MATRIX, scene.normalMatrix);
+    writer.Add(SNAPSHOT_BOUNDS_X, scene.boundsX);
+    writer.Add(SNAPSHOT_BOUNDS_Y, scene.boundsY);
+    writer.Add(SNAPSHOT_BOUNDS_Z, scene.boundsZ);
+    writer.Add(SNAPSHOT_BOUNDS_RADIUS, scene.boundsRadius);
+    writer.Add(SNAPSHOT_MESH, meshes);
+    writer.Add(SNAPSHOT_INDEX_COUNT, scene.indexCount);
+    writer.Add(SNAPSHOT_MATERIAL, materials);
+    writer.Add(SNAPSHOT_TEXTURE, textures);
+    writer.Add(SNAPSHOT_STENCIL, stencil);
+    writer.Add(SNAPSHOT_FLAGS, scene.flags);
+    writer.Add(SNAPSHOT_MESH_INFO, meshInfo);
+    writer.Write(SCENE_SNAPSHOT_MAGIC, SCENE_SNAPSHOT_VERSION, image);
+    return true;
+}
 
-         23,	24,	8,
-         8,	24,	9,
+// Saves the built scene, its transforms have to be up to date
+bool UWriteSceneSnapshot(const char* path)
+{
+    std::vector<unsigned char> image;
+    if (!UBuildSceneSnapshot(image))
+        return false;
 
-         24,	25, 9,
-         9,	25,	10,
+    // Write beside the target and rename, a mapping of the old snapshot keeps its pages
+    const std::string temporaryPath = std::string(path) + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.write((const char*)image.data(), image.size()))
+        {
+            cout << "ERROR: Could not write scene snapshot " << path << endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+    {
+        cout << "ERROR: Could not write scene snapshot " << path << ": " << error.message() << endl;
+        return false;
+    }
 
-         25,	26,	10,
-         10, 26, 11,
+    cout << "INFO: Wrote scene snapshot " << path << ", " << gScene.entities.Size() << " entities in " << image.size() / 1024 << " KB" << endl;
+    return true;
+}
 
-         26,	27,	11,
-         11,	27,	12,
+// Copies a column out of the image, false unless it has one value per row
+template<typename T>
+bool UTakeSnapshotColumn(const SnapshotImage& image, uint32_t id, size_t rows, std::vector<T>& column)
+{
+    size_t count;
+    const T* values = image.Section<T>(id, count);
+    if (values == nullptr || count != rows)
+        return false;
+    column.assign(values, values + count);
+    return true;
+}
 
-         27,	28,	12,
-         12,	28,	13,
+// Maps a snapshot and takes the scene from it. Fails without touching the scene when the file
+// is missing, damaged or was built from another scene or other options.
+bool ULoadSceneSnapshot(const char* path)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-         28,	29,	13,
-         13,	29,	14,
+    MappedFile& file = gSceneSnapshot;
+    if (!file.Open(path))
+    {
+        cout << "INFO: No scene snapshot at " << path << " yet, building the scene" << endl;
+        return false;
+    }
 
-         30,	0,	14,
-         0, 16, 30,
+    std::string error;
+    SnapshotImage image;
+    size_t count, rows, nameBytes;
+    bool valid = image.Open(file.Data(), file.Size(), SCENE_SNAPSHOT_MAGIC, SCENE_SNAPSHOT_VERSION, error);
+    const SceneSnapshotKey* key = valid ? image.Section<SceneSnapshotKey>(SNAPSHOT_KEY, count) : nullptr;
+    const SceneSnapshotKey currentKey = USceneSnapshotKey();
+    if (valid && (key == nullptr || count != 1 || memcmp(key, &currentKey, sizeof(currentKey)) != 0))
+    {
+        valid = false;
+        error = "built from another scene or with other options";
+    }
 
-         30, 29, 14
+    const unsigned char* compiledScene = valid ? image.Section<unsigned char>(SNAPSHOT_SCENE, count) : nullptr;
+    SceneDescription description;
+    valid = valid && compiledScene != nullptr && ReadSceneBinary(compiledScene, count, description, error);
+
+    const char* names = valid ? image.Section<char>(SNAPSHOT_NAMES, nameBytes) : nullptr;
+    const uint32_t* nameOffsets = valid ? image.Section<uint32_t>(SNAPSHOT_NAME_OFFSETS, rows) : nullptr;
+    const uint32_t* meshes = valid ? image.Section<uint32_t>(SNAPSHOT_MESH, count) : nullptr;
+    valid = valid && names != nullptr && nameOffsets != nullptr && meshes != nullptr && count == rows &&
+            (rows == 0 || (nameBytes > 0 && names[nameBytes - 1] == '\0'));
+    const uint32_t* materials = valid ? image.Section<uint32_t>(SNAPSHOT_MATERIAL, count) : nullptr;
+    valid = valid && materials != nullptr && count == rows;
+    const uint32_t* textures = valid ? image.Section<uint32_t>(SNAPSHOT_TEXTURE, count) : nullptr;
+    valid = valid && textures != nullptr && count == rows;
+    const uint8_t* stencil = valid ? image.Section<uint8_t>(SNAPSHOT_STENCIL, count) : nullptr;
+    valid = valid && stencil != nullptr && count == rows;
+    if (!valid)
+    {
+        cout << "INFO: Rebuilding the scene, snapshot " << path << " " << (error.empty() ? "is damaged" : error) << endl;
+        file.Close();
+        return false;
+    }
 
-     };
+    // References are checked before anything is taken, so a bad snapshot leaves no half built scene
+    const size_t materialCount = description.materials.size() + SNAPSHOT_MATERIAL_COUNT;
+    for (size_t row = 0; row < rows && valid; ++row)
+    {
+        valid = nameOffsets[row] < nameBytes && meshes[row] < SCENE_MESH_COUNT && materials[row] < materialCount &&
+                (textures[row] == SCENE_NONE || textures[row] < description.textures.size()) && stencil[row] <= STENCIL_MASKED;
+    }
 
-     const GLuint floatsPerTexture = 2;
-     const GLuint floatsPerVertex = 3;
+    SceneStore scene;
+    valid = valid && UTakeSnapshotColumn(image, SNAPSHOT_MODEL, rows, scene.model) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_NORMAL_MATRIX, rows, scene.normalMatrix) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_BOUNDS_X, rows, scene.boundsX) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_BOUNDS_Y, rows, scene.boundsY) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_BOUNDS_Z, rows, scene.boundsZ) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_BOUNDS_RADIUS, rows, scene.boundsRadius) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_INDEX_COUNT, rows, scene.indexCount) &&
+            UTakeSnapshotColumn(image, SNAPSHOT_FLAGS, rows, scene.flags);
+    if (!valid)
+    {
+        cout << "INFO: Rebuilding the scene, snapshot " << path << " is damaged" << endl;
+        file.Close();
+        return false;
+    }
 
+    gSceneDescription = std::move(description);
+    UCreateSceneMaterials();
 
-     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-     glBindVertexArray(mesh.vao);
+    scene.entities.Reserve(rows);
+    scene.name.resize(rows);
+    scene.mesh.resize(rows);
+    scene.material.resize(rows);
+    scene.texture.resize(rows);
+    scene.stencil.resize(rows);
+    for (size_t row = 0; row < rows; ++row)
+    {
+        scene.entities.Create();
+        scene.name[row] = names + nameOffsets[row];
+        scene.mesh[row] = SCENE_MESHES[meshes[row]].mesh;
+        scene.material[row] = materials[row] < gSceneMaterials.size() ? &gSceneMaterials[materials[row]]
+                                                                       : SNAPSHOT_MATERIALS[materials[row] - gSceneMaterials.size()];
+        scene.texture[row] = textures[row] != SCENE_NONE ? &gSceneTextures[textures[row]] : nullptr;
+        scene.stencil[row] = (StencilPass)stencil[row];
+    }
+    gScene = std::move(scene);
+    UUseSceneLamp();
 
-     // Create 2 buffers: first one for the vertex data; second one for the indices
-     glGenBuffers(2, mesh.vbos);
-     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cout << "INFO: Scene snapshot " << path << ": " << rows << " entities mapped in " << ms << " ms" << endl;
+    return true;
+}
 
-     mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// Whether the scene taken from the snapshot fits the meshes created since. Index counts and
+// bounds were taken from the meshes it was built with, which change with the code generating
+// them rather than with the scene file.
+bool USnapshotMatchesMeshes()
+{
+    std::string error;
+    SnapshotImage image;
+    size_t count = 0;
+    const SnapshotMeshInfo* meshInfo = image.Open(gSceneSnapshot.Data(), gSceneSnapshot.Size(), SCENE_SNAPSHOT_MAGIC, SCENE_SNAPSHOT_VERSION, error)
+                                           ? image.Section<SnapshotMeshInfo>(SNAPSHOT_MESH_INFO, count) : nullptr;
+    bool valid = meshInfo != nullptr && count == SCENE_MESH_COUNT;
+    for (size_t i = 0; i < SCENE_MESH_COUNT && valid; ++i)
+        valid = meshInfo[i].nIndices == SCENE_MESHES[i].mesh->nIndices && meshInfo[i].radius == SCENE_MESHES[i].mesh->radius;
+
+    // Whatever the stored meshes say, no row may draw past the end of its mesh
+    const SceneStore& scene = gScene;
+    for (uint32_t row = 0; row < scene.entities.Size() && valid; ++row)
+        valid = scene.indexCount[row] <= scene.mesh[row]->nIndices;
+
+    if (!valid)
+        cout << "INFO: Rebuilding the scene, snapshot " << gSnapshotPath << " was built from other meshes" << endl;
+    return valid;
+}
 
-     // Strides between vertex coordinates is 5 (x, y, z, tX, tY). A tightly packed stride is 0.
-     GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture);// The number of floats before each
+// Times a launch building the scene against one mapping its snapshot, first with the snapshot's
+// pages dropped from the OS cache and then with them cached. Uses a snapshot file of its own,
+// the one of --snapshot would otherwise be replaced by one built without meshes.
+bool UBenchmarkSnapshot()
+{
+    const char* path = "scene_benchmark.snapshot";
+    const auto elapsedMs = [](std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
 
-     // Create Vertex Attribute Pointers
-     glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-     glEnableVertexAttribArray(0);
+    // What a launch without a snapshot does. Meshes are not created without a window, which
+    // leaves their bounds at zero but costs the same.
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!ULoadScene())
+        return false;
+    UCreateScene();
+    UUpdateTransforms();
+    const double rebuildMs = elapsedMs(start);
 
+    std::vector<unsigned char> built;
+    if (!UBuildSceneSnapshot(built) || !UWriteSceneSnapshot(path))
+        return false;
 
-     glVertexAttribPointer(2, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-     glEnableVertexAttribArray(2);
+    double loadMs[2];
+    const bool evicted = EvictFileCache(path);
+    for (double& ms : loadMs)
+    {
+        gScene = SceneStore();
+        gSceneSnapshot.Close();
+        start = std::chrono::steady_clock::now();
+        if (!ULoadSceneSnapshot(path))
+        {
+            cout << "ERROR: Scene snapshot did not load back" << endl;
+            return false;
+        }
+        ms = elapsedMs(start);
     }
 
-    else if (meshChoice == 5) {
-    //**********************************************************************
-    //Coffee Cup Texture Top
-    //**********************************************************************
+    // The mapped scene has to be the one that was built
+    std::vector<unsigned char> loaded;
+    if (!UBuildSceneSnapshot(loaded) || loaded != built)
+    {
+        cout << "ERROR: Scene mapped from the snapshot differs from the one built" << endl;
+        return false;
+    }
 
-    // Position and Color data
-    GLfloat verts[] = {
+    cout << "INFO: Scene snapshot benchmark, " << gScene.entities.Size() << " entities, " << built.size() / 1024 << " KB" << endl;
+    cout << "INFO:   Full rebuild " << rebuildMs << " ms" << endl;
+    cout << "INFO:   Cold start " << loadMs[0] << " ms, " << rebuildMs / loadMs[0] << "x faster"
+         << (evicted ? "" : " (file cache could not be dropped, pages may have been cached)") << endl;
+    cout << "INFO:   Warm start " << loadMs[1] << " ms, " << rebuildMs / loadMs[1] << "x faster" << endl;
+    gScene = SceneStore();
+    gSceneSnapshot.Close();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    cout << "INFO: Scene snapshot checks passed" << endl;
+    return true;
+}
 
-        //Top Circle
-        // Vertex Positions    // Colors (r,g,b,a) 
-        // Top Right Quarter                        //Normals            
-         0.0f,  0.5f, 0.0f,     0.5f, 1.0f,         0.0f, 1.0f,  0.0f,                    // Top Mid Circle Vertex 0
-                                                    
-         0.1f,  0.49f, 0.0f,    0.6f, 0.99f,         0.0f, 1.0f,  0.0f,                    // 1
-         0.2f,  0.45f, 0.0f,    0.7f, 0.95f,         0.0f, 1.0f,  0.0f,                    // 2
-         0.3f,  0.4f, 0.0f,     0.8f, 0.9f,          0.0f, 1.0f,  0.0f,                   // 3
-         0.4f,  0.3f, 0.0f,     0.9f, 0.8f,          0.0f, 1.0f,  0.0f,                   // 4
-         0.46f,  0.2f, 0.0f,    0.96f, 0.7f,         0.0f, 1.0f,  0.0f,                    // 5
-         0.49f,  0.1f, 0.0f,    0.99f, 0.6f,         0.0f, 1.0f,  0.0f,                    // 6
+// Draws the blended queue over the default framebuffer, testing but not writing depth.
+// After the deferred path the opaque depth is still in the G-buffer.
+void UDrawBlended(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, bool deferred)
+{
+    if (gBlendedQueue.empty())
+        return;
 
-         0.5f,  0.0f, 0.0f,     1.0f, 0.5f,       0.0f, 1.0f,  0.0f,                      // 7 Right Mid Circle Vertex
+    if (gTransparencyMode == TRANSPARENCY_OIT)
+    {
+        UDrawWeightedBlended(view, projection, viewPosition, deferred ? gGBuffer : 0);
+        return;
+    }
 
-         // Bottom Right Quarter
-         0.49f,  -0.1f, 0.0f,   0.99f, 0.4f,      0.0f, 1.0f,  0.0f,                       // 8
-         0.45f,  -0.2f, 0.0f,   0.95f, 0.3f,      0.0f, 1.0f,  0.0f,                       // 9
-         0.4f,  -0.3f, 0.0f,    0.9f, 0.2f,       0.0f, 1.0f,  0.0f,                      // 10
-         0.3f,  -0.4f, 0.0f,    0.8f, 0.1f,       0.0f, 1.0f,  0.0f,                      // 11
-         0.2f,  -0.46f, 0.0f,   0.7f, 0.04f,      0.0f, 1.0f,  0.0f,                       // 12
-         0.1f,  -0.49f, 0.0f,   0.6f, 0.01f,      0.0f, 1.0f,  0.0f,                       // 13
+    // Blended objects are drawn forward on top and need the scene's depth to be hidden behind it
+    if (deferred)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, gGBuffer);
+        glBlitFramebuffer(0, 0, gGBufferWidth, gGBufferHeight, 0, 0, gGBufferWidth, gGBufferHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
 
-         0.0f,  -0.5f, 0.0f,    0.5f, 0.0f,      0.0f, 1.0f,  0.0f,                       // 14 Bottom Mid Circle Vertex
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    UDrawScene(view, projection, viewPosition, 0, false, gBlendedQueue);
+    glDisable(GL_BLEND);
+}
 
-         // Bottom Left Quarter
-         -0.1f,  -0.49f, 0.0f,  0.4f, 0.01f,    0.0f, 1.0f,  0.0f,                         // 15
-         -0.2f,  -0.45f, 0.0f,  0.3f, 0.05f,    0.0f, 1.0f,  0.0f,                         // 16
-         -0.3f,  -0.4f, 0.0f,   0.2f, 0.1f,     0.0f, 1.0f,  0.0f,                        // 17
-         -0.4f,  -0.3f, 0.0f,   0.1f, 0.2f,     0.0f, 1.0f,  0.0f,                        // 18
-         -0.46f, -0.2f, 0.0f,   0.04f, 0.3f,    0.0f, 1.0f,  0.0f,                         // 19
-         -0.49f, -0.1f, 0.0f,   0.01f, 0.4f,    0.0f, 1.0f,  0.0f,                         // 20
+//********************************************************************
+//WEIGHTED BLENDED TRANSPARENCY
+//
+// Order independent alternative to the sorted blended queue, after
+// McGuire and Bavoil. Every transparent fragment adds its weighted,
+// premultiplied colour to an accumulation target and multiplies a
+// revealage target by 1 - alpha, both with fixed function blending,
+// so the draws need no order. One full screen pass then puts the
+// weighted average over the opaque scene. The weight favours near
+// and more opaque fragments, which is what keeps overlapping layers
+// plausible without sorting. T switches between the two.
+//
+// With no order to keep, consecutive transparent objects sharing a
+// mesh, texture and material are drawn as one instanced draw, their
+// model matrices read from a storage buffer.
+//********************************************************************
+bool UCreateWeightedBlendedOit()
+{
+    const char* const names[] = { "fullscreen.vert", "oit.frag" };
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    if (!UCreateShaderProgram(names, stages, 2, "transparency composite program", gOitCompositeProgramId))
+        return false;
 
-         -0.5f,  -0.0f, 0.0f,   0.0f, 0.5f,     0.0f, 1.0f,  0.0f,                        // 21 Left Mid Circle Vertex
+    // The composite shares the deferred path's full screen triangle, or makes it when deferred is unavailable
+    if (gFullscreenVao == 0)
+        glGenVertexArrays(1, &gFullscreenVao);
+    glGenFramebuffers(1, &gOitFramebuffer);
+    gOitTextures = gResources->Create(RESOURCE_TEXTURE, "transparency targets", nullptr, 0, 0);
 
-         // Top Right Quarter
-         -0.49f, 0.1f, 0.0f,    0.01f, 0.6f,    0.0f, 1.0f,  0.0f,                         // 22
-         -0.45f, 0.2f, 0.0f,    0.05f, 0.7f,    0.0f, 1.0f,  0.0f,                         // 23
-         -0.4f,  0.3f, 0.0f,    0.1f, 0.8f,     0.0f, 1.0f,  0.0f,                        // 24
-         -0.3f,  0.4f, 0.0f,    0.2f, 0.9f,     0.0f, 1.0f,  0.0f,                        // 25
-         -0.2f,  0.46f, 0.0f,   0.3f, 0.96f,    0.0f, 1.0f,  0.0f,                         // 26
-         -0.1f,  0.49f, 0.0f,   0.4f, 0.99f,    0.0f, 1.0f,  0.0f,                         // 27
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    return UResizeOitTargets(viewport[2], viewport[3]);
+}
 
-          0.0f,  0.0f, 0.0f,     0.5f, 0.5f,    0.0f, 1.0f,  0.0f,                       // Circle Center 28
-    };
+void UDestroyWeightedBlendedOit()
+{
+    gResources->Release(gOitTextures);
+    gOitTextures = ResourceHandle();
+    gResources->Release(gResources->Find(RESOURCE_BUFFER, gInstanceBuffer));
+    gInstanceBuffer = 0;
+    gInstanceCapacity = 0;
+    glDeleteFramebuffers(1, &gOitFramebuffer);
+    gOitFramebuffer = 0;
+    if (gOitCompositeProgramId != 0)
+        UDestroyShaderProgram(gOitCompositeProgramId);
+    gOitCompositeProgramId = 0;
+}
 
-    // Index data to share position data
-    GLushort indices[] = {
-        //**********************************************************************
-        //Coffee Cup Body
-        //**********************************************************************
-        //Top Circle 
-        //Top Right Quarter
-        0, 1, 28,
-        1, 2, 28,
-        2, 3, 28,
-        3, 4, 28,
-        4, 5, 28,
-        5, 6, 28,
-        6, 7, 28,
+// Reallocates the accumulation, revealage and depth targets when the viewport changed size
+bool UResizeOitTargets(int width, int height)
+{
+    if (width == gOitWidth && height == gOitHeight)
+        return true;
+    if (width <= 0 || height <= 0)
+        return false;
 
-        //Bottom Right Quarter
-        7, 8, 28,
-        8, 9, 28,
-        9, 10, 28,
-        10, 11, 28,
-        11, 12, 28,
-        12, 13, 28,
-        13, 14, 28,
+    // The depth target has the window's format so the opaque depth can be blitted into it
+    const GLenum formats[OIT_TARGET_COUNT] = { GL_RGBA16F, GL_R8, GL_DEPTH24_STENCIL8 };
+    const size_t texelBytes[OIT_TARGET_COUNT] = { 8, 1, 4 };
+    if (!UAllocateRenderTargets(gOitFramebuffer, gOitTextures, formats, texelBytes, OIT_TARGET_COUNT, width, height, "Transparency"))
+    {
+        gOitWidth = 0;
+        gOitHeight = 0;
+        return false;
+    }
 
-        //Bottom Left Quarter
-        14, 15, 28,
-        15, 16, 28,
-        16, 17, 28,
-        17, 18, 28,
-        18, 19, 28,
-        19, 20, 28,
-        20, 21, 28,
+    gOitWidth = width;
+    gOitHeight = height;
+    return true;
+}
 
-        //Top Right Quarter
-        21, 22, 28,
-        22, 23, 28,
-        23, 24, 28,
-        24, 25, 28,
-        25, 26, 28,
-        26, 27, 28,
-        27, 0, 28,
-    };
+// Objects whose draws can be merged into one instanced draw
+bool USameInstanceBatch(uint32_t a, uint32_t b)
+{
+    const SceneStore& scene = gScene;
+    return scene.mesh[a] == scene.mesh[b] && scene.indexCount[a] == scene.indexCount[b] &&
+           scene.texture[a] == scene.texture[b] && scene.material[a] == scene.material[b];
+}
 
-    const GLuint floatsPerTexture = 2;
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
+// Groups the blended queue into instance batches and uploads their model matrices
+void UBuildInstanceBatches()
+{
+    FrameArena* arena = gFrameArenas.Local();
+    gInstanceBatches = FrameVector<InstanceBatch>(arena);
+    gInstanceModels = FrameVector<glm::mat4>(arena);
+    gInstanceBatches.reserve(gBlendedQueue.size());
+    gInstanceModels.reserve(gBlendedQueue.size());
 
+    for (const DrawKey& draw : gBlendedQueue)
+    {
+        const uint32_t row = UDrawPacket(draw.index).object;
+        if (gInstanceBatches.empty() || !USameInstanceBatch(gInstanceBatches.back().object, row))
+            gInstanceBatches.push_back({ row, (int)gInstanceModels.size(), 0 });
+        gInstanceModels.push_back(gScene.model[row]);
+        ++gInstanceBatches.back().count;
+    }
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+    // Grows to the largest frame seen so far, afterwards the storage is orphaned and refilled
+    if (gInstanceModels.size() > gInstanceCapacity)
+    {
+        gResources->Release(gResources->Find(RESOURCE_BUFFER, gInstanceBuffer));
+        gInstanceCapacity = gInstanceModels.size();
+        glGenBuffers(1, &gInstanceBuffer);
+        const uint32_t name = gInstanceBuffer;
+        gResources->Create(RESOURCE_BUFFER, "instance models", &name, 1, gInstanceCapacity * sizeof(glm::mat4));
+    }
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gInstanceBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gInstanceCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gInstanceModels.size() * sizeof(glm::mat4), gInstanceModels.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, gInstanceBuffer);
+}
 
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// Accumulates the blended queue and composites it over the default framebuffer. depthFramebuffer
+// holds the opaque scene's depth, the window's own or the G-buffer.
+void UDrawWeightedBlended(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition, GLuint depthFramebuffer)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (!UResizeOitTargets(viewport[2], viewport[3]))
+        return;
+
+    UBuildInstanceBatches();
+
+    // Transparent surfaces behind opaque ones are rejected by the opaque depth, which they do not write
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, depthFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gOitFramebuffer);
+    glBlitFramebuffer(0, 0, gOitWidth, gOitHeight, 0, 0, gOitWidth, gOitHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, gOitFramebuffer);
+
+    const GLfloat noAccumulation[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const GLfloat fullyRevealed[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glClearBufferfv(GL_COLOR, OIT_ACCUMULATION, noAccumulation);
+    glClearBufferfv(GL_COLOR, OIT_REVEALAGE, fullyRevealed);
+
+    glEnable(GL_BLEND);
+    glBlendFunci(OIT_ACCUMULATION, GL_ONE, GL_ONE);
+    glBlendFunci(OIT_REVEALAGE, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+    glDepthMask(GL_FALSE);
+    glActiveTexture(GL_TEXTURE0);
 
-    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+    const ShaderPermutation* shader = nullptr;
+    const Material* material = nullptr;
+    for (const InstanceBatch& batch : gInstanceBatches)
+    {
+        const uint32_t row = batch.object;
+        const ShaderPermutation* objectShader = UGetShaderPermutation(gScene.material[row]->features | SHADER_OIT);
+        if (objectShader == nullptr)
+            objectShader = gOitFallbackShader;
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+        if (objectShader != shader)
+        {
+            shader = objectShader;
+            glUseProgram(shader->programId);
+            UApplyFrameUniforms(view, projection, viewPosition);
+            glUniform1i(UNIFORM_INSTANCED, GL_TRUE);
+            material = nullptr;
+        }
 
-    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        if (gScene.material[row] != material)
+        {
+            material = gScene.material[row];
+            UApplyMaterial(*material);
+        }
 
-    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
-    glEnableVertexAttribArray(2);
-    
+        if (gScene.texture[row] != nullptr)
+            UBindTexture(*gScene.texture[row]);
+
+        glUniform1i(UNIFORM_FIRST_INSTANCE, batch.first);
+        glBindVertexArray(gScene.mesh[row]->vao);
+        glDrawElementsInstanced(GL_TRIANGLES, gScene.indexCount[row], GL_UNSIGNED_SHORT, NULL, batch.count);
     }
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
 
-    else if (meshChoice == 6) {
-    //**********************************************************************
-    //Cube Data
-    //**********************************************************************
+    // Composite: the average transparent colour covers 1 - revealage of the opaque scene
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(gOitCompositeProgramId);
+    for (int i = 0; i < OIT_DEPTH; ++i)
+    {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, gResources->Name(gOitTextures, i));
+    }
 
-    // Position and Color data
-    GLfloat verts[] = {
-        //Right Pyramid
-        // Vertex Positions   // Texture Coords     //Normals
-         0.5f,  0.5f, 0.0f,   1.0f, 1.0f,           0.0f, -0.0f,  1.0f,                     // Top Right Square Vertex 0
-         0.5f, -0.5f, 0.0f,   1.0f, 0.0f,           0.0f, -0.0f,  1.0f,                     // Bottom Right Square Vertex 1
-         -0.5f, -0.5f, 0.0f,  0.0f, 0.0f,           0.0f, -0.0f,  1.0f,                     // Bottom Left Square Vertex 2
-         -0.5f,  0.5f, 0.0f,  0.0f, 1.0f,           0.0f, -0.0f,  1.0f,                     // Top Left Square Vertex 3
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(gFullscreenVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
 
-         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           0.0f, -0.0f,  -2.0f, // 4
-         0.5f, -0.5f, -1.0f,  1.0f, 0.0f,           0.0f, -0.0f,  -2.0f, // 5
-         - 0.5f, -0.5f, -1.0f, 0.0f, 0.0f,          0.0f, -0.0f,  -2.0f, // 6
-         - 0.5f,  0.5f, -1.0f, 0.0f, 1.0f,          0.0f, -0.0f,  -2.0f,  // 7
+    for (int i = 0; i < OIT_DEPTH; ++i)
+    {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
 
-         0.5f,  0.5f, 0.0f,   1.0f, 0.0f,           0.0f, 1.0f,  -0.5f,                     // Top Right Square Vertex 8
-         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           0.0f, 1.0f,  -0.5f, // 9
-         -0.5f,  0.5f, -1.0f, 0.0f, 1.0f,           0.0f, 1.0f,  -0.5f,  // 10
-         -0.5f,  0.5f, 0.0f,  0.0f, 0.0f,           0.0f, 1.0f,  -0.5f,                     // Top Left Square Vertex 11
+//**********************************************************
+//FILL RATE BENCHMARK
+//
+//Draws the carpet repeatedly from grazing camera angles with
+//each sampler and reports GPU time and shaded pixels per second
+//**********************************************************
+void UBenchmarkFillRate()
+{
+    const int DRAWS = 100;
+    const float cameraHeights[] = { 0.05f, 0.25f, 1.0f }; // Above the carpet, lower is more grazing
+    const char* const samplerNames[SAMPLER_COUNT] = { "bilinear", "trilinear", "anisotropic" };
 
-         -0.5f,  0.5f, 0.0f,  1.0f, 1.0f,           -1.0f, 0.0f,  -0.5f,                     // Top Left Square Vertex 12
-         -0.5f,  0.5f, -1.0f, 0.0f, 1.0f,           -1.0f, -0.0f,  -0.5f,  // 13
-         -0.5f, -0.5f, -1.0f, 0.0f, 0.0f,           -1.0f, -0.0f,  -0.5f, // 14
-         -0.5f, -0.5f, 0.0f,  1.0f, 0.0f,           -1.0f, -0.0f,  -0.5f,                     // Bottom Left Square Vertex 15
+    GLuint queries[2];
+    glGenQueries(2, queries);
 
-         0.5f,  0.5f, 0.0f,   0.0f, 1.0f,           1.0f, -0.0f,  -0.5f,                     // Top Right Square Vertex 16
-         0.5f,  0.5f, -1.0f,  1.0f, 1.0f,           1.0f, -0.0f,  -0.5f, // 17
-         0.5f, -0.5f, 0.0f,   0.0f, 0.0f,           1.0f, -0.0f,  -0.5f,                     // Bottom Right Square Vertex 18
-         0.5f, -0.5f, -1.0f,  1.0f, 0.0f,           1.0f, -0.0f,  -0.5f, // 19
-    };
+    const ShaderPermutation* shader = UGetShaderPermutation(MATERIAL_MATTE.features);
+    if (shader == nullptr)
+        return;
 
-    // Index data to share position data
-    GLushort indices[] = {
+    glUseProgram(shader->programId);
+    UApplyMaterial(MATERIAL_MATTE);
+    glBindVertexArray(gMesh_plane.vao);
+    glActiveTexture(GL_TEXTURE0);
+    ResourceHandle* carpet = USceneTexture("carpet");
+    UBindTexture(carpet != nullptr ? *carpet : gPlaceholderTexture);
 
-        //Square Base
-        0, 1, 3,  // Triangle 1
-        1, 2, 3,   // Triangle 2
+    // Without depth testing every draw shades every covered pixel again
+    glDisable(GL_DEPTH_TEST);
 
-        4, 5, 7,
-        5, 6, 7,
+    // Same transform as the carpet in URender
+    glm::mat4 model = glm::translate(glm::vec3(-3.0f, -2.25f, 0.0f)) * glm::scale(glm::vec3(15.0f, 15.0f, 15.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-        16, 17, 18,
-        17, 19, 18,
+    glUniformMatrix4fv(UNIFORM_MODEL, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix3fv(UNIFORM_NORMAL_MATRIX, 1, GL_FALSE, glm::value_ptr(glm::mat3(glm::transpose(glm::inverse(model)))));
 
-        12, 13, 14,
-        14, 15, 12,
+    cout << "INFO: Fill rate benchmark, carpet at grazing angles, " << DRAWS << " draws per sample" << endl;
 
-        8, 9, 10,
-        10, 11, 8,
+    for (float height : cameraHeights)
+    {
+        glm::vec3 eye(-3.0f, -2.25f + height, 7.5f);
+        glm::mat4 view = glm::lookAt(eye, glm::vec3(-3.0f, -2.25f, -7.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+        UApplyFrameUniforms(view, projection, eye);
 
-        
+        for (int sampler = 0; sampler < SAMPLER_COUNT; ++sampler)
+        {
+            glBindSampler(0, gSamplers[sampler]);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            // Warm up so the texture is hot before timing
+            glDrawElements(GL_TRIANGLES, gMesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+            glFinish();
+
+            glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+            glBeginQuery(GL_SAMPLES_PASSED, queries[1]);
+            for (int i = 0; i < DRAWS; ++i)
+                glDrawElements(GL_TRIANGLES, gMesh_plane.nIndices, GL_UNSIGNED_SHORT, NULL);
+            glEndQuery(GL_SAMPLES_PASSED);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 nanoseconds = 0, samples = 0;
+            glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &nanoseconds);
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &samples);
+
+            const double seconds = std::max(nanoseconds, (GLuint64)1) / 1e9;
+            cout << "INFO:   height " << height << ", " << samplerNames[sampler] << ": "
+                 << seconds * 1000.0 / DRAWS << " ms per draw, "
+                 << samples / seconds / 1e6 << " Mpixels/s" << endl;
+        }
+    }
 
-    };
+    glBindSampler(0, gSamplers[SAMPLER_ANISOTROPIC]);
+    glEnable(GL_DEPTH_TEST);
+    glDeleteQueries(2, queries);
+}
 
-    const GLuint floatsPerTexture = 2;
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
+//********************************************************************
+//SHADER IMPLEMENTATION
+//
+// Programs are built in two steps. UBeginProgramBuild submits every
+// compile and the link without waiting on any of them, so with
+// GL_KHR_parallel_shader_compile the driver works on them in the
+// background. UFinishProgramBuild reads back the results.
+//********************************************************************
+bool UBeginProgramBuild(const char* const* sources, const GLenum* stages, int count, const char* label, ProgramBuild& build)
+{
+    build.buildStart = std::chrono::steady_clock::now();
+    build.label = label;
+    build.shaderCount = 0;
+
+    // A binary linked by an earlier launch on the same driver skips compilation entirely
+    build.cacheKey = UProgramCacheKey(sources, count);
+    build.fromCache = ULoadProgramBinary(build.cacheKey, build.programId);
+    if (build.fromCache)
+        return true;
 
+    // Create a Shader program object.
+    build.programId = glCreateProgram();
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+    // Errors are only checked once the build finished, checking here would wait for the compiler
+    for (int i = 0; i < count && i < PROGRAM_MAX_STAGES; ++i)
+    {
+        GLuint shaderId = glCreateShader(stages[i]);
+        glShaderSource(shaderId, 1, &sources[i], NULL);
+        glCompileShader(shaderId);
+        glAttachShader(build.programId, shaderId);
+
+        build.shaderIds[i] = shaderId;
+        build.stages[i] = stages[i];
+        ++build.shaderCount;
+    }
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    // Has to be set before linking for glGetProgramBinary to return anything
+    glProgramParameteri(build.programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(build.programId);
+    return true;
+}
 
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// True once UFinishProgramBuild will not block. Without the parallel compile extension
+// there is no way to ask, so the build is treated as done and finishing it waits.
+bool UIsProgramBuildDone(const ProgramBuild& build)
+{
+    if (build.fromCache || !gParallelShaderCompile)
+        return true;
+
+    GLint done = GL_FALSE;
+    glGetProgramiv(build.programId, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// Reports compile and link errors, then caches and registers the program.
+// On failure the program is deleted and build.programId is 0.
+bool UFinishProgramBuild(ProgramBuild& build)
+{
+    if (!build.fromCache)
+    {
+        // Compilation and linkage error reporting
+        int success = 0;
+        char infoLog[512];
+        bool built = true;
 
-    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+        for (int i = 0; i < build.shaderCount; ++i)
+        {
+            glGetShaderiv(build.shaderIds[i], GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                const char* stageName = build.stages[i] == GL_VERTEX_SHADER ? "VERTEX" : build.stages[i] == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE";
+                glGetShaderInfoLog(build.shaderIds[i], sizeof(infoLog), NULL, infoLog);
+                std::cout << "ERROR::SHADER::" << stageName << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+                built = false;
+            }
+
+            // The program keeps the linked code, the shader objects are no longer needed
+            glDeleteShader(build.shaderIds[i]);
+        }
+        build.shaderCount = 0;
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+        if (built)
+        {
+            glGetProgramiv(build.programId, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                glGetProgramInfoLog(build.programId, sizeof(infoLog), NULL, infoLog);
+                std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+                built = false;
+            }
+        }
 
-    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        if (!built)
+        {
+            glDeleteProgram(build.programId);
+            build.programId = 0;
+            return false;
+        }
 
-    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerTexture)));
-    glEnableVertexAttribArray(2);
+        USaveProgramBinary(build.cacheKey, build.programId);
     }
 
-    else if (meshChoice == 7) {
-    //**********************************************************************
-    //Full Cylinder
-    //**********************************************************************
-
-    // Position and Color data
-    GLfloat verts[] = {
+    URegisterProgram(build.programId, build.label, build.fromCache, build.buildStart);
+    return true;
+}
 
-        //Top Circle
-        // Vertex Positions    
-        // Top Right Quarter
-         0.0f,  0.5f, 0.0f,      0.0f,  1.0f,     0.0f, 1.0f, -0.5f,                    // Top Mid Circle Vertex 0
+// Submits a build of a program from shader files, from their SPIR-V modules when they are current,
+// and records the files it was read from in dependencies
+bool UBeginShaderProgramBuild(const char* const* shaderNames, const GLenum* stages, int count, const char* label, ProgramBuild& build,
+                              std::vector<std::string>& dependencies)
+{
+    std::string sources[PROGRAM_MAX_STAGES];
+    const char* sourceTexts[PROGRAM_MAX_STAGES];
+    dependencies.clear();
+    for (int i = 0; i < count && i < PROGRAM_MAX_STAGES; ++i)
+    {
+        if (!ULoadShaderSource(shaderNames[i], sources[i], dependencies))
+            return false;
+        sourceTexts[i] = sources[i].c_str();
+    }
 
-         0.1f,  0.49f, 0.0f,     0.03f, 1.0f,     0.2f, 0.98f, -0.5f,                   // 1
-         0.2f,  0.45f, 0.0f,     0.06f, 1.0f,      0.4f, 0.92f, -0.5f,                 // 2
-         0.3f,  0.4f, 0.0f,      0.12f, 1.0f,      0.6f, 0.8f, -0.5f,                   // 3
-         0.4f,  0.3f, 0.0f,      0.15f, 1.0f,      0.8f, 0.6f, -0.5f,                  // 4
-         0.46f,  0.2f, 0.0f,     0.18f, 1.0f,       0.90f, 0.43f, -0.5f,                // 5
-         0.49f,  0.1f, 0.0f,     0.21f, 1.0f,      0.98f, 0.2f, -0.5f,                   // 6
+    if (UBeginSpirvProgramBuild(shaderNames, sources, stages, count, stages[0], nullptr, nullptr, 0, label, build))
+        return true;
+    return UBeginProgramBuild(sourceTexts, stages, count, label, build);
+}
 
-         0.5f,  0.0f, 0.0f,      0.25f, 1.0f,      1.0f, 0.0f, -0.5f,                  // 7 Right Mid Circle Vertex
+// Builds the program of a fixed pass and waits for it. programId has to be the global the pass
+// draws with, saved shader files rebuild the program and replace it there.
+bool UCreateShaderProgram(const char* const* shaderNames, const GLenum* stages, int count, const char* label, GLuint& programId)
+{
+    PassProgram pass = {};
+    pass.label = label;
+    for (int i = 0; i < count && i < PROGRAM_MAX_STAGES; ++i)
+    {
+        pass.names[i] = shaderNames[i];
+        pass.stages[i] = stages[i];
+    }
+    pass.count = std::min(count, PROGRAM_MAX_STAGES);
+    pass.programId = &programId;
 
-         // Bottom Right Quarter
-         0.49f,  -0.1f, 0.0f,    0.28f, 1.0f,      0.98f, -0.2f, -0.5f,                 // 8
-         0.45f,  -0.2f, 0.0f,    0.31f, 1.0f,      0.92f, -0.4f, -0.5f,                 // 9
-         0.4f,  -0.3f, 0.0f,     0.34f, 1.0f,      0.8f, -0.6f, -0.5f,                  // 10
-         0.3f,  -0.4f, 0.0f,     0.37f, 1.0f,      0.6f, -0.8f, -0.5f,                  // 11
-         0.2f,  -0.46f, 0.0f,    0.40f, 1.0f,      0.4f, -0.92f, -0.5f,                 // 12
-         0.1f,  -0.49f, 0.0f,    0.43f, 1.0f,      0.2f, -0.98f, -0.5f,                 // 13
+    ProgramBuild build;
+    if (!UBeginShaderProgramBuild(pass.names, pass.stages, pass.count, label, build, pass.dependencies) || !UFinishProgramBuild(build))
+        return false;
 
-         0.0f,  -0.5f, 0.0f,     0.5f, 1.0f,       0.0f, -1.0f, -0.5f,                 // 14 Bottom Mid Circle Vertex
+    programId = build.programId;
+    gPassPrograms.push_back(std::move(pass));
+    return true;
+}
 
-         // Bottom Left Quarter
-         -0.1f,  -0.49f, 0.0f,   0.53f, 1.0f,      -0.2f, -0.98f, -0.5f,                  // 15
-         -0.2f,  -0.45f, 0.0f,   0.56f, 1.0f,       -0.4f, -0.92f, -0.5f,                 // 16
-         -0.3f,  -0.4f, 0.0f,    0.59f, 1.0f,       -0.6f, -0.8f, -0.5f,                  // 17
-         -0.4f,  -0.3f, 0.0f,    0.63f, 1.0f,       -0.8f, -0.6f, -0.5f,                  // 18
-         -0.46f, -0.2f, 0.0f,    0.66f, 1.0f,        -0.90f, -0.43f, -0.5f,               // 19
-         -0.49f, -0.1f, 0.0f,    0.70f, 1.0f,       -0.98f, -0.2f, -0.5f,                 // 20
+// Builds a single compute shader program
+bool UCreateComputeProgram(const char* shaderName, GLuint& programId)
+{
+    const GLenum stage = GL_COMPUTE_SHADER;
+    return UCreateShaderProgram(&shaderName, &stage, 1, shaderName, programId);
+}
 
-         -0.5f,  -0.0f, 0.0f,    0.75f, 1.0f,       -1.0f, 0.0f, -0.5f,                  // 21 Left Mid Circle Vertex
-         // Top Right Quarter
-         -0.49f, 0.1f, 0.0f,     0.78f, 1.0f,      -0.98f, 0.2f, -0.5f,                 // 22
-         -0.45f, 0.2f, 0.0f,     0.81f, 1.0f,      -0.92f, 0.4f, -0.5f,                 // 23
-         -0.4f,  0.3f, 0.0f,     0.84f, 1.0f,      -0.8f, 0.6f, -0.5f,                  // 24
-         -0.3f,  0.4f, 0.0f,     0.87f, 1.0f,      -0.6f, 0.8f, -0.5f,                  // 25
-         -0.2f,  0.46f, 0.0f,    0.91f, 1.0f,      -0.4f, 0.92f, -0.5f,                 // 26
-         -0.1f,  0.49f, 0.0f,    0.93f, 1.0f,      -0.2f, 0.98f, -0.5f,                 // 27
+//********************************************************************
+//SPIR-V SHADERS
+//
+// --build-shaders compiles every shader file to SPIR-V for OpenGL with
+// glslangValidator, whose front end validates it on the way. It is a
+// manual command: run the built program with it after changing a
+// shader, glslangValidator on the PATH, and it exits with failure when
+// one does not compile. Nothing runs it automatically, so without it
+// shader errors still only show up at runtime. With GL_ARB_gl_spirv the
+// modules are loaded in place of the GLSL, which stays the fallback
+// when either is missing or built from another source.
+//********************************************************************
+bool UBuildShaders()
+{
+    // The extension tells glslang the stage
+    const char* const names[] = {
+        "uber.vert", "uber.frag", "depth.frag", "procedural.comp", "cluster.comp",
+        "fullscreen.vert", "deferred.frag", "shadow.vert", "shadow.frag", "oit.frag"
+    };
 
-          0.0f,  0.0f, 0.0f,     1.0f, 1.0f,       -0.5f, 1.0f, -0.5f,          // Circle Center 28
+    const std::string expandedDir = std::string(SHADER_DIR) + "build/";
+    std::error_code error;
+    std::filesystem::create_directories(expandedDir, error);
 
-        //Bottom Circle
-        // Vertex Positions    
-        // Top Right Quarter
-         0.0f,  0.5f, 1.0f,     0.0f, 0.0f,  0.0f, 1.0f, -0.5f,            // Top Mid Circle Vertex 29
+    bool built = true;
+    for (const char* name : names)
+    {
+        // Missing files are seeded with the embedded source, so there is something to edit. Seeds
+        // nobody edited are refreshed when the embedded source changed, name + ".seed" tells them apart.
+        const std::string sourcePath = std::string(SHADER_DIR) + name;
+        std::string seeded;
+        {
+            std::ifstream file(sourcePath, std::ios::binary);
+            if (file)
+                seeded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        const std::string embedded = UEmbeddedShaderSource(name);
+        if (!std::filesystem::exists(sourcePath, error) || UShaderSeedOutdated(name, seeded) || seeded == embedded)
+        {
+            if (seeded != embedded)
+            {
+                std::ofstream output(sourcePath, std::ios::binary | std::ios::trunc);
+                output << embedded;
+            }
+            std::ofstream seed(sourcePath + ".seed", std::ios::trunc);
+            seed << HashContent((const unsigned char*)embedded.data(), embedded.size()) << '\n';
+        }
 
-         0.1f,  0.49f, 1.0f,    0.03f, 0.0f, 0.2f, 0.98f, -0.5f,           // 30
-         0.2f,  0.45f, 1.0f,    0.06f, 0.0f,  0.4f, 0.92f, -0.5f,          // 31
-         0.3f,  0.4f, 1.0f,     0.12f, 0.0f,  0.6f, 0.8f, -0.5f,           // 32
-         0.4f,  0.3f, 1.0f,     0.15f, 0.0f,  0.8f, 0.6f, -0.5f,           // 33
-         0.46f,  0.2f, 1.0f,    0.18f, 0.0f,   0.90f, 0.43f, -0.5f,        // 34
-         0.49f,  0.1f, 1.0f,    0.21f, 0.0f,  0.98f, 0.2f, -0.5f,          // 35
+        // glslang gets the source with its includes already resolved, the same text the GLSL path compiles
+        std::string source;
+        std::vector<std::string> dependencies;
+        const std::string expandedPath = expandedDir + name;
+        if (!ULoadShaderSource(name, source, dependencies))
+        {
+            built = false;
+            continue;
+        }
+        {
+            std::ofstream output(expandedPath, std::ios::binary | std::ios::trunc);
+            if (!output.write(source.data(), source.size()))
+            {
+                cout << "ERROR: Failed to write " << expandedPath << endl;
+                built = false;
+                continue;
+            }
+        }
 
-         0.5f,  0.0f, 1.0f,     0.25f, 0.0f,  1.0f, 0.0f, -0.5f,          //36 Right Mid Circle Vertex
+        const std::string command = "glslangValidator -G -o \"" + sourcePath + ".spv\" \"" + expandedPath + "\"";
+        if (std::system(command.c_str()) != 0)
+        {
+            cout << "ERROR: " << name << " did not compile to SPIR-V" << endl;
+            built = false;
+            continue;
+        }
 
-         // Bottom Right Quarter
-         0.49f,  -0.1f, 1.0f,   0.28f, 0.0f,  0.98f, -0.2f, -0.5f,          // 37
-         0.45f,  -0.2f, 1.0f,   0.31f, 0.0f,  0.92f, -0.4f, -0.5f,          // 38
-         0.4f,  -0.3f, 1.0f,    0.34f, 0.0f,  0.8f, -0.6f, -0.5f,           // 39
-         0.3f,  -0.4f, 1.0f,    0.37f, 0.0f,  0.6f, -0.8f, -0.5f,           // 40
-         0.2f,  -0.46f, 1.0f,   0.40f, 0.0f,  0.4f, -0.92f, -0.5f,          // 41
-         0.1f,  -0.49f, 1.0f,   0.43f, 0.0f,  0.2f, -0.98f, -0.5f,          // 42
+        // The module is only used while the source it was built from is current
+        std::ofstream hash(sourcePath + ".spv.hash", std::ios::trunc);
+        hash << HashContent((const unsigned char*)source.data(), source.size()) << '\n';
+        if (!hash)
+        {
+            cout << "ERROR: Failed to write " << sourcePath << ".spv.hash" << endl;
+            built = false;
+        }
+        else
+            cout << "INFO: Built " << sourcePath << ".spv" << endl;
+    }
+    return built;
+}
 
-         0.0f,  -0.5f, 1.0f,    0.5f, 0.0f,   0.0f, -1.0f, -0.5f,            //43 Bottom Mid Circle Vertex
+// Starts building a program from the SPIR-V modules SHADER_DIR + module + ".spv", with the
+// specialization constants applied to specializedStage. Fails without GL_ARB_gl_spirv, when
+// a module is missing, or when module + ".spv.hash" does not match its expanded GLSL in
+// sources, so the caller can build from GLSL instead.
+bool UBeginSpirvProgramBuild(const char* const* modules, const std::string* sources, const GLenum* stages, int count, GLenum specializedStage,
+                             const GLuint* constantIds, const GLuint* constantValues, int constantCount,
+                             const char* label, ProgramBuild& build)
+{
+    if (!gUseSpirv || count > PROGRAM_MAX_STAGES)
+        return false;
 
-         // Bottom Left Quarter
-         -0.1f,  -0.49f, 1.0f,  0.53f, 0.0f,   -0.2f, -0.98f, -0.5f,             //44
-         -0.2f,  -0.45f, 1.0f,  0.56f, 0.0f,    -0.4f, -0.92f, -0.5f,            //45
-         -0.3f,  -0.4f, 1.0f,   0.59f, 0.0f,    -0.6f, -0.8f, -0.5f,             //46
-         -0.4f,  -0.3f, 1.0f,   0.63f, 0.0f,    -0.8f, -0.6f, -0.5f,              //47
-         -0.46f, -0.2f, 1.0f,   0.66f, 0.0f,     -0.90f, -0.43f, -0.5f,          //48
-         -0.49f, -0.1f, 1.0f,   0.70f, 0.0f,    -0.98f, -0.2f, -0.5f,           // 49
+    std::vector<unsigned char> binaries[PROGRAM_MAX_STAGES];
+    for (int i = 0; i < count; ++i)
+    {
+        if (!USpirvModuleCurrent(modules[i], sources[i]))
+            return false;
 
-         -0.5f,  -0.0f, 1.0f,   0.75f, 0.0f,    -1.0f, 0.0f, -0.5f,              //50 Left Mid Circle Vertex
+        std::ifstream file(std::string(SHADER_DIR) + modules[i] + ".spv", std::ios::binary);
+        if (!file)
+            return false;
+        binaries[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (binaries[i].empty() || binaries[i].size() % 4 != 0)
+            return false;
+    }
 
-         // Top Right Quarter
-         -0.49f, 0.1f, 1.0f,    0.78f, 0.0f,  -0.98f, 0.2f, -0.5f,             // 51
-         -0.45f, 0.2f, 1.0f,    0.81f, 0.0f,  -0.92f, 0.4f, -0.5f,             //52
-         -0.4f,  0.3f, 1.0f,    0.84f, 0.0f,  -0.8f, 0.6f, -0.5f,             // 53
-         -0.3f,  0.4f, 1.0f,    0.87f, 0.0f,  -0.6f, 0.8f, -0.5f,              //54
-         -0.2f,  0.46f, 1.0f,   0.91f, 0.0f,  -0.4f, 0.92f, -0.5f,             //55
-         -0.1f,  0.49f, 1.0f,   0.93f, 0.0f,  -0.2f, 0.98f, -0.5f,             //56
+    build.buildStart = std::chrono::steady_clock::now();
+    build.label = label;
+    build.shaderCount = 0;
+
+    // Modules and specialization stand in for the sources in the binary cache key
+    std::string keySource = "spirv";
+    for (int i = 0; i < count; ++i)
+        keySource += " " + std::to_string(HashContent(binaries[i].data(), binaries[i].size()));
+    for (int i = 0; i < constantCount; ++i)
+        keySource += " " + std::to_string(constantIds[i]) + "=" + std::to_string(constantValues[i]);
+    const char* keySources[] = { keySource.c_str() };
+    build.cacheKey = UProgramCacheKey(keySources, 1);
+    build.fromCache = ULoadProgramBinary(build.cacheKey, build.programId);
+    if (build.fromCache)
+        return true;
 
-         0.0f,  0.0f, 1.0f,      1.0f, 1.0f,  0.0f, 0.0f, 0.0f,              // Circle Center 57
+    build.programId = glCreateProgram();
+    for (int i = 0; i < count; ++i)
+    {
+        GLuint shaderId = glCreateShader(stages[i]);
+        glShaderBinary(1, &shaderId, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, binaries[i].data(), (GLsizei)binaries[i].size());
+        if (stages[i] == specializedStage)
+            glSpecializeShaderARB(shaderId, "main", constantCount, constantIds, constantValues);
+        else
+            glSpecializeShaderARB(shaderId, "main", 0, nullptr, nullptr);
+        glAttachShader(build.programId, shaderId);
 
-         0.0f,  0.5f, 0.0f,      1.0f,  1.0f,  0.0f, 0.0f, 0.0f,          // Top Mid Circle Vertex 58
-         0.0f,  0.5f, 1.0f,      1.0f,  0.0f,   0.0f, 0.0f, 0.0f,          // bottom Mid Circle Vertex 59
+        build.shaderIds[i] = shaderId;
+        build.stages[i] = stages[i];
+        ++build.shaderCount;
+    }
 
-    };
+    glProgramParameteri(build.programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(build.programId);
+    return true;
+}
 
-    // Index data to share position data
-    GLushort indices[] = {
-        //**********************************************************************
-        //Coffee Cup Body
-        //**********************************************************************
+// True when module + ".spv.hash" says the module was built from source, its expanded GLSL
+bool USpirvModuleCurrent(const char* module, const std::string& source)
+{
+    std::ifstream hash(std::string(SHADER_DIR) + module + ".spv.hash");
+    unsigned long long sourceHash = 0;
+    if (!(hash >> sourceHash))
+        return false;
+    if (sourceHash != HashContent((const unsigned char*)source.data(), source.size()))
+    {
+        cout << "INFO: " << module << ".spv was built from an older source, building from GLSL" << endl;
+        return false;
+    }
+    return true;
+}
 
-        //Top Circle 
-        //Top Right Quarter
-        0, 1, 28,
-        1, 2, 28,
-        2, 3, 28,
-        3, 4, 28,
-        4, 5, 28,
-        5, 6, 28,
-        6, 7, 28,
+// The shading permutations and the depth prepass share uber.vert and have to run the same compile
+// of it, so they take SPIR-V only while every module they use is current, and GLSL all together
+// once a shader file was saved
+bool UPermutationsUseSpirv()
+{
+    if (!gUseSpirv || gShaderFilesEdited)
+        return false;
 
-        //Bottom Right Quarter
-        7, 8, 28,
-        8, 9, 28,
-        9, 10, 28,
-        10, 11, 28,
-        11, 12, 28,
-        12, 13, 28,
-        13, 14, 28,
+    if (gPermutationModulesCurrent < 0)
+    {
+        const char* const names[] = { "uber.vert", "uber.frag", "depth.frag" };
+        bool current = true;
+        for (const char* name : names)
+        {
+            std::string source;
+            std::vector<std::string> dependencies;
+            current = current && ULoadShaderSource(name, source, dependencies) && USpirvModuleCurrent(name, source);
+        }
+        gPermutationModulesCurrent = current ? 1 : 0;
+    }
+    return gPermutationModulesCurrent == 1;
+}
 
-        //Bottom Left Quarter
-        14, 15, 28,
-        15, 16, 28,
-        16, 17, 28,
-        17, 18, 28,
-        18, 19, 28,
-        19, 20, 28,
-        20, 21, 28,
+//********************************************************************
+//SHADER FILES AND HOT RELOAD
+//
+// A shader is read from SHADER_DIR when a file with its name is there,
+// with every #include "file" line replaced by that file from the same
+// directory, and from its embedded copy otherwise. Copies seeded by
+// --build-shaders and never edited give way to a newer embedded
+// source, so they do not pin the old one forever. Saved files are
+// picked up while running: the permutations and pass programs
+// depending on them are rebuilt in the background and swapped in once
+// they link. A save during such a build queues one more after it.
+//********************************************************************
+const char* UEmbeddedShaderSource(const std::string& name)
+{
+    if (name == "uber.vert")
+        return vertexShaderSource;
+    if (name == "uber.frag")
+        return uberFragmentShaderSource;
+    if (name == "procedural.comp")
+        return proceduralComputeShaderSource;
+    if (name == "cluster.comp")
+        return clusterComputeShaderSource;
+    if (name == "lighting.glsl")
+        return lightingShaderSource;
+    if (name == "fullscreen.vert")
+        return fullscreenVertexShaderSource;
+    if (name == "deferred.frag")
+        return deferredFragmentShaderSource;
+    if (name == "shadow.vert")
+        return shadowVertexShaderSource;
+    if (name == "shadow.frag")
+        return shadowFragmentShaderSource;
+    if (name == "depth.frag")
+        return depthFragmentShaderSource;
+    if (name == "oit.frag")
+        return oitCompositeFragmentShaderSource;
+    return nullptr;
+}
 
-        //Top Right Quarter
-        21, 22, 28,
-        22, 23, 28,
-        23, 24, 28,
-        24, 25, 28,
-        25, 26, 28,
-        26, 27, 28,
-        27, 0, 28,
+// True when the file name in SHADER_DIR, holding text, is a copy --build-shaders seeded from an
+// embedded source that changed since. Its name + ".seed" holds the hash of the seeded text, an
+// edited copy no longer matches it and keeps overriding.
+bool UShaderSeedOutdated(const std::string& name, const std::string& text)
+{
+    const char* embedded = UEmbeddedShaderSource(name);
+    std::ifstream seed(std::string(SHADER_DIR) + name + ".seed");
+    unsigned long long seedHash = 0;
+    if (embedded == nullptr || !(seed >> seedHash))
+        return false;
 
-        //Bottom Circle 
-        //Top Right Quarter
-        29, 30, 57,
-        30, 31, 57,
-        31, 32, 57,
-        32, 33, 57,
-        33, 34, 57,
-        34, 35, 57,
-        35, 36, 57,
+    return HashContent((const unsigned char*)text.data(), text.size()) == seedHash &&
+           HashContent((const unsigned char*)embedded, strlen(embedded)) != seedHash;
+}
 
-        //Bottom Right Quarter
-        36, 37, 57,
-        37, 38, 57,
-        38, 39, 57,
-        39, 40, 57,
-        40, 41, 57,
-        41, 42, 57,
-        42, 43, 57,
+// Source of the shader file name with its includes resolved. Every file read, or looked for,
+// is added to dependencies. Files missing from SHADER_DIR fall back to their embedded copy.
+bool ULoadShaderSource(const std::string& name, std::string& source, std::vector<std::string>& dependencies, int depth)
+{
+    const int MAX_INCLUDE_DEPTH = 8;
+    if (depth > MAX_INCLUDE_DEPTH)
+    {
+        cout << "ERROR: Shader includes nested too deep at " << name << endl;
+        return false;
+    }
+    dependencies.push_back(name);
+
+    std::string text;
+    std::ifstream file(std::string(SHADER_DIR) + name, std::ios::binary);
+    if (file)
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file && UShaderSeedOutdated(name, text))
+        text = UEmbeddedShaderSource(name);
+    else if (!file && UEmbeddedShaderSource(name) != nullptr)
+        text = UEmbeddedShaderSource(name);
+    else if (!file)
+    {
+        cout << "ERROR: Shader file " << SHADER_DIR << name << " not found" << endl;
+        return false;
+    }
 
-        //Bottom Left Quarter
-        43, 44, 57,
-        44, 45, 57,
-        45, 46, 57,
-        46, 47, 57,
-        47, 48, 57,
-        48, 49, 57,
-        49, 50, 57,
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        const size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+        {
+            source += line;
+            source += '\n';
+            continue;
+        }
 
-        //Top Right Quarter
-        50, 51, 57,
-        51, 52, 57,
-        52, 53, 57,
-        53, 54, 57,
-        54, 55, 57,
-        55, 56, 57,
-        56, 29, 57,
+        const size_t open = line.find('"', start);
+        const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+        if (close == std::string::npos)
+        {
+            cout << "ERROR: Malformed include in " << name << ": " << line << endl;
+            return false;
+        }
+        if (!ULoadShaderSource(line.substr(open + 1, close - open - 1), source, dependencies, depth + 1))
+            return false;
+    }
+    return true;
+}
 
-        //Cylinder Sides
-        0, 29, 30,
-        30, 1, 0,
+// Puts a #define per feature right after the #version line, which has to stay first
+std::string UAddShaderDefines(const std::string& source, unsigned int features)
+{
+    std::string defines;
+    for (int i = 0; i < SHADER_FEATURE_COUNT; ++i)
+        if (features & (1u << i))
+            defines += std::string("#define ") + SHADER_FEATURE_DEFINES[i] + "\n";
 
-        1, 30, 31,
-        31, 2, 1,
+    size_t insertAt = source.find("#version");
+    if (insertAt != std::string::npos)
+    {
+        insertAt = source.find('\n', insertAt);
+        insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+    }
+    else
+        insertAt = 0;
+    return source.substr(0, insertAt) + defines + source.substr(insertAt);
+}
 
-        2, 31, 32,
-        32, 3, 2,
+// Starts watching SHADER_DIR for saved files
+void UWatchShaderFiles()
+{
+    std::error_code error;
+    std::filesystem::create_directories(SHADER_DIR, error);
 
-        3, 32, 33,
-        33, 4, 3,
+#ifdef __linux__
+    gShaderWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (gShaderWatch >= 0 && inotify_add_watch(gShaderWatch, SHADER_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(gShaderWatch);
+        gShaderWatch = -1;
+    }
+    if (gShaderWatch < 0)
+        cout << "INFO: Could not watch " << SHADER_DIR << ", shader hot reload is off" << endl;
+#else
+    // Without inotify the directory is scanned for changed modification times instead
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(SHADER_DIR, error))
+        gShaderFileTimes[entry.path().filename().string()] = entry.last_write_time(error);
+#endif
+}
 
-        4, 33, 34,
-        34, 5, 4,
+void UStopWatchingShaderFiles()
+{
+#ifdef __linux__
+    if (gShaderWatch >= 0)
+        close(gShaderWatch);
+    gShaderWatch = -1;
+#endif
+}
 
-        5, 34, 35,
-        35, 6, 5,
+// Names of the files in SHADER_DIR saved since the last call, without waiting
+std::vector<std::string> UReadChangedShaderFiles()
+{
+    std::vector<std::string> changed;
 
-        6, 35, 36,
-        36, 7, 6,
+#ifdef __linux__
+    if (gShaderWatch < 0)
+        return changed;
 
-        7, 36, 37,
-        37, 8, 7,
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        const ssize_t length = read(gShaderWatch, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
 
-        8, 37, 38,
-        38, 9, 8,
+        for (ssize_t offset = 0; offset < length; )
+        {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            if (event->len > 0)
+                changed.push_back(event->name);
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+#else
+    static std::chrono::steady_clock::time_point nextScan;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < nextScan)
+        return changed;
+    nextScan = now + std::chrono::milliseconds(500);
+
+    std::error_code error;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(SHADER_DIR, error))
+    {
+        const std::string name = entry.path().filename().string();
+        const std::filesystem::file_time_type writeTime = entry.last_write_time(error);
+        auto known = gShaderFileTimes.find(name);
+        if (known == gShaderFileTimes.end() || known->second != writeTime)
+        {
+            gShaderFileTimes[name] = writeTime;
+            changed.push_back(name);
+        }
+    }
+#endif
 
-        9, 38, 39,
-        39, 10, 9,
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
 
-        10, 39, 40,
-        40, 11, 10,
+// Rebuilds the permutations and pass programs depending on saved shader files in the background.
+// Each keeps drawing with its current program until the new one is ready, and for good if it fails.
+void UPollShaderChanges()
+{
+    const std::vector<std::string> changed = UReadChangedShaderFiles();
+    if (changed.empty())
+        return;
 
-        11, 40, 41,
-        41, 12, 11,
+    const auto affects = [&changed](const std::vector<std::string>& dependencies)
+    {
+        for (const std::string& name : changed)
+            if (std::find(dependencies.begin(), dependencies.end(), name) != dependencies.end())
+                return true;
+        return false;
+    };
 
-        12, 41, 42,
-        42, 13, 12,
+    // The permutations share uber.vert and the prepass relies on them running the same compile of
+    // it, so a save affecting any of them rebuilds them all
+    bool permutationsAffected = false;
+    for (const ShaderPermutation& permutation : gShaderPermutations)
+        permutationsAffected = permutationsAffected || affects(permutation.dependencies);
 
-        13, 42, 43,
-        43, 14, 13,
+    for (ShaderPermutation& permutation : gShaderPermutations)
+    {
+        if (!permutationsAffected)
+            break;
 
-        14, 43, 44,
-        44, 15, 14,
+        // The SPIR-V modules were built from the files before this edit
+        gShaderFilesEdited = true;
 
-        15, 44, 45,
-        45, 16, 15,
+        // A build in flight read the files before this save, another one follows once it is done
+        if (permutation.state == PERMUTATION_BUILDING || permutation.reloading)
+            permutation.rebuildPending = true;
+        else
+            URebuildShaderPermutation(permutation);
+    }
 
-        16, 45, 46,
-        46, 17, 16,
+    for (PassProgram& pass : gPassPrograms)
+    {
+        if (!affects(pass.dependencies))
+            continue;
 
-        17, 46, 47,
-        47, 18, 17,
+        gShaderFilesEdited = true;
+        if (pass.reloading)
+            pass.rebuildPending = true;
+        else
+            URebuildPassProgram(pass);
+    }
+}
 
-        18, 47, 48,
-        48, 19, 18,
+// Starts building the permutation again from the shader files as they are now
+void URebuildShaderPermutation(ShaderPermutation& permutation)
+{
+    cout << "INFO: Rebuilding shader permutation" << UPermutationName(permutation.features) << endl;
 
-        19, 48, 49,
-        49, 20, 19,
+    if (permutation.state == PERMUTATION_FAILED)
+    {
+        // Never had a program, so it is built like the first time
+        permutation.build = ProgramBuild();
+        permutation.state = UBeginPermutationBuild(permutation, permutation.build) ? PERMUTATION_BUILDING : PERMUTATION_FAILED;
+    }
+    else
+    {
+        permutation.reloadBuild = ProgramBuild();
+        permutation.reloading = UBeginPermutationBuild(permutation, permutation.reloadBuild);
+        if (!permutation.reloading)
+            cout << "ERROR: Shader permutation" << UPermutationName(permutation.features) << " failed to rebuild, keeping the previous program" << endl;
+    }
+}
 
-        20, 49, 50,
-        50, 21, 20,
+// Same for the program of a fixed pass, which always has a program to keep drawing with
+void URebuildPassProgram(PassProgram& pass)
+{
+    cout << "INFO: Rebuilding " << pass.label << endl;
 
-        21, 50, 51,
-        51, 22, 21,
+    pass.reloadBuild = ProgramBuild();
+    pass.reloading = UBeginShaderProgramBuild(pass.names, pass.stages, pass.count, pass.label, pass.reloadBuild, pass.dependencies);
+    if (!pass.reloading)
+        cout << "ERROR: " << pass.label << " failed to rebuild, keeping the previous program" << endl;
+}
 
-        22, 51, 52,
-        52, 23, 22,
+// Replaces the pass's program once the rebuild linked, a failed one leaves the current program in place
+void UFinishPassReload(PassProgram& pass)
+{
+    pass.reloading = false;
+    if (!UFinishProgramBuild(pass.reloadBuild))
+    {
+        cout << "ERROR: " << pass.label << " failed to rebuild, keeping the previous program" << endl;
+        return;
+    }
 
-        23, 52, 53,
-        53, 24, 23,
+    UDestroyShaderProgram(*pass.programId);
+    *pass.programId = pass.reloadBuild.programId;
 
-        24, 53, 54,
-        54, 25, 24,
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - pass.reloadBuild.buildStart;
+    cout << "INFO: " << pass.label << " reloaded after " << elapsed.count() << " ms" << endl;
+}
 
-        25, 54, 55,
-        55, 26, 25,
+// Deletes the objects of a build that was never finished
+void UAbandonProgramBuild(ProgramBuild& build)
+{
+    for (int i = 0; i < build.shaderCount; ++i)
+        glDeleteShader(build.shaderIds[i]);
+    glDeleteProgram(build.programId);
+    build = ProgramBuild();
+}
 
-        26, 55, 56,
-        56, 27, 26,
+// Hands a linked program to the registry and adds its build time to the startup report
+void URegisterProgram(GLuint programId, const char* label, bool fromCache, std::chrono::steady_clock::time_point buildStart)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - buildStart;
+    if (fromCache)
+    {
+        ++gProgramsFromCache;
+        gProgramCacheMs += elapsed.count();
+    }
+    else
+    {
+        ++gProgramsCompiled;
+        gProgramCompileMs += elapsed.count();
+    }
 
-        27, 58, 59,
-        27, 56, 59
-    };
+    // Binary size stands in for the driver memory behind the program
+    GLint binaryBytes = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &binaryBytes);
+    const uint32_t name = programId;
+    gResources->Create(RESOURCE_PROGRAM, label, &name, 1, (size_t)binaryBytes);
+}
 
-    const GLuint floatsPerTexture = 2;
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
+//********************************************************************
+//PROGRAM BINARY CACHE
+//
+// Linked programs are saved with glGetProgramBinary and loaded with
+// glProgramBinary on later launches. Binaries only load on the driver
+// that produced them, so the key covers the renderer and version
+// strings along with every source, permutation #defines included.
+//********************************************************************
+uint64_t UProgramCacheKey(const char* const* sources, int count)
+{
+    std::string key = std::to_string(PROGRAM_CACHE_VERSION);
+    key += '\0';
+    key += (const char*)glGetString(GL_RENDERER);
+    key += '\0';
+    key += (const char*)glGetString(GL_VERSION);
+    for (int i = 0; i < count; ++i)
+    {
+        key += '\0';
+        key += sources[i];
+    }
+    return HashContent((const unsigned char*)key.data(), key.size());
+}
 
+std::string UProgramCachePath(uint64_t key)
+{
+    char cacheName[64];
+    snprintf(cacheName, sizeof(cacheName), "%016llx.bin", (unsigned long long)key);
+    return std::string(PROGRAM_CACHE_DIR) + cacheName;
+}
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+// Creates programId from the cached binary for key. Fails when there is none or the driver
+// rejects it, which it may do after any driver update, so the caller compiles from source instead.
+bool ULoadProgramBinary(uint64_t key, GLuint& programId)
+{
+    if (!gUseProgramCache)
+        return false;
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    const std::string path = UProgramCachePath(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    // Header: magic, binary format
+    const size_t HEADER_BYTES = 8;
+    if (bytes.size() <= HEADER_BYTES || ReadU32(bytes.data()) != PROGRAM_CACHE_MAGIC)
+        return false;
+    const GLenum format = ReadU32(bytes.data() + 4);
 
-    // Strides between vertex coordinates is 8 (x, y, z, tX, tY, nX, nY, nZ). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerTexture + floatsPerNormal);// The number of floats before each
+    programId = glCreateProgram();
+    glProgramBinary(programId, format, bytes.data() + HEADER_BYTES, (GLsizei)(bytes.size() - HEADER_BYTES));
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    GLint success = 0;
+    glGetProgramiv(programId, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        cout << "INFO: Cached program binary " << path << " was rejected, compiling from source" << endl;
+        glDeleteProgram(programId);
+        programId = 0;
+        return false;
+    }
+    return true;
+}
 
-    glVertexAttribPointer(1, floatsPerTexture, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+void USaveProgramBinary(uint64_t key, GLuint programId)
+{
+    if (!gUseProgramCache)
+        return;
 
-    glVertexAttribPointer(2, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerTexture)));
-    glEnableVertexAttribArray(2);
+    GLint length = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
 
-    }
-}
+    std::vector<unsigned char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(programId, length, &length, &format, binary.data());
 
+    std::vector<unsigned char> bytes;
+    AppendU32(bytes, PROGRAM_CACHE_MAGIC);
+    AppendU32(bytes, format);
+    bytes.insert(bytes.end(), binary.begin(), binary.begin() + length);
 
+    std::error_code error;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIR, error);
 
-//**********************************************************
-//DESTROY MESH
-//**********************************************************
-void UDestroyMesh(GLMesh& mesh)
+    // Write beside the target and rename, so a reader never sees a half written file
+    const std::string path = UProgramCachePath(key);
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.write((const char*)bytes.data(), bytes.size()))
+        {
+            cout << "Failed to write program cache " << path << endl;
+            return;
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+}
+
+void UReportProgramBuilds()
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(2, mesh.vbos);
+    const char* startKind = gProgramsFromCache == 0 ? "cold" : gProgramsCompiled == 0 ? "warm" : "partly warm";
+    cout << "INFO: Shader programs (" << startKind << " start): " << gProgramsFromCache << " loaded from the binary cache in "
+         << gProgramCacheMs << " ms, " << gProgramsCompiled << " compiled from source in " << gProgramCompileMs << " ms" << endl;
 }
 
-//**********************************************************
-//CREATE TEXTURE
-//**********************************************************
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Program for a combination of ShaderFeature bits. The first call submits its build from the
+// uber shader; until the build finished, or when it failed, nullptr is returned.
+const ShaderPermutation* UGetShaderPermutation(unsigned int features)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    for (const ShaderPermutation& permutation : gShaderPermutations)
+        if (permutation.features == features)
+            return permutation.state == PERMUTATION_READY ? &permutation : nullptr;
+
+    gShaderPermutations.emplace_back();
+    ShaderPermutation& permutation = gShaderPermutations.back();
+    permutation.features = features;
+    permutation.programId = 0;
+    permutation.state = PERMUTATION_BUILDING;
+    permutation.reloading = false;
+    permutation.rebuildPending = false;
+
+    if (!UBeginPermutationBuild(permutation, permutation.build))
     {
-        flipImageVertically(image, width, height, channels);
+        cout << "ERROR: Shader permutation" << UPermutationName(features) << " failed to build" << endl;
+        permutation.state = PERMUTATION_FAILED;
+    }
+    return nullptr;
+}
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+// Submits a build of the permutation into build and records the shader files it depends on.
+// Uses the SPIR-V modules unless the shader files were edited after they were built.
+bool UBeginPermutationBuild(ShaderPermutation& permutation, ProgramBuild& build)
+{
+    const bool depthOnly = (permutation.features & PERMUTATION_DEPTH_ONLY) != 0;
+    const GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* const names[] = { "uber.vert", depthOnly ? "depth.frag" : "uber.frag" };
+    const char* label = depthOnly ? "depth prepass program" : "program";
+
+    // The sources are loaded either way, their includes are dependencies of the SPIR-V modules too
+    std::string vertexSource;
+    std::string fragmentSource;
+    std::vector<std::string> dependencies;
+    const bool loaded = ULoadShaderSource(names[0], vertexSource, dependencies) && ULoadShaderSource(names[1], fragmentSource, dependencies);
+    permutation.dependencies = dependencies;
+
+    if (!loaded)
+        return false;
+    const uint64_t vertexHash = HashContent((const unsigned char*)vertexSource.data(), vertexSource.size());
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+    // SPIR-V: one module, every feature bit is the specialization constant with its index as id.
+    // depth.frag has no constants.
+    if (UPermutationsUseSpirv())
+    {
+        GLuint constantIds[SHADER_FEATURE_COUNT];
+        GLuint constantValues[SHADER_FEATURE_COUNT];
+        for (int i = 0; i < SHADER_FEATURE_COUNT; ++i)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            constantIds[i] = i;
+            constantValues[i] = (permutation.features >> i) & 1u;
+        }
+        const std::string sources[] = { vertexSource, fragmentSource };
+        const int constantCount = depthOnly ? 0 : SHADER_FEATURE_COUNT;
+        if (UBeginSpirvProgramBuild(names, sources, stages, 2, GL_FRAGMENT_SHADER, constantIds, constantValues, constantCount, label, build))
+        {
+            build.vertexKey = vertexHash + 1;
+            return true;
         }
+    }
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+    if (!depthOnly)
+        fragmentSource = UAddShaderDefines(fragmentSource, permutation.features);
+    const char* const sources[] = { vertexSource.c_str(), fragmentSource.c_str() };
+    if (!UBeginProgramBuild(sources, stages, 2, label, build))
+        return false;
+    build.vertexKey = vertexHash;
+    return true;
+}
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+// Feature defines of a permutation for log messages
+std::string UPermutationName(unsigned int features)
+{
+    if (features == 0)
+        return " (default)";
+    if (features & PERMUTATION_DEPTH_ONLY)
+        return " (depth only)";
+
+    std::string name;
+    for (int i = 0; i < SHADER_FEATURE_COUNT; ++i)
+        if (features & (1u << i))
+            name += std::string(" ") + SHADER_FEATURE_DEFINES[i];
+    return name;
+}
 
-        return true;
-    }
+// Same as UGetShaderPermutation, but waits for the build to finish
+const ShaderPermutation* UWaitForShaderPermutation(unsigned int features)
+{
+    if (const ShaderPermutation* permutation = UGetShaderPermutation(features))
+        return permutation;
 
-    // Error loading the image
-    return false;
+    for (ShaderPermutation& permutation : gShaderPermutations)
+    {
+        if (permutation.features != features)
+            continue;
+        if (permutation.state == PERMUTATION_BUILDING)
+            UFinishShaderPermutation(permutation);
+        return permutation.state == PERMUTATION_READY ? &permutation : nullptr;
+    }
+    return nullptr;
 }
 
-//**********************************************************
-//DESTROY TEXTURE
-//**********************************************************
-void UDestroyTexture(GLuint textureId)
+// Collects the result of a permutation build
+void UFinishShaderPermutation(ShaderPermutation& permutation)
 {
-    glGenTextures(1, &textureId);
+    if (!UFinishProgramBuild(permutation.build))
+    {
+        cout << "ERROR: Shader permutation" << UPermutationName(permutation.features) << " failed to build" << endl;
+        permutation.state = PERMUTATION_FAILED;
+        return;
+    }
+
+    permutation.programId = permutation.build.programId;
+    UWarmUpShaderPermutation(permutation);
+    permutation.state = PERMUTATION_READY;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - permutation.build.buildStart;
+    cout << "INFO: Shader permutation" << UPermutationName(permutation.features) << " ready after " << elapsed.count() << " ms" << endl;
 }
 
-//********************************************************************
-//SHADER IMPLEMENTATION
-//
-// Implements the UCreateShaders function
-//********************************************************************
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Swaps in a reloaded program once it linked, a failed one leaves the current program in place
+void UFinishShaderReload(ShaderPermutation& permutation)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
+    permutation.reloading = false;
+    if (!UFinishProgramBuild(permutation.reloadBuild))
+    {
+        cout << "ERROR: Shader permutation" << UPermutationName(permutation.features) << " failed to rebuild, keeping the previous program" << endl;
+        return;
+    }
 
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+    const GLuint previousProgramId = permutation.programId;
+    permutation.build = permutation.reloadBuild;
+    permutation.programId = permutation.build.programId;
+    UWarmUpShaderPermutation(permutation);
+    UDestroyShaderProgram(previousProgramId);
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - permutation.build.buildStart;
+    cout << "INFO: Shader permutation" << UPermutationName(permutation.features) << " reloaded after " << elapsed.count() << " ms" << endl;
+}
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+// Finishes the permutation and pass program builds the driver completed since the last frame,
+// never waits on one. Saves that arrived during a build start the next one here.
+void UPollShaderPermutations()
+{
+    bool building = false;
+    for (ShaderPermutation& permutation : gShaderPermutations)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        if (permutation.reloading && UIsProgramBuildDone(permutation.reloadBuild))
+            UFinishShaderReload(permutation);
 
-        return false;
+        if (permutation.state == PERMUTATION_BUILDING && UIsProgramBuildDone(permutation.build))
+            UFinishShaderPermutation(permutation);
+
+        if (permutation.rebuildPending && permutation.state != PERMUTATION_BUILDING && !permutation.reloading)
+        {
+            permutation.rebuildPending = false;
+            URebuildShaderPermutation(permutation);
+        }
+        building = building || permutation.state == PERMUTATION_BUILDING;
     }
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    for (PassProgram& pass : gPassPrograms)
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        if (pass.reloading && UIsProgramBuildDone(pass.reloadBuild))
+            UFinishPassReload(pass);
 
-        return false;
+        if (pass.rebuildPending && !pass.reloading)
+        {
+            pass.rebuildPending = false;
+            URebuildPassProgram(pass);
+        }
     }
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+    if (!building && !gShadersReadyReported && !gShaderPermutations.empty())
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - gStartupTime;
+        cout << "INFO: All " << gShaderPermutations.size() << " shader permutations ready " << elapsed.count() << " ms after startup" << endl;
+        UReportProgramBuilds();
+        gShadersReadyReported = true;
+    }
+}
 
-        return false;
+// Drivers finish part of the compilation on a program's first draw, for the state it is drawn with.
+// Drawing an object of the scene into a single scissored pixel right after the build moves that
+// cost away from the frame that first shows the object. The pixel is cleared with the next frame.
+void UWarmUpShaderPermutation(const ShaderPermutation& permutation)
+{
+    int warmUpRow = -1;
+    for (uint32_t row = 0; row < gScene.entities.Size(); ++row)
+    {
+        if (gScene.material[row]->features == (permutation.features & ~(SHADER_DEFERRED | SHADER_OIT)))
+        {
+            warmUpRow = (int)row;
+            break;
+        }
     }
+    if (warmUpRow < 0)
+        return;
+
+    // G-buffer and OIT permutations are warmed up against their targets' formats
+    GLuint framebuffer = 0;
+    if ((permutation.features & SHADER_DEFERRED) != 0 && gGBufferWidth > 0)
+        framebuffer = gGBuffer;
+    else if ((permutation.features & SHADER_OIT) != 0 && gOitWidth > 0)
+        framebuffer = gOitFramebuffer;
+    if (framebuffer != 0)
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    glUseProgram(permutation.programId);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, 1, 1);
+    glBindVertexArray(gScene.mesh[warmUpRow]->vao);
+    glDrawElements(GL_TRIANGLES, gScene.indexCount[warmUpRow], GL_UNSIGNED_SHORT, NULL);
+    glBindVertexArray(0);
+    glDisable(GL_SCISSOR_TEST);
 
-    glUseProgram(programId);    // Uses the shader program
+    if (framebuffer != 0)
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    return true;
+// Camera and light uniforms of the current program
+void UApplyFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition)
+{
+    glUniformMatrix4fv(UNIFORM_VIEW, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(UNIFORM_PROJECTION, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform3f(UNIFORM_OBJECT_COLOR, gObjectColor.r, gObjectColor.g, gObjectColor.b);
+    glUniform3f(UNIFORM_LIGHT_COLOR, gLightColor.r, gLightColor.g, gLightColor.b);
+    glUniform3f(UNIFORM_VIEW_POSITION, viewPosition.x, viewPosition.y, viewPosition.z);
+
+    // Fragments find their cluster from the window position, so they need the viewport size
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glUniform4f(UNIFORM_CLUSTER_PARAMS, (GLfloat)viewport[2], (GLfloat)viewport[3], LIGHT_CAMERA_NEAR, LIGHT_CAMERA_FAR);
+}
+
+void UApplyMaterial(const Material& material)
+{
+    glUniform1f(UNIFORM_AMBIENT_STRENGTH, material.ambientStrength);
+    glUniform1f(UNIFORM_SPECULAR_INTENSITY, material.specularIntensity);
+    glUniform1f(UNIFORM_HIGHLIGHT_SIZE, material.highlightSize);
+    glUniform1f(UNIFORM_ALPHA, material.alpha);
 }
+
 //Destroy shader program
 void UDestroyShaderProgram(GLuint programId)
 {
-    glDeleteProgram(programId);
+    gResources->Release(gResources->Find(RESOURCE_PROGRAM, programId));
+}
+
+//**********************************************************
+//GPU RESOURCES
+//
+//Deletes the GL objects behind registry entries and reports
+//how much GPU memory each category holds
+//**********************************************************
+void UReleaseGpuObjects(ResourceType type, const uint32_t* names, int count)
+{
+    switch (type)
+    {
+    case RESOURCE_MESH:
+        glDeleteVertexArrays(1, &names[0]);
+        glDeleteBuffers(count - 1, &names[1]);
+        break;
+    case RESOURCE_TEXTURE:
+        glDeleteTextures(count, names);
+        break;
+    case RESOURCE_PROGRAM:
+        glDeleteProgram(names[0]);
+        break;
+    case RESOURCE_BUFFER:
+        glDeleteBuffers(count, names);
+        break;
+    default:
+        break;
+    }
+}
+
+void UReportGpuMemory()
+{
+    const double MB = 1024.0 * 1024.0;
+    for (int type = 0; type < RESOURCE_TYPE_COUNT; ++type)
+    {
+        const ResourceType resourceType = (ResourceType)type;
+        cout << "INFO: GPU " << RESOURCE_TYPE_NAMES[type] << ": " << gResources->LiveCount(resourceType) << " live, "
+             << gResources->CurrentBytes(resourceType) / MB << " MB (peak " << gResources->PeakBytes(resourceType) / MB << " MB)" << endl;
+    }
 }
 
 
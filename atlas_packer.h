@@ -0,0 +1,208 @@
+#ifndef ATLAS_PACKER_H
+#define ATLAS_PACKER_H
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+//************************************************************
+//ATLAS PACKER
+//
+//Skyline bottom-left packing of small images into one shared
+//texture. Every image is surrounded by a gutter of repeated
+//edge texels and placed on a grid of the gutter size, so the
+//first log2(padding) + 1 mip levels never filter in a
+//neighbour's texels.
+//************************************************************
+struct AtlasRect
+{
+    int x;          // Position of the image itself, inside its gutter
+    int y;
+    int width;
+    int height;
+};
+
+class SkylinePacker
+{
+public:
+    SkylinePacker(int width, int height) : atlasWidth(width), atlasHeight(height)
+    {
+        skyline.push_back({ 0, 0, width });
+    }
+
+    // Finds the lowest spot the box fits, ties go to the leftmost one
+    bool Insert(int width, int height, int& x, int& y)
+    {
+        int bestIndex = -1;
+        int bestY = INT_MAX;
+        int bestX = 0;
+
+        for (size_t i = 0; i < skyline.size(); ++i)
+        {
+            int top;
+            if (Fits(i, width, height, top) && top < bestY)
+            {
+                bestIndex = (int)i;
+                bestY = top;
+                bestX = skyline[i].x;
+            }
+        }
+
+        if (bestIndex < 0)
+            return false;
+
+        AddSegment(bestIndex, bestX, bestY + height, width);
+        x = bestX;
+        y = bestY;
+        return true;
+    }
+
+private:
+    struct Segment
+    {
+        int x;
+        int y;
+        int width;
+    };
+
+    // Top of the skyline under a box starting at segment index, if the box fits there
+    bool Fits(size_t index, int width, int height, int& top) const
+    {
+        if (skyline[index].x + width > atlasWidth)
+            return false;
+
+        top = 0;
+        int remaining = width;
+        for (size_t i = index; remaining > 0; ++i)
+        {
+            if (i == skyline.size())
+                return false;
+            top = std::max(top, skyline[i].y);
+            if (top + height > atlasHeight)
+                return false;
+            remaining -= skyline[i].width;
+        }
+        return true;
+    }
+
+    void AddSegment(int index, int x, int y, int width)
+    {
+        skyline.insert(skyline.begin() + index, { x, y, width });
+
+        // Cut away what the new segment covers of the ones to its right
+        for (size_t i = index + 1; i < skyline.size(); )
+        {
+            const int overlap = x + width - skyline[i].x;
+            if (overlap <= 0)
+                break;
+
+            if (overlap >= skyline[i].width)
+            {
+                skyline.erase(skyline.begin() + i);
+                continue;
+            }
+            skyline[i].x += overlap;
+            skyline[i].width -= overlap;
+            break;
+        }
+
+        // Merge neighbours at the same height
+        for (size_t i = 0; i + 1 < skyline.size(); )
+        {
+            if (skyline[i].y == skyline[i + 1].y)
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            }
+            else
+                ++i;
+        }
+    }
+
+    int atlasWidth;
+    int atlasHeight;
+    std::vector<Segment> skyline;
+};
+
+// Places every size in sizes (width, height pairs) into the smallest power of two atlas
+// found, tallest first. padding must be a power of two; it is both the gutter around
+// each image and the grid images are aligned to. Fails when nothing up to maxSize fits.
+inline bool PackAtlas(const std::vector<std::pair<int, int>>& sizes, int padding, int maxSize,
+                      int& atlasWidth, int& atlasHeight, std::vector<AtlasRect>& rects)
+{
+    auto alignUp = [padding](int value) { return (value + padding - 1) / padding * padding; };
+
+    std::vector<int> order(sizes.size());
+    long long area = 0;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        order[i] = (int)i;
+        area += (long long)alignUp(sizes[i].first + 2 * padding) * alignUp(sizes[i].second + 2 * padding);
+    }
+    std::sort(order.begin(), order.end(), [&sizes](int a, int b)
+    {
+        return sizes[a].second != sizes[b].second ? sizes[a].second > sizes[b].second : sizes[a].first > sizes[b].first;
+    });
+
+    // Start at the smallest square that could hold the area and grow one side at a time
+    atlasWidth = padding;
+    atlasHeight = padding;
+    while ((long long)atlasWidth * atlasHeight < area)
+    {
+        if (atlasWidth <= atlasHeight)
+            atlasWidth *= 2;
+        else
+            atlasHeight *= 2;
+    }
+
+    while (atlasWidth <= maxSize && atlasHeight <= maxSize)
+    {
+        SkylinePacker packer(atlasWidth, atlasHeight);
+        rects.assign(sizes.size(), AtlasRect());
+
+        bool packed = true;
+        for (int i : order)
+        {
+            int x, y;
+            if (!packer.Insert(alignUp(sizes[i].first + 2 * padding), alignUp(sizes[i].second + 2 * padding), x, y))
+            {
+                packed = false;
+                break;
+            }
+            rects[i] = { x + padding, y + padding, sizes[i].first, sizes[i].second };
+        }
+
+        if (packed)
+            return true;
+
+        if (atlasWidth <= atlasHeight)
+            atlasWidth *= 2;
+        else
+            atlasHeight *= 2;
+    }
+
+    return false;
+}
+
+// Copies image into the atlas at rect and fills its gutter by repeating the edge texels outwards
+inline void BlitWithGutter(unsigned char* atlas, int atlasWidth, int atlasHeight, int channels,
+                           const unsigned char* image, const AtlasRect& rect, int padding)
+{
+    const int x0 = std::max(rect.x - padding, 0);
+    const int y0 = std::max(rect.y - padding, 0);
+    const int x1 = std::min(rect.x + rect.width + padding, atlasWidth);
+    const int y1 = std::min(rect.y + rect.height + padding, atlasHeight);
+
+    for (int y = y0; y < y1; ++y)
+    {
+        const int sourceY = std::min(std::max(y - rect.y, 0), rect.height - 1);
+        for (int x = x0; x < x1; ++x)
+        {
+            const int sourceX = std::min(std::max(x - rect.x, 0), rect.width - 1);
+            memcpy(atlas + ((size_t)y * atlasWidth + x) * channels, image + ((size_t)sourceY * rect.width + sourceX) * channels, channels);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+//************************************************************
+//COMMAND QUEUE
+//
+//Fixed size ring of commands from exactly one producer thread
+//to exactly one consumer thread. Pushing and popping are lock
+//free: each side only writes its own index and publishes it
+//with release ordering. The mutex is only touched to put an
+//idle consumer to sleep and wake it up again, so a busy queue
+//never blocks either side.
+//************************************************************
+template <typename T, size_t Capacity>
+class CommandQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    CommandQueue() = default;
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    // Producer only. False when the queue is full.
+    bool TryPush(const T& command)
+    {
+        const size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        slots[tail & (Capacity - 1)] = command;
+        tailIndex.store(tail + 1, std::memory_order_seq_cst);
+
+        // Pairs with the sleeping consumer re-checking the tail after announcing itself
+        if (consumerSleeping.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeUp.notify_one();
+        }
+        return true;
+    }
+
+    // Producer only. Yields while the queue is full, the consumer frees slots without being woken.
+    void Push(const T& command)
+    {
+        while (!TryPush(command))
+            std::this_thread::yield();
+    }
+
+    // Consumer only. False when the queue is empty.
+    bool TryPop(T& command)
+    {
+        const size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire))
+            return false;
+
+        command = slots[head & (Capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Sleeps until a command arrives.
+    void Pop(T& command)
+    {
+        if (TryPop(command))
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        consumerSleeping.store(true, std::memory_order_seq_cst);
+        wakeUp.wait(lock, [this] { return headIndex.load(std::memory_order_relaxed) != tailIndex.load(std::memory_order_seq_cst); });
+        consumerSleeping.store(false, std::memory_order_relaxed);
+        lock.unlock();
+
+        TryPop(command);
+    }
+
+private:
+    T slots[Capacity];
+
+    // Free running counters, the slot is the counter modulo Capacity. Kept on separate
+    // cache lines so the two threads do not invalidate each other's index on every call.
+    alignas(64) std::atomic<size_t> headIndex{ 0 };   // Written by the consumer
+    alignas(64) std::atomic<size_t> tailIndex{ 0 };   // Written by the producer
+
+    std::atomic<bool> consumerSleeping{ false };
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+};
+
+#endif
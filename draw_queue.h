@@ -0,0 +1,62 @@
+#ifndef DRAW_QUEUE_H
+#define DRAW_QUEUE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//************************************************************
+//DRAW QUEUE
+//
+//Orders draws by a small integer key with an LSD radix sort,
+//one counting pass per byte of the key, so sorting stays linear
+//in the number of draws. The sort is stable: draws with equal
+//keys keep the order they were queued in, which lets a run of
+//draws that has to stay together share one key.
+//************************************************************
+struct DrawKey
+{
+    uint32_t key;
+    uint32_t index;     // Draw the key belongs to
+};
+
+const int DRAW_DEPTH_BITS = 16;
+
+// Maps a view space distance onto [0, 2^DRAW_DEPTH_BITS), nearest first.
+// Distances outside [nearPlane, farPlane] are clamped to the ends.
+inline uint32_t QuantizeDepth(float distance, float nearPlane, float farPlane)
+{
+    const uint32_t maxKey = (1u << DRAW_DEPTH_BITS) - 1;
+    const float t = (distance - nearPlane) / (farPlane - nearPlane);
+    return (uint32_t)(std::min(std::max(t, 0.0f), 1.0f) * maxKey);
+}
+
+// Sorts draws by the low keyBits bits of their key, smallest first. scratch is resized as
+// needed and can be kept between calls so sorting every frame does not allocate. Both are
+// vectors of DrawKey, with any allocator as long as they share it.
+template<typename DrawKeys>
+void RadixSortDrawKeys(DrawKeys& draws, DrawKeys& scratch, int keyBits = DRAW_DEPTH_BITS)
+{
+    scratch.resize(draws.size());
+
+    for (int shift = 0; shift < keyBits; shift += 8)
+    {
+        uint32_t offsets[256] = {};
+        for (const DrawKey& draw : draws)
+            ++offsets[(draw.key >> shift) & 0xFF];
+
+        uint32_t total = 0;
+        for (uint32_t& offset : offsets)
+        {
+            const uint32_t count = offset;
+            offset = total;
+            total += count;
+        }
+
+        for (const DrawKey& draw : draws)
+            scratch[offsets[(draw.key >> shift) & 0xFF]++] = draw;
+        draws.swap(scratch);
+    }
+}
+
+#endif
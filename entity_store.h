@@ -0,0 +1,101 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//************************************************************
+//ENTITY STORE
+//
+//Stable entity ids over densely packed rows. Components are
+//kept by the caller as one array per field, all indexed by row,
+//so a system touching two fields streams through two arrays
+//and nothing else. Rows are only ever appended and cleared all
+//at once, so they keep the order they were created in, which
+//callers rely on for draw order.
+//
+//Ids carry a generation like resource handles, so an id kept
+//after the store was cleared resolves to nothing rather than
+//to whatever took its place.
+//************************************************************
+struct EntityId
+{
+    uint32_t index = 0;
+    uint32_t generation = 0;     // 0 is never handed out, so a default id is invalid
+
+    bool IsValid() const { return generation != 0; }
+    bool operator==(const EntityId& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const EntityId& other) const { return !(*this == other); }
+};
+
+class EntityIndex
+{
+public:
+    // New entity at row Size() - 1, the caller appends a value to every component array
+    EntityId Create()
+    {
+        uint32_t index;
+        if (!freeIndices.empty())
+        {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        else
+        {
+            index = (uint32_t)slots.size();
+            slots.emplace_back();
+        }
+
+        Slot& slot = slots[index];
+        slot.row = (uint32_t)rowIds.size();
+        rowIds.push_back({ index, slot.generation });
+        return rowIds.back();
+    }
+
+    // Row of a live entity, -1 for stale ids
+    int Row(EntityId id) const
+    {
+        if (id.index >= slots.size())
+            return -1;
+        const Slot& slot = slots[id.index];
+        return slot.row != INVALID_ROW && slot.generation == id.generation ? (int)slot.row : -1;
+    }
+
+    EntityId Id(uint32_t row) const { return rowIds[row]; }
+    uint32_t Size() const { return (uint32_t)rowIds.size(); }
+
+    void Reserve(size_t count)
+    {
+        slots.reserve(count);
+        rowIds.reserve(count);
+    }
+
+    void Clear()
+    {
+        for (const EntityId& id : rowIds)
+        {
+            Slot& slot = slots[id.index];
+            slot.row = INVALID_ROW;
+            if (++slot.generation == 0)
+                slot.generation = 1;
+            freeIndices.push_back(id.index);
+        }
+        rowIds.clear();
+    }
+
+private:
+    static constexpr uint32_t INVALID_ROW = 0xFFFFFFFF;
+
+    struct Slot
+    {
+        uint32_t row = INVALID_ROW;
+        uint32_t generation = 1;
+    };
+
+    std::vector<Slot> slots;            // By id index
+    std::vector<EntityId> rowIds;       // By row
+    std::vector<uint32_t> freeIndices;
+};
+
+#endif
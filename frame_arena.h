@@ -0,0 +1,240 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+//************************************************************
+//FRAME ARENA
+//
+//Bump allocator for data that lives for a single frame: draw
+//packets, sort keys, culling output. Allocating moves a pointer
+//and freeing does nothing; the whole arena is rewound at once
+//when its frame comes around again.
+//
+//Each thread allocates from its own arena so nothing is shared
+//or locked, and every thread has one arena per frame in flight,
+//so data handed along with a frame stays valid until that frame
+//is recycled. An arena that runs out borrows extra blocks from
+//the heap and grows to its peak on the next rewind, so the heap
+//is only touched until the frames settle.
+//************************************************************
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t initialCapacity) : capacity(std::max<size_t>(initialCapacity, 64))
+    {
+        block = static_cast<unsigned char*>(malloc(this->capacity));
+        if (block == nullptr)
+            throw std::bad_alloc();
+    }
+
+    ~FrameArena()
+    {
+        ReleaseOverflow();
+        free(block);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // alignment must be a power of two
+    void* Allocate(size_t bytes, size_t alignment)
+    {
+        // Aligned by address, the block itself is only aligned as far as malloc guarantees
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block);
+        const size_t start = ((base + used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (start + bytes <= capacity)
+        {
+            used = start + bytes;
+            return block + start;
+        }
+
+        // Out of room, borrow a block until the next rewind. The link to the previous
+        // one sits in front of the memory handed out, with room to align past it.
+        Overflow* extra = static_cast<Overflow*>(malloc(sizeof(Overflow) + alignment - 1 + bytes));
+        if (extra == nullptr)
+            throw std::bad_alloc();
+        extra->next = overflow;
+        overflow = extra;
+        overflowBytes += bytes + alignment;
+        const uintptr_t memory = reinterpret_cast<uintptr_t>(extra) + sizeof(Overflow);
+        return reinterpret_cast<void*>((memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    // Frees everything at once. Grows the block when the frame did not fit, so the next one will.
+    void Rewind()
+    {
+        peak = std::max(peak, used + overflowBytes);
+        if (overflow != nullptr)
+        {
+            ReleaseOverflow();
+            while (capacity < peak)
+                capacity *= 2;
+            free(block);
+            block = static_cast<unsigned char*>(malloc(capacity));
+            if (block == nullptr)
+                throw std::bad_alloc();
+            ++grownCount;
+        }
+        used = 0;
+        overflowBytes = 0;
+    }
+
+    size_t Used() const { return used + overflowBytes; }
+    size_t Capacity() const { return capacity; }
+    size_t Peak() const { return peak; }
+    int GrownCount() const { return grownCount; }
+
+private:
+    struct Overflow
+    {
+        Overflow* next;
+    };
+
+    void ReleaseOverflow()
+    {
+        while (overflow != nullptr)
+        {
+            Overflow* next = overflow->next;
+            free(overflow);
+            overflow = next;
+        }
+    }
+
+    unsigned char* block = nullptr;
+    size_t capacity;
+    size_t used = 0;
+    Overflow* overflow = nullptr;   // Blocks borrowed since the last rewind, newest first
+    size_t overflowBytes = 0;
+    size_t peak = 0;
+    int grownCount = 0;
+};
+
+// STL allocator drawing from a frame arena. Without an arena it falls back to the heap, so
+// containers can be declared before they are bound to a frame. Moving a container moves its
+// arena along, which is how a container is rebound: assign it a new empty one.
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(FrameArena* arena = nullptr) : arena(arena)
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena)
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        if (arena == nullptr)
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* pointer, size_t)
+    {
+        if (arena == nullptr)
+            ::operator delete(pointer);
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+    template<typename U>
+    friend class ArenaAllocator;
+
+    FrameArena* arena;
+};
+
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// One arena per thread and frame in flight
+class FrameArenas
+{
+public:
+    static constexpr int MAX_FRAMES = 3;
+    static constexpr int MAX_THREADS = 256;     // Threads beyond this allocate from the heap
+
+    // frameCount is the number of frames whose data is alive at once, at most MAX_FRAMES
+    FrameArenas(int frameCount, size_t capacity) : frameCount(std::min(std::max(frameCount, 1), MAX_FRAMES)), capacity(capacity)
+    {
+    }
+
+    FrameArenas(const FrameArenas&) = delete;
+    FrameArenas& operator=(const FrameArenas&) = delete;
+
+    // Rewinds the arenas frame reuses. No thread may allocate from this set meanwhile, and
+    // data allocated frameCount frames ago is gone afterwards.
+    void BeginFrame(uint64_t frame)
+    {
+        current = (int)(frame % frameCount);
+        RewindCurrent();
+    }
+
+    // Rewinds the current frame's arenas again, for benchmarks repeating a frame's work
+    void RewindCurrent()
+    {
+        for (std::unique_ptr<FrameArena>& arena : arenas[current])
+        {
+            if (arena != nullptr)
+                arena->Rewind();
+        }
+    }
+
+    // Calling thread's arena for the current frame, created the first time the thread asks.
+    // nullptr once MAX_THREADS threads took one, which ArenaAllocator turns into heap allocations.
+    FrameArena* Local()
+    {
+        if (threadSlot < 0)
+            threadSlot = nextThreadSlot.fetch_add(1, std::memory_order_relaxed);
+        if (threadSlot >= MAX_THREADS)
+            return nullptr;
+
+        std::unique_ptr<FrameArena>& arena = arenas[current][threadSlot];
+        if (arena == nullptr)
+            arena = std::make_unique<FrameArena>(capacity);
+        return arena.get();
+    }
+
+    // Bytes all arenas can hold without touching the heap
+    size_t Capacity() const
+    {
+        size_t total = 0;
+        for (int frame = 0; frame < frameCount; ++frame)
+            for (const std::unique_ptr<FrameArena>& arena : arenas[frame])
+                total += arena != nullptr ? arena->Capacity() : 0;
+        return total;
+    }
+
+private:
+    int frameCount;
+    size_t capacity;                // Starting size of every arena
+    int current = 0;
+    std::unique_ptr<FrameArena> arenas[MAX_FRAMES][MAX_THREADS];
+
+    static std::atomic<int> nextThreadSlot;
+    static thread_local int threadSlot;
+};
+
+inline std::atomic<int> FrameArenas::nextThreadSlot{ 0 };
+inline thread_local int FrameArenas::threadSlot = -1;
+
+#endif
@@ -0,0 +1,510 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//************************************************************
+//JOB SYSTEM
+//
+//Work-stealing scheduler for short engine tasks. Every worker
+//owns a Chase-Lev deque: it pushes and pops jobs at the bottom
+//without locks, while idle workers steal from the top of other
+//workers' deques. Threads outside the system submit through a
+//shared queue and help run jobs while they wait.
+//
+//Completion is tracked with counters. A counter is raised for
+//every job started with it and lowered when the job finished;
+//Wait runs other jobs until it reaches zero, and RunAfter holds
+//a job back until another counter reached zero, which is how
+//dependencies are expressed.
+//
+//Unlike ThreadPool, jobs are expected to be short and must not
+//block: a blocked job keeps its worker from stealing. Finished
+//jobs are pooled, so once the pool has grown to the number of
+//jobs in flight, scheduling no longer touches the heap as long
+//as a job's captures fit std::function's inline storage (two
+//pointers in common implementations).
+//************************************************************
+class JobSystem;
+struct Job;
+
+// Number of jobs still running or waiting to run, see the header comment
+class JobCounter
+{
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // Also waits for the last job to let go of the counter, so it can be destroyed right after
+    bool IsDone() const
+    {
+        return pending.load(std::memory_order_acquire) == 0 && finishing.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending{ 0 };
+    std::atomic<int> finishing{ 0 };        // Jobs between lowering pending and their last access to the counter
+    std::mutex mutex;                       // Guards continuations
+    std::vector<Job*> continuations;        // Jobs started with RunAfter, scheduled once pending drops to 0
+};
+
+struct Job
+{
+    std::function<void()> work;
+    JobCounter* counter;                  // Lowered when the job finished, may be nullptr
+};
+
+// Chase-Lev deque of a fixed power of two capacity, with the memory orderings of
+// Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak
+// Memory Models". Push and Pop are for the owning thread only, Steal for any thread.
+class WorkStealingDeque
+{
+public:
+    static constexpr int64_t CAPACITY = 4096;
+
+    WorkStealingDeque()
+    {
+        for (std::atomic<Job*>& slot : slots)
+            slot.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // False when full, the caller runs the job itself then
+    bool Push(Job* job)
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+
+        slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Newest job first, keeps the owner on the data it just touched
+    Job* Pop()
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        Job* job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last job, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // Oldest job first, which tends to be the largest piece of a split range
+    Job* Steal()
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        Job* job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;     // Lost to the owner or another thief
+        return job;
+    }
+
+    // Only a hint while other threads push or steal
+    bool Empty() const
+    {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Job*> slots[CAPACITY];
+};
+
+class JobSystem
+{
+public:
+    // threadCount includes the threads that wait on counters, so threadCount - 1 workers are
+    // started; 0 picks one per core
+    explicit JobSystem(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+        for (unsigned int i = 0; i + 1 < threadCount; ++i)
+            deques.push_back(std::make_unique<WorkStealingDeque>());
+        jobCaches.resize(deques.size());
+        for (std::vector<Job*>& cache : jobCaches)
+            cache.reserve(2 * JOB_CACHE_BATCH);
+        for (unsigned int i = 0; i + 1 < threadCount; ++i)
+            workers.emplace_back([this, i] { WorkerLoop((int)i); });
+    }
+
+    // Jobs still queued are run before the workers stop
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+
+        for (std::vector<Job*>& cache : jobCaches)
+            freeJobs.insert(freeJobs.end(), cache.begin(), cache.end());
+        for (Job* job : freeJobs)
+            delete job;
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Threads taking part in the work, counting the one that waits
+    unsigned int Size() const
+    {
+        return (unsigned int)workers.size() + 1;
+    }
+
+    void Run(std::function<void()> work, JobCounter* counter = nullptr)
+    {
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        Schedule(NewJob(std::move(work), counter));
+    }
+
+    // Starts work once dependency reached zero, without holding a thread while it waits
+    void RunAfter(JobCounter& dependency, std::function<void()> work, JobCounter* counter = nullptr)
+    {
+        if (counter != nullptr)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        Job* job = NewJob(std::move(work), counter);
+
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending.load(std::memory_order_acquire) > 0)
+            {
+                dependency.continuations.push_back(job);
+                return;
+            }
+        }
+        Schedule(job);
+    }
+
+    // Runs queued jobs until counter reached zero
+    void Wait(JobCounter& counter)
+    {
+        while (!counter.IsDone())
+        {
+            if (Job* job = FindJob())
+                Execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // Runs body(i) for every i in [0, count) and returns once all of them finished, same as
+    // ThreadPool::ParallelFor. The range is split in halves down to grain indices per job, so
+    // a thief always takes half of what is left rather than a single index.
+    template<typename Body>
+    void ParallelFor(int count, const Body& body, int grain = 1)
+    {
+        if (count <= 0)
+            return;
+
+        JobCounter counter;
+        const ParallelForRange range = { this, &CallBody<Body>, &body, &counter, std::max(grain, 1) };
+        Split(range, 0, count);
+        Wait(counter);
+    }
+
+private:
+    static constexpr size_t JOB_CACHE_BATCH = 32;   // Jobs a worker moves between its cache and the shared pool at once
+
+    // What every piece of a parallel for shares, lives on the stack of the thread that started it
+    struct ParallelForRange
+    {
+        JobSystem* system;
+        void (*call)(const void* body, int i);
+        const void* body;
+        JobCounter* counter;
+        int grain;
+    };
+
+    template<typename Body>
+    static void CallBody(const void* body, int i)
+    {
+        (*static_cast<const Body*>(body))(i);
+    }
+
+    // Hands the upper halves to other threads and runs what is left of [begin, end) itself
+    static void Split(const ParallelForRange& range, int begin, int end)
+    {
+        while (end - begin > range.grain)
+        {
+            const int middle = begin + (end - begin) / 2;
+
+            // Captures no more than two pointers' worth so the job does not allocate
+            const ParallelForRange* shared = &range;
+            const int64_t bounds = (int64_t)middle << 32 | (uint32_t)end;
+            range.system->Run([shared, bounds] { Split(*shared, (int)(bounds >> 32), (int)bounds); }, range.counter);
+            end = middle;
+        }
+        for (int i = begin; i < end; ++i)
+            range.call(range.body, i);
+    }
+
+    // Workers take jobs from their own cache, other threads from the shared pool
+    Job* NewJob(std::function<void()>&& work, JobCounter* counter)
+    {
+        Job* job = nullptr;
+        if (currentSystem == this)
+        {
+            std::vector<Job*>& cache = jobCaches[currentWorker];
+            if (cache.empty())
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                const size_t take = std::min(freeJobs.size(), JOB_CACHE_BATCH);
+                cache.insert(cache.end(), freeJobs.end() - take, freeJobs.end());
+                freeJobs.resize(freeJobs.size() - take);
+            }
+            if (!cache.empty())
+            {
+                job = cache.back();
+                cache.pop_back();
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (!freeJobs.empty())
+            {
+                job = freeJobs.back();
+                freeJobs.pop_back();
+            }
+        }
+
+        if (job == nullptr)
+            job = new Job;
+        job->work = std::move(work);
+        job->counter = counter;
+        return job;
+    }
+
+    void FreeJob(Job* job)
+    {
+        job->work = nullptr;
+        if (currentSystem == this)
+        {
+            std::vector<Job*>& cache = jobCaches[currentWorker];
+            cache.push_back(job);
+            if (cache.size() < 2 * JOB_CACHE_BATCH)
+                return;
+
+            // Jobs pile up on the workers that run them, hand a batch back to the ones creating them
+            std::lock_guard<std::mutex> lock(poolMutex);
+            freeJobs.insert(freeJobs.end(), cache.end() - JOB_CACHE_BATCH, cache.end());
+            cache.resize(cache.size() - JOB_CACHE_BATCH);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            freeJobs.push_back(job);
+        }
+    }
+
+    // Deque of the calling thread if it is one of this system's workers
+    WorkStealingDeque* OwnDeque() const
+    {
+        return currentSystem == this ? deques[currentWorker].get() : nullptr;
+    }
+
+    void Schedule(Job* job)
+    {
+        WorkStealingDeque* own = OwnDeque();
+        if (own != nullptr)
+        {
+            if (!own->Push(job))
+                Execute(job);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            PushSubmitted(job);
+        }
+
+        if (sleepers.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeUp.notify_one();
+        }
+    }
+
+    Job* FindJob()
+    {
+        WorkStealingDeque* own = OwnDeque();
+        if (own != nullptr)
+        {
+            if (Job* job = own->Pop())
+                return job;
+        }
+
+        // Steal starting at a different victim every time so thieves spread out
+        const size_t count = deques.size();
+        const size_t start = count > 0 ? (size_t)nextVictim.fetch_add(1, std::memory_order_relaxed) % count : 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            WorkStealingDeque* victim = deques[(start + i) % count].get();
+            if (victim == own)
+                continue;
+            if (Job* job = victim->Steal())
+                return job;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return PopSubmitted();
+    }
+
+    // Ring of jobs from outside threads, doubles when full so it stops allocating once it fits
+    // the most jobs ever waiting. Callers hold mutex.
+    void PushSubmitted(Job* job)
+    {
+        if (submittedCount == submitted.size())
+        {
+            std::vector<Job*> grown(std::max<size_t>(submitted.size() * 2, 64));
+            for (size_t i = 0; i < submittedCount; ++i)
+                grown[i] = submitted[(submittedHead + i) % submitted.size()];
+            submitted.swap(grown);
+            submittedHead = 0;
+        }
+        submitted[(submittedHead + submittedCount) % submitted.size()] = job;
+        ++submittedCount;
+    }
+
+    Job* PopSubmitted()
+    {
+        if (submittedCount == 0)
+            return nullptr;
+        Job* job = submitted[submittedHead];
+        submittedHead = (submittedHead + 1) % submitted.size();
+        --submittedCount;
+        return job;
+    }
+
+    void Execute(Job* job)
+    {
+        job->work();
+
+        JobCounter* counter = job->counter;
+        FreeJob(job);
+        if (counter == nullptr)
+            return;
+
+        counter->finishing.fetch_add(1, std::memory_order_acq_rel);
+        if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            // Last job of the counter, release what was waiting on it
+            std::vector<Job*> ready;
+            {
+                std::lock_guard<std::mutex> lock(counter->mutex);
+                ready.swap(counter->continuations);
+            }
+            for (Job* next : ready)
+                Schedule(next);
+        }
+        counter->finishing.fetch_sub(1, std::memory_order_release);    // Last access, a waiter may destroy it now
+    }
+
+    void WorkerLoop(int index)
+    {
+        currentSystem = this;
+        currentWorker = index;
+
+        const int SPINS_BEFORE_SLEEP = 64;
+        int idleSpins = 0;
+        for (;;)
+        {
+            if (Job* job = FindJob())
+            {
+                Execute(job);
+                idleSpins = 0;
+                continue;
+            }
+
+            if (++idleSpins < SPINS_BEFORE_SLEEP)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Announce the sleep before the last look, so a Schedule after it sees a sleeper
+            std::unique_lock<std::mutex> lock(mutex);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            if (submittedCount == 0 && !stopping && !AnyStealable())
+                wakeUp.wait_for(lock, std::chrono::milliseconds(1));
+            sleepers.fetch_sub(1, std::memory_order_seq_cst);
+            if (stopping && submittedCount == 0 && !AnyStealable())
+                return;
+            idleSpins = 0;
+        }
+    }
+
+    bool AnyStealable()
+    {
+        for (std::unique_ptr<WorkStealingDeque>& deque : deques)
+        {
+            if (!deque->Empty())
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<WorkStealingDeque>> deques;    // One per worker
+    std::vector<std::thread> workers;
+    std::vector<Job*> submitted;                                // From threads outside the system, guarded by mutex
+    size_t submittedHead = 0;
+    size_t submittedCount = 0;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::atomic<int> sleepers{ 0 };
+    std::atomic<unsigned int> nextVictim{ 0 };
+    std::vector<std::vector<Job*>> jobCaches;                   // Finished jobs per worker, owner only
+    std::vector<Job*> freeJobs;                                 // Finished jobs shared by all threads, guarded by poolMutex
+    std::mutex poolMutex;
+    bool stopping = false;
+
+    static thread_local JobSystem* currentSystem;
+    static thread_local int currentWorker;
+};
+
+inline thread_local JobSystem* JobSystem::currentSystem = nullptr;
+inline thread_local int JobSystem::currentWorker = 0;
+
+#endif
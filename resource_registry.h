@@ -0,0 +1,228 @@
+#ifndef RESOURCE_REGISTRY_H
+#define RESOURCE_REGISTRY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+//************************************************************
+//RESOURCE REGISTRY
+//
+//Owns every GPU object behind a generational handle. A slot
+//is reused once its object is released, and bumping the
+//generation makes old handles to it resolve to nothing rather
+//than to whatever moved in. Byte sizes are tracked per category
+//with their peak, and objects are freed as soon as their last
+//reference goes away.
+//
+//The registry only stores object names; deleting them is left
+//to the releaser so this file stays free of GL calls.
+//************************************************************
+enum ResourceType
+{
+    RESOURCE_MESH,      // Vertex array followed by its buffers
+    RESOURCE_TEXTURE,
+    RESOURCE_PROGRAM,
+    RESOURCE_BUFFER,
+    RESOURCE_TYPE_COUNT
+};
+
+const int RESOURCE_MAX_NAMES = 3; // Most objects a single resource owns
+
+const char* const RESOURCE_TYPE_NAMES[RESOURCE_TYPE_COUNT] = { "meshes", "textures", "programs", "buffers" };
+
+struct ResourceHandle
+{
+    uint32_t index = 0;
+    uint32_t generation = 0;     // 0 is never handed out, so a default handle is invalid
+
+    bool IsValid() const { return generation != 0; }
+    bool operator==(const ResourceHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const ResourceHandle& other) const { return !(*this == other); }
+};
+
+class ResourceRegistry
+{
+public:
+    typedef std::function<void(ResourceType type, const uint32_t* names, int count)> Releaser;
+
+    explicit ResourceRegistry(Releaser releaser) : releaser(std::move(releaser))
+    {
+    }
+
+    ResourceRegistry(const ResourceRegistry&) = delete;
+    ResourceRegistry& operator=(const ResourceRegistry&) = delete;
+
+    // Takes ownership of the objects in names with one reference held by the caller.
+    // A resource may start out without objects and receive them later through Replace.
+    ResourceHandle Create(ResourceType type, const std::string& label, const uint32_t* names, int count, size_t bytes)
+    {
+        uint32_t index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            index = (uint32_t)slots.size();
+            slots.emplace_back();
+        }
+
+        Slot& slot = slots[index];
+        slot.type = type;
+        slot.label = label;
+        slot.references = 1;
+        slot.bytes = 0;
+        SetNames(slot, names, count);
+        Account(slot, bytes);
+
+        ++liveCount[type];
+        return { index, slot.generation };
+    }
+
+    void AddRef(ResourceHandle handle)
+    {
+        if (Slot* slot = Resolve(handle))
+            ++slot->references;
+    }
+
+    // Frees the objects when this was the last reference
+    void Release(ResourceHandle handle)
+    {
+        Slot* slot = Resolve(handle);
+        if (slot == nullptr || --slot->references > 0)
+            return;
+
+        Free(*slot);
+        freeSlots.push_back(handle.index);
+    }
+
+    // Swaps in new objects for the resource, the old ones are freed right away.
+    // Handles stay valid, so everything holding one sees the new objects.
+    void Replace(ResourceHandle handle, const uint32_t* names, int count, size_t bytes)
+    {
+        Slot* slot = Resolve(handle);
+        if (slot == nullptr)
+            return;
+
+        if (slot->nameCount > 0)
+            releaser(slot->type, slot->names, slot->nameCount);
+        SetNames(*slot, names, count);
+        Account(*slot, bytes);
+    }
+
+    // Object name of a live resource, 0 for stale handles or resources without objects yet
+    uint32_t Name(ResourceHandle handle, int i = 0) const
+    {
+        const Slot* slot = Resolve(handle);
+        return slot != nullptr && i < slot->nameCount ? slot->names[i] : 0;
+    }
+
+    bool IsAlive(ResourceHandle handle) const
+    {
+        return Resolve(handle) != nullptr;
+    }
+
+    // Live resource of the given type owning the object name, invalid if there is none
+    ResourceHandle Find(ResourceType type, uint32_t name) const
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const Slot& slot = slots[i];
+            if (slot.references > 0 && slot.type == type && slot.nameCount > 0 && slot.names[0] == name)
+                return { (uint32_t)i, slot.generation };
+        }
+        return ResourceHandle();
+    }
+
+    size_t CurrentBytes(ResourceType type) const { return currentBytes[type]; }
+    size_t PeakBytes(ResourceType type) const { return peakBytes[type]; }
+    int LiveCount(ResourceType type) const { return liveCount[type]; }
+
+    // Frees everything still alive, newest first, regardless of references.
+    // Calls report(label) for each one so leaks show up at shutdown.
+    int ReleaseAll(const std::function<void(ResourceType type, const std::string& label)>& report = nullptr)
+    {
+        int released = 0;
+        for (size_t i = slots.size(); i-- > 0; )
+        {
+            Slot& slot = slots[i];
+            if (slot.references == 0)
+                continue;
+
+            if (report)
+                report(slot.type, slot.label);
+            Free(slot);
+            freeSlots.push_back((uint32_t)i);
+            ++released;
+        }
+        return released;
+    }
+
+private:
+    struct Slot
+    {
+        ResourceType type = RESOURCE_TEXTURE;
+        std::string label;
+        uint32_t generation = 1;
+        int references = 0;          // 0 while the slot is free
+        uint32_t names[RESOURCE_MAX_NAMES] = {};
+        int nameCount = 0;
+        size_t bytes = 0;
+    };
+
+    Slot* Resolve(ResourceHandle handle)
+    {
+        if (handle.index >= slots.size())
+            return nullptr;
+        Slot& slot = slots[handle.index];
+        return slot.references > 0 && slot.generation == handle.generation ? &slot : nullptr;
+    }
+
+    const Slot* Resolve(ResourceHandle handle) const
+    {
+        return const_cast<ResourceRegistry*>(this)->Resolve(handle);
+    }
+
+    void SetNames(Slot& slot, const uint32_t* names, int count)
+    {
+        slot.nameCount = std::min(count, RESOURCE_MAX_NAMES);
+        for (int i = 0; i < slot.nameCount; ++i)
+            slot.names[i] = names[i];
+    }
+
+    void Account(Slot& slot, size_t bytes)
+    {
+        currentBytes[slot.type] += bytes - slot.bytes;
+        peakBytes[slot.type] = std::max(peakBytes[slot.type], currentBytes[slot.type]);
+        slot.bytes = bytes;
+    }
+
+    void Free(Slot& slot)
+    {
+        if (slot.nameCount > 0)
+            releaser(slot.type, slot.names, slot.nameCount);
+
+        Account(slot, 0);
+        --liveCount[slot.type];
+
+        slot.references = 0;
+        slot.nameCount = 0;
+        slot.label.clear();
+        if (++slot.generation == 0)
+            slot.generation = 1;
+    }
+
+    Releaser releaser;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    size_t currentBytes[RESOURCE_TYPE_COUNT] = {};
+    size_t peakBytes[RESOURCE_TYPE_COUNT] = {};
+    int liveCount[RESOURCE_TYPE_COUNT] = {};
+};
+
+#endif
@@ -0,0 +1,811 @@
+#ifndef SCENE_FORMAT_H
+#define SCENE_FORMAT_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//************************************************************
+//SCENE FORMAT
+//
+//Scenes are authored as JSON and can be compiled into a binary
+//form that loads with a handful of copies. Both decode into the
+//same flat records: textures, materials, lights and entities,
+//with names and paths in one string block and references by
+//index, so the records themselves are plain data.
+//
+//The JSON side is read by a pull parser walking the text in
+//place. Keys and strings come back as views into the text and
+//numbers are converted straight from it, so reading allocates
+//nothing; only the records being filled grow.
+//
+//Meshes are referenced by name and resolved by the caller, and
+//entity transforms are given as position, a list of rotations
+//applied in order and scale, composed here into one matrix.
+//************************************************************
+
+// Pull parser over a JSON text. Every call consumes one piece and returns false on a syntax
+// error, after which all calls fail and Error() tells what and where.
+class JsonReader
+{
+public:
+    JsonReader(const char* text, size_t length) : cursor(text), begin(text), end(text + length)
+    {
+    }
+
+    bool BeginObject() { return Open('{'); }
+    bool BeginArray() { return Open('['); }
+
+    // Next key of the object being read, false once its closing brace was consumed
+    bool NextMember(std::string_view& key)
+    {
+        if (!NextItem('}'))
+            return false;
+        return ReadString(key) && Expect(':');
+    }
+
+    // Moves to the next element of the array being read, false once its closing bracket was consumed
+    bool NextElement()
+    {
+        return NextItem(']');
+    }
+
+    // Raw text between the quotes, escapes are left in place (see Unescape)
+    bool ReadString(std::string_view& value)
+    {
+        if (!Expect('"'))
+            return false;
+        const char* start = cursor;
+        while (cursor < end && *cursor != '"')
+        {
+            if (*cursor == '\\')
+                ++cursor;
+            ++cursor;
+        }
+        if (cursor >= end)
+            return Fail("unterminated string");
+        value = std::string_view(start, cursor - start);
+        ++cursor;
+        return true;
+    }
+
+    bool ReadNumber(float& value)
+    {
+        SkipSpace();
+        if (failed)
+            return false;
+        const std::from_chars_result result = std::from_chars(cursor, end, value);
+        if (result.ec != std::errc())
+            return Fail("number expected");
+        cursor = result.ptr;
+        return true;
+    }
+
+    bool ReadBool(bool& value)
+    {
+        SkipSpace();
+        if (Literal("true"))
+            value = true;
+        else if (Literal("false"))
+            value = false;
+        else
+            return Fail("true or false expected");
+        return true;
+    }
+
+    // Fills count numbers from an array of exactly that length
+    bool ReadNumbers(float* values, int count)
+    {
+        if (!BeginArray())
+            return false;
+        int read = 0;
+        while (NextElement())
+        {
+            if (read == count)
+                return Fail("too many numbers");
+            if (!ReadNumber(values[read++]))
+                return false;
+        }
+        return !failed && (read == count || Fail("too few numbers"));
+    }
+
+    // Steps over a value of any kind, for keys the reader does not know
+    bool Skip()
+    {
+        SkipSpace();
+        if (failed || cursor >= end)
+            return Fail("value expected");
+
+        std::string_view ignored;
+        float number;
+        bool flag;
+        switch (*cursor)
+        {
+        case '{':
+            BeginObject();
+            while (NextMember(ignored))
+                Skip();
+            return !failed;
+        case '[':
+            BeginArray();
+            while (NextElement())
+                Skip();
+            return !failed;
+        case '"':
+            return ReadString(ignored);
+        case 't':
+        case 'f':
+            return ReadBool(flag);
+        case 'n':
+            return Literal("null") || Fail("value expected");
+        default:
+            return ReadNumber(number);
+        }
+    }
+
+    // Fails with message unless the whole text was read
+    bool Finish()
+    {
+        SkipSpace();
+        return !failed && (cursor == end || Fail("text after the end of the document"));
+    }
+
+    bool Fail(const char* message)
+    {
+        if (!failed)
+        {
+            failed = true;
+            error = message;
+            errorAt = cursor;
+        }
+        return false;
+    }
+
+    bool Failed() const { return failed; }
+    const char* Error() const { return error; }
+
+    // 1-based line of the error
+    int ErrorLine() const
+    {
+        int line = 1;
+        for (const char* c = begin; c < errorAt; ++c)
+            line += *c == '\n' ? 1 : 0;
+        return line;
+    }
+
+    // Appends value to out with its escapes resolved. \u escapes are not supported.
+    static bool Unescape(std::string_view value, std::vector<char>& out)
+    {
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            char c = value[i];
+            if (c == '\\')
+            {
+                switch (value[++i])
+                {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case '"': c = '"'; break;
+                case '\\': c = '\\'; break;
+                case '/': c = '/'; break;
+                default: return false;
+                }
+            }
+            out.push_back(c);
+        }
+        return true;
+    }
+
+private:
+    void SkipSpace()
+    {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+            ++cursor;
+    }
+
+    bool Expect(char c)
+    {
+        SkipSpace();
+        if (failed)
+            return false;
+        if (cursor >= end || *cursor != c)
+        {
+            static const char* const messages[] = { "'{' expected", "'[' expected", "'\"' expected", "':' expected" };
+            return Fail(messages[c == '{' ? 0 : c == '[' ? 1 : c == '"' ? 2 : 3]);
+        }
+        ++cursor;
+        return true;
+    }
+
+    // The first item of a container takes no comma. Any container read in between closes before
+    // the next item is looked at, so one flag is enough for nesting.
+    bool Open(char c)
+    {
+        first = true;
+        return Expect(c);
+    }
+
+    bool Literal(const char* word)
+    {
+        const size_t length = strlen(word);
+        if ((size_t)(end - cursor) < length || memcmp(cursor, word, length) != 0)
+            return false;
+        cursor += length;
+        return true;
+    }
+
+    // Handles the comma between items and the closing character, true when another item follows
+    bool NextItem(char close)
+    {
+        SkipSpace();
+        if (failed)
+            return false;
+        if (cursor < end && *cursor == close)
+        {
+            ++cursor;
+            first = false;
+            return false;
+        }
+        if (!first)
+        {
+            if (cursor >= end || *cursor != ',')
+                return Fail("',' expected");
+            ++cursor;
+            SkipSpace();
+        }
+        first = false;
+        return true;
+    }
+
+    const char* cursor;
+    const char* begin;
+    const char* end;
+    bool first = true;      // Next item is the first of its object or array
+    bool failed = false;
+    const char* error = nullptr;
+    const char* errorAt = nullptr;
+};
+
+// Records. Strings are offsets into SceneDescription::strings, zero terminated.
+const uint32_t SCENE_NONE = 0xFFFFFFFF;
+
+enum SceneMaterialFlags
+{
+    SCENE_MATERIAL_ALPHA_TEST = 1 << 0,
+    SCENE_MATERIAL_UNLIT = 1 << 1
+};
+
+enum SceneStencil
+{
+    SCENE_STENCIL_OFF,
+    SCENE_STENCIL_MARK,
+    SCENE_STENCIL_CUT,
+    SCENE_STENCIL_MASKED
+};
+
+enum ScenePattern
+{
+    SCENE_PATTERN_NOISE,
+    SCENE_PATTERN_WEAVE,
+    SCENE_PATTERN_GRAIN
+};
+
+struct SceneTexture
+{
+    uint32_t name;
+    uint32_t path;
+    uint32_t atlas;             // Packed into the shared atlas
+    uint32_t pattern;           // ScenePattern that can stand in for the file, SCENE_NONE for none
+    uint32_t generate;          // Generated from the pattern instead of loaded from path
+    float baseColor[3];
+    float detailColor[3];
+    float patternScale;
+};
+
+struct SceneMaterial
+{
+    uint32_t name;
+    uint32_t flags;             // SceneMaterialFlags
+    float ambientStrength;
+    float specularIntensity;
+    float highlightSize;
+    float alpha;
+};
+
+// The first light is the lamp, it casts the shadows
+struct SceneLight
+{
+    float position[3];
+    float color[3];
+    float radius;               // 0 reaches the whole scene
+};
+
+struct SceneEntity
+{
+    uint32_t name;
+    uint32_t mesh;              // Index into SceneDescription::meshes
+    uint32_t indexMesh;         // Mesh whose index count is drawn, the cup handle's inside draws part of the handle
+    uint32_t texture;           // SCENE_NONE draws without a texture
+    uint32_t material;
+    uint32_t stencil;           // SceneStencil
+    uint32_t dynamic;
+    float model[16];            // Column major
+};
+
+struct SceneDescription
+{
+    std::vector<SceneTexture> textures;
+    std::vector<SceneMaterial> materials;
+    std::vector<uint32_t> meshes;           // Names of the meshes entities use
+    std::vector<SceneLight> lights;
+    std::vector<SceneEntity> entities;
+    std::vector<char> strings;
+
+    const char* String(uint32_t offset) const { return strings.data() + offset; }
+
+    void Clear()
+    {
+        textures.clear();
+        materials.clear();
+        meshes.clear();
+        lights.clear();
+        entities.clear();
+        strings.clear();
+    }
+};
+
+namespace SceneDetail
+{
+    inline bool AddString(SceneDescription& scene, std::string_view value, uint32_t& offset)
+    {
+        offset = (uint32_t)scene.strings.size();
+        if (!JsonReader::Unescape(value, scene.strings))
+        {
+            scene.strings.resize(offset);
+            return false;
+        }
+        scene.strings.push_back('\0');
+        return true;
+    }
+
+    inline bool SameString(const SceneDescription& scene, uint32_t offset, std::string_view value)
+    {
+        const char* text = scene.String(offset);
+        return strncmp(text, value.data(), value.size()) == 0 && text[value.size()] == '\0';
+    }
+
+    // Index of the record named value, SCENE_NONE if there is none
+    template<typename Record>
+    uint32_t Find(const SceneDescription& scene, const std::vector<Record>& records, std::string_view value)
+    {
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            if (SameString(scene, records[i].name, value))
+                return (uint32_t)i;
+        }
+        return SCENE_NONE;
+    }
+
+    // Index of value among names, SCENE_NONE if it is none of them
+    inline uint32_t Lookup(std::string_view value, const char* const* names, uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (value == names[i])
+                return i;
+        }
+        return SCENE_NONE;
+    }
+
+    // Index of the mesh named value, added on first use. Fails the reader on unsupported escapes.
+    inline uint32_t MeshIndex(JsonReader& json, SceneDescription& scene, std::string_view value)
+    {
+        for (size_t i = 0; i < scene.meshes.size(); ++i)
+        {
+            if (SameString(scene, scene.meshes[i], value))
+                return (uint32_t)i;
+        }
+        uint32_t offset;
+        if (!AddString(scene, value, offset))
+        {
+            json.Fail("unsupported escape");
+            return SCENE_NONE;
+        }
+        scene.meshes.push_back(offset);
+        return (uint32_t)scene.meshes.size() - 1;
+    }
+
+    // out = a * b, column major
+    inline void Multiply(const float a[16], const float b[16], float out[16])
+    {
+        float result[16];
+        for (int column = 0; column < 4; ++column)
+            for (int row = 0; row < 4; ++row)
+                result[column * 4 + row] = a[row] * b[column * 4] + a[4 + row] * b[column * 4 + 1] +
+                                           a[8 + row] * b[column * 4 + 2] + a[12 + row] * b[column * 4 + 3];
+        memcpy(out, result, sizeof(result));
+    }
+
+    // Same matrix as glm::rotate(angle, axis)
+    inline void Rotation(float angle, const float axis[3], float out[16])
+    {
+        const float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        const float x = axis[0] / length, y = axis[1] / length, z = axis[2] / length;
+        const float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+        const float rotation[16] = {
+            c + t * x * x,     t * x * y + s * z, t * x * z - s * y, 0.0f,
+            t * y * x - s * z, c + t * y * y,     t * y * z + s * x, 0.0f,
+            t * z * x + s * y, t * z * y - s * x, c + t * z * z,     0.0f,
+            0.0f,              0.0f,              0.0f,              1.0f
+        };
+        memcpy(out, rotation, sizeof(rotation));
+    }
+
+    inline bool ReadTexture(JsonReader& json, SceneDescription& scene)
+    {
+        SceneTexture texture = { SCENE_NONE, SCENE_NONE, 0, SCENE_NONE, 0, { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, 1.0f };
+        std::string_view key, value;
+        if (!json.BeginObject())
+            return false;
+        while (json.NextMember(key))
+        {
+            bool flag = false;
+            if (key == "name")
+                json.ReadString(value) && (AddString(scene, value, texture.name) || json.Fail("unsupported escape"));
+            else if (key == "path")
+                json.ReadString(value) && (AddString(scene, value, texture.path) || json.Fail("unsupported escape"));
+            else if (key == "atlas")
+            {
+                json.ReadBool(flag);
+                texture.atlas = flag ? 1 : 0;
+            }
+            else if (key == "procedural")
+            {
+                json.BeginObject();
+                while (json.NextMember(key))
+                {
+                    if (key == "pattern")
+                    {
+                        if (!json.ReadString(value))
+                            break;
+                        static const char* const patterns[] = { "noise", "weave", "grain" };    // ScenePattern order
+                        texture.pattern = Lookup(value, patterns, 3);
+                        if (texture.pattern == SCENE_NONE)
+                            json.Fail("pattern must be noise, weave or grain");
+                    }
+                    else if (key == "base")
+                        json.ReadNumbers(texture.baseColor, 3);
+                    else if (key == "detail")
+                        json.ReadNumbers(texture.detailColor, 3);
+                    else if (key == "scale")
+                        json.ReadNumber(texture.patternScale);
+                    else if (key == "generate")
+                    {
+                        json.ReadBool(flag);
+                        texture.generate = flag ? 1 : 0;
+                    }
+                    else
+                        json.Skip();
+                }
+            }
+            else
+                json.Skip();
+        }
+        if (json.Failed())
+            return false;
+        if (texture.name == SCENE_NONE || texture.path == SCENE_NONE)
+            return json.Fail("texture needs a name and a path");
+        if (texture.generate && texture.pattern == SCENE_NONE)
+            return json.Fail("generated texture needs a pattern");
+        scene.textures.push_back(texture);
+        return true;
+    }
+
+    inline bool ReadMaterial(JsonReader& json, SceneDescription& scene)
+    {
+        SceneMaterial material = { SCENE_NONE, 0, 0.5f, 0.5f, 16.0f, 1.0f };
+        std::string_view key, value;
+        if (!json.BeginObject())
+            return false;
+        while (json.NextMember(key))
+        {
+            bool flag = false;
+            if (key == "name")
+                json.ReadString(value) && (AddString(scene, value, material.name) || json.Fail("unsupported escape"));
+            else if (key == "ambient")
+                json.ReadNumber(material.ambientStrength);
+            else if (key == "specular")
+                json.ReadNumber(material.specularIntensity);
+            else if (key == "highlight")
+                json.ReadNumber(material.highlightSize);
+            else if (key == "alpha")
+                json.ReadNumber(material.alpha);
+            else if (key == "alphaTest" && json.ReadBool(flag))
+                material.flags |= flag ? SCENE_MATERIAL_ALPHA_TEST : 0;
+            else if (key == "unlit" && json.ReadBool(flag))
+                material.flags |= flag ? SCENE_MATERIAL_UNLIT : 0;
+            else if (key != "alphaTest" && key != "unlit")
+                json.Skip();
+        }
+        if (json.Failed())
+            return false;
+        if (material.name == SCENE_NONE)
+            return json.Fail("material needs a name");
+        scene.materials.push_back(material);
+        return true;
+    }
+
+    inline bool ReadLight(JsonReader& json, SceneDescription& scene)
+    {
+        SceneLight light = { { 0.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, 0.0f };
+        std::string_view key;
+        if (!json.BeginObject())
+            return false;
+        while (json.NextMember(key))
+        {
+            if (key == "position")
+                json.ReadNumbers(light.position, 3);
+            else if (key == "color")
+                json.ReadNumbers(light.color, 3);
+            else if (key == "radius")
+                json.ReadNumber(light.radius);
+            else
+                json.Skip();
+        }
+        if (json.Failed())
+            return false;
+        scene.lights.push_back(light);
+        return true;
+    }
+
+    inline bool ReadEntity(JsonReader& json, SceneDescription& scene)
+    {
+        SceneEntity entity = { SCENE_NONE, SCENE_NONE, SCENE_NONE, SCENE_NONE, SCENE_NONE, SCENE_STENCIL_OFF, 0, {} };
+        float position[3] = { 0.0f, 0.0f, 0.0f };
+        float scale[3] = { 1.0f, 1.0f, 1.0f };
+        float rotation[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };   // All rotations, in order
+
+        std::string_view key, value;
+        if (!json.BeginObject())
+            return false;
+        while (json.NextMember(key))
+        {
+            bool flag = false;
+            if (key == "name")
+                json.ReadString(value) && (AddString(scene, value, entity.name) || json.Fail("unsupported escape"));
+            else if (key == "mesh" && json.ReadString(value))
+                entity.mesh = MeshIndex(json, scene, value);
+            else if (key == "indexMesh" && json.ReadString(value))
+                entity.indexMesh = MeshIndex(json, scene, value);
+            else if (key == "texture" && json.ReadString(value))
+            {
+                entity.texture = Find(scene, scene.textures, value);
+                if (entity.texture == SCENE_NONE)
+                    json.Fail("unknown texture, textures have to be listed before the entities");
+            }
+            else if (key == "material" && json.ReadString(value))
+            {
+                entity.material = Find(scene, scene.materials, value);
+                if (entity.material == SCENE_NONE)
+                    json.Fail("unknown material, materials have to be listed before the entities");
+            }
+            else if (key == "stencil" && json.ReadString(value))
+            {
+                static const char* const stencils[] = { "off", "mark", "cut", "masked" };      // SceneStencil order
+                entity.stencil = Lookup(value, stencils, 4);
+                if (entity.stencil == SCENE_NONE)
+                    json.Fail("stencil must be off, mark, cut or masked");
+            }
+            else if (key == "dynamic" && json.ReadBool(flag))
+                entity.dynamic = flag ? 1 : 0;
+            else if (key == "position")
+                json.ReadNumbers(position, 3);
+            else if (key == "scale")
+                json.ReadNumbers(scale, 3);
+            else if (key == "rotate")
+            {
+                // [[angle in radians, axis x, y, z], ...]
+                json.BeginArray();
+                while (json.NextElement())
+                {
+                    float angleAxis[4];
+                    float next[16];
+                    if (!json.ReadNumbers(angleAxis, 4))
+                        break;
+                    Rotation(angleAxis[0], angleAxis + 1, next);
+                    Multiply(rotation, next, rotation);
+                }
+            }
+            else if (key != "mesh" && key != "indexMesh" && key != "texture" && key != "material" && key != "stencil" && key != "dynamic")
+                json.Skip();
+        }
+        if (json.Failed())
+            return false;
+        if (entity.name == SCENE_NONE || entity.mesh == SCENE_NONE || entity.material == SCENE_NONE)
+            return json.Fail("entity needs a name, a mesh and a material");
+        if (entity.indexMesh == SCENE_NONE)
+            entity.indexMesh = entity.mesh;
+
+        // model = translate(position) * rotations * scale(scale)
+        const float translation[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, position[0], position[1], position[2], 1 };
+        const float scaling[16] = { scale[0], 0, 0, 0, 0, scale[1], 0, 0, 0, 0, scale[2], 0, 0, 0, 0, 1 };
+        Multiply(translation, rotation, entity.model);
+        Multiply(entity.model, scaling, entity.model);
+        scene.entities.push_back(entity);
+        return true;
+    }
+
+    template<typename Read>
+    bool ReadArray(JsonReader& json, SceneDescription& scene, Read read)
+    {
+        if (!json.BeginArray())
+            return false;
+        while (json.NextElement())
+        {
+            if (!read(json, scene))
+                return false;
+        }
+        return !json.Failed();
+    }
+}
+
+// Reads a JSON scene into scene. On failure error says what went wrong and on which line.
+inline bool ParseSceneJson(const char* text, size_t length, SceneDescription& scene, std::string& error)
+{
+    scene.Clear();
+
+    JsonReader json(text, length);
+    std::string_view key;
+    if (json.BeginObject())
+    {
+        while (json.NextMember(key))
+        {
+            bool read;
+            if (key == "textures")
+                read = SceneDetail::ReadArray(json, scene, SceneDetail::ReadTexture);
+            else if (key == "materials")
+                read = SceneDetail::ReadArray(json, scene, SceneDetail::ReadMaterial);
+            else if (key == "lights")
+                read = SceneDetail::ReadArray(json, scene, SceneDetail::ReadLight);
+            else if (key == "entities")
+                read = SceneDetail::ReadArray(json, scene, SceneDetail::ReadEntity);
+            else
+                read = json.Skip();
+            if (!read)
+                break;
+        }
+    }
+    if (!json.Failed())
+        json.Finish();
+    if (json.Failed())
+    {
+        error = std::string(json.Error()) + " on line " + std::to_string(json.ErrorLine());
+        return false;
+    }
+    return true;
+}
+
+// Compiled scenes start with this header, followed by the records in its order and the strings
+const uint32_t SCENE_BINARY_MAGIC = 0x314E4353;     // "SCN1"
+const uint32_t SCENE_BINARY_VERSION = 2;
+
+struct SceneBinaryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t textureCount;
+    uint32_t materialCount;
+    uint32_t meshCount;
+    uint32_t lightCount;
+    uint32_t entityCount;
+    uint32_t stringBytes;
+};
+
+namespace SceneDetail
+{
+    template<typename T>
+    void Append(std::vector<unsigned char>& out, const std::vector<T>& values)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values.data());
+        out.insert(out.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+    template<typename T>
+    bool Take(const unsigned char*& cursor, const unsigned char* end, uint32_t count, std::vector<T>& values)
+    {
+        const size_t bytes = (size_t)count * sizeof(T);
+        if ((size_t)(end - cursor) < bytes)
+            return false;
+        values.resize(count);
+        if (bytes > 0)
+            memcpy(values.data(), cursor, bytes);
+        cursor += bytes;
+        return true;
+    }
+}
+
+inline void WriteSceneBinary(const SceneDescription& scene, std::vector<unsigned char>& out)
+{
+    const SceneBinaryHeader header = { SCENE_BINARY_MAGIC, SCENE_BINARY_VERSION, (uint32_t)scene.textures.size(), (uint32_t)scene.materials.size(),
+                                       (uint32_t)scene.meshes.size(), (uint32_t)scene.lights.size(), (uint32_t)scene.entities.size(),
+                                       (uint32_t)scene.strings.size() };
+    out.clear();
+    out.reserve(sizeof(header) + scene.textures.size() * sizeof(SceneTexture) + scene.materials.size() * sizeof(SceneMaterial) +
+                scene.meshes.size() * sizeof(uint32_t) + scene.lights.size() * sizeof(SceneLight) +
+                scene.entities.size() * sizeof(SceneEntity) + scene.strings.size());
+    const unsigned char* headerBytes = reinterpret_cast<const unsigned char*>(&header);
+    out.insert(out.end(), headerBytes, headerBytes + sizeof(header));
+    SceneDetail::Append(out, scene.textures);
+    SceneDetail::Append(out, scene.materials);
+    SceneDetail::Append(out, scene.meshes);
+    SceneDetail::Append(out, scene.lights);
+    SceneDetail::Append(out, scene.entities);
+    SceneDetail::Append(out, scene.strings);
+}
+
+// True when bytes start like a compiled scene, anything else is taken for JSON
+inline bool IsSceneBinary(const unsigned char* bytes, size_t size)
+{
+    uint32_t magic = 0;
+    if (size >= sizeof(magic))
+        memcpy(&magic, bytes, sizeof(magic));
+    return magic == SCENE_BINARY_MAGIC;
+}
+
+inline bool ReadSceneBinary(const unsigned char* bytes, size_t size, SceneDescription& scene, std::string& error)
+{
+    SceneBinaryHeader header;
+    if (size < sizeof(header))
+    {
+        error = "file too short";
+        return false;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (header.magic != SCENE_BINARY_MAGIC || header.version != SCENE_BINARY_VERSION)
+    {
+        error = "not a compiled scene of version " + std::to_string(SCENE_BINARY_VERSION);
+        return false;
+    }
+
+    const unsigned char* cursor = bytes + sizeof(header);
+    const unsigned char* end = bytes + size;
+    if (!SceneDetail::Take(cursor, end, header.textureCount, scene.textures) ||
+        !SceneDetail::Take(cursor, end, header.materialCount, scene.materials) ||
+        !SceneDetail::Take(cursor, end, header.meshCount, scene.meshes) ||
+        !SceneDetail::Take(cursor, end, header.lightCount, scene.lights) ||
+        !SceneDetail::Take(cursor, end, header.entityCount, scene.entities) ||
+        !SceneDetail::Take(cursor, end, header.stringBytes, scene.strings))
+    {
+        error = "file truncated";
+        return false;
+    }
+
+    // References are checked once here so nothing downstream has to
+    const auto badString = [&](uint32_t offset) { return offset >= scene.strings.size(); };
+    bool valid = scene.strings.empty() || scene.strings.back() == '\0';
+    for (const SceneTexture& texture : scene.textures)
+        valid = valid && !badString(texture.name) && !badString(texture.path) &&
+                (texture.pattern == SCENE_NONE || texture.pattern <= SCENE_PATTERN_GRAIN) && (!texture.generate || texture.pattern != SCENE_NONE);
+    for (const SceneMaterial& material : scene.materials)
+        valid = valid && !badString(material.name);
+    for (uint32_t mesh : scene.meshes)
+        valid = valid && !badString(mesh);
+    for (const SceneEntity& entity : scene.entities)
+    {
+        valid = valid && !badString(entity.name) && entity.mesh < header.meshCount && entity.indexMesh < header.meshCount &&
+                entity.material < header.materialCount && (entity.texture == SCENE_NONE || entity.texture < header.textureCount) &&
+                entity.stencil <= SCENE_STENCIL_MASKED;
+    }
+    if (!valid)
+    {
+        error = "reference out of range";
+        return false;
+    }
+    return true;
+}
+
+#endif
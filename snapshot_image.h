@@ -0,0 +1,262 @@
+#ifndef SNAPSHOT_IMAGE_H
+#define SNAPSHOT_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//************************************************************
+//SNAPSHOT IMAGE
+//
+//A file of typed sections, each an array of plain data at a
+//64 byte aligned offset from the start of the file. Nothing in
+//an image is a pointer, references between sections are
+//indices, so an image can be mapped at any address and read
+//where it lies. The table of contents is checked once when the
+//image is opened; what the sections hold is for the caller to
+//check.
+//
+//MappedFile maps a whole file read-only. Its pages are only
+//read from disk when first touched.
+//************************************************************
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path)
+    {
+        Close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+            return false;
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        size = data != nullptr ? (size_t)fileSize.QuadPart : 0;
+#else
+        const int file = open(path, O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat status;
+        void* mapped = MAP_FAILED;
+        if (fstat(file, &status) == 0 && status.st_size > 0)
+            mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = (const unsigned char*)mapped;
+        size = (size_t)status.st_size;
+#endif
+        return data != nullptr;
+    }
+
+    void Close()
+    {
+        if (data == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+};
+
+// Drops the file's pages from the OS file cache so the next mapping reads them from disk,
+// for measuring a cold start. Returns false where that is not supported.
+inline bool EvictFileCache(const char* path)
+{
+#if defined(_WIN32) || !defined(POSIX_FADV_DONTNEED)
+    (void)path;
+    return false;
+#else
+    const int file = open(path, O_RDONLY);
+    if (file < 0)
+        return false;
+    const bool evicted = fdatasync(file) == 0 && posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(file);
+    return evicted;
+#endif
+}
+
+const size_t SNAPSHOT_ALIGNMENT = 64;
+
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+    uint32_t sectionCount;
+    uint32_t reserved;
+};
+
+struct SnapshotSection
+{
+    uint32_t id;
+    uint32_t elementSize;
+    uint64_t offset;            // From the start of the image, a multiple of SNAPSHOT_ALIGNMENT
+    uint64_t count;
+};
+
+// Collects sections and lays them out as an image. The values are only read by Write,
+// so they have to stay alive until then.
+class SnapshotWriter
+{
+public:
+    template<typename T>
+    void Add(uint32_t id, const T* values, size_t count)
+    {
+        sections.push_back({ { id, (uint32_t)sizeof(T), 0, count }, values });
+    }
+
+    template<typename T>
+    void Add(uint32_t id, const std::vector<T>& values)
+    {
+        Add(id, values.data(), values.size());
+    }
+
+    void Write(uint32_t magic, uint32_t version, std::vector<unsigned char>& out) const
+    {
+        size_t offset = Align(sizeof(SnapshotHeader) + sections.size() * sizeof(SnapshotSection));
+        std::vector<SnapshotSection> table;
+        for (const Pending& pending : sections)
+        {
+            SnapshotSection section = pending.section;
+            section.offset = offset;
+            table.push_back(section);
+            offset = Align(offset + section.count * section.elementSize);
+        }
+
+        const SnapshotHeader header = { magic, version, offset, (uint32_t)table.size(), 0 };
+        out.assign(offset, 0);
+        memcpy(out.data(), &header, sizeof(header));
+        if (!table.empty())
+            memcpy(out.data() + sizeof(header), table.data(), table.size() * sizeof(SnapshotSection));
+        for (size_t i = 0; i < table.size(); ++i)
+        {
+            if (table[i].count > 0)
+                memcpy(out.data() + table[i].offset, sections[i].values, table[i].count * table[i].elementSize);
+        }
+    }
+
+private:
+    struct Pending
+    {
+        SnapshotSection section;
+        const void* values;
+    };
+
+    static size_t Align(size_t offset)
+    {
+        return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+    }
+
+    std::vector<Pending> sections;
+};
+
+// Sections of an image in memory, usually a MappedFile. Nothing is copied, the image has to
+// outlive everything read through it.
+class SnapshotImage
+{
+public:
+    bool Open(const unsigned char* bytes, size_t size, uint32_t magic, uint32_t version, std::string& error)
+    {
+        data = nullptr;
+        table = nullptr;
+        sectionCount = 0;
+
+        SnapshotHeader header;
+        if (bytes == nullptr || size < sizeof(header))
+            return Fail(error, "file too short");
+        memcpy(&header, bytes, sizeof(header));
+        if (header.magic != magic)
+            return Fail(error, "not a snapshot");
+        if (header.version != version)
+            return Fail(error, "written by another version");
+        if (header.fileSize != size || (size - sizeof(header)) / sizeof(SnapshotSection) < header.sectionCount)
+            return Fail(error, "file truncated");
+        if ((uintptr_t)bytes % SNAPSHOT_ALIGNMENT != 0)
+            return Fail(error, "image is not aligned");
+
+        const SnapshotSection* sections = reinterpret_cast<const SnapshotSection*>(bytes + sizeof(header));
+        for (uint32_t i = 0; i < header.sectionCount; ++i)
+        {
+            const SnapshotSection& section = sections[i];
+            if (section.offset % SNAPSHOT_ALIGNMENT != 0 || section.offset > size || section.elementSize == 0 ||
+                section.count > (size - section.offset) / section.elementSize)
+                return Fail(error, "section out of range");
+        }
+
+        data = bytes;
+        table = sections;
+        sectionCount = header.sectionCount;
+        return true;
+    }
+
+    // Values of the section with the id, nullptr when it is missing or holds another type
+    template<typename T>
+    const T* Section(uint32_t id, size_t& count) const
+    {
+        for (uint32_t i = 0; i < sectionCount; ++i)
+        {
+            if (table[i].id == id && table[i].elementSize == sizeof(T))
+            {
+                count = (size_t)table[i].count;
+                return reinterpret_cast<const T*>(data + table[i].offset);
+            }
+        }
+        count = 0;
+        return nullptr;
+    }
+
+private:
+    static bool Fail(std::string& error, const char* message)
+    {
+        error = message;
+        return false;
+    }
+
+    const unsigned char* data = nullptr;
+    const SnapshotSection* table = nullptr;
+    uint32_t sectionCount = 0;
+};
+
+#endif
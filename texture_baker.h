@@ -0,0 +1,554 @@
+#ifndef TEXTURE_BAKER_H
+#define TEXTURE_BAKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+//************************************************************
+//TEXTURE BAKER
+//
+//Turns decoded images into block compressed mip chains (BC1
+//for opaque images, BC3 for images with alpha) and stores
+//them as KTX2 files, so later launches skip both the image
+//decode and the encode. Pure CPU code, safe on worker threads.
+//************************************************************
+
+// Bump whenever the encoder output changes so stale cache files are ignored
+const uint32_t TEXTURE_BAKER_VERSION = 1;
+
+enum TextureFormat
+{
+    TEXTURE_RGB8,
+    TEXTURE_RGBA8,
+    TEXTURE_BC1,
+    TEXTURE_BC3
+};
+
+struct TextureLevel
+{
+    int width;
+    int height;
+    std::vector<unsigned char> data;
+};
+
+// A whole mip chain, or the coarse end of one when only part of a cache file was read
+struct BakedTexture
+{
+    TextureFormat format = TEXTURE_RGBA8;
+    int baseWidth = 0;      // Size of the full resolution level
+    int baseHeight = 0;
+    int mipCount = 0;       // Levels in the full chain
+    int firstLevel = 0;     // Chain level held by levels[0]
+    std::vector<TextureLevel> levels;
+};
+
+inline bool IsBlockCompressed(TextureFormat format)
+{
+    return format == TEXTURE_BC1 || format == TEXTURE_BC3;
+}
+
+// Bytes in one upload row: a row of pixels, or a row of 4x4 blocks when compressed
+inline size_t TextureRowBytes(TextureFormat format, int width)
+{
+    switch (format)
+    {
+    case TEXTURE_RGB8:  return (size_t)width * 3;
+    case TEXTURE_RGBA8: return (size_t)width * 4;
+    case TEXTURE_BC1:   return (size_t)((width + 3) / 4) * 8;
+    default:            return (size_t)((width + 3) / 4) * 16;
+    }
+}
+
+inline int TextureRowCount(TextureFormat format, int height)
+{
+    return IsBlockCompressed(format) ? (height + 3) / 4 : height;
+}
+
+inline size_t TextureLevelBytes(TextureFormat format, int width, int height)
+{
+    return TextureRowBytes(format, width) * TextureRowCount(format, height);
+}
+
+// 64-bit FNV-1a, used as the cache key of a source image
+inline uint64_t HashContent(const unsigned char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//************************************************************
+//MIP CHAIN
+//************************************************************
+
+// Box filtered mip chain down to 1x1, input is tightly packed RGBA
+inline std::vector<TextureLevel> BuildMipChain(const unsigned char* rgba, int width, int height)
+{
+    std::vector<TextureLevel> levels;
+    levels.push_back({ width, height, std::vector<unsigned char>(rgba, rgba + (size_t)width * height * 4) });
+
+    while (width > 1 || height > 1)
+    {
+        const TextureLevel& src = levels.back();
+        TextureLevel dst = { std::max(1, width / 2), std::max(1, height / 2), {} };
+        dst.data.resize((size_t)dst.width * dst.height * 4);
+
+        for (int y = 0; y < dst.height; ++y)
+        {
+            const int y0 = std::min(y * 2, height - 1);
+            const int y1 = std::min(y * 2 + 1, height - 1);
+            for (int x = 0; x < dst.width; ++x)
+            {
+                const int x0 = std::min(x * 2, width - 1);
+                const int x1 = std::min(x * 2 + 1, width - 1);
+                for (int c = 0; c < 4; ++c)
+                {
+                    int sum = src.data[((size_t)y0 * width + x0) * 4 + c] + src.data[((size_t)y0 * width + x1) * 4 + c]
+                            + src.data[((size_t)y1 * width + x0) * 4 + c] + src.data[((size_t)y1 * width + x1) * 4 + c];
+                    dst.data[((size_t)y * dst.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+
+        width = dst.width;
+        height = dst.height;
+        levels.push_back(std::move(dst));
+    }
+
+    return levels;
+}
+
+//************************************************************
+//BLOCK ENCODERS
+//************************************************************
+
+// Copies the 4x4 RGBA block at (blockX, blockY), edge pixels are repeated past the image border
+inline void FetchBlock(const TextureLevel& level, int blockX, int blockY, unsigned char block[64])
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        const int srcY = std::min(blockY * 4 + y, level.height - 1);
+        for (int x = 0; x < 4; ++x)
+        {
+            const int srcX = std::min(blockX * 4 + x, level.width - 1);
+            memcpy(block + (y * 4 + x) * 4, &level.data[((size_t)srcY * level.width + srcX) * 4], 4);
+        }
+    }
+}
+
+inline uint16_t PackRGB565(const float color[3])
+{
+    int r = (int)(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRGB565(uint16_t packed, float color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// BC1 color block: endpoints fitted along the principal axis of the block's colors
+inline void EncodeColorBlock(const unsigned char block[64], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            mean[c] += block[i * 4 + c] / 16.0f;
+
+    float cov[3][3] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float d[3] = { block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2] };
+        for (int a = 0; a < 3; ++a)
+            for (int b = 0; b < 3; ++b)
+                cov[a][b] += d[a] * d[b];
+    }
+
+    // Power iteration for the dominant eigenvector
+    float axis[3] = { 0.577f, 0.577f, 0.577f };
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[3];
+        for (int a = 0; a < 3; ++a)
+            next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break; // Flat block, any axis will do
+        for (int a = 0; a < 3; ++a)
+            axis[a] = next[a] / length;
+    }
+
+    float minProj = 1e30f, maxProj = -1e30f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float proj = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+        minProj = std::min(minProj, proj);
+        maxProj = std::max(maxProj, proj);
+    }
+
+    float end0[3], end1[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        end0[c] = mean[c] + axis[c] * maxProj;
+        end1[c] = mean[c] + axis[c] * minProj;
+    }
+
+    uint16_t color0 = PackRGB565(end0);
+    uint16_t color1 = PackRGB565(end1);
+    if (color0 < color1)
+        std::swap(color0, color1); // Four color mode needs color0 > color1
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        float palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            float bestDistance = 1e30f;
+            for (int p = 0; p < 4; ++p)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < 3; ++c)
+                {
+                    float d = block[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (i * 2);
+        }
+    }
+
+    out[0] = (unsigned char)(color0 & 0xFF);
+    out[1] = (unsigned char)(color0 >> 8);
+    out[2] = (unsigned char)(color1 & 0xFF);
+    out[3] = (unsigned char)(color1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+// BC3 alpha block: eight interpolated values between the block's min and max alpha
+inline void EncodeAlphaBlock(const unsigned char block[64], unsigned char out[8])
+{
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        alpha0 = std::max(alpha0, (int)block[i * 4 + 3]);
+        alpha1 = std::min(alpha1, (int)block[i * 4 + 3]);
+    }
+
+    out[0] = (unsigned char)alpha0;
+    out[1] = (unsigned char)alpha1;
+
+    uint64_t indices = 0;
+    if (alpha0 != alpha1)
+    {
+        int palette[8] = { alpha0, alpha1 };
+        for (int p = 2; p < 8; ++p)
+            palette[p] = ((8 - p) * alpha0 + (p - 1) * alpha1) / 7;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            for (int p = 1; p < 8; ++p)
+                if (std::abs(block[i * 4 + 3] - palette[p]) < std::abs(block[i * 4 + 3] - palette[best]))
+                    best = p;
+            indices |= (uint64_t)best << (i * 3);
+        }
+    }
+
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+// Encodes every mip level of a 3 or 4 channel image, block rows are spread over the pool
+inline bool BakeTexture(const unsigned char* pixels, int width, int height, int channels, ThreadPool* pool, BakedTexture& texture)
+{
+    if (channels != 3 && channels != 4)
+        return false;
+
+    std::vector<unsigned char> rgba((size_t)width * height * 4);
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+            rgba[i * 4 + c] = pixels[i * channels + c];
+        rgba[i * 4 + 3] = channels == 4 ? pixels[i * 4 + 3] : 255;
+    }
+
+    std::vector<TextureLevel> mips = BuildMipChain(rgba.data(), width, height);
+
+    texture.format = channels == 4 ? TEXTURE_BC3 : TEXTURE_BC1;
+    texture.baseWidth = width;
+    texture.baseHeight = height;
+    texture.mipCount = (int)mips.size();
+    texture.firstLevel = 0;
+    texture.levels.clear();
+
+    for (const TextureLevel& mip : mips)
+    {
+        const int blocksX = (mip.width + 3) / 4;
+        const int blocksY = (mip.height + 3) / 4;
+        const size_t rowBytes = TextureRowBytes(texture.format, mip.width);
+
+        TextureLevel level = { mip.width, mip.height, std::vector<unsigned char>(rowBytes * blocksY) };
+        const TextureFormat format = texture.format;
+
+        auto encodeRow = [&](int blockY)
+        {
+            unsigned char block[64];
+            unsigned char* out = level.data.data() + rowBytes * blockY;
+            for (int blockX = 0; blockX < blocksX; ++blockX)
+            {
+                FetchBlock(mip, blockX, blockY, block);
+                if (format == TEXTURE_BC3)
+                {
+                    EncodeAlphaBlock(block, out);
+                    out += 8;
+                }
+                EncodeColorBlock(block, out);
+                out += 8;
+            }
+        };
+
+        if (pool)
+            pool->ParallelFor(blocksY, encodeRow);
+        else
+            for (int blockY = 0; blockY < blocksY; ++blockY)
+                encodeRow(blockY);
+
+        texture.levels.push_back(std::move(level));
+    }
+
+    return true;
+}
+
+//************************************************************
+//KTX2 CONTAINER
+//
+//Only what the cache needs: one 2D image, no supercompression,
+//BC1/BC3 formats. Level data is stored smallest mip first.
+//************************************************************
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+
+inline void AppendU32(std::vector<unsigned char>& bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        bytes.push_back((unsigned char)(value >> (i * 8)));
+}
+
+inline void AppendU64(std::vector<unsigned char>& bytes, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        bytes.push_back((unsigned char)(value >> (i * 8)));
+}
+
+inline uint32_t ReadU32(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+inline uint64_t ReadU64(const unsigned char* bytes)
+{
+    return ReadU32(bytes) | ((uint64_t)ReadU32(bytes + 4) << 32);
+}
+
+inline bool WriteKtx2(const std::string& path, const BakedTexture& texture)
+{
+    if (!IsBlockCompressed(texture.format) || texture.levels.empty() || texture.firstLevel != 0)
+        return false;
+
+    const bool bc3 = texture.format == TEXTURE_BC3;
+    const uint32_t levelCount = (uint32_t)texture.levels.size();
+    const uint32_t sampleCount = bc3 ? 2 : 1;
+    const uint32_t dfdBlockSize = 24 + 16 * sampleCount;
+    const uint32_t dfdOffset = 80 + 24 * levelCount;
+    const uint32_t dfdLength = 4 + dfdBlockSize;
+
+    std::vector<unsigned char> bytes(KTX2_IDENTIFIER, KTX2_IDENTIFIER + 12);
+    AppendU32(bytes, bc3 ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+    AppendU32(bytes, 1);                          // typeSize
+    AppendU32(bytes, texture.levels[0].width);
+    AppendU32(bytes, texture.levels[0].height);
+    AppendU32(bytes, 0);                          // pixelDepth
+    AppendU32(bytes, 0);                          // layerCount
+    AppendU32(bytes, 1);                          // faceCount
+    AppendU32(bytes, levelCount);
+    AppendU32(bytes, 0);                          // supercompressionScheme
+
+    AppendU32(bytes, dfdOffset);
+    AppendU32(bytes, dfdLength);
+    AppendU32(bytes, 0);                          // kvdByteOffset
+    AppendU32(bytes, 0);                          // kvdByteLength
+    AppendU64(bytes, 0);                          // sgdByteOffset
+    AppendU64(bytes, 0);                          // sgdByteLength
+
+    // Level offsets, data follows the descriptor with the smallest level first
+    std::vector<uint64_t> offsets(levelCount);
+    uint64_t offset = dfdOffset + dfdLength;
+    for (int level = (int)levelCount - 1; level >= 0; --level)
+    {
+        offset = (offset + 15) & ~(uint64_t)15;
+        offsets[level] = offset;
+        offset += texture.levels[level].data.size();
+    }
+    for (uint32_t level = 0; level < levelCount; ++level)
+    {
+        AppendU64(bytes, offsets[level]);
+        AppendU64(bytes, texture.levels[level].data.size());
+        AppendU64(bytes, texture.levels[level].data.size());
+    }
+
+    // Basic data format descriptor
+    AppendU32(bytes, dfdLength);
+    AppendU32(bytes, 0);                                        // vendorId, descriptorType
+    AppendU32(bytes, 2 | (dfdBlockSize << 16));                 // versionNumber, descriptorBlockSize
+    AppendU32(bytes, (bc3 ? 130 : 128) | (1 << 8) | (1 << 16)); // BC1A/BC3 model, BT709 primaries, linear transfer
+    AppendU32(bytes, 3 | (3 << 8));                             // 4x4 texel blocks
+    AppendU32(bytes, bc3 ? 16 : 8);                             // bytesPlane0
+    AppendU32(bytes, 0);
+    if (bc3)
+    {
+        AppendU32(bytes, 0 | (63 << 16) | (15u << 24));         // alpha half
+        AppendU32(bytes, 0);
+        AppendU32(bytes, 0);
+        AppendU32(bytes, 0xFFFFFFFF);
+    }
+    AppendU32(bytes, (bc3 ? 64 : 0) | (63 << 16));              // color half
+    AppendU32(bytes, 0);
+    AppendU32(bytes, 0);
+    AppendU32(bytes, 0xFFFFFFFF);
+
+    for (int level = (int)levelCount - 1; level >= 0; --level)
+    {
+        bytes.resize(offsets[level], 0);
+        bytes.insert(bytes.end(), texture.levels[level].data.begin(), texture.levels[level].data.end());
+    }
+
+    // Write beside the target and rename, so a reader never sees a half written file. Every
+    // write gets its own temporary name, workers baking the same target never share one.
+    static std::atomic<unsigned int> writeCount{ 0 };
+    const std::string temporaryPath = path + "." + std::to_string(writeCount.fetch_add(1)) + ".tmp";
+    std::error_code error;
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.write((const char*)bytes.data(), bytes.size()))
+        {
+            file.close();
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporaryPath, path, error);
+    if (!error)
+        return true;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+}
+
+// Reads the levels of the chain that are at most maxDimension texels on their longest side,
+// stopping before endLevel (-1 reads down to 1x1). Only the requested level data is read from disk.
+inline bool ReadKtx2(const std::string& path, BakedTexture& texture, int maxDimension = INT_MAX, int endLevel = -1)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    unsigned char header[80];
+    if (!file.read((char*)header, sizeof(header)) || memcmp(header, KTX2_IDENTIFIER, 12) != 0)
+        return false;
+
+    const uint32_t vkFormat = ReadU32(&header[12]);
+    const uint32_t width = ReadU32(&header[20]);
+    const uint32_t height = ReadU32(&header[24]);
+    const uint32_t faceCount = ReadU32(&header[36]);
+    const uint32_t levelCount = ReadU32(&header[40]);
+    const uint32_t supercompression = ReadU32(&header[44]);
+
+    if (vkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+        texture.format = TEXTURE_BC1;
+    else if (vkFormat == VK_FORMAT_BC3_UNORM_BLOCK)
+        texture.format = TEXTURE_BC3;
+    else
+        return false;
+
+    if (faceCount != 1 || supercompression != 0 || levelCount == 0 || levelCount > 32 || width == 0 || height == 0)
+        return false;
+
+    std::vector<unsigned char> levelIndex(24 * levelCount);
+    if (!file.read((char*)levelIndex.data(), levelIndex.size()))
+        return false;
+
+    texture.baseWidth = (int)width;
+    texture.baseHeight = (int)height;
+    texture.mipCount = (int)levelCount;
+    texture.firstLevel = (int)levelCount - 1;
+    while (texture.firstLevel > 0 && std::max(std::max(1u, width >> (texture.firstLevel - 1)), std::max(1u, height >> (texture.firstLevel - 1))) <= (uint32_t)maxDimension)
+        --texture.firstLevel;
+
+    if (endLevel < 0 || endLevel > (int)levelCount)
+        endLevel = (int)levelCount;
+
+    texture.levels.clear();
+    for (int level = texture.firstLevel; level < endLevel; ++level)
+    {
+        const unsigned char* entry = &levelIndex[24 * level];
+        const uint64_t offset = ReadU64(entry);
+        const uint64_t length = ReadU64(entry + 8);
+
+        TextureLevel data = { std::max(1, (int)(width >> level)), std::max(1, (int)(height >> level)), {} };
+        if (length != TextureLevelBytes(texture.format, data.width, data.height))
+            return false;
+
+        data.data.resize(length);
+        file.seekg(offset);
+        if (!file.read((char*)data.data.data(), length))
+            return false;
+
+        texture.levels.push_back(std::move(data));
+    }
+
+    return !texture.levels.empty();
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//************************************************************
+//THREAD POOL
+//
+//Fixed set of worker threads pulling jobs from a shared queue.
+//Used to move blocking CPU work (image decoding) off the thread
+//that owns the OpenGL context. Jobs must never call into GL.
+//************************************************************
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            // Leave one core for the render thread
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+
+        for (unsigned int i = 0; i < threadCount; ++i)
+            workers.emplace_back([this] { WorkerLoop(); });
+    }
+
+    // Jobs still waiting in the queue are discarded, running jobs are finished
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            std::queue<std::function<void()>>().swap(jobs);
+        }
+        wakeUp.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push(std::move(job));
+        }
+        wakeUp.notify_one();
+    }
+
+    unsigned int Size() const
+    {
+        return (unsigned int)workers.size();
+    }
+
+    // Runs body(i) for every i in [0, count) and returns once all of them finished.
+    // The calling thread takes part in the work, so this is safe to call from inside a job:
+    // helpers that only start after everything was claimed simply find nothing left to do.
+    void ParallelFor(int count, const std::function<void(int)>& body)
+    {
+        struct Shared
+        {
+            std::function<void(int)> body;
+            std::atomic<int> next{ 0 };
+            std::atomic<int> finished{ 0 };
+            int count = 0;
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+
+        std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+        shared->body = body;
+        shared->count = count;
+
+        auto drain = [](Shared& work)
+        {
+            for (int i = work.next++; i < work.count; i = work.next++)
+            {
+                work.body(i);
+                if (++work.finished == work.count)
+                {
+                    std::lock_guard<std::mutex> lock(work.mutex);
+                    work.done.notify_all();
+                }
+            }
+        };
+
+        unsigned int helpers = std::min<unsigned int>(Size(), count > 1 ? count - 1 : 0);
+        for (unsigned int i = 0; i < helpers; ++i)
+            Submit([shared, drain] { drain(*shared); });
+
+        drain(*shared);
+
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        shared->done.wait(lock, [&] { return shared->finished == shared->count; });
+    }
+
+private:
+    void WorkerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+};
+
+#endif